@@ -6,6 +6,7 @@ pkg_check_modules(vorbis REQUIRED vorbis)
 pkg_check_modules(vorbisenc REQUIRED vorbisenc)
 find_package(glfw3 REQUIRED)
 find_package(OpenGL REQUIRED)
+find_package(Threads REQUIRED)
 pkg_check_modules(gles REQUIRED glesv2)
 
 include(FetchContent)
@@ -1,13 +1,22 @@
 add_executable(zimtohrli_test
+    cpp/zimt/analysis_file_test.cc
     cpp/zimt/audio_test.cc
     cpp/zimt/cam_test.cc
+    cpp/zimt/decimated_filterbank_test.cc
     cpp/zimt/dtw_test.cc
     cpp/zimt/elliptic_test.cc
     cpp/zimt/filterbank_test.cc
+    cpp/zimt/incremental_test.cc
+    cpp/zimt/intensity_pyramid_test.cc
     cpp/zimt/loudness_test.cc
     cpp/zimt/masking_test.cc
+    cpp/zimt/metric_server_test.cc
     cpp/zimt/mos_test.cc
+    cpp/zimt/multi_rate_test.cc
     cpp/zimt/nsim_test.cc
+    cpp/zimt/screening_test.cc
+    cpp/zimt/streaming_test.cc
+    cpp/zimt/thread_pool_test.cc
     cpp/zimt/zimtohrli_test.cc
     cpp/zimt/test_file_paths.cc
 )
@@ -50,12 +59,20 @@ add_test(NAME zimtohrli_go_test
 )
 
 add_executable(zimtohrli_benchmark
+    cpp/zimt/decimated_filterbank_test.cc
     cpp/zimt/dtw_test.cc
     cpp/zimt/elliptic_test.cc
     cpp/zimt/filterbank_test.cc
+    cpp/zimt/incremental_test.cc
     cpp/zimt/loudness_test.cc
     cpp/zimt/masking_test.cc
     cpp/zimt/nsim_test.cc
+    cpp/zimt/streaming_test.cc
     cpp/zimt/zimtohrli_test.cc
 )
 target_link_libraries(zimtohrli_benchmark zimtohrli_base gtest gmock benchmark_main)
+
+add_executable(zimtohrli_throughput_benchmark
+    cpp/zimt/throughput_benchmark.cc
+)
+target_link_libraries(zimtohrli_throughput_benchmark zimtohrli_base absl::flags_parse)
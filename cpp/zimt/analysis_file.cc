@@ -0,0 +1,287 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zimt/analysis_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "hwy/aligned_allocator.h"
+#include "hwy/base.h"
+#include "zimt/cam.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+namespace {
+
+constexpr char kAnalysisFileMagic[8] = {'Z', 'I', 'M', 'T',
+                                        'S', 'P', 'E', 'C'};
+
+// 64 bit FNV-1a hash of the bytes of a sequence of values.
+class Fingerprinter {
+ public:
+  template <typename T>
+  void Add(const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    for (size_t index = 0; index < sizeof(T); ++index) {
+      hash_ = (hash_ ^ bytes[index]) * 1099511628211ull;
+    }
+  }
+
+  uint64_t Hash() const { return hash_; }
+
+ private:
+  uint64_t hash_ = 14695981039346656037ull;
+};
+
+size_t RowStride(size_t num_channels) {
+  constexpr size_t kFloatsPerAlignment = kAnalysisFileAlignment / sizeof(float);
+  return (num_channels + kFloatsPerAlignment - 1) / kFloatsPerAlignment *
+         kFloatsPerAlignment;
+}
+
+// Returns whether num_steps rows of row_stride floats take exactly rows_size
+// bytes, without overflowing for corrupt headers.
+bool IsRowsSize(size_t rows_size, uint64_t num_steps, uint64_t row_stride) {
+  if (rows_size % sizeof(float) != 0) {
+    return false;
+  }
+  const size_t num_floats = rows_size / sizeof(float);
+  if (num_steps == 0 || row_stride == 0) {
+    return num_floats == 0;
+  }
+  return num_floats % row_stride == 0 && num_floats / row_stride == num_steps;
+}
+
+absl::Status ErrnoError(const std::string& message) {
+  return absl::InternalError(absl::StrCat(message, ": ", std::strerror(errno)));
+}
+
+}  // namespace
+
+uint64_t AnalysisFingerprint(const Zimtohrli& z) {
+  CHECK(z.cam_filterbank.has_value());
+  Fingerprinter fingerprinter;
+  fingerprinter.Add(kAnalysisFileVersion);
+  fingerprinter.Add(z.perceptual_sample_rate);
+  fingerprinter.Add(z.full_scale_sine_db);
+  fingerprinter.Add(z.epsilon);
+  fingerprinter.Add(static_cast<uint8_t>(z.apply_masking));
+  fingerprinter.Add(static_cast<uint8_t>(z.apply_loudness));
+  fingerprinter.Add(static_cast<uint8_t>(z.fast_math));
+  fingerprinter.Add(z.masking.lower_zero_at_20);
+  fingerprinter.Add(z.masking.lower_zero_at_80);
+  fingerprinter.Add(z.masking.upper_zero_at_20);
+  fingerprinter.Add(z.masking.upper_zero_at_80);
+  fingerprinter.Add(z.masking.max_mask);
+  fingerprinter.Add(z.loudness.a_f_params);
+  fingerprinter.Add(z.loudness.l_u_params);
+  fingerprinter.Add(z.loudness.t_f_params);
+  const CamFilterbank& filterbank = z.cam_filterbank.value();
+  fingerprinter.Add(filterbank.sample_rate);
+  fingerprinter.Add(filterbank.cam_delta);
+  fingerprinter.Add(filterbank.filter_order);
+  fingerprinter.Add(filterbank.filter_pass_band_ripple);
+  fingerprinter.Add(filterbank.filter_stop_band_ripple);
+  // The decimated filterbank changes the energy, and 0 can't be a
+  // max_decimation.
+  fingerprinter.Add(static_cast<uint64_t>(
+      z.decimated_filterbank == nullptr
+          ? 0
+          : z.decimated_filterbank->MaxDecimation()));
+  const size_t num_channels = filterbank.thresholds_hz.shape()[1];
+  fingerprinter.Add(static_cast<uint64_t>(num_channels));
+  for (size_t threshold_index = 0;
+       threshold_index < filterbank.thresholds_hz.shape()[0];
+       ++threshold_index) {
+    for (size_t channel_index = 0; channel_index < num_channels;
+         ++channel_index) {
+      fingerprinter.Add(
+          filterbank.thresholds_hz[{threshold_index}][channel_index]);
+    }
+  }
+  return fingerprinter.Hash();
+}
+
+absl::Status WriteAnalysisFile(
+    const std::string& path, uint64_t fingerprint, float perceptual_sample_rate,
+    const hwy::AlignedNDArray<float, 2>& spectrogram) {
+  const size_t num_channels = spectrogram.shape()[1];
+  const size_t row_stride = RowStride(num_channels);
+  AnalysisFileHeader header = {};
+  std::memcpy(header.magic, kAnalysisFileMagic, sizeof(header.magic));
+  header.version = kAnalysisFileVersion;
+  header.header_size = sizeof(AnalysisFileHeader);
+  header.fingerprint = fingerprint;
+  header.num_steps = spectrogram.shape()[0];
+  header.num_channels = num_channels;
+  header.row_stride = row_stride;
+  header.perceptual_sample_rate = perceptual_sample_rate;
+
+  const std::string tmp_path = absl::StrCat(path, ".tmp.", getpid());
+  {
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+      return ErrnoError(absl::StrCat("unable to create ", tmp_path));
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    std::vector<float> row(row_stride, 0.0f);
+    for (size_t step_index = 0; step_index < spectrogram.shape()[0];
+         ++step_index) {
+      hwy::CopyBytes(spectrogram[{step_index}].data(), row.data(),
+                     num_channels * sizeof(float));
+      file.write(reinterpret_cast<const char*>(row.data()),
+                 row_stride * sizeof(float));
+    }
+    file.close();
+    if (!file) {
+      std::remove(tmp_path.c_str());
+      return ErrnoError(absl::StrCat("unable to write ", tmp_path));
+    }
+  }
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    const absl::Status status =
+        ErrnoError(absl::StrCat("unable to rename ", tmp_path, " to ", path));
+    std::remove(tmp_path.c_str());
+    return status;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status WriteAnalysisFile(const std::string& path, const Zimtohrli& z,
+                               const Analysis& analysis) {
+  return WriteAnalysisFile(path, AnalysisFingerprint(z),
+                           z.perceptual_sample_rate, analysis.spectrogram);
+}
+
+absl::StatusOr<MappedAnalysisFile> MappedAnalysisFile::Open(
+    const std::string& path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return ErrnoError(absl::StrCat("unable to open ", path));
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    const absl::Status status =
+        ErrnoError(absl::StrCat("unable to stat ", path));
+    close(fd);
+    return status;
+  }
+  const size_t size = static_cast<size_t>(file_stat.st_size);
+  if (size < sizeof(AnalysisFileHeader)) {
+    close(fd);
+    return absl::InvalidArgumentError(
+        absl::StrCat(path, " is too small to be an analysis file"));
+  }
+  void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return ErrnoError(absl::StrCat("unable to map ", path));
+  }
+  MappedAnalysisFile result(data, size);
+
+  const AnalysisFileHeader& header = result.Header();
+  if (std::memcmp(header.magic, kAnalysisFileMagic, sizeof(header.magic)) !=
+      0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(path, " is not an analysis file"));
+  }
+  if (header.version != kAnalysisFileVersion) {
+    return absl::InvalidArgumentError(absl::StrCat(path, " has version ",
+                                                   header.version, ", want ",
+                                                   kAnalysisFileVersion));
+  }
+  if (header.header_size != sizeof(AnalysisFileHeader) ||
+      header.row_stride < header.num_channels ||
+      header.row_stride % (kAnalysisFileAlignment / sizeof(float)) != 0 ||
+      !IsRowsSize(size - header.header_size, header.num_steps,
+                  header.row_stride)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(path, " has an inconsistent header"));
+  }
+  return result;
+}
+
+absl::StatusOr<MappedAnalysisFile> MappedAnalysisFile::Open(
+    const std::string& path, uint64_t expected_fingerprint) {
+  absl::StatusOr<MappedAnalysisFile> result = Open(path);
+  if (result.ok() && result->Header().fingerprint != expected_fingerprint) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        path, " was produced with different parameters (fingerprint ",
+        result->Header().fingerprint, ", want ", expected_fingerprint, ")"));
+  }
+  return result;
+}
+
+MappedAnalysisFile::MappedAnalysisFile(MappedAnalysisFile&& other)
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)) {}
+
+MappedAnalysisFile& MappedAnalysisFile::operator=(MappedAnalysisFile&& other) {
+  if (this != &other) {
+    if (data_ != nullptr) {
+      munmap(const_cast<void*>(data_), size_);
+    }
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+  return *this;
+}
+
+MappedAnalysisFile::~MappedAnalysisFile() {
+  if (data_ != nullptr) {
+    munmap(const_cast<void*>(data_), size_);
+  }
+}
+
+hwy::Span<const float> MappedAnalysisFile::operator[](size_t step_index) const {
+  const AnalysisFileHeader& header = Header();
+  CHECK_LT(step_index, header.num_steps);
+  const float* rows = reinterpret_cast<const float*>(
+      static_cast<const uint8_t*>(data_) + header.header_size);
+  return hwy::Span<const float>(rows + step_index * header.row_stride,
+                                header.num_channels);
+}
+
+hwy::AlignedNDArray<float, 2> MappedAnalysisFile::Spectrogram() const {
+  const std::array<size_t, 2> shape = Shape();
+  hwy::AlignedNDArray<float, 2> result({shape[0], shape[1]});
+  for (size_t step_index = 0; step_index < shape[0]; ++step_index) {
+    hwy::CopyBytes((*this)[step_index].data(), result[{step_index}].data(),
+                   shape[1] * sizeof(float));
+  }
+  return result;
+}
+
+}  // namespace zimtohrli
@@ -0,0 +1,136 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CPP_ZIMT_ANALYSIS_FILE_H_
+#define CPP_ZIMT_ANALYSIS_FILE_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "hwy/aligned_allocator.h"
+#include "hwy/base.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+// Version of the analysis file format.
+constexpr uint32_t kAnalysisFileVersion = 1;
+
+// Alignment in bytes of the header and each row of an analysis file.
+constexpr size_t kAnalysisFileAlignment = 64;
+
+// Header of an analysis file.
+//
+// An analysis file stores the spectrogram of an Analysis, which is all that is
+// needed to compute distances. It consists of this header, followed by
+// num_steps rows of row_stride little-endian floats, where the first
+// num_channels floats of each row are the spectrogram values and the rest is
+// zero padding. row_stride * sizeof(float) is a multiple of
+// kAnalysisFileAlignment, so when the file is mapped into memory at a page
+// boundary every row is aligned like the rows of a hwy::AlignedNDArray.
+struct AnalysisFileHeader {
+  // "ZIMTSPEC".
+  char magic[8];
+  // kAnalysisFileVersion.
+  uint32_t version;
+  // sizeof(AnalysisFileHeader), i.e. the byte offset of the first row.
+  uint32_t header_size;
+  // AnalysisFingerprint of the Zimtohrli instance that produced the analysis.
+  uint64_t fingerprint;
+  uint64_t num_steps;
+  uint64_t num_channels;
+  // Number of floats between the start of each row.
+  uint64_t row_stride;
+  // The perceptual sample rate of the spectrogram, for human consumption.
+  float perceptual_sample_rate;
+  uint8_t reserved[12];
+};
+static_assert(sizeof(AnalysisFileHeader) == kAnalysisFileAlignment);
+
+// Returns a hash of the Zimtohrli parameters and CamFilterbank settings that
+// affect the spectrogram produced by z.Analyze.
+//
+// Parameters only used when computing distances, like the NSIM windows and the
+// unwarp window, are not included, so analyses can be reused when those
+// change.
+uint64_t AnalysisFingerprint(const Zimtohrli& z);
+
+// Writes spectrogram to path as an analysis file with the given fingerprint.
+//
+// The file is written to a temporary path and renamed into place, so
+// concurrent readers never see a partially written file.
+absl::Status WriteAnalysisFile(
+    const std::string& path, uint64_t fingerprint, float perceptual_sample_rate,
+    const hwy::AlignedNDArray<float, 2>& spectrogram);
+
+// Writes the spectrogram of analysis, as produced by z, to path.
+absl::Status WriteAnalysisFile(const std::string& path, const Zimtohrli& z,
+                               const Analysis& analysis);
+
+// A read-only memory mapping of an analysis file.
+//
+// The rows are views directly into the mapped file, so opening a file only
+// costs reading the pages that are actually used.
+class MappedAnalysisFile {
+ public:
+  // Maps the analysis file at path and validates its header.
+  static absl::StatusOr<MappedAnalysisFile> Open(const std::string& path);
+
+  // Like Open, but also fails with a failed precondition error if the
+  // fingerprint of the file doesn't match expected_fingerprint.
+  static absl::StatusOr<MappedAnalysisFile> Open(const std::string& path,
+                                                 uint64_t expected_fingerprint);
+
+  MappedAnalysisFile(MappedAnalysisFile&& other);
+  MappedAnalysisFile& operator=(MappedAnalysisFile&& other);
+  MappedAnalysisFile(const MappedAnalysisFile&) = delete;
+  MappedAnalysisFile& operator=(const MappedAnalysisFile&) = delete;
+  ~MappedAnalysisFile();
+
+  // Returns the header of the file.
+  const AnalysisFileHeader& Header() const {
+    return *static_cast<const AnalysisFileHeader*>(data_);
+  }
+
+  // Returns the (num_steps, num_channels) shape of the spectrogram.
+  std::array<size_t, 2> Shape() const {
+    return {static_cast<size_t>(Header().num_steps),
+            static_cast<size_t>(Header().num_channels)};
+  }
+
+  // Returns a view of the num_channels values of the spectrogram row at
+  // step_index.
+  //
+  // The view is aligned to kAnalysisFileAlignment bytes, and the padding after
+  // it up to the next row is readable and zero.
+  hwy::Span<const float> operator[](size_t step_index) const;
+
+  // Returns a copy of the spectrogram in a hwy::AlignedNDArray, as used by
+  // Zimtohrli::Distance.
+  hwy::AlignedNDArray<float, 2> Spectrogram() const;
+
+ private:
+  MappedAnalysisFile(const void* data, size_t size)
+      : data_(data), size_(size) {}
+  const void* data_;
+  size_t size_;
+};
+
+}  // namespace zimtohrli
+
+#endif  // CPP_ZIMT_ANALYSIS_FILE_H_
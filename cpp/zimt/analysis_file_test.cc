@@ -0,0 +1,154 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zimt/analysis_file.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "gtest/gtest.h"
+#include "hwy/aligned_allocator.h"
+#include "zimt/cam.h"
+#include "zimt/decimated_filterbank.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+namespace {
+
+Zimtohrli CreateZimtohrli(float sample_rate) {
+  return Zimtohrli{.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+}
+
+TEST(AnalysisFile, RoundTripTest) {
+  const float sample_rate = 48000;
+  const Zimtohrli z = CreateZimtohrli(sample_rate);
+  hwy::AlignedNDArray<float, 1> signal({static_cast<size_t>(sample_rate / 4)});
+  for (size_t index = 0; index < signal.shape()[0]; ++index) {
+    signal[{}][index] = 0.5 * std::sin(2 * M_PI * 1000 * index / sample_rate);
+  }
+  const Analysis analysis = z.Analyze(signal[{}]);
+  const std::string path = testing::TempDir() + "/round_trip.zspec";
+  ASSERT_TRUE(WriteAnalysisFile(path, z, analysis).ok());
+
+  absl::StatusOr<MappedAnalysisFile> file =
+      MappedAnalysisFile::Open(path, AnalysisFingerprint(z));
+  ASSERT_TRUE(file.ok()) << file.status();
+  EXPECT_EQ(file->Header().perceptual_sample_rate, z.perceptual_sample_rate);
+  ASSERT_EQ(file->Shape(), analysis.spectrogram.shape());
+  for (size_t step_index = 0; step_index < analysis.spectrogram.shape()[0];
+       ++step_index) {
+    EXPECT_EQ(reinterpret_cast<uintptr_t>((*file)[step_index].data()) %
+                  kAnalysisFileAlignment,
+              size_t{0});
+    for (size_t channel_index = 0;
+         channel_index < analysis.spectrogram.shape()[1]; ++channel_index) {
+      EXPECT_EQ((*file)[step_index][channel_index],
+                analysis.spectrogram[{step_index}][channel_index]);
+    }
+  }
+
+  const hwy::AlignedNDArray<float, 2> spectrogram = file->Spectrogram();
+  EXPECT_EQ(
+      z.Distance(false, spectrogram, analysis.spectrogram).value,
+      z.Distance(false, analysis.spectrogram, analysis.spectrogram).value);
+}
+
+TEST(AnalysisFile, FingerprintTest) {
+  const Zimtohrli z = CreateZimtohrli(48000);
+  EXPECT_EQ(AnalysisFingerprint(z),
+            AnalysisFingerprint(CreateZimtohrli(48000)));
+  EXPECT_NE(AnalysisFingerprint(z),
+            AnalysisFingerprint(CreateZimtohrli(44100)));
+
+  Zimtohrli louder = CreateZimtohrli(48000);
+  louder.full_scale_sine_db += 10;
+  EXPECT_NE(AnalysisFingerprint(z), AnalysisFingerprint(louder));
+
+  Zimtohrli decimated = CreateZimtohrli(48000);
+  decimated.decimated_filterbank = std::make_shared<const DecimatedFilterbank>(
+      *decimated.cam_filterbank, 16);
+  EXPECT_NE(AnalysisFingerprint(z), AnalysisFingerprint(decimated));
+
+  // Parameters only used by Distance don't change the spectrogram.
+  Zimtohrli other_nsim = CreateZimtohrli(48000);
+  other_nsim.nsim_step_window *= 2;
+  EXPECT_EQ(AnalysisFingerprint(z), AnalysisFingerprint(other_nsim));
+}
+
+TEST(AnalysisFile, OpenFailuresTest) {
+  const Zimtohrli z = CreateZimtohrli(48000);
+  const hwy::AlignedNDArray<float, 2> spectrogram({3, 5});
+  const std::string path = testing::TempDir() + "/open_failures.zspec";
+  ASSERT_TRUE(WriteAnalysisFile(path, AnalysisFingerprint(z),
+                                z.perceptual_sample_rate, spectrogram)
+                  .ok());
+  EXPECT_TRUE(MappedAnalysisFile::Open(path).ok());
+  EXPECT_EQ(MappedAnalysisFile::Open(path, AnalysisFingerprint(z) + 1)
+                .status()
+                .code(),
+            absl::StatusCode::kFailedPrecondition);
+
+  EXPECT_FALSE(
+      MappedAnalysisFile::Open(testing::TempDir() + "/missing.zspec").ok());
+
+  const std::string garbage_path = testing::TempDir() + "/garbage.zspec";
+  {
+    std::ofstream garbage(garbage_path, std::ios::binary);
+    garbage << std::string(sizeof(AnalysisFileHeader) * 2, 'x');
+  }
+  EXPECT_EQ(MappedAnalysisFile::Open(garbage_path).status().code(),
+            absl::StatusCode::kInvalidArgument);
+
+  const std::string truncated_path = testing::TempDir() + "/truncated.zspec";
+  {
+    std::ifstream source(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(source)),
+                         std::istreambuf_iterator<char>());
+    std::ofstream truncated(truncated_path, std::ios::binary);
+    truncated << contents.substr(0, contents.size() - sizeof(float));
+  }
+  EXPECT_EQ(MappedAnalysisFile::Open(truncated_path).status().code(),
+            absl::StatusCode::kInvalidArgument);
+
+  // With rows of 64 bytes, 2^58 more steps wrap the byte size of the rows
+  // around to the size of the file.
+  const std::string overflowing_path = testing::TempDir() + "/overflow.zspec";
+  {
+    std::ifstream source(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(source)),
+                         std::istreambuf_iterator<char>());
+    AnalysisFileHeader header;
+    std::memcpy(&header, contents.data(), sizeof(header));
+    ASSERT_EQ(header.row_stride * sizeof(float), 64);
+    header.num_steps += uint64_t{1} << 58;
+    std::memcpy(contents.data(), &header, sizeof(header));
+    std::ofstream overflowing(overflowing_path, std::ios::binary);
+    overflowing << contents;
+  }
+  EXPECT_EQ(MappedAnalysisFile::Open(overflowing_path).status().code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+}  // namespace
+
+}  // namespace zimtohrli
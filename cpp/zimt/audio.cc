@@ -14,6 +14,7 @@
 
 #include "zimt/audio.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <string>
@@ -23,13 +24,125 @@
 #include "absl/base/attributes.h"
 #include "absl/log/check.h"
 #include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
 #include "hwy/aligned_allocator.h"
 #include "hwy/base.h"
 #include "portaudio.h"
 #include "sndfile.h"
 
+// This file uses a lot of magic from the SIMD library Highway.
+// In simplified terms, it will compile the code for multiple architectures
+// using the "foreach_target.h" header file, and use the special namespace
+// convention HWY_NAMESPACE to find the code to adapt to the SIMD functions,
+// which are then called via HWY_DYNAMIC_DISPATCH. This leads to a lot of
+// hard-to-explain Highway-related conventions being followed, like this here
+// #define that makes this entire file be included by Highway in the process of
+// building.
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "zimt/audio.cc"
+#include "hwy/foreach_target.h"  // IWYU pragma: keep
+// Must come after foreach_target.h to avoid redefinition errors.
+#include "hwy/highway.h"
+
+// This is Highway magic conventions.
+HWY_BEFORE_NAMESPACE();
+namespace zimtohrli {
+
+namespace HWY_NAMESPACE {
+
+const hwy::HWY_NAMESPACE::ScalableTag<float> d;
+using Vec = hwy::HWY_NAMESPACE::Vec<decltype(d)>;
+
+// Channel channel_index of planar starts at planar + channel_index *
+// channel_stride.
+void HwyDeinterleave(const float* interleaved, size_t num_frames,
+                     size_t num_channels, float* planar,
+                     size_t channel_stride) {
+  const size_t lanes = hwy::HWY_NAMESPACE::Lanes(d);
+  size_t frame_index = 0;
+  switch (num_channels) {
+    case 1:
+      hwy::CopyBytes(interleaved, planar, num_frames * sizeof(float));
+      frame_index = num_frames;
+      break;
+    case 2: {
+      float* out_0 = planar;
+      float* out_1 = planar + channel_stride;
+      for (; frame_index + lanes <= num_frames; frame_index += lanes) {
+        Vec channel_0, channel_1;
+        hwy::HWY_NAMESPACE::LoadInterleaved2(d, interleaved + 2 * frame_index,
+                                             channel_0, channel_1);
+        hwy::HWY_NAMESPACE::StoreU(channel_0, d, out_0 + frame_index);
+        hwy::HWY_NAMESPACE::StoreU(channel_1, d, out_1 + frame_index);
+      }
+      break;
+    }
+    case 3: {
+      float* out_0 = planar;
+      float* out_1 = planar + channel_stride;
+      float* out_2 = planar + 2 * channel_stride;
+      for (; frame_index + lanes <= num_frames; frame_index += lanes) {
+        Vec channel_0, channel_1, channel_2;
+        hwy::HWY_NAMESPACE::LoadInterleaved3(d, interleaved + 3 * frame_index,
+                                             channel_0, channel_1, channel_2);
+        hwy::HWY_NAMESPACE::StoreU(channel_0, d, out_0 + frame_index);
+        hwy::HWY_NAMESPACE::StoreU(channel_1, d, out_1 + frame_index);
+        hwy::HWY_NAMESPACE::StoreU(channel_2, d, out_2 + frame_index);
+      }
+      break;
+    }
+    case 4: {
+      float* out_0 = planar;
+      float* out_1 = planar + channel_stride;
+      float* out_2 = planar + 2 * channel_stride;
+      float* out_3 = planar + 3 * channel_stride;
+      for (; frame_index + lanes <= num_frames; frame_index += lanes) {
+        Vec channel_0, channel_1, channel_2, channel_3;
+        hwy::HWY_NAMESPACE::LoadInterleaved4(d, interleaved + 4 * frame_index,
+                                             channel_0, channel_1, channel_2,
+                                             channel_3);
+        hwy::HWY_NAMESPACE::StoreU(channel_0, d, out_0 + frame_index);
+        hwy::HWY_NAMESPACE::StoreU(channel_1, d, out_1 + frame_index);
+        hwy::HWY_NAMESPACE::StoreU(channel_2, d, out_2 + frame_index);
+        hwy::HWY_NAMESPACE::StoreU(channel_3, d, out_3 + frame_index);
+      }
+      break;
+    }
+  }
+  // The frames not covered by whole vectors, and all frames of files with
+  // more than 4 channels.
+  for (; frame_index < num_frames; ++frame_index) {
+    for (size_t channel_index = 0; channel_index < num_channels;
+         ++channel_index) {
+      planar[channel_index * channel_stride + frame_index] =
+          interleaved[frame_index * num_channels + channel_index];
+    }
+  }
+}
+
+}  // namespace HWY_NAMESPACE
+
+}  // namespace zimtohrli
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+
 namespace zimtohrli {
 
+HWY_EXPORT(HwyDeinterleave);
+
+void Deinterleave(hwy::Span<const float> interleaved, size_t frame_offset,
+                  hwy::AlignedNDArray<float, 2>& planar) {
+  const size_t num_channels = planar.shape()[0];
+  CHECK_EQ(interleaved.size() % num_channels, size_t{0});
+  const size_t num_frames = interleaved.size() / num_channels;
+  CHECK_LE(frame_offset + num_frames, planar.shape()[1]);
+  HWY_DYNAMIC_DISPATCH(HwyDeinterleave)
+  (interleaved.data(), num_frames, num_channels, planar.data() + frame_offset,
+   planar.memory_shape()[1]);
+}
+
 std::string GetFormatName(size_t format_id) {
   if (format_id & SF_FORMAT_WAV) {
     return "wav";
@@ -185,27 +298,113 @@ absl::StatusOr<const PaStreamInfo> AudioFile::Play(
   return zimtohrli::PlayFrames(buffer_.frames, info_.samplerate, progress);
 }
 
-absl::StatusOr<AudioFile> AudioFile::Load(const std::string& path) {
+namespace {
+
+// The number of frames AudioFileReader decodes at a time.
+constexpr size_t kReadChunkFrames = 4096;
+
+}  // namespace
+
+AudioFileReader::AudioFileReader(SNDFILE* file, const SF_INFO& info)
+    : file_(file),
+      info_(info),
+      interleaved_(kReadChunkFrames * static_cast<size_t>(info.channels)) {}
+
+AudioFileReader::AudioFileReader(AudioFileReader&& other) noexcept
+    : file_(std::exchange(other.file_, nullptr)),
+      info_(other.info_),
+      interleaved_(std::move(other.interleaved_)) {}
+
+AudioFileReader& AudioFileReader::operator=(AudioFileReader&& other) noexcept {
+  if (this != &other) {
+    if (file_ != nullptr) {
+      sf_close(file_);
+    }
+    file_ = std::exchange(other.file_, nullptr);
+    info_ = other.info_;
+    interleaved_ = std::move(other.interleaved_);
+  }
+  return *this;
+}
+
+AudioFileReader::~AudioFileReader() {
+  if (file_ != nullptr) {
+    sf_close(file_);
+  }
+}
+
+absl::StatusOr<AudioFileReader> AudioFileReader::Open(
+    const std::string& path) {
   SF_INFO info{};
   SNDFILE* file = sf_open(path.c_str(), SFM_READ, &info);
   if (sf_error(file)) {
-    return absl::InternalError(sf_strerror(file));
+    const absl::Status status = absl::InternalError(sf_strerror(file));
+    if (file != nullptr) {
+      sf_close(file);
+    }
+    return status;
   }
-  std::vector<float> samples(info.channels * info.frames);
-  CHECK_EQ(sf_readf_float(file, samples.data(), info.frames), info.frames);
-  hwy::AlignedNDArray<float, 2> frames(
-      {static_cast<size_t>(info.channels), static_cast<size_t>(info.frames)});
-  for (size_t frame_index = 0; frame_index < info.frames; ++frame_index) {
-    for (size_t channel_index = 0; channel_index < info.channels;
-         ++channel_index) {
-      frames[{channel_index}][frame_index] =
-          samples[frame_index * info.channels + channel_index];
+  return AudioFileReader(file, info);
+}
+
+absl::StatusOr<size_t> AudioFileReader::Read(
+    hwy::AlignedNDArray<float, 2>& frames) {
+  return Read(0, frames);
+}
+
+absl::StatusOr<size_t> AudioFileReader::Read(
+    size_t frame_offset, hwy::AlignedNDArray<float, 2>& frames) {
+  CHECK_EQ(frames.shape()[0], NumChannels());
+  CHECK_LE(frame_offset, frames.shape()[1]);
+  return Read(frames.shape()[1] - frame_offset, frames.memory_shape()[1],
+              frames.data() + frame_offset);
+}
+
+absl::StatusOr<size_t> AudioFileReader::Read(size_t max_frames,
+                                             size_t channel_stride,
+                                             float* data) {
+  CHECK_GE(channel_stride, max_frames);
+  size_t num_read = 0;
+  while (num_read < max_frames) {
+    const size_t num_chunk_frames =
+        std::min(kReadChunkFrames, max_frames - num_read);
+    const sf_count_t num_chunk_read = sf_readf_float(
+        file_, interleaved_.data(), static_cast<sf_count_t>(num_chunk_frames));
+    if (sf_error(file_)) {
+      return absl::InternalError(sf_strerror(file_));
     }
+    if (num_chunk_read <= 0) {
+      break;
+    }
+    HWY_DYNAMIC_DISPATCH(HwyDeinterleave)
+    (interleaved_.data(), static_cast<size_t>(num_chunk_read), NumChannels(),
+     data + num_read, channel_stride);
+    num_read += static_cast<size_t>(num_chunk_read);
   }
-  sf_close(file);
-  return AudioFile(path, info,
-                   {.sample_rate = static_cast<float>(info.samplerate),
+  return num_read;
+}
+
+absl::StatusOr<AudioFile> AudioFile::Load(const std::string& path) {
+  absl::StatusOr<AudioFileReader> reader = AudioFileReader::Open(path);
+  if (!reader.ok()) {
+    return reader.status();
+  }
+  hwy::AlignedNDArray<float, 2> frames(
+      {reader->NumChannels(), reader->NumFrames()});
+  const absl::StatusOr<size_t> num_read = reader->Read(frames);
+  if (!num_read.ok()) {
+    return num_read.status();
+  }
+  if (*num_read != reader->NumFrames()) {
+    return absl::DataLossError(absl::StrCat("only read ", *num_read, " of ",
+                                            reader->NumFrames(),
+                                            " frames from ", path));
+  }
+  return AudioFile(path, reader->Info(),
+                   {.sample_rate = reader->SampleRate(),
                     .frames = std::move(frames)});
 }
 
 }  // namespace zimtohrli
+
+#endif  // HWY_ONCE
@@ -19,6 +19,7 @@
 #include <functional>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
@@ -44,6 +45,69 @@ absl::Status CloseAudio();
 using ProgressFunction = std::function<void(bool playing, size_t frame_index,
                                             const PaStreamInfo& info)>;
 
+// Copies the interleaved frames into planar, a (num_channels,
+// num_frames)-shaped array, starting at frame_offset.
+//
+// interleaved contains a whole number of frames of num_channels samples each,
+// and must fit in planar after frame_offset.
+void Deinterleave(hwy::Span<const float> interleaved, size_t frame_offset,
+                  hwy::AlignedNDArray<float, 2>& planar);
+
+// Reads an audio file in chunks of planar frames.
+//
+// Only buffers a small chunk of interleaved samples, so long recordings can be
+// processed, e.g. by pushing each channel of each chunk into a
+// StreamingAnalyzer, while they are decoded and with bounded memory.
+class AudioFileReader {
+ public:
+  // Opens the file at path for reading.
+  static absl::StatusOr<AudioFileReader> Open(const std::string& path);
+
+  AudioFileReader(AudioFileReader&& other) noexcept;
+  AudioFileReader& operator=(AudioFileReader&& other) noexcept;
+  ~AudioFileReader();
+
+  // Reads the next frames of the file into frames, a (num_channels,
+  // max_frames)-shaped array.
+  //
+  // Returns the number of frames read, which is only less than max_frames at
+  // the end of the file.
+  absl::StatusOr<size_t> Read(hwy::AlignedNDArray<float, 2>& frames);
+
+  // Reads the next frames of the file into frames, starting at frame_offset
+  // and stopping at the end of frames or at the end of the file.
+  absl::StatusOr<size_t> Read(size_t frame_offset,
+                              hwy::AlignedNDArray<float, 2>& frames);
+
+  // Reads at most max_frames next frames of the file into planar memory
+  // owned by the caller, where the samples of channel channel_index start at
+  // data + channel_index * channel_stride.
+  //
+  // channel_stride must be at least max_frames. Returns the number of frames
+  // read, which is only less than max_frames at the end of the file.
+  absl::StatusOr<size_t> Read(size_t max_frames, size_t channel_stride,
+                              float* data);
+
+  // Returns the metadata about the file.
+  const SF_INFO& Info() const { return info_; }
+
+  // Returns the sample rate of the file.
+  float SampleRate() const { return static_cast<float>(info_.samplerate); }
+
+  // Returns the number of channels of the file.
+  size_t NumChannels() const { return static_cast<size_t>(info_.channels); }
+
+  // Returns the number of frames in the file.
+  size_t NumFrames() const { return static_cast<size_t>(info_.frames); }
+
+ private:
+  AudioFileReader(SNDFILE* file, const SF_INFO& info);
+  SNDFILE* file_;
+  SF_INFO info_;
+  // Interleaved samples of the chunk being read.
+  std::vector<float> interleaved_;
+};
+
 // An audio buffer.
 struct AudioBuffer {
   // Plays the audio on the default audio device.
@@ -71,6 +135,9 @@ struct AudioBuffer {
 class AudioFile {
  public:
   // Reads from the path and returns an audio file.
+  //
+  // Decodes the file in chunks directly into the planar frames, so it only
+  // uses memory for one copy of the samples.
   static absl::StatusOr<AudioFile> Load(const std::string& path);
 
   // Returns an audio buffer containing the data of this audio file.
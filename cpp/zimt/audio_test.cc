@@ -16,10 +16,12 @@
 
 #include <cstddef>
 #include <filesystem>
+#include <vector>
 
 #include "absl/log/check.h"
 #include "absl/status/statusor.h"
 #include "gtest/gtest.h"
+#include "hwy/aligned_allocator.h"
 #include "zimt/test_file_paths.h"
 
 namespace zimtohrli {
@@ -67,6 +69,86 @@ TEST(AudioFile, LoadAudioFileTest) {
   }
 }
 
+TEST(AudioFile, ChunkedReadTest) {
+  const std::filesystem::path test_wav_path =
+      GetTestFilePath("cpp/zimt/test.wav");
+  absl::StatusOr<AudioFile> audio_file = AudioFile::Load(test_wav_path);
+  CHECK_OK(audio_file.status());
+  absl::StatusOr<AudioFileReader> reader =
+      AudioFileReader::Open(test_wav_path);
+  CHECK_OK(reader.status());
+  EXPECT_EQ(reader->NumChannels(), 2);
+  EXPECT_EQ(reader->NumFrames(), 10);
+
+  hwy::AlignedNDArray<float, 2> chunk({reader->NumChannels(), 3});
+  std::vector<size_t> chunk_sizes;
+  size_t frame_index = 0;
+  while (true) {
+    const absl::StatusOr<size_t> num_read = reader->Read(chunk);
+    CHECK_OK(num_read.status());
+    chunk_sizes.push_back(*num_read);
+    if (*num_read == 0) {
+      break;
+    }
+    for (size_t chunk_index = 0; chunk_index < *num_read; ++chunk_index) {
+      for (size_t channel_index = 0; channel_index < reader->NumChannels();
+           ++channel_index) {
+        EXPECT_EQ(chunk[{channel_index}][chunk_index],
+                  audio_file->Frames()[{channel_index}][frame_index]);
+      }
+      ++frame_index;
+    }
+  }
+  EXPECT_EQ(chunk_sizes, std::vector<size_t>({3, 3, 3, 1, 0}));
+}
+
+TEST(AudioFile, ReadIntoPlanarMemoryTest) {
+  const std::filesystem::path test_wav_path =
+      GetTestFilePath("cpp/zimt/test.wav");
+  absl::StatusOr<AudioFile> audio_file = AudioFile::Load(test_wav_path);
+  CHECK_OK(audio_file.status());
+  absl::StatusOr<AudioFileReader> reader =
+      AudioFileReader::Open(test_wav_path);
+  CHECK_OK(reader.status());
+
+  // Asks for more frames than the file has, with unpadded channels.
+  const size_t max_frames = reader->NumFrames() + 2;
+  std::vector<float> data(reader->NumChannels() * max_frames, 0.0f);
+  const absl::StatusOr<size_t> num_read =
+      reader->Read(max_frames, max_frames, data.data());
+  CHECK_OK(num_read.status());
+  ASSERT_EQ(*num_read, reader->NumFrames());
+  for (size_t channel_index = 0; channel_index < reader->NumChannels();
+       ++channel_index) {
+    for (size_t frame_index = 0; frame_index < *num_read; ++frame_index) {
+      EXPECT_EQ(data[channel_index * max_frames + frame_index],
+                audio_file->Frames()[{channel_index}][frame_index]);
+    }
+  }
+}
+
+TEST(AudioFile, DeinterleaveTest) {
+  const size_t num_frames = 37;
+  const size_t frame_offset = 5;
+  for (size_t num_channels = 1; num_channels <= 6; ++num_channels) {
+    std::vector<float> interleaved(num_frames * num_channels);
+    for (size_t index = 0; index < interleaved.size(); ++index) {
+      interleaved[index] = static_cast<float>(index);
+    }
+    hwy::AlignedNDArray<float, 2> planar(
+        {num_channels, frame_offset + num_frames});
+    Deinterleave(hwy::Span<const float>(interleaved.data(), interleaved.size()),
+                 frame_offset, planar);
+    for (size_t channel_index = 0; channel_index < num_channels;
+         ++channel_index) {
+      for (size_t frame_index = 0; frame_index < num_frames; ++frame_index) {
+        EXPECT_EQ(planar[{channel_index}][frame_offset + frame_index],
+                  interleaved[frame_index * num_channels + channel_index]);
+      }
+    }
+  }
+}
+
 }  // namespace
 
 }  // namespace zimtohrli
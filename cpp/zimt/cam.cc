@@ -14,69 +14,341 @@
 
 #include "zimt/cam.h"
 
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
 #include "hwy/aligned_allocator.h"
 #include "zimt/elliptic.h"
 #include "zimt/filterbank.h"
 
 namespace zimtohrli {
 
-float Cam::HzFromCam(float cam) const {
-  return (pow(10, cam / erbs_scale_1) - erbs_offset) / erbs_scale_2;
-}
+namespace {
 
-float Cam::CamFromHz(float hz) const {
-  return erbs_scale_1 * log10(erbs_offset + erbs_scale_2 * hz);
-}
+constexpr char kFilterbankCacheMagic[8] = {'Z', 'I', 'M', 'T',
+                                           'F', 'B', 'N', 'K'};
+constexpr uint32_t kFilterbankCacheVersion = 1;
 
-CamFilterbank Cam::CreateFilterbank(float sample_rate) const {
-  const float low_threshold_cam = CamFromHz(low_threshold_hz);
-  const float high_threshold_cam = CamFromHz(high_threshold_hz);
-  const float cam_delta =
-      CamFromHz(low_threshold_hz + minimum_bandwidth_hz) - low_threshold_cam;
+// Upper bounds on the sizes in a filterbank cache file, to reject corrupt
+// files before allocating memory for them.
+constexpr uint32_t kMaxCachedFilters = 1 << 20;
+constexpr uint32_t kMaxCachedSections = 64;
+constexpr uint32_t kMaxCachedCoeffs = 64;
+
+// The parameters of a Cam and a sample rate, which identify a filterbank
+// design.
+using DesignKey = std::array<float, 10>;
 
+DesignKey KeyOf(const Cam& cam, float sample_rate) {
+  return {cam.erbs_scale_1,
+          cam.erbs_scale_2,
+          cam.erbs_offset,
+          cam.low_threshold_hz,
+          cam.high_threshold_hz,
+          cam.minimum_bandwidth_hz,
+          static_cast<float>(cam.filter_order),
+          cam.filter_pass_band_ripple,
+          cam.filter_stop_band_ripple,
+          sample_rate};
+}
+
+// The result of designing the filters of a filterbank.
+struct FilterbankDesign {
   std::vector<std::vector<BACoeffs>> coeffs;
-  std::vector<std::pair<float, float>> thresholds_vector;
+  // The low and high threshold of each filter.
+  std::vector<std::pair<float, float>> thresholds_hz;
+  float cam_delta;
+};
+
+// A design along with the filterbank created from it, whose coefficients are
+// shared by all filterbanks created from the cache.
+struct CachedDesign {
+  FilterbankDesign design;
+  Filterbank filter;
+};
+
+struct FilterbankCache {
+  std::mutex mutex;
+  std::map<DesignKey, std::shared_ptr<const CachedDesign>> designs;
+};
+
+FilterbankCache& GetFilterbankCache() {
+  static FilterbankCache* const cache = new FilterbankCache();
+  return *cache;
+}
+
+FilterbankDesign Design(const Cam& cam, float sample_rate) {
+  const float low_threshold_cam = cam.CamFromHz(cam.low_threshold_hz);
+  const float high_threshold_cam = cam.CamFromHz(cam.high_threshold_hz);
+  FilterbankDesign result = {
+      .cam_delta =
+          cam.CamFromHz(cam.low_threshold_hz + cam.minimum_bandwidth_hz) -
+          low_threshold_cam,
+  };
 
   int sections = -1;
   for (float left_cam = low_threshold_cam;
-       left_cam + cam_delta < high_threshold_cam; left_cam += cam_delta) {
-    float left_hz = HzFromCam(left_cam);
-    float right_hz = HzFromCam(left_cam + cam_delta);
-    const std::vector<BACoeffs> filter_coeffs = DigitalSOSBandPass(
-        filter_order, filter_pass_band_ripple, filter_stop_band_ripple, left_hz,
-        right_hz, sample_rate);
+       left_cam + result.cam_delta < high_threshold_cam;
+       left_cam += result.cam_delta) {
+    float left_hz = cam.HzFromCam(left_cam);
+    float right_hz = cam.HzFromCam(left_cam + result.cam_delta);
+    std::vector<BACoeffs> filter_coeffs = DigitalSOSBandPass(
+        cam.filter_order, cam.filter_pass_band_ripple,
+        cam.filter_stop_band_ripple, left_hz, right_hz, sample_rate);
     if (sections == -1) {
       sections = filter_coeffs.size();
     } else {
       CHECK_EQ(filter_coeffs.size(), sections);
     }
-    coeffs.push_back(filter_coeffs);
-    thresholds_vector.push_back(std::make_pair(left_hz, right_hz));
+    result.coeffs.push_back(std::move(filter_coeffs));
+    result.thresholds_hz.push_back(std::make_pair(left_hz, right_hz));
   }
-  CHECK(!coeffs.empty());
-
-  hwy::AlignedNDArray<float, 2> thresholds({3, coeffs.size()});
-  for (size_t filter_index = 0; filter_index < coeffs.size(); ++filter_index) {
-    thresholds[{0}][filter_index] = thresholds_vector[filter_index].first;
-    thresholds[{1}][filter_index] = (thresholds_vector[filter_index].first +
-                                     thresholds_vector[filter_index].second) *
-                                    0.5;
-    thresholds[{2}][filter_index] = thresholds_vector[filter_index].second;
+  CHECK(!result.coeffs.empty());
+  return result;
+}
+
+CamFilterbank FromDesign(const Cam& cam, float sample_rate,
+                         const FilterbankDesign& design, Filterbank filter) {
+  const size_t num_filters = design.thresholds_hz.size();
+  hwy::AlignedNDArray<float, 2> thresholds({3, num_filters});
+  for (size_t filter_index = 0; filter_index < num_filters; ++filter_index) {
+    thresholds[{0}][filter_index] = design.thresholds_hz[filter_index].first;
+    thresholds[{1}][filter_index] =
+        (design.thresholds_hz[filter_index].first +
+         design.thresholds_hz[filter_index].second) *
+        0.5;
+    thresholds[{2}][filter_index] = design.thresholds_hz[filter_index].second;
   }
 
-  return {.filter = Filterbank(coeffs),
+  return {.filter = std::move(filter),
           .thresholds_hz = std::move(thresholds),
-          .cam_delta = cam_delta,
+          .cam_delta = design.cam_delta,
           .sample_rate = sample_rate,
-          .filter_order = filter_order,
-          .filter_pass_band_ripple = filter_pass_band_ripple,
-          .filter_stop_band_ripple = filter_stop_band_ripple};
+          .filter_order = cam.filter_order,
+          .filter_pass_band_ripple = cam.filter_pass_band_ripple,
+          .filter_stop_band_ripple = cam.filter_stop_band_ripple};
+}
+
+// Adds design to the cache unless key is already present, and returns the
+// cached design for key.
+std::shared_ptr<const CachedDesign> Insert(const DesignKey& key,
+                                           FilterbankDesign design) {
+  Filterbank filter(design.coeffs);
+  std::shared_ptr<const CachedDesign> cached =
+      std::make_shared<const CachedDesign>(CachedDesign{
+          .design = std::move(design), .filter = std::move(filter)});
+  FilterbankCache& cache = GetFilterbankCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  return cache.designs.emplace(key, std::move(cached)).first->second;
+}
+
+absl::Status ErrnoError(const std::string& message) {
+  return absl::InternalError(absl::StrCat(message, ": ", std::strerror(errno)));
+}
+
+template <typename T>
+void WriteValue(std::ostream& stream, const T& value) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool ReadValue(std::istream& stream, T& value) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  return static_cast<bool>(
+      stream.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+}  // namespace
+
+float Cam::HzFromCam(float cam) const {
+  return (pow(10, cam / erbs_scale_1) - erbs_offset) / erbs_scale_2;
+}
+
+float Cam::CamFromHz(float hz) const {
+  return erbs_scale_1 * log10(erbs_offset + erbs_scale_2 * hz);
+}
+
+CamFilterbank Cam::CreateFilterbank(float sample_rate) const {
+  const DesignKey key = KeyOf(*this, sample_rate);
+  std::shared_ptr<const CachedDesign> cached;
+  {
+    FilterbankCache& cache = GetFilterbankCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    const auto it = cache.designs.find(key);
+    if (it != cache.designs.end()) {
+      cached = it->second;
+    }
+  }
+  if (cached == nullptr) {
+    // Designing outside the lock lets different designs be created in
+    // parallel. If another thread inserts the same design meanwhile, Insert
+    // returns that one.
+    cached = Insert(key, Design(*this, sample_rate));
+  }
+  return FromDesign(*this, sample_rate, cached->design, cached->filter);
+}
+
+CamFilterbank Cam::DesignFilterbank(float sample_rate) const {
+  const FilterbankDesign design = Design(*this, sample_rate);
+  return FromDesign(*this, sample_rate, design, Filterbank(design.coeffs));
+}
+
+size_t FilterbankCacheSize() {
+  FilterbankCache& cache = GetFilterbankCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  return cache.designs.size();
+}
+
+void ClearFilterbankCache() {
+  FilterbankCache& cache = GetFilterbankCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  cache.designs.clear();
+}
+
+absl::Status WriteFilterbankCache(const std::string& path) {
+  std::map<DesignKey, std::shared_ptr<const CachedDesign>> designs;
+  {
+    FilterbankCache& cache = GetFilterbankCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    designs = cache.designs;
+  }
+
+  const std::string tmp_path = absl::StrCat(path, ".tmp.", getpid());
+  {
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+      return ErrnoError(absl::StrCat("unable to create ", tmp_path));
+    }
+    WriteValue(file, kFilterbankCacheMagic);
+    WriteValue(file, kFilterbankCacheVersion);
+    WriteValue(file, static_cast<uint32_t>(designs.size()));
+    for (const auto& key_and_design : designs) {
+      const FilterbankDesign& design = key_and_design.second->design;
+      const std::vector<BACoeffs>& first_filter = design.coeffs.front();
+      WriteValue(file, key_and_design.first);
+      WriteValue(file, design.cam_delta);
+      WriteValue(file, static_cast<uint32_t>(design.coeffs.size()));
+      WriteValue(file, static_cast<uint32_t>(first_filter.size()));
+      WriteValue(file, static_cast<uint32_t>(first_filter[0].b_coeffs.size()));
+      WriteValue(file, static_cast<uint32_t>(first_filter[0].a_coeffs.size()));
+      for (const std::pair<float, float>& thresholds : design.thresholds_hz) {
+        WriteValue(file, thresholds.first);
+        WriteValue(file, thresholds.second);
+      }
+      for (const std::vector<BACoeffs>& filter : design.coeffs) {
+        for (const BACoeffs& section : filter) {
+          file.write(reinterpret_cast<const char*>(section.b_coeffs.data()),
+                     section.b_coeffs.size() * sizeof(double));
+          file.write(reinterpret_cast<const char*>(section.a_coeffs.data()),
+                     section.a_coeffs.size() * sizeof(double));
+        }
+      }
+    }
+    file.close();
+    if (!file) {
+      std::remove(tmp_path.c_str());
+      return ErrnoError(absl::StrCat("unable to write ", tmp_path));
+    }
+  }
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    const absl::Status status =
+        ErrnoError(absl::StrCat("unable to rename ", tmp_path, " to ", path));
+    std::remove(tmp_path.c_str());
+    return status;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ReadFilterbankCache(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return ErrnoError(absl::StrCat("unable to open ", path));
+  }
+  const absl::Status truncated =
+      absl::DataLossError(absl::StrCat(path, " is truncated"));
+  char magic[sizeof(kFilterbankCacheMagic)];
+  uint32_t version;
+  uint32_t num_designs;
+  if (!ReadValue(file, magic) || !ReadValue(file, version) ||
+      !ReadValue(file, num_designs)) {
+    return truncated;
+  }
+  if (std::memcmp(magic, kFilterbankCacheMagic, sizeof(magic)) != 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(path, " is not a filterbank cache file"));
+  }
+  if (version != kFilterbankCacheVersion) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(path, " has version ", version, ", want ",
+                     kFilterbankCacheVersion));
+  }
+
+  std::vector<std::pair<DesignKey, FilterbankDesign>> designs;
+  for (uint32_t design_index = 0; design_index < num_designs; ++design_index) {
+    DesignKey key;
+    FilterbankDesign design;
+    uint32_t num_filters;
+    uint32_t num_sections;
+    uint32_t num_b_coeffs;
+    uint32_t num_a_coeffs;
+    if (!ReadValue(file, key) || !ReadValue(file, design.cam_delta) ||
+        !ReadValue(file, num_filters) || !ReadValue(file, num_sections) ||
+        !ReadValue(file, num_b_coeffs) || !ReadValue(file, num_a_coeffs)) {
+      return truncated;
+    }
+    if (num_filters == 0 || num_filters > kMaxCachedFilters ||
+        num_sections == 0 || num_sections > kMaxCachedSections ||
+        num_b_coeffs == 0 || num_b_coeffs > kMaxCachedCoeffs ||
+        num_a_coeffs == 0 || num_a_coeffs > kMaxCachedCoeffs) {
+      return absl::InvalidArgumentError(
+          absl::StrCat(path, " contains a design of invalid size"));
+    }
+    design.thresholds_hz.resize(num_filters);
+    for (std::pair<float, float>& thresholds : design.thresholds_hz) {
+      if (!ReadValue(file, thresholds.first) ||
+          !ReadValue(file, thresholds.second)) {
+        return truncated;
+      }
+    }
+    design.coeffs.resize(num_filters);
+    for (std::vector<BACoeffs>& filter : design.coeffs) {
+      filter.resize(num_sections);
+      for (BACoeffs& section : filter) {
+        section.b_coeffs.resize(num_b_coeffs);
+        section.a_coeffs.resize(num_a_coeffs);
+        if (!file.read(reinterpret_cast<char*>(section.b_coeffs.data()),
+                       num_b_coeffs * sizeof(double)) ||
+            !file.read(reinterpret_cast<char*>(section.a_coeffs.data()),
+                       num_a_coeffs * sizeof(double))) {
+          return truncated;
+        }
+      }
+    }
+    designs.push_back(std::make_pair(key, std::move(design)));
+  }
+  for (std::pair<DesignKey, FilterbankDesign>& key_and_design : designs) {
+    Insert(key_and_design.first, std::move(key_and_design.second));
+  }
+  return absl::OkStatus();
 }
 
 }  // namespace zimtohrli
@@ -15,6 +15,10 @@
 #ifndef CPP_ZIMT_CAM_H_
 #define CPP_ZIMT_CAM_H_
 
+#include <cstddef>
+#include <string>
+
+#include "absl/status/status.h"
 #include "hwy/aligned_allocator.h"
 #include "zimt/filterbank.h"
 
@@ -55,8 +59,17 @@ struct Cam {
   // Returns a filterbank with filters between low_threshold_hz and
   // high_threshold_hz, with the first filter having minimum_bandwidth_hz width,
   // and all filters having the same bandwidth in Cam.
+  //
+  // Designs are kept in a process-wide cache keyed by sample_rate and all
+  // parameters of this Cam, so creating a filterbank with the same parameters
+  // again only copies the thresholds, and shares the filter coefficients with
+  // the previously created filterbanks.
   CamFilterbank CreateFilterbank(float sample_rate) const;
 
+  // Like CreateFilterbank, but always designs the filters from scratch and
+  // doesn't touch the cache.
+  CamFilterbank DesignFilterbank(float sample_rate) const;
+
   // Scale constant for Hz/Cam conversion.
   float erbs_scale_1 = 21.4;
   // Scale constant for Hz/Cam conversion.
@@ -80,6 +93,28 @@ struct Cam {
   float filter_stop_band_ripple = 80;
 };
 
+// Returns the number of filterbank designs in the process-wide cache used by
+// Cam::CreateFilterbank.
+size_t FilterbankCacheSize();
+
+// Removes all filterbank designs from the process-wide cache.
+//
+// Filterbanks already created keep their coefficients.
+void ClearFilterbankCache();
+
+// Writes all filterbank designs in the process-wide cache to path.
+//
+// Meant for short-lived processes that create the same filterbanks every time
+// they start: loading the designs with ReadFilterbankCache is much faster than
+// running the filter design again.
+absl::Status WriteFilterbankCache(const std::string& path);
+
+// Adds the filterbank designs in path, written by WriteFilterbankCache, to the
+// process-wide cache.
+//
+// Designs already in the cache are kept.
+absl::Status ReadFilterbankCache(const std::string& path);
+
 }  // namespace zimtohrli
 
 #endif  // CPP_ZIMT_CAM_H_
@@ -16,9 +16,12 @@
 
 #include <cmath>
 #include <cstddef>
+#include <fstream>
+#include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/status/status.h"
 #include "gtest/gtest.h"
 #include "hwy/aligned_allocator.h"
 #include "zimt/filterbank.h"
@@ -134,6 +137,75 @@ TEST(Cam, ProcessFilterbankTest) {
   }
 }
 
+void ExpectSameFilterbank(const CamFilterbank& got,
+                          const CamFilterbank& want) {
+  ASSERT_EQ(got.filter.Size(), want.filter.Size());
+  EXPECT_EQ(got.cam_delta, want.cam_delta);
+  EXPECT_EQ(got.sample_rate, want.sample_rate);
+  for (size_t threshold_index = 0; threshold_index < 3; ++threshold_index) {
+    for (size_t filter_index = 0; filter_index < want.filter.Size();
+         ++filter_index) {
+      EXPECT_EQ(got.thresholds_hz[{threshold_index}][filter_index],
+                want.thresholds_hz[{threshold_index}][filter_index]);
+    }
+  }
+  hwy::AlignedNDArray<float, 1> signal({480});
+  signal[{}][0] = 1;
+  hwy::AlignedNDArray<float, 2> got_output({480, got.filter.Size()});
+  got.filter.Filter(signal[{}], got_output);
+  hwy::AlignedNDArray<float, 2> want_output({480, want.filter.Size()});
+  want.filter.Filter(signal[{}], want_output);
+  for (size_t sample_index = 0; sample_index < signal.shape()[0];
+       ++sample_index) {
+    for (size_t filter_index = 0; filter_index < want.filter.Size();
+         ++filter_index) {
+      EXPECT_EQ(got_output[{sample_index}][filter_index],
+                want_output[{sample_index}][filter_index]);
+    }
+  }
+}
+
+TEST(Cam, FilterbankCacheTest) {
+  const Cam cam{.minimum_bandwidth_hz = 51};
+  const size_t size_before = FilterbankCacheSize();
+  const CamFilterbank first = cam.CreateFilterbank(48000);
+  EXPECT_EQ(FilterbankCacheSize(), size_before + 1);
+  const CamFilterbank second = cam.CreateFilterbank(48000);
+  EXPECT_EQ(FilterbankCacheSize(), size_before + 1);
+  ExpectSameFilterbank(first, cam.DesignFilterbank(48000));
+  ExpectSameFilterbank(second, first);
+
+  cam.CreateFilterbank(44100);
+  EXPECT_EQ(FilterbankCacheSize(), size_before + 2);
+  Cam sharper = cam;
+  sharper.filter_order = 2;
+  sharper.CreateFilterbank(48000);
+  EXPECT_EQ(FilterbankCacheSize(), size_before + 3);
+}
+
+TEST(Cam, FilterbankCacheFileTest) {
+  const Cam cam{.minimum_bandwidth_hz = 53};
+  cam.CreateFilterbank(48000);
+  const std::string path = testing::TempDir() + "/filterbanks";
+  ASSERT_TRUE(WriteFilterbankCache(path).ok());
+
+  ClearFilterbankCache();
+  EXPECT_EQ(FilterbankCacheSize(), size_t{0});
+  const absl::Status status = ReadFilterbankCache(path);
+  ASSERT_TRUE(status.ok()) << status;
+  const size_t size_after_read = FilterbankCacheSize();
+  EXPECT_GT(size_after_read, size_t{0});
+  const CamFilterbank loaded = cam.CreateFilterbank(48000);
+  EXPECT_EQ(FilterbankCacheSize(), size_after_read);
+  ExpectSameFilterbank(loaded, cam.DesignFilterbank(48000));
+
+  EXPECT_FALSE(ReadFilterbankCache(path + ".missing").ok());
+  const std::string garbage_path = testing::TempDir() + "/garbage";
+  std::ofstream(garbage_path) << "not a filterbank cache file";
+  EXPECT_EQ(ReadFilterbankCache(garbage_path).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
 }  // namespace
 
 }  // namespace zimtohrli
@@ -40,6 +40,7 @@
 #include <cmath>
 #include <cstddef>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <string>
 #include <utility>
@@ -56,6 +57,9 @@
 #include "zimt/audio.h"
 #include "zimt/cam.h"
 #include "zimt/mos.h"
+#include "zimt/multi_rate.h"
+#include "zimt/stats.h"
+#include "zimt/thread_pool.h"
 #include "zimt/ux.h"
 #include "zimt/zimtohrli.h"
 
@@ -75,6 +79,10 @@ ABSL_FLAG(bool, truncate, false,
 ABSL_FLAG(float, unwarp_window, 2.0f,
           "unwarp window length in seconds, must be greater than 0 if truncate "
           "is false and the files are of different lengths");
+ABSL_FLAG(float, unwarp_radius, 0.0f,
+          "maximum warp in seconds considered when unwarping, converted to "
+          "time steps like the unwarp window, 0 means only limited by the "
+          "unwarp window");
 ABSL_FLAG(bool, normalize_amplitude, true,
           "whether to normalize the amplitude of all B sounds to the same max "
           "amplitude as the A sound");
@@ -84,6 +92,9 @@ ABSL_FLAG(bool, output_zimtohrli_distance, false,
 ABSL_FLAG(bool, per_channel, false,
           "Whether to output the produced metric per channel instead of a "
           "single value for all channels.");
+ABSL_FLAG(size_t, threads, 1,
+          "number of threads to analyze and compare audio channels and files "
+          "B with");
 
 namespace zimtohrli {
 
@@ -111,12 +122,13 @@ struct DistanceData {
   DistanceData(const Zimtohrli& z, const DistanceData* previous_step,
                const hwy::AlignedNDArray<float, 2>& thresholds_hz,
                const hwy::AlignedNDArray<float, 2>& a,
-               const hwy::AlignedNDArray<float, 2>& b, const std::string& unit,
-               float perceptual_sample_rate)
+               const hwy::AlignedNDArray<float, 2>& b,
+               const std::vector<std::pair<size_t, size_t>>& time_pairs,
+               const std::string& unit, float perceptual_sample_rate)
       : previous_step(previous_step),
         a(&a),
         b(&b),
-        distance(z.Distance(true, a, b)),
+        distance(z.Distance(true, a, b, time_pairs)),
         unit(unit),
         thresholds_hz(&thresholds_hz),
         perceptual_sample_rate(perceptual_sample_rate) {}
@@ -221,6 +233,11 @@ int Main(int argc, char* argv[]) {
   if (verbose) {
     PrintLoadFileInfo(path_a, file_a->Info(), file_a_measurements);
   }
+  // Files B at other sample rates than file A are only supported when
+  // computing plain distances, which don't need the frames to line up.
+  const bool ux = absl::GetFlag(FLAGS_ux);
+  const bool allow_mixed_sample_rates = !ux && !verbose;
+  // The length of the shortest file, in frames at the sample rate of file A.
   size_t min_length = file_a->Frames().shape()[1];
 
   std::vector<AudioFile> file_b_vector;
@@ -240,8 +257,14 @@ int Main(int argc, char* argv[]) {
       PrintLoadFileInfo(file_b->Path(), file_b->Info(), measurements);
     }
     CHECK_EQ(file_a->Info().channels, file_b->Info().channels);
-    CHECK_EQ(file_a->Info().samplerate, file_b->Info().samplerate);
-    min_length = std::min(min_length, file_b->Frames().shape()[1]);
+    if (!allow_mixed_sample_rates) {
+      CHECK_EQ(file_a->Info().samplerate, file_b->Info().samplerate)
+          << "files of different sample rates can't be used with --ux or "
+             "--verbose";
+    }
+    min_length = std::min(
+        min_length, file_b->Frames().shape()[1] * file_a->Info().samplerate /
+                        file_b->Info().samplerate);
     if (absl::GetFlag(FLAGS_normalize_amplitude)) {
       for (size_t channel_index = 0; channel_index < file_b->Info().channels;
            ++channel_index) {
@@ -266,16 +289,20 @@ int Main(int argc, char* argv[]) {
     file_b_vector.push_back(*std::move(file_b));
   }
 
-  Cam cam{.minimum_bandwidth_hz = frequency_resolution};
-  cam.high_threshold_hz =
-      std::min(cam.high_threshold_hz, file_a->Info().samplerate / 2.0f);
-  Zimtohrli z = {
-      .perceptual_sample_rate = absl::GetFlag(FLAGS_perceptual_sample_rate),
-      .cam_filterbank =
-          cam.CreateFilterbank(static_cast<float>(file_a->Info().samplerate)),
-      .unwarp_window_seconds = absl::GetFlag(FLAGS_unwarp_window),
-      .full_scale_sine_db = absl::GetFlag(FLAGS_full_scale_sine_db),
-  };
+  const Cam cam{.minimum_bandwidth_hz = frequency_resolution};
+  const std::shared_ptr<ZimtohrliStats> stats =
+      verbose ? std::make_shared<ZimtohrliStats>() : nullptr;
+  MultiRateZimtohrli multi_rate_z(
+      cam, Zimtohrli{
+               .perceptual_sample_rate =
+                   absl::GetFlag(FLAGS_perceptual_sample_rate),
+               .unwarp_window_seconds = absl::GetFlag(FLAGS_unwarp_window),
+               .unwarp_radius_seconds = absl::GetFlag(FLAGS_unwarp_radius),
+               .full_scale_sine_db = absl::GetFlag(FLAGS_full_scale_sine_db),
+               .stats = stats,
+           });
+  const float sample_rate_a = static_cast<float>(file_a->Info().samplerate);
+  const Zimtohrli& z = multi_rate_z.ForSampleRate(sample_rate_a);
 
   // Run a more optimized code path if the user doesn't want either UX or
   // verbose output.
@@ -285,60 +312,71 @@ int Main(int argc, char* argv[]) {
     file_a->Info().frames = min_length;
   }
   for (AudioFile& file_b : file_b_vector) {
+    const float sample_rate_b = static_cast<float>(file_b.Info().samplerate);
+    CHECK(multi_rate_z.Comparable(sample_rate_a, sample_rate_b))
+        << file_b.Path() << " at " << sample_rate_b
+        << "Hz doesn't get the same frequency channels as " << file_a->Path()
+        << " at " << sample_rate_a << "Hz";
     if (truncate) {
-      file_b.Frames().truncate({file_b.Frames().shape()[0], min_length});
-      file_b.Info().frames = min_length;
-    } else if (absl::GetFlag(FLAGS_unwarp_window) == 0) {
+      const size_t length_b =
+          min_length * file_b.Info().samplerate / file_a->Info().samplerate;
+      file_b.Frames().truncate({file_b.Frames().shape()[0], length_b});
+      file_b.Info().frames = length_b;
+    } else if (absl::GetFlag(FLAGS_unwarp_window) == 0 &&
+               file_b.Info().samplerate == file_a->Info().samplerate) {
       CHECK_EQ(file_a->Info().frames, file_b.Info().frames)
           << "use --truncate=true or --unwarp_window=[something > 0]";
     }
+    // Without a dynamic time warp the time steps are paired one to one, but
+    // lengths rounded to another sample rate can still give one step more or
+    // less.
+    if (absl::GetFlag(FLAGS_unwarp_window) == 0) {
+      const size_t num_steps_a = z.NumSteps(file_a->Frames().shape()[1]);
+      const size_t num_steps_b =
+          multi_rate_z.ForSampleRate(sample_rate_b)
+              .NumSteps(file_b.Frames().shape()[1]);
+      if (num_steps_a != num_steps_b) {
+        std::cerr << file_b.Path() << " has " << num_steps_b
+                  << " time steps and " << file_a->Path() << " has "
+                  << num_steps_a
+                  << ", use --unwarp_window=[something > 0] to compare them"
+                  << std::endl;
+        return 5;
+      }
+    }
   }
 
-  const bool ux = absl::GetFlag(FLAGS_ux);
   const bool per_channel = absl::GetFlag(FLAGS_per_channel);
+  ThreadPool pool(absl::GetFlag(FLAGS_threads));
   if (!ux && !verbose) {
-    const size_t num_downscaled_samples_a = static_cast<size_t>(
-        std::ceil(static_cast<float>(file_a->Frames().shape()[1]) *
-                  z.perceptual_sample_rate / z.cam_filterbank->sample_rate));
-    hwy::AlignedNDArray<float, 2> channels_a(
-        {file_a->Frames().shape()[1], z.cam_filterbank->filter.Size()});
-    hwy::AlignedNDArray<float, 2> energy_channels_db_a(
-        {num_downscaled_samples_a, z.cam_filterbank->filter.Size()});
-    hwy::AlignedNDArray<float, 2> partial_energy_channels_db_a(
-        {num_downscaled_samples_a, z.cam_filterbank->filter.Size()});
-    std::vector<hwy::AlignedNDArray<float, 2>> file_a_spectrograms;
-    for (size_t channel_index = 0; channel_index < file_a->Info().channels;
-         ++channel_index) {
-      hwy::AlignedNDArray<float, 2> spectrogram(
-          {num_downscaled_samples_a, z.cam_filterbank->filter.Size()});
-      z.Spectrogram(file_a->Frames()[{channel_index}], channels_a,
-                    energy_channels_db_a, partial_energy_channels_db_a,
-                    spectrogram);
-      file_a_spectrograms.push_back(std::move(spectrogram));
-    }
+    const size_t num_channels = file_a->Info().channels;
+    std::vector<std::optional<Analysis>> file_a_analyses(num_channels);
+    pool.ParallelFor(num_channels, [&](size_t channel_index) {
+      file_a_analyses[channel_index] =
+          z.Analyze(file_a->Frames()[{channel_index}]);
+    });
+    // Distance of channel channel_index of file B file_b_index is at
+    // distances[file_b_index * num_channels + channel_index].
+    std::vector<float> distances(file_b_vector.size() * num_channels);
+    pool.ParallelFor(distances.size(), [&](size_t task_index) {
+      const size_t file_b_index = task_index / num_channels;
+      const size_t channel_index = task_index % num_channels;
+      const AudioFile& file_b = file_b_vector[file_b_index];
+      const Analysis analysis_b = multi_rate_z.Analyze(
+          static_cast<float>(file_b.Info().samplerate),
+          file_b.Frames()[{channel_index}]);
+      distances[task_index] =
+          z.Distance(false, file_a_analyses[channel_index]->spectrogram,
+                     analysis_b.spectrogram)
+              .value;
+    });
     for (int file_b_index = 0; file_b_index < file_b_vector.size();
          ++file_b_index) {
-      const AudioFile& file_b = file_b_vector[file_b_index];
-      const size_t num_downscaled_samples_b = static_cast<size_t>(
-          std::ceil(static_cast<float>(file_b.Frames().shape()[1]) *
-                    z.perceptual_sample_rate / z.cam_filterbank->sample_rate));
-      hwy::AlignedNDArray<float, 2> channels_b(
-          {file_b.Frames().shape()[1], z.cam_filterbank->filter.Size()});
-      hwy::AlignedNDArray<float, 2> energy_channels_db_b(
-          {num_downscaled_samples_b, z.cam_filterbank->filter.Size()});
-      hwy::AlignedNDArray<float, 2> partial_energy_channels_db_b(
-          {num_downscaled_samples_b, z.cam_filterbank->filter.Size()});
-      hwy::AlignedNDArray<float, 2> spectrogram_b(
-          {num_downscaled_samples_b, z.cam_filterbank->filter.Size()});
       float sum_of_squares = 0;
-      for (size_t channel_index = 0; channel_index < file_a->Info().channels;
+      for (size_t channel_index = 0; channel_index < num_channels;
            ++channel_index) {
-        z.Spectrogram(file_b.Frames()[{channel_index}], channels_b,
-                      energy_channels_db_b, partial_energy_channels_db_b,
-                      spectrogram_b);
         const float distance =
-            z.Distance(false, file_a_spectrograms[channel_index], spectrogram_b)
-                .value;
+            distances[file_b_index * num_channels + channel_index];
         if (per_channel) {
           std::cout << GetMetric(distance) << std::endl;
         } else {
@@ -349,7 +387,7 @@ int Main(int argc, char* argv[]) {
         for (int file_b_index = 0; file_b_index < file_b_vector.size();
              ++file_b_index) {
           std::cout << GetMetric(std::sqrt(sum_of_squares /
-                                           float(file_a->Info().channels)))
+                                           float(num_channels)))
                     << std::endl;
         }
       }
@@ -362,14 +400,24 @@ int Main(int argc, char* argv[]) {
   for (const AudioFile& file_b : file_b_vector) {
     frames_b.push_back(&file_b.Frames());
   }
-  Comparison comparison = z.Compare(file_a->Frames(), frames_b);
+  Comparison comparison = z.Compare(file_a->Frames(), frames_b, pool);
 
   if (ux) {
+    z.ComputeDeltas(file_a->Frames(), frames_b, comparison, pool);
+    const hwy::AlignedNDArray<float, 2>& z_thresholds_hz =
+        z.cam_filterbank->thresholds_hz;
+    hwy::AlignedNDArray<float, 2> thresholds_hz(z_thresholds_hz.shape());
+    for (size_t row_index = 0; row_index < thresholds_hz.shape()[0];
+         ++row_index) {
+      const hwy::Span<const float> row = z_thresholds_hz[{row_index}];
+      std::copy(row.data(), row.data() + row.size(),
+                thresholds_hz[{row_index}].data());
+    }
     UX ux;
     ux.Paint({.file_a = std::move(file_a.value()),
               .file_b = std::move(file_b_vector),
               .comparison = std::move(comparison),
-              .thresholds_hz = std::move(z.cam_filterbank->thresholds_hz),
+              .thresholds_hz = std::move(thresholds_hz),
               .full_scale_sine_db = full_scale_sine_db,
               .perceptual_sample_rate = z.perceptual_sample_rate,
               .unwarp_window = absl::GetFlag(FLAGS_unwarp_window)});
@@ -389,6 +437,7 @@ int Main(int argc, char* argv[]) {
             z, nullptr, z.cam_filterbank->thresholds_hz,
             comparison.analysis_a[channel_index].energy_channels_db,
             comparison.analysis_b[b_index][channel_index].energy_channels_db,
+            comparison.dtw[b_index][channel_index].energy_channels_db,
             "dB SPL", z.perceptual_sample_rate);
         std::cout << "    Raw channel distance: " << raw_channel_distance
                   << std::endl;
@@ -398,6 +447,7 @@ int Main(int argc, char* argv[]) {
             comparison.analysis_a[channel_index].partial_energy_channels_db,
             comparison.analysis_b[b_index][channel_index]
                 .partial_energy_channels_db,
+            comparison.dtw[b_index][channel_index].partial_energy_channels_db,
             "dB SPL", z.perceptual_sample_rate);
         std::cout << "    Masked channel distance: " << masked_channel_distance
                   << std::endl;
@@ -405,7 +455,8 @@ int Main(int argc, char* argv[]) {
         const DistanceData phons_channel_distance = DistanceData(
             z, &masked_channel_distance, z.cam_filterbank->thresholds_hz,
             comparison.analysis_a[channel_index].spectrogram,
-            comparison.analysis_b[b_index][channel_index].spectrogram, "Phons",
+            comparison.analysis_b[b_index][channel_index].spectrogram,
+            comparison.dtw[b_index][channel_index].spectrogram, "Phons",
             z.perceptual_sample_rate);
         std::cout << "    Phons channel distance: " << phons_channel_distance
                   << std::endl;
@@ -422,6 +473,12 @@ int Main(int argc, char* argv[]) {
       std::cout << "  File MOS: " << MOSFromZimtohrli(zimtohrli_file_distance)
                 << std::endl;
     }
+#ifdef ZIMTOHRLI_STATS
+    std::cout << "Stage stats:" << std::endl << *stats;
+#else
+    std::cout << "Stage stats: not recorded, build with -DZIMTOHRLI_STATS=ON"
+              << std::endl;
+#endif
     return 0;
   }
 
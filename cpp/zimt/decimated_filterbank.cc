@@ -0,0 +1,181 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zimt/decimated_filterbank.h"
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/numeric/bits.h"
+#include "hwy/aligned_allocator.h"
+#include "zimt/cam.h"
+#include "zimt/elliptic.h"
+#include "zimt/filterbank.h"
+
+namespace zimtohrli {
+
+namespace {
+
+// Number of taps on each side of the center of the half band filter.
+constexpr size_t kHalfBandRadius = 15;
+
+// A zero phase half band low pass filter. The taps at even nonzero offsets
+// from the center of a half band filter are zero.
+struct HalfBandFilter {
+  float center;
+  // side[i] is the tap at offsets -(2 * i + 1) and 2 * i + 1.
+  std::array<float, (kHalfBandRadius + 1) / 2> side;
+};
+
+// Returns a Blackman windowed half band filter with unit DC gain.
+//
+// The Blackman window gives more than 70 dB attenuation above 0.34 times the
+// input sample rate, while keeping the pass band flat up to 0.16 times the
+// input sample rate.
+HalfBandFilter DesignHalfBandFilter() {
+  constexpr double kWindowLength = 2 * kHalfBandRadius;
+  std::array<double, (kHalfBandRadius + 1) / 2> side;
+  double sum = 0.5;
+  for (size_t tap_index = 0; tap_index < side.size(); ++tap_index) {
+    const double offset = 2 * tap_index + 1;
+    const double position = (kHalfBandRadius + offset) / kWindowLength;
+    const double window = 0.42 - 0.5 * std::cos(2 * M_PI * position) +
+                          0.08 * std::cos(4 * M_PI * position);
+    side[tap_index] = window * std::sin(M_PI * offset / 2) / (M_PI * offset);
+    sum += 2 * side[tap_index];
+  }
+  HalfBandFilter result = {.center = static_cast<float>(0.5 / sum)};
+  for (size_t tap_index = 0; tap_index < side.size(); ++tap_index) {
+    result.side[tap_index] = static_cast<float>(side[tap_index] / sum);
+  }
+  return result;
+}
+
+// Returns input low pass filtered and decimated by 2, with output sample i
+// centered on input sample 2 * i. The input is treated as zero outside its
+// bounds.
+std::vector<float> Halve(const std::vector<float>& input) {
+  static const HalfBandFilter filter = DesignHalfBandFilter();
+  const size_t input_size = input.size();
+  std::vector<float> output((input_size + 1) / 2);
+  for (size_t output_index = 0; output_index < output.size();
+       ++output_index) {
+    const size_t input_index = 2 * output_index;
+    float value = filter.center * input[input_index];
+    for (size_t tap_index = 0; tap_index < filter.side.size(); ++tap_index) {
+      const size_t offset = 2 * tap_index + 1;
+      const float before =
+          input_index >= offset ? input[input_index - offset] : 0.0f;
+      const float after = input_index + offset < input_size
+                              ? input[input_index + offset]
+                              : 0.0f;
+      value += filter.side[tap_index] * (before + after);
+    }
+    output[output_index] = value;
+  }
+  return output;
+}
+
+}  // namespace
+
+DecimatedFilterbank::DecimatedFilterbank(const CamFilterbank& cam_filterbank,
+                                         size_t max_decimation)
+    : size_(cam_filterbank.filter.Size()), max_decimation_(max_decimation) {
+  CHECK_GT(max_decimation, 0);
+  CHECK_EQ(max_decimation, absl::bit_ceil(max_decimation));
+  const float sample_rate = cam_filterbank.sample_rate;
+  size_t filter_index = 0;
+  while (filter_index < size_) {
+    // Since the channels are ordered by frequency, the decimation of each
+    // channel is at most that of the previous one.
+    size_t decimation = max_decimation;
+    while (decimation > 1 &&
+           cam_filterbank.thresholds_hz[{2}][filter_index] >
+               sample_rate / (4 * decimation)) {
+      decimation /= 2;
+    }
+    std::vector<std::vector<BACoeffs>> coeffs;
+    const size_t first_filter = filter_index;
+    for (; filter_index < size_ &&
+           (decimation == 1 ||
+            cam_filterbank.thresholds_hz[{2}][filter_index] <=
+                sample_rate / (4 * decimation));
+         ++filter_index) {
+      coeffs.push_back(DigitalSOSBandPass(
+          cam_filterbank.filter_order, cam_filterbank.filter_pass_band_ripple,
+          cam_filterbank.filter_stop_band_ripple,
+          cam_filterbank.thresholds_hz[{0}][filter_index],
+          cam_filterbank.thresholds_hz[{2}][filter_index],
+          sample_rate / decimation));
+    }
+    groups_.push_back({.decimation = decimation,
+                       .first_filter = first_filter,
+                       .filter = Filterbank(coeffs)});
+  }
+}
+
+size_t DecimatedFilterbank::Decimation(size_t filter_index) const {
+  CHECK_LT(filter_index, size_);
+  for (size_t group_index = groups_.size() - 1; group_index > 0;
+       --group_index) {
+    if (groups_[group_index].first_filter <= filter_index) {
+      return groups_[group_index].decimation;
+    }
+  }
+  return groups_[0].decimation;
+}
+
+void DecimatedFilterbank::FilterEnergy(
+    hwy::Span<const float> input,
+    hwy::AlignedNDArray<float, 2>& energy_channels) const {
+  const size_t num_rows = energy_channels.shape()[0];
+  CHECK_GT(num_rows, 0);
+  CHECK_EQ(energy_channels.shape()[1], size_);
+  const size_t downscaling = input.size() / num_rows;
+  CHECK_GE(downscaling, groups_.front().decimation);
+  hwy::ZeroBytes(energy_channels.data(),
+                 energy_channels.memory_size() * sizeof(float));
+
+  // decimated[i] is the input decimated by 2^i.
+  std::vector<std::vector<float>> decimated = {
+      std::vector<float>(input.data(), input.data() + input.size())};
+  for (const Group& group : groups_) {
+    while ((size_t{1} << (decimated.size() - 1)) < group.decimation) {
+      decimated.push_back(Halve(decimated.back()));
+    }
+    const std::vector<float>& signal =
+        decimated[absl::bit_width(group.decimation) - 1];
+    const size_t group_size = group.filter.Size();
+    FilterbankState state = group.filter.NewState();
+    hwy::AlignedNDArray<float, 2> row({1, group_size});
+    // Row row_index covers the same input samples as in FilterEnergy of the
+    // full rate filterbank, [row_index * downscaling, (row_index + 1) *
+    // downscaling), which are the decimated samples centered on them.
+    for (size_t row_index = 0; row_index < num_rows; ++row_index) {
+      const size_t begin = row_index * downscaling / group.decimation;
+      const size_t end = (row_index + 1) * downscaling / group.decimation;
+      group.filter.FilterEnergy(
+          hwy::Span<const float>(signal.data() + begin, end - begin), state,
+          row);
+      std::memcpy(energy_channels[{row_index}].data() + group.first_filter,
+                  row[{0}].data(), group_size * sizeof(float));
+    }
+  }
+}
+
+}  // namespace zimtohrli
@@ -0,0 +1,88 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CPP_ZIMT_DECIMATED_FILTERBANK_H_
+#define CPP_ZIMT_DECIMATED_FILTERBANK_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "hwy/aligned_allocator.h"
+#include "zimt/cam.h"
+#include "zimt/filterbank.h"
+
+namespace zimtohrli {
+
+// A multirate version of the filterbank of a CamFilterbank, where channels
+// with narrow low frequency bands process a decimated copy of the signal.
+//
+// The channels are grouped by the largest power of two decimation whose
+// Nyquist frequency is at least twice the high threshold of the channel, and
+// the filters of each group are redesigned for the decimated sample rate. The
+// signal is decimated by repeated halving with a zero phase half band FIR
+// filter, so the decimated copies stay aligned in time with the input.
+//
+// With the dense low frequency channels of the default Cam, most channels run
+// at a fraction of the input sample rate.
+//
+// The energy is an approximation of that of the full rate filterbank: the
+// filters designed for the lower rates fall off slightly differently close to
+// the decimated Nyquist frequencies, and content beyond them is filtered out
+// before it reaches the channel filters.
+class DecimatedFilterbank {
+ public:
+  // Creates a multirate version of the filterbank of cam_filterbank, where no
+  // channel is decimated by more than max_decimation.
+  //
+  // max_decimation must be a power of two, and 1 gives a filterbank identical
+  // to the full rate one.
+  DecimatedFilterbank(const CamFilterbank& cam_filterbank,
+                      size_t max_decimation);
+
+  // Populates energy_channels like Filterbank::FilterEnergy for the whole
+  // input, with filter states starting from zero.
+  //
+  // energy_channels is a (num_downscaled_samples, num_channels)-shaped array.
+  // The number of input samples per downscaled sample must be at least the
+  // largest decimation used by any channel.
+  void FilterEnergy(hwy::Span<const float> input,
+                    hwy::AlignedNDArray<float, 2>& energy_channels) const;
+
+  // Returns the number of filters in the bank.
+  size_t Size() const { return size_; }
+
+  // Returns the max_decimation this filterbank was created with.
+  size_t MaxDecimation() const { return max_decimation_; }
+
+  // Returns the decimation of the input processed by filter_index.
+  size_t Decimation(size_t filter_index) const;
+
+ private:
+  // A run of consecutive channels processing the same decimation of the
+  // input.
+  struct Group {
+    size_t decimation;
+    size_t first_filter;
+    Filterbank filter;
+  };
+
+  size_t size_;
+  size_t max_decimation_;
+  // Ordered by first_filter, i.e. by decreasing decimation.
+  std::vector<Group> groups_;
+};
+
+}  // namespace zimtohrli
+
+#endif  // CPP_ZIMT_DECIMATED_FILTERBANK_H_
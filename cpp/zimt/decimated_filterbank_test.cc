@@ -0,0 +1,168 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zimt/decimated_filterbank.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+
+#include "benchmark/benchmark.h"
+#include "gtest/gtest.h"
+#include "hwy/aligned_allocator.h"
+#include "zimt/cam.h"
+#include "zimt/filterbank.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+namespace {
+
+constexpr float kSampleRate = 48000;
+
+TEST(DecimatedFilterbank, DecimationTest) {
+  const CamFilterbank cam_filterbank = Cam{}.CreateFilterbank(kSampleRate);
+  const DecimatedFilterbank filterbank(cam_filterbank, 16);
+  ASSERT_EQ(filterbank.Size(), cam_filterbank.filter.Size());
+  EXPECT_EQ(filterbank.Decimation(0), size_t{16});
+  EXPECT_EQ(filterbank.Decimation(filterbank.Size() - 1), size_t{1});
+  size_t num_decimated = 0;
+  for (size_t filter_index = 0; filter_index < filterbank.Size();
+       ++filter_index) {
+    const size_t decimation = filterbank.Decimation(filter_index);
+    EXPECT_LE(cam_filterbank.thresholds_hz[{2}][filter_index],
+              kSampleRate / (4 * decimation));
+    if (filter_index > 0) {
+      EXPECT_LE(decimation, filterbank.Decimation(filter_index - 1));
+    }
+    if (decimation > 1) {
+      ++num_decimated;
+    }
+  }
+  // Most of the dense low frequency channels run at a lower rate.
+  EXPECT_GT(num_decimated * 2, filterbank.Size());
+
+  const DecimatedFilterbank full_rate(cam_filterbank, 1);
+  for (size_t filter_index = 0; filter_index < full_rate.Size();
+       ++filter_index) {
+    EXPECT_EQ(full_rate.Decimation(filter_index), size_t{1});
+  }
+}
+
+TEST(DecimatedFilterbank, FilterEnergyTest) {
+  const CamFilterbank cam_filterbank = Cam{}.CreateFilterbank(kSampleRate);
+  const DecimatedFilterbank filterbank(cam_filterbank, 16);
+  const size_t num_samples = static_cast<size_t>(kSampleRate / 2);
+  const size_t num_energy_samples = 50;
+
+  for (const float hz : {100.0f, 1000.0f, 5000.0f}) {
+    hwy::AlignedNDArray<float, 1> signal({num_samples});
+    for (size_t index = 0; index < num_samples; ++index) {
+      signal[{}][index] = 0.5 * std::sin(2 * M_PI * hz * index / kSampleRate);
+    }
+    hwy::AlignedNDArray<float, 2> want(
+        {num_energy_samples, filterbank.Size()});
+    FilterbankState state = cam_filterbank.filter.NewState();
+    cam_filterbank.filter.FilterEnergy(signal[{}], state, want);
+    hwy::AlignedNDArray<float, 2> got({num_energy_samples, filterbank.Size()});
+    filterbank.FilterEnergy(signal[{}], got);
+
+    // Skip the onset, where the filters of different rates ring differently,
+    // and compare the channels within 20 dB of the loudest one.
+    for (size_t sample_index = 5; sample_index < num_energy_samples;
+         ++sample_index) {
+      float max_energy = 0;
+      for (size_t filter_index = 0; filter_index < filterbank.Size();
+           ++filter_index) {
+        max_energy = std::max(max_energy, want[{sample_index}][filter_index]);
+      }
+      for (size_t filter_index = 0; filter_index < filterbank.Size();
+           ++filter_index) {
+        const float want_energy = want[{sample_index}][filter_index];
+        if (want_energy < max_energy * 0.01) {
+          continue;
+        }
+        EXPECT_NEAR(10 * std::log10(got[{sample_index}][filter_index]),
+                    10 * std::log10(want_energy), 0.35)
+            << "hz=" << hz << ", sample_index=" << sample_index
+            << ", filter_index=" << filter_index;
+      }
+    }
+  }
+}
+
+TEST(DecimatedFilterbank, ZimtohrliTest) {
+  Zimtohrli z{.cam_filterbank = Cam{}.CreateFilterbank(kSampleRate)};
+  Zimtohrli decimated_z =
+      z.WithFilterbank(Cam{}.CreateFilterbank(kSampleRate));
+  decimated_z.decimated_filterbank =
+      std::make_shared<const DecimatedFilterbank>(*z.cam_filterbank, 16);
+
+  const size_t num_samples = static_cast<size_t>(kSampleRate / 2);
+  hwy::AlignedNDArray<float, 1> signal_a({num_samples});
+  hwy::AlignedNDArray<float, 1> signal_b({num_samples});
+  hwy::AlignedNDArray<float, 1> signal_c({num_samples});
+  for (size_t index = 0; index < num_samples; ++index) {
+    signal_a[{}][index] = 0.5 * std::sin(2 * M_PI * 440 * index / kSampleRate);
+    const float distortion = std::sin(2 * M_PI * 3000 * index / kSampleRate);
+    signal_b[{}][index] = signal_a[{}][index] + 0.02 * distortion;
+    signal_c[{}][index] = signal_a[{}][index] + 0.2 * distortion;
+  }
+  const Analysis analysis_a = decimated_z.Analyze(signal_a[{}]);
+  const Analysis analysis_b = decimated_z.Analyze(signal_b[{}]);
+  const Analysis analysis_c = decimated_z.Analyze(signal_c[{}]);
+  EXPECT_NEAR(decimated_z
+                  .Distance(false, analysis_a.spectrogram,
+                            decimated_z.Analyze(signal_a[{}]).spectrogram)
+                  .value,
+              0, 1e-6);
+  // The decimated filterbank ranks distortions like the full rate one.
+  const float distance_b =
+      decimated_z
+          .Distance(false, analysis_a.spectrogram, analysis_b.spectrogram)
+          .value;
+  const float distance_c =
+      decimated_z
+          .Distance(false, analysis_a.spectrogram, analysis_c.spectrogram)
+          .value;
+  EXPECT_GT(distance_b, 0);
+  EXPECT_LT(distance_b, distance_c);
+  EXPECT_LT(z.Distance(false, z.Analyze(signal_a[{}]).spectrogram,
+                       z.Analyze(signal_b[{}]).spectrogram)
+                .value,
+            z.Distance(false, z.Analyze(signal_a[{}]).spectrogram,
+                       z.Analyze(signal_c[{}]).spectrogram)
+                .value);
+}
+
+void BM_DecimatedFilterEnergy(benchmark::State& state) {
+  const CamFilterbank cam_filterbank = Cam{}.CreateFilterbank(kSampleRate);
+  const DecimatedFilterbank filterbank(cam_filterbank, state.range(0));
+
+  hwy::AlignedNDArray<float, 1> in_signal({size_t(kSampleRate)});
+  in_signal[{}][0] = 1;
+  hwy::AlignedNDArray<float, 2> energy_channels({100, filterbank.Size()});
+
+  for (auto s : state) {
+    filterbank.FilterEnergy(in_signal[{}], energy_channels);
+  }
+  state.SetItemsProcessed(in_signal.size() * filterbank.Size() *
+                          state.iterations());
+}
+BENCHMARK_RANGE(BM_DecimatedFilterEnergy, 1, 32);
+
+}  // namespace
+
+}  // namespace zimtohrli
@@ -18,7 +18,6 @@
 #include <array>
 #include <cmath>
 #include <cstddef>
-#include <iterator>
 #include <limits>
 #include <utility>
 #include <vector>
@@ -105,57 +104,116 @@ struct ArraySlice {
   }
 };
 
-std::vector<std::pair<size_t, size_t>> DTWSlice(
-    const ArraySlice& spec_a, const ArraySlice& spec_b,
-    hwy::AlignedNDArray<float, 2>& cost_matrix) {
-  CHECK_EQ(cost_matrix.shape()[0], spec_a.shape()[0]);
-  CHECK_EQ(cost_matrix.shape()[1], spec_b.shape()[0]);
-  for (size_t spec_b_index = 0; spec_b_index < spec_b.shape()[0];
-       ++spec_b_index) {
-    cost_matrix[{0}][spec_b_index] = std::numeric_limits<float>::infinity();
-  }
-  for (size_t spec_a_index = 1; spec_a_index < spec_a.shape()[0];
-       ++spec_a_index) {
-    for (size_t spec_b_index = 0; spec_b_index < spec_b.shape()[0];
-         ++spec_b_index) {
-      cost_matrix[{spec_a_index}][spec_b_index] =
-          std::numeric_limits<float>::infinity();
+// Populates band with the steps of spec_b within warp_radius steps of the
+// diagonal for each of num_a steps of spec_a.
+void SakoeChibaBand(size_t num_a, size_t num_b, size_t warp_radius,
+                    std::vector<std::pair<size_t, size_t>>& band) {
+  band.resize(num_a);
+  for (size_t spec_a_index = 0; spec_a_index < num_a; ++spec_a_index) {
+    band[spec_a_index] = {
+        spec_a_index > warp_radius ? spec_a_index - warp_radius : 0,
+        std::min(num_b, spec_a_index + warp_radius + 1)};
+  }
+}
+
+// Populates workspace.path with the DTW between spec_a and spec_b, only
+// considering the cells (a, b) where b is within workspace.band[a].
+//
+// As in the full DTW, the first step of each array is only matched with the
+// first step of the other.
+void BandDTW(const ArraySlice& spec_a, const ArraySlice& spec_b,
+             DTWWorkspace& workspace) {
+  const size_t num_a = spec_a.shape()[0];
+  const size_t num_b = spec_b.shape()[0];
+  std::vector<std::pair<size_t, size_t>>& band = workspace.band;
+  CHECK_EQ(band.size(), num_a);
+  band[0] = {0, 1};
+  size_t band_width = 0;
+  for (const auto& [begin_b_index, end_b_index] : band) {
+    if (begin_b_index < end_b_index) {
+      band_width = std::max(band_width, end_b_index - begin_b_index);
     }
   }
-  cost_matrix[{0}][0] = 0;
-  for (size_t spec_a_index = 1; spec_a_index < spec_a.shape()[0];
-       ++spec_a_index) {
-    for (size_t spec_b_index = 1; spec_b_index < spec_b.shape()[0];
+  std::vector<float>& cost_band = workspace.cost_band;
+  cost_band.assign(num_a * band_width, std::numeric_limits<float>::infinity());
+  // Cell (a, b) is at cost_band[a * band_width + b - band[a].first].
+  const auto cost = [&](size_t a, size_t b) {
+    if (b < band[a].first || b >= band[a].second) {
+      return std::numeric_limits<float>::infinity();
+    }
+    return cost_band[a * band_width + b - band[a].first];
+  };
+  cost_band[0] = 0;
+  for (size_t spec_a_index = 1; spec_a_index < num_a; ++spec_a_index) {
+    const size_t end_b_index = std::min(num_b, band[spec_a_index].second);
+    float* cost_row = cost_band.data() + spec_a_index * band_width;
+    const size_t begin_b_index =
+        std::max<size_t>(1, band[spec_a_index].first);
+    if (begin_b_index < end_b_index) {
+      workspace.num_cells += end_b_index - begin_b_index;
+    }
+    for (size_t spec_b_index = begin_b_index; spec_b_index < end_b_index;
          ++spec_b_index) {
-      const float cost = HWY_DYNAMIC_DISPATCH(HwyDeltaNorm)(
+      const float delta_norm = HWY_DYNAMIC_DISPATCH(HwyDeltaNorm)(
           spec_a[{spec_a_index}], spec_b[{spec_b_index}]);
-      cost_matrix[{spec_a_index}][spec_b_index] =
-          cost +
-          std::min(cost_matrix[{spec_a_index - 1}][spec_b_index - 1],
-                   std::min(cost_matrix[{spec_a_index - 1}][spec_b_index],
-                            cost_matrix[{spec_a_index}][spec_b_index - 1]));
+      cost_row[spec_b_index - band[spec_a_index].first] =
+          delta_norm +
+          std::min(cost(spec_a_index - 1, spec_b_index - 1),
+                   std::min(cost(spec_a_index - 1, spec_b_index),
+                            cost(spec_a_index, spec_b_index - 1)));
     }
   }
 
-  std::vector<std::pair<size_t, size_t>> result;
+  std::vector<std::pair<size_t, size_t>>& path = workspace.path;
+  path.clear();
   std::pair<size_t, size_t> pos = {0, 0};
-  result.push_back(pos);
-  while (pos.first + 1 < cost_matrix.shape()[0] &&
-         pos.second + 1 < cost_matrix.shape()[1]) {
-    std::vector<std::pair<size_t, size_t>> possible_next_positions = {
-        {pos.first + 1, pos.second + 1},
-        {pos.first + 1, pos.second},
-        {pos.first, pos.second + 1}};
-    std::vector<float> direction_costs(possible_next_positions.size());
-    std::transform(
-        possible_next_positions.begin(), possible_next_positions.end(),
-        direction_costs.begin(),
-        [&](const auto& pos) { return cost_matrix[{pos.first}][pos.second]; });
-    int min_cost_direction = std::distance(
-        direction_costs.begin(),
-        std::min_element(direction_costs.begin(), direction_costs.end()));
-    pos = possible_next_positions[min_cost_direction];
-    result.push_back(pos);
+  path.push_back(pos);
+  while (pos.first + 1 < num_a && pos.second + 1 < num_b) {
+    // Ties are resolved in the order diagonal, step in A, step in B.
+    std::pair<size_t, size_t> next = {pos.first + 1, pos.second + 1};
+    float next_cost = cost(next.first, next.second);
+    if (const float a_cost = cost(pos.first + 1, pos.second);
+        a_cost < next_cost) {
+      next = {pos.first + 1, pos.second};
+      next_cost = a_cost;
+    }
+    if (const float b_cost = cost(pos.first, pos.second + 1);
+        b_cost < next_cost) {
+      next = {pos.first, pos.second + 1};
+    }
+    pos = next;
+    path.push_back(pos);
+  }
+}
+
+// Populates workspace.path with the DTW between spec_a and spec_b, only
+// considering the cells within warp_radius steps of the diagonal.
+void DTWSlice(const ArraySlice& spec_a, const ArraySlice& spec_b,
+              size_t warp_radius, DTWWorkspace& workspace) {
+  SakoeChibaBand(spec_a.shape()[0], spec_b.shape()[0], warp_radius,
+                 workspace.band);
+  BandDTW(spec_a, spec_b, workspace);
+}
+
+// Returns spec with each pair of consecutive steps replaced by their mean, and
+// a last unpaired step kept as is.
+hwy::AlignedNDArray<float, 2> DecimateSteps(
+    const hwy::AlignedNDArray<float, 2>& spec) {
+  const size_t num_steps = spec.shape()[0];
+  hwy::AlignedNDArray<float, 2> result({(num_steps + 1) / 2, spec.shape()[1]});
+  // The padding is included, so that it stays as it is in spec.
+  const size_t row_size = spec.memory_shape()[1];
+  for (size_t step_index = 0; step_index < result.shape()[0]; ++step_index) {
+    const float* first = spec[{2 * step_index}].data();
+    float* decimated = result[{step_index}].data();
+    if (2 * step_index + 1 < num_steps) {
+      const float* second = spec[{2 * step_index + 1}].data();
+      for (size_t index = 0; index < row_size; ++index) {
+        decimated[index] = 0.5f * (first[index] + second[index]);
+      }
+    } else {
+      hwy::CopyBytes(first, decimated, row_size * sizeof(float));
+    }
   }
   return result;
 }
@@ -165,54 +223,184 @@ std::vector<std::pair<size_t, size_t>> DTWSlice(
 std::vector<std::pair<size_t, size_t>> DTW(
     const hwy::AlignedNDArray<float, 2>& spec_a,
     const hwy::AlignedNDArray<float, 2>& spec_b) {
-  hwy::AlignedNDArray<float, 2> cost_matrix(
-      {spec_a.shape()[0], spec_b.shape()[0]});
-  return DTWSlice({spec_a, 0, spec_b.shape()[0]},
-                  {spec_b, 0, spec_a.shape()[0]}, cost_matrix);
+  DTWWorkspace workspace;
+  DTWSlice({spec_a, 0, spec_a.shape()[0]}, {spec_b, 0, spec_b.shape()[0]},
+           std::max(spec_a.shape()[0], spec_b.shape()[0]), workspace);
+  return std::move(workspace.path);
 }
 
 std::vector<std::pair<size_t, size_t>> ChainDTW(
     const hwy::AlignedNDArray<float, 2>& spec_a,
     const hwy::AlignedNDArray<float, 2>& spec_b, size_t window_size) {
-  std::pair<size_t, size_t> offset = {0, 0};
-  std::vector<std::pair<size_t, size_t>> result = {offset};
-  hwy::AlignedNDArray<float, 2> cost_matrix(
-      {std::min(window_size, spec_a.shape()[0]),
-       std::min(window_size, spec_b.shape()[0])});
-  // Do DTW on one window at a time, moving our offset forward to the end of
-  // each computed DTW.
-  while (offset.first + 1 < spec_a.shape()[0] &&
-         offset.second + 1 < spec_b.shape()[0]) {
-    const ArraySlice slice_a = {
-        spec_a, offset.first,
-        std::min(window_size, spec_a.shape()[0] - offset.first)};
-    const ArraySlice slice_b = {
-        spec_b, offset.second,
-        std::min(window_size, spec_b.shape()[0] - offset.second)};
-    if (cost_matrix.shape()[0] != slice_a.shape()[0] ||
-        cost_matrix.shape()[1] != slice_b.shape()[0]) {
-      cost_matrix = hwy::AlignedNDArray<float, 2>(
-          {slice_a.shape()[0], slice_b.shape()[0]});
+  DTWWorkspace workspace;
+  return ChainDTW(spec_a, spec_b, window_size, window_size, workspace);
+}
+
+std::vector<std::pair<size_t, size_t>> ChainDTW(
+    const hwy::AlignedNDArray<float, 2>& spec_a,
+    const hwy::AlignedNDArray<float, 2>& spec_b, size_t window_size,
+    size_t warp_radius, DTWWorkspace& workspace) {
+  std::vector<std::pair<size_t, size_t>> result;
+  ChainDTW(spec_a, spec_b, window_size, warp_radius, workspace, result);
+  return result;
+}
+
+ChainDTWIterator::ChainDTWIterator(const hwy::AlignedNDArray<float, 2>& spec_a,
+                                   const hwy::AlignedNDArray<float, 2>& spec_b,
+                                   size_t window_size, size_t warp_radius,
+                                   DTWWorkspace& workspace)
+    : spec_a_(spec_a),
+      spec_b_(spec_b),
+      window_size_(window_size),
+      warp_radius_(warp_radius),
+      workspace_(workspace) {
+  CHECK_GT(warp_radius, 0);
+}
+
+ChainDTWIterator::ChainDTWIterator(
+    const hwy::AlignedNDArray<float, 2>& spec_a,
+    const hwy::AlignedNDArray<float, 2>& spec_b, size_t window_size,
+    size_t warp_radius, const std::vector<std::pair<size_t, size_t>>& corridor,
+    DTWWorkspace& workspace)
+    : ChainDTWIterator(spec_a, spec_b, window_size, warp_radius, workspace) {
+  CHECK_EQ(corridor.size(), spec_a.shape()[0]);
+  corridor_ = &corridor;
+}
+
+bool ChainDTWIterator::Done() const {
+  return offset_.first + 1 >= spec_a_.shape()[0] ||
+         offset_.second + 1 >= spec_b_.shape()[0];
+}
+
+void ChainDTWIterator::Next(std::vector<std::pair<size_t, size_t>>& result) {
+  const ArraySlice slice_a = {
+      spec_a_, offset_.first,
+      std::min(window_size_, spec_a_.shape()[0] - offset_.first)};
+  const ArraySlice slice_b = {
+      spec_b_, offset_.second,
+      std::min(window_size_, spec_b_.shape()[0] - offset_.second)};
+  SakoeChibaBand(slice_a.size, slice_b.size, warp_radius_, workspace_.band);
+  if (corridor_ != nullptr) {
+    // Intersect the band with the corridor, in the coordinates of the window.
+    for (size_t spec_a_index = 0; spec_a_index < slice_a.size;
+         ++spec_a_index) {
+      auto& [begin_b_index, end_b_index] = workspace_.band[spec_a_index];
+      const auto& [corridor_begin, corridor_end] =
+          (*corridor_)[spec_a_index + offset_.first];
+      const size_t begin =
+          std::max(begin_b_index + offset_.second, corridor_begin);
+      const size_t end = std::min(end_b_index + offset_.second, corridor_end);
+      begin_b_index = begin - offset_.second;
+      end_b_index = std::max(begin, end) - offset_.second;
     }
-    std::vector<std::pair<size_t, size_t>> dtw =
-        DTWSlice(slice_a, slice_b, cost_matrix);
-    // If we have more than one entire window before reaching the end, then
-    // throw away the forward half of the DTW to allow a wider search outside
-    // what the last search ended at.
-    if (spec_a.shape()[0] - dtw.back().first - offset.first > window_size &&
-        spec_b.shape()[0] - dtw.back().second - offset.second > window_size) {
-      dtw = std::vector<std::pair<size_t, size_t>>(
-          dtw.begin(), dtw.begin() + dtw.size() / 2);
+  }
+  BandDTW(slice_a, slice_b, workspace_);
+  std::vector<std::pair<size_t, size_t>>& dtw = workspace_.path;
+  // If we have more than one entire window before reaching the end, then
+  // throw away the forward half of the DTW to allow a wider search outside
+  // what the last search ended at.
+  if (spec_a_.shape()[0] - dtw.back().first - offset_.first > window_size_ &&
+      spec_b_.shape()[0] - dtw.back().second - offset_.second > window_size_) {
+    dtw.resize(dtw.size() / 2);
+  }
+  // Don't add the start point of the window, it's the end point of the
+  // previous one.
+  const std::pair<size_t, size_t> offset = offset_;
+  for (size_t dtw_index = 1; dtw_index < dtw.size(); ++dtw_index) {
+    offset_ = {dtw[dtw_index].first + offset.first,
+               dtw[dtw_index].second + offset.second};
+    result.push_back(offset_);
+  }
+}
+
+void ChainDTW(const hwy::AlignedNDArray<float, 2>& spec_a,
+              const hwy::AlignedNDArray<float, 2>& spec_b, size_t window_size,
+              size_t warp_radius, DTWWorkspace& workspace,
+              std::vector<std::pair<size_t, size_t>>& result) {
+  ChainDTWIterator iterator(spec_a, spec_b, window_size, warp_radius,
+                            workspace);
+  result.clear();
+  result.push_back({0, 0});
+  // Do DTW on one window at a time, moving the offset forward to the end of
+  // each computed DTW.
+  while (!iterator.Done()) {
+    iterator.Next(result);
+  }
+}
+
+void CoarseToFineCorridor(const hwy::AlignedNDArray<float, 2>& spec_a,
+                          const hwy::AlignedNDArray<float, 2>& spec_b,
+                          size_t window_size, size_t warp_radius,
+                          size_t corridor_radius, DTWWorkspace& workspace) {
+  CHECK_GT(corridor_radius, 0);
+  const size_t num_a = spec_a.shape()[0];
+  const size_t num_b = spec_b.shape()[0];
+  std::vector<std::pair<size_t, size_t>>& corridor = workspace.corridor;
+  // The corridor is at least 2 * corridor_radius + 2 steps wide, so there is
+  // little to gain from decimating windows that are not several times wider.
+  if (std::min(window_size, std::max(num_a, num_b)) <=
+      8 * (corridor_radius + 1)) {
+    corridor.assign(num_a, {0, num_b});
+    return;
+  }
+  std::vector<std::pair<size_t, size_t>> coarse_path;
+  CoarseToFineChainDTW(DecimateSteps(spec_a), DecimateSteps(spec_b),
+                       (window_size + 1) / 2, (warp_radius + 1) / 2,
+                       corridor_radius, workspace, coarse_path);
+
+  // The range of steps of spec_b covered by the projection of coarse_path to
+  // each step of spec_a.
+  std::vector<std::pair<size_t, size_t>> projection(num_a, {num_b, 0});
+  for (const auto& [coarse_a_index, coarse_b_index] : coarse_path) {
+    for (size_t spec_a_index = 2 * coarse_a_index;
+         spec_a_index < std::min(num_a, 2 * coarse_a_index + 2);
+         ++spec_a_index) {
+      auto& [begin_b_index, end_b_index] = projection[spec_a_index];
+      begin_b_index = std::min(begin_b_index, 2 * coarse_b_index);
+      end_b_index =
+          std::max(end_b_index, std::min(num_b, 2 * coarse_b_index + 2));
     }
-    // Don't add the start point for the last window, it's already in the
-    // result.
-    for (size_t dtw_index = 1; dtw_index < dtw.size(); ++dtw_index) {
-      result.push_back({dtw[dtw_index].first + offset.first,
-                        dtw[dtw_index].second + offset.second});
+  }
+  // The path stops at the last step of either array, so the remaining steps
+  // of spec_a can be matched with any later step of spec_b.
+  for (size_t spec_a_index = 1; spec_a_index < num_a; ++spec_a_index) {
+    if (projection[spec_a_index].first >= projection[spec_a_index].second) {
+      projection[spec_a_index] = {projection[spec_a_index - 1].first, num_b};
     }
-    offset = result.back();
   }
-  return result;
+
+  // Both ends of the ranges grow monotonically with the steps of spec_a, so
+  // widening the projection by corridor_radius steps along both axes only
+  // needs the ranges corridor_radius steps away.
+  corridor.resize(num_a);
+  for (size_t spec_a_index = 0; spec_a_index < num_a; ++spec_a_index) {
+    const size_t first_b_index =
+        projection[spec_a_index > corridor_radius
+                       ? spec_a_index - corridor_radius
+                       : 0]
+            .first;
+    const size_t last_b_index =
+        projection[std::min(num_a - 1, spec_a_index + corridor_radius)].second;
+    corridor[spec_a_index] = {
+        first_b_index > corridor_radius ? first_b_index - corridor_radius : 0,
+        std::min(num_b, last_b_index + corridor_radius)};
+  }
+}
+
+void CoarseToFineChainDTW(const hwy::AlignedNDArray<float, 2>& spec_a,
+                          const hwy::AlignedNDArray<float, 2>& spec_b,
+                          size_t window_size, size_t warp_radius,
+                          size_t corridor_radius, DTWWorkspace& workspace,
+                          std::vector<std::pair<size_t, size_t>>& result) {
+  CoarseToFineCorridor(spec_a, spec_b, window_size, warp_radius,
+                       corridor_radius, workspace);
+  ChainDTWIterator iterator(spec_a, spec_b, window_size, warp_radius,
+                            workspace.corridor, workspace);
+  result.clear();
+  result.push_back({0, 0});
+  while (!iterator.Done()) {
+    iterator.Next(result);
+  }
 }
 
 }  // namespace zimtohrli
@@ -23,6 +23,25 @@
 
 namespace zimtohrli {
 
+// Scratch memory for the DTW functions, reused between windows and calls to
+// avoid allocating for each of them.
+struct DTWWorkspace {
+  // The accumulated costs of the cells inside the band of the current window,
+  // one row of as many cells as the widest range in band per step of spec_a.
+  std::vector<float> cost_band;
+  // The range [first, second) of steps of spec_b inside the band of each step
+  // of spec_a of the current window.
+  std::vector<std::pair<size_t, size_t>> band;
+  // The range [first, second) of steps of spec_b each step of spec_a can be
+  // matched with, as populated by CoarseToFineCorridor.
+  std::vector<std::pair<size_t, size_t>> corridor;
+  // The path through the current window.
+  std::vector<std::pair<size_t, size_t>> path;
+  // The number of cost matrix cells evaluated since this was last set to
+  // zero.
+  size_t num_cells = 0;
+};
+
 // Computes the DTW (https://en.wikipedia.org/wiki/Dynamic_time_warping)
 // between two arrays.
 //
@@ -40,6 +59,104 @@ std::vector<std::pair<size_t, size_t>> ChainDTW(
     const hwy::AlignedNDArray<float, 2>& spec_a,
     const hwy::AlignedNDArray<float, 2>& spec_b, size_t window_size);
 
+// Like ChainDTW above, but only computes the cells within warp_radius steps of
+// the diagonal of each window (a Sakoe-Chiba band), and uses the provided
+// workspace for all intermediate storage.
+//
+// A warp_radius of at least window_size computes the same DTW as ChainDTW
+// above.
+std::vector<std::pair<size_t, size_t>> ChainDTW(
+    const hwy::AlignedNDArray<float, 2>& spec_a,
+    const hwy::AlignedNDArray<float, 2>& spec_b, size_t window_size,
+    size_t warp_radius, DTWWorkspace& workspace);
+
+// Like ChainDTW above, but populates result instead of returning a new
+// vector, so that its capacity can be reused.
+void ChainDTW(const hwy::AlignedNDArray<float, 2>& spec_a,
+              const hwy::AlignedNDArray<float, 2>& spec_b, size_t window_size,
+              size_t warp_radius, DTWWorkspace& workspace,
+              std::vector<std::pair<size_t, size_t>>& result);
+
+// Populates workspace.corridor with the steps of spec_b within
+// corridor_radius steps of the ChainDTW between spec_a and spec_b decimated 2x
+// in time, projected back to the steps of spec_a.
+//
+// The ChainDTW of the decimated arrays is computed by CoarseToFineChainDTW with
+// window_size and warp_radius halved, so the decimation repeats until the
+// windows are no longer much wider than the corridor. At that point the
+// corridor covers all steps of spec_b instead.
+void CoarseToFineCorridor(const hwy::AlignedNDArray<float, 2>& spec_a,
+                          const hwy::AlignedNDArray<float, 2>& spec_b,
+                          size_t window_size, size_t warp_radius,
+                          size_t corridor_radius, DTWWorkspace& workspace);
+
+// Like ChainDTW above, but only computes the cells of each window within the
+// corridor populated by CoarseToFineCorridor.
+//
+// Each decimation level computes a number of cells proportional to the number
+// of steps times the corridor width, so large windows cost close to linear
+// instead of quadratic time. The result is the same as ChainDTW as long as
+// the path of ChainDTW stays within the corridor, i.e. the decimated
+// spectrograms warp like the originals to within about corridor_radius steps.
+void CoarseToFineChainDTW(const hwy::AlignedNDArray<float, 2>& spec_a,
+                          const hwy::AlignedNDArray<float, 2>& spec_b,
+                          size_t window_size, size_t warp_radius,
+                          size_t corridor_radius, DTWWorkspace& workspace,
+                          std::vector<std::pair<size_t, size_t>>& result);
+
+// Computes the same time pairs as ChainDTW, one window at a time, so that the
+// pairs of the first windows can be used before the later windows are
+// computed.
+//
+// The time pairs of ChainDTW are {0, 0} followed by the pairs appended by all
+// calls to Next until Done returns true.
+//
+// spec_a, spec_b, and workspace must outlive the iterator.
+class ChainDTWIterator {
+ public:
+  ChainDTWIterator(const hwy::AlignedNDArray<float, 2>& spec_a,
+                   const hwy::AlignedNDArray<float, 2>& spec_b,
+                   size_t window_size, size_t warp_radius,
+                   DTWWorkspace& workspace);
+
+  // Like the constructor above, but only computes the cells within corridor,
+  // which has one range of steps of spec_b per step of spec_a, like
+  // DTWWorkspace::corridor, and must outlive the iterator.
+  ChainDTWIterator(const hwy::AlignedNDArray<float, 2>& spec_a,
+                   const hwy::AlignedNDArray<float, 2>& spec_b,
+                   size_t window_size, size_t warp_radius,
+                   const std::vector<std::pair<size_t, size_t>>& corridor,
+                   DTWWorkspace& workspace);
+
+  // Returns whether all windows have been computed.
+  bool Done() const;
+
+  // Computes the next window, and appends its time pairs to result.
+  void Next(std::vector<std::pair<size_t, size_t>>& result);
+
+  // Returns the last time pair computed, where the next window starts.
+  std::pair<size_t, size_t> Offset() const { return offset_; }
+
+  // Makes the next window start at offset, which must be a time pair
+  // previously returned by Offset for the same spec_a.
+  //
+  // Each window only depends on the steps of spec_a and spec_b it covers, so
+  // seeking to the start of a window recomputes the chain from there, e.g.
+  // after steps of spec_b not covered by the earlier windows changed.
+  void Seek(std::pair<size_t, size_t> offset) { offset_ = offset; }
+
+ private:
+  const hwy::AlignedNDArray<float, 2>& spec_a_;
+  const hwy::AlignedNDArray<float, 2>& spec_b_;
+  size_t window_size_;
+  size_t warp_radius_;
+  DTWWorkspace& workspace_;
+  // The corridor the cells are restricted to, if any.
+  const std::vector<std::pair<size_t, size_t>>* corridor_ = nullptr;
+  // The last time pair computed.
+  std::pair<size_t, size_t> offset_ = {0, 0};
+};
+
 }  // namespace zimtohrli
 
 #endif  // CPP_ZIMT_DTW_H_
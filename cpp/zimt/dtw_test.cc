@@ -14,6 +14,8 @@
 
 #include "zimt/dtw.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <utility>
 #include <vector>
@@ -63,6 +65,109 @@ TEST(DTW, ChainDTWTest) {
   EXPECT_EQ(got_dtw, expected_dtw);
 }
 
+TEST(DTW, BandedChainDTWTest) {
+  hwy::AlignedNDArray<float, 2> spec_a({10, 1});
+  hwy::AlignedNDArray<float, 2> spec_b({10, 1});
+
+  const std::vector<float> a_values = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+  const std::vector<float> b_values = {0, 1, 2, 3, 3, 4, 5, 6, 8, 9};
+  for (size_t i = 0; i < 10; ++i) {
+    spec_a[{i}][0] = a_values[i];
+    spec_b[{i}][0] = b_values[i];
+  }
+
+  DTWWorkspace workspace;
+  const std::vector<std::pair<size_t, size_t>> unbanded_dtw =
+      ChainDTW(spec_a, spec_b, 6);
+  EXPECT_EQ(ChainDTW(spec_a, spec_b, 6, 6, workspace), unbanded_dtw);
+  // The unbanded DTW never warps more than 1 step.
+  EXPECT_EQ(ChainDTW(spec_a, spec_b, 6, 1, workspace), unbanded_dtw);
+}
+
+TEST(DTW, BandedChainDTWLimitsWarpTest) {
+  hwy::AlignedNDArray<float, 2> spec_a({20, 1});
+  hwy::AlignedNDArray<float, 2> spec_b({20, 1});
+  for (size_t i = 0; i < 20; ++i) {
+    spec_a[{i}][0] = i;
+    spec_b[{i}][0] = i < 4 ? 0 : i - 4;
+  }
+
+  // spec_b lags spec_a by 4 steps, but a window covering both specs with a
+  // warp radius of 2 limits the warp to 2 steps.
+  DTWWorkspace workspace;
+  const std::vector<std::pair<size_t, size_t>> got_dtw =
+      ChainDTW(spec_a, spec_b, 20, 2, workspace);
+  EXPECT_EQ(got_dtw.front(), (std::pair<size_t, size_t>{0, 0}));
+  EXPECT_EQ(got_dtw.back(), (std::pair<size_t, size_t>{17, 19}));
+  for (const auto& [index_a, index_b] : got_dtw) {
+    EXPECT_LE(std::max(index_a, index_b) - std::min(index_a, index_b),
+              size_t{2});
+  }
+  EXPECT_NE(got_dtw, ChainDTW(spec_a, spec_b, 20));
+}
+
+TEST(DTW, ChainDTWIteratorTest) {
+  hwy::AlignedNDArray<float, 2> spec_a({40, 1});
+  hwy::AlignedNDArray<float, 2> spec_b({36, 1});
+  for (size_t i = 0; i < 40; ++i) {
+    spec_a[{i}][0] = i % 7;
+  }
+  for (size_t i = 0; i < 36; ++i) {
+    spec_b[{i}][0] = (i + 3) % 7;
+  }
+  DTWWorkspace workspace;
+  const std::vector<std::pair<size_t, size_t>> want_dtw =
+      ChainDTW(spec_a, spec_b, 8, 3, workspace);
+
+  ChainDTWIterator iterator(spec_a, spec_b, 8, 3, workspace);
+  std::vector<std::pair<size_t, size_t>> got_dtw = {{0, 0}};
+  size_t num_windows = 0;
+  while (!iterator.Done()) {
+    const size_t size_before = got_dtw.size();
+    iterator.Next(got_dtw);
+    EXPECT_GT(got_dtw.size(), size_before);
+    ++num_windows;
+  }
+  EXPECT_GT(num_windows, size_t{1});
+  EXPECT_EQ(got_dtw, want_dtw);
+}
+
+TEST(DTW, CoarseToFineChainDTWTest) {
+  // A slowly varying spectrogram, and a copy that drifts up to 40 steps
+  // behind it and then catches up again.
+  const size_t num_steps = 1000;
+  const size_t num_channels = 8;
+  const auto value = [](float step, size_t channel_index) {
+    return std::sin(0.02f * step + 0.7f * channel_index) +
+           0.5f * std::sin(0.047f * step * (channel_index + 1));
+  };
+  hwy::AlignedNDArray<float, 2> spec_a({num_steps, num_channels});
+  hwy::AlignedNDArray<float, 2> spec_b({num_steps, num_channels});
+  for (size_t step_index = 0; step_index < num_steps; ++step_index) {
+    const float lag = 20 - 20 * std::cos(0.006f * step_index);
+    for (size_t channel_index = 0; channel_index < num_channels;
+         ++channel_index) {
+      spec_a[{step_index}][channel_index] = value(step_index, channel_index);
+      spec_b[{step_index}][channel_index] =
+          value(std::max(0.0f, step_index - lag), channel_index);
+    }
+  }
+
+  DTWWorkspace workspace;
+  const std::vector<std::pair<size_t, size_t>> want_dtw =
+      ChainDTW(spec_a, spec_b, 400, 100, workspace);
+  const size_t want_cells = workspace.num_cells;
+  workspace.num_cells = 0;
+  std::vector<std::pair<size_t, size_t>> got_dtw;
+  CoarseToFineChainDTW(spec_a, spec_b, 400, 100, 4, workspace, got_dtw);
+  EXPECT_EQ(got_dtw, want_dtw);
+  EXPECT_LT(workspace.num_cells * 4, want_cells);
+
+  // Windows not much wider than the corridor are computed directly.
+  CoarseToFineChainDTW(spec_a, spec_b, 20, 5, 4, workspace, got_dtw);
+  EXPECT_EQ(got_dtw, ChainDTW(spec_a, spec_b, 20, 5, workspace));
+}
+
 void BM_DTW(benchmark::State& state) {
   hwy::AlignedNDArray<float, 2> spec_a(
       {static_cast<size_t>(state.range(0)), 1024});
@@ -101,6 +206,26 @@ void BM_ChainDTW(benchmark::State& state) {
 }
 BENCHMARK_RANGE(BM_ChainDTW, 100, 5000);
 
+void BM_BandedChainDTW(benchmark::State& state) {
+  hwy::AlignedNDArray<float, 2> spec_a(
+      {static_cast<size_t>(state.range(0)), 1024});
+  hwy::AlignedNDArray<float, 2> spec_b(
+      {static_cast<size_t>(state.range(0)), 1024});
+  for (size_t step_index = 0; step_index < spec_a.shape()[0]; ++step_index) {
+    for (size_t channel_index = 0; channel_index < spec_a.shape()[1];
+         ++channel_index) {
+      spec_a[{step_index}][channel_index] = 1.0;
+    }
+  }
+
+  DTWWorkspace workspace;
+  for (auto s : state) {
+    ChainDTW(spec_a, spec_b, 200, 20, workspace);
+  }
+  state.SetItemsProcessed(state.range(0) * state.iterations());
+}
+BENCHMARK_RANGE(BM_BandedChainDTW, 100, 5000);
+
 }  // namespace
 
 }  // namespace zimtohrli
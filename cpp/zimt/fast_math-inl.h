@@ -0,0 +1,106 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Cheap polynomial approximations of log and exp, for callers that only need
+// fractions of a dB of precision.
+//
+// Included once per Highway target, like other Highway -inl.h headers, so it
+// must come after hwy/foreach_target.h and hwy/highway.h.
+
+// Per-target include guard, see hwy/highway.h.
+#if defined(CPP_ZIMT_FAST_MATH_INL_H_) == defined(HWY_TARGET_TOGGLE)
+#ifdef CPP_ZIMT_FAST_MATH_INL_H_
+#undef CPP_ZIMT_FAST_MATH_INL_H_
+#else
+#define CPP_ZIMT_FAST_MATH_INL_H_
+#endif
+
+#include "hwy/contrib/math/math-inl.h"
+#include "hwy/highway.h"
+
+HWY_BEFORE_NAMESPACE();
+namespace zimtohrli {
+namespace HWY_NAMESPACE {
+
+// Returns an approximation of log2(x) for positive, normal, x.
+//
+// Splits x into exponent and mantissa and evaluates a degree 4 polynomial fit
+// of log2 on the mantissa. The absolute error is less than 1.1e-4, i.e. less
+// than 3.3e-4 dB in 10 * log10(x).
+template <class D, class V>
+HWY_INLINE V FastLog2(D d, V x) {
+  const hwy::HWY_NAMESPACE::RebindToSigned<D> di;
+  const auto bits = BitCast(di, x);
+  const V exponent = ConvertTo(d, Sub(ShiftRight<23>(bits), Set(di, 127)));
+  // The mantissa, in [1, 2), minus 1.
+  const V t = Sub(BitCast(d, Or(And(bits, Set(di, 0x007FFFFF)),
+                                Set(di, 0x3F800000))),
+                  Set(d, 1.0f));
+  V poly = Set(d, -0.0800108761f);
+  poly = MulAdd(poly, t, Set(d, 0.315467596f));
+  poly = MulAdd(poly, t, Set(d, -0.672934175f));
+  poly = MulAdd(poly, t, Set(d, 1.43730211f));
+  poly = MulAdd(poly, t, Set(d, 0.000100189034f));
+  return Add(exponent, poly);
+}
+
+// Returns an approximation of 2^x.
+//
+// Splits x into integer and fractional part and evaluates a degree 4
+// polynomial fit of 2^x on the fractional part. x is clamped to [-126, 126],
+// so very small results are 2^-126 instead of 0. The relative error is less
+// than 3.7e-6, i.e. less than 1.6e-5 dB.
+template <class D, class V>
+HWY_INLINE V FastExp2(D d, V x) {
+  const hwy::HWY_NAMESPACE::RebindToSigned<D> di;
+  const V clamped = Min(Max(x, Set(d, -126.0f)), Set(d, 126.0f));
+  const V integer_part = Floor(clamped);
+  const V t = Sub(clamped, integer_part);
+  const V scale = BitCast(
+      d, ShiftLeft<23>(Add(ConvertTo(di, integer_part), Set(di, 127))));
+  V poly = Set(d, 0.0136839831f);
+  poly = MulAdd(poly, t, Set(d, 0.0517177358f));
+  poly = MulAdd(poly, t, Set(d, 0.241621315f));
+  poly = MulAdd(poly, t, Set(d, 0.692969561f));
+  poly = MulAdd(poly, t, Set(d, 1.00000358f));
+  return Mul(scale, poly);
+}
+
+// Returns log10(x), using FastLog2 if fast_math is true and Highway's full
+// precision Log10 otherwise.
+template <bool fast_math, class D, class V>
+HWY_INLINE V Log10Of(D d, V x) {
+  if constexpr (fast_math) {
+    return Mul(FastLog2(d, x), Set(d, 0.301029996f));
+  } else {
+    return Log10(d, x);
+  }
+}
+
+// Returns e^x, using FastExp2 if fast_math is true and Highway's full
+// precision Exp otherwise.
+template <bool fast_math, class D, class V>
+HWY_INLINE V ExpOf(D d, V x) {
+  if constexpr (fast_math) {
+    return FastExp2(d, Mul(x, Set(d, 1.44269504f)));
+  } else {
+    return Exp(d, x);
+  }
+}
+
+}  // namespace HWY_NAMESPACE
+}  // namespace zimtohrli
+HWY_AFTER_NAMESPACE();
+
+#endif  // CPP_ZIMT_FAST_MATH_INL_H_
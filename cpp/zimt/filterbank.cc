@@ -14,12 +14,17 @@
 
 #include "zimt/filterbank.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstring>
+#include <memory>
+#include <thread>  // NOLINT
+#include <utility>
 #include <vector>
 
 #include "absl/log/check.h"
 #include "absl/numeric/bits.h"
+#include "absl/types/span.h"
 #include "hwy/aligned_allocator.h"
 #include "hwy/base.h"
 #include "zimt/elliptic.h"
@@ -62,14 +67,305 @@ void HwyComputeReciprocal(hwy::Span<const float> coeffs,
   }
 }
 
-void HwyFilter(const hwy::AlignedNDArray<float, 3>& b_coeffs,
-               const hwy::AlignedNDArray<float, 3>& a_coeffs,
-               hwy::AlignedNDArray<float, 3>& x_buffer,
-               hwy::AlignedNDArray<float, 3>& y_buffer,
-               hwy::Span<const float> input,
-               hwy::AlignedNDArray<float, 2>& output,
-               size_t& global_sample_index) {
+#if !HWY_HAVE_SCALABLE
+// The buffers of one signal filtered by HwyFilterFixedImpl, laid out like the
+// corresponding arguments of HwyFilterImpl.
+struct FixedImplSignal {
+  const float* input_data;
+  float* x_buffer_data;
+  float* y_buffer_data;
+  float* output_data;
+  size_t* global_sample_index;
+};
+
+// Like HwyFilterImpl, but for filterbanks with exactly kNumSections sections
+// of kNumBCoeffs b-coefficients and kNumACoeffs a-coefficients, filtering
+// kNumSignals signals of num_samples samples in lock step.
+//
+// Runs one lane-block of filters at a time through all samples, keeping the
+// coefficients and the histories of every section in registers instead of
+// reloading them from the coefficient arrays and circular buffers for every
+// sample and section. Only the final section output touches memory per
+// sample, and the histories are written back to the circular buffers at the
+// end so the state can be continued by either kernel.
+//
+// Each signal is a serial chain of dependent multiply-adds, so stepping
+// several signals together lets their chains hide each other's latency while
+// sharing the coefficient registers.
+//
+// Performs the same operations in the same order as HwyFilterImpl, so the
+// results are identical.
+//
+// Not available for scalable targets, since their vectors can't be array
+// elements.
+template <bool energy, size_t kNumSections, size_t kNumBCoeffs,
+          size_t kNumACoeffs, size_t kNumSignals>
+void HwyFilterFixedImpl(const hwy::AlignedNDArray<float, 3>& b_coeffs,
+                        const hwy::AlignedNDArray<float, 3>& a_coeffs,
+                        size_t x_buffer_length, size_t y_buffer_length,
+                        const FixedImplSignal* signals, size_t num_samples,
+                        size_t num_output_rows, size_t downscaling) {
+#if HWY_IS_DEBUG_BUILD
+  CHECK_EQ(kNumSections, b_coeffs.shape()[0]);
+  CHECK_EQ(kNumSections, a_coeffs.shape()[0]);
+  CHECK_EQ(kNumBCoeffs, b_coeffs.shape()[1]);
+  CHECK_EQ(kNumACoeffs, a_coeffs.shape()[1]);
+#endif
+  const size_t num_filters = b_coeffs.shape()[2];
+  const size_t padded_num_filters = b_coeffs.memory_shape()[2];
+
+  const float* a_coeffs_data = a_coeffs.data();
+  const float* b_coeffs_data = b_coeffs.data();
+
+  const size_t x_buffer_values_per_section =
+      x_buffer_length * padded_num_filters;
+  const size_t y_buffer_values_per_section =
+      y_buffer_length * padded_num_filters;
+
+  // Returns the offset of the value steps_back samples before
+  // sample_index in a circular buffer of buffer_length.
+  const auto circular = [&](size_t sample_index, size_t buffer_length,
+                            size_t steps_back) HWY_ATTR {
+    return padded_num_filters *
+           ((sample_index + buffer_length - steps_back) &
+            (buffer_length - 1));
+  };
+
+  for (size_t filter_index = 0; filter_index < num_filters;
+       filter_index += Lanes(d)) {
+    Vec b[kNumSections][kNumBCoeffs];
+    Vec a[kNumSections][kNumACoeffs];
+    for (size_t section_index = 0; section_index < kNumSections;
+         ++section_index) {
+      for (size_t k = 0; k < kNumBCoeffs; ++k) {
+        b[section_index][k] =
+            Load(d, b_coeffs_data + filter_index +
+                        (padded_num_filters *
+                         ((kNumBCoeffs * section_index) + k)));
+      }
+      for (size_t k = 0; k < kNumACoeffs; ++k) {
+        a[section_index][k] =
+            Load(d, a_coeffs_data + filter_index +
+                        (padded_num_filters *
+                         ((kNumACoeffs * section_index) + k)));
+      }
+    }
+    // x[signal_index][section_index][k] and y[signal_index][section_index][k]
+    // are the input and output of the section k samples back, where k == 0 is
+    // the current sample.
+    Vec x[kNumSignals][kNumSections][kNumBCoeffs];
+    Vec y[kNumSignals][kNumSections][kNumACoeffs];
+    for (size_t signal_index = 0; signal_index < kNumSignals; ++signal_index) {
+      const FixedImplSignal& signal = signals[signal_index];
+      const size_t start_sample_index = *signal.global_sample_index;
+      for (size_t section_index = 0; section_index < kNumSections;
+           ++section_index) {
+        const float* x_section = signal.x_buffer_data + filter_index +
+                                 (x_buffer_values_per_section * section_index);
+        const float* y_section = signal.y_buffer_data + filter_index +
+                                 (y_buffer_values_per_section * section_index);
+        for (size_t k = 0; k < kNumBCoeffs; ++k) {
+          x[signal_index][section_index][k] = Zero(d);
+          if (k > 0) {
+            x[signal_index][section_index][k] =
+                Load(d, x_section +
+                            circular(start_sample_index, x_buffer_length, k));
+          }
+        }
+        for (size_t k = 0; k < kNumACoeffs; ++k) {
+          y[signal_index][section_index][k] = Zero(d);
+          if (k > 0) {
+            y[signal_index][section_index][k] =
+                Load(d, y_section +
+                            circular(start_sample_index, y_buffer_length, k));
+          }
+        }
+      }
+    }
+
+    // Steps all sections of all signals through one input sample, and sets
+    // results to the output of the last section of each signal.
+    const auto step = [&](size_t sample_index,
+                          Vec (&results)[kNumSignals]) HWY_ATTR {
+      for (size_t signal_index = 0; signal_index < kNumSignals;
+           ++signal_index) {
+        results[signal_index] =
+            Set(d, signals[signal_index].input_data[sample_index]);
+      }
+      for (size_t section_index = 0; section_index < kNumSections;
+           ++section_index) {
+        for (size_t signal_index = 0; signal_index < kNumSignals;
+             ++signal_index) {
+          Vec* section_x = x[signal_index][section_index];
+          Vec* section_y = y[signal_index][section_index];
+          section_x[0] = results[signal_index];
+          Vec numerator_out = Zero(d);
+          for (size_t k = 0; k < kNumBCoeffs; ++k) {
+            numerator_out =
+                MulAdd(b[section_index][k], section_x[k], numerator_out);
+          }
+          Vec denominator_out = Zero(d);
+          for (size_t k = 1; k < kNumACoeffs; ++k) {
+            denominator_out =
+                MulAdd(a[section_index][k], section_y[k], denominator_out);
+          }
+          section_y[0] =
+              Mul(a[section_index][0], Sub(numerator_out, denominator_out));
+          results[signal_index] = section_y[0];
+          for (size_t k = kNumBCoeffs - 1; k > 0; --k) {
+            section_x[k] = section_x[k - 1];
+          }
+          for (size_t k = kNumACoeffs - 1; k > 0; --k) {
+            section_y[k] = section_y[k - 1];
+          }
+        }
+      }
+    };
+
+    Vec results[kNumSignals];
+    if constexpr (energy) {
+      size_t sample_index = 0;
+      for (size_t output_row_index = 0;
+           output_row_index < num_output_rows && sample_index < num_samples;
+           ++output_row_index) {
+        const size_t output_offset =
+            (padded_num_filters * output_row_index) + filter_index;
+        const size_t row_end =
+            std::min(num_samples, sample_index + downscaling);
+        Vec energy_out[kNumSignals];
+        for (size_t signal_index = 0; signal_index < kNumSignals;
+             ++signal_index) {
+          energy_out[signal_index] =
+              Load(d, signals[signal_index].output_data + output_offset);
+        }
+        for (; sample_index < row_end; ++sample_index) {
+          step(sample_index, results);
+          for (size_t signal_index = 0; signal_index < kNumSignals;
+               ++signal_index) {
+            energy_out[signal_index] =
+                MulAdd(results[signal_index], results[signal_index],
+                       energy_out[signal_index]);
+          }
+        }
+        for (size_t signal_index = 0; signal_index < kNumSignals;
+             ++signal_index) {
+          Store(energy_out[signal_index], d,
+                signals[signal_index].output_data + output_offset);
+        }
+      }
+      for (; sample_index < num_samples; ++sample_index) {
+        step(sample_index, results);
+      }
+    } else {
+      for (size_t sample_index = 0; sample_index < num_samples;
+           ++sample_index) {
+        step(sample_index, results);
+        for (size_t signal_index = 0; signal_index < kNumSignals;
+             ++signal_index) {
+          Store(results[signal_index], d,
+                signals[signal_index].output_data +
+                    (padded_num_filters * sample_index) + filter_index);
+        }
+      }
+    }
+
+    // After the last step, index k in the histories holds the value k samples
+    // before the end of the input.
+    for (size_t signal_index = 0; signal_index < kNumSignals; ++signal_index) {
+      const FixedImplSignal& signal = signals[signal_index];
+      const size_t end_sample_index =
+          *signal.global_sample_index + num_samples;
+      for (size_t section_index = 0; section_index < kNumSections;
+           ++section_index) {
+        float* x_section = signal.x_buffer_data + filter_index +
+                           (x_buffer_values_per_section * section_index);
+        float* y_section = signal.y_buffer_data + filter_index +
+                           (y_buffer_values_per_section * section_index);
+        for (size_t k = 1; k < kNumBCoeffs; ++k) {
+          Store(x[signal_index][section_index][k], d,
+                x_section + circular(end_sample_index, x_buffer_length, k));
+        }
+        for (size_t k = 1; k < kNumACoeffs; ++k) {
+          Store(y[signal_index][section_index][k], d,
+                y_section + circular(end_sample_index, y_buffer_length, k));
+        }
+      }
+    }
+  }
+  for (size_t signal_index = 0; signal_index < kNumSignals; ++signal_index) {
+    *signals[signal_index].global_sample_index += num_samples;
+  }
+}
+
+// Returns whether filterbanks with these coefficients, cascades of up to 3
+// biquads which covers the Cam filterbanks up to filter_order 3, have
+// HwyFilterFixedImpl kernels.
+bool HasFixedImpl(const hwy::AlignedNDArray<float, 3>& b_coeffs,
+                  const hwy::AlignedNDArray<float, 3>& a_coeffs) {
+  return b_coeffs.shape()[1] == 3 && a_coeffs.shape()[1] == 3 &&
+         b_coeffs.shape()[0] >= 1 && b_coeffs.shape()[0] <= 3;
+}
+
+// Runs the kNumSignals signals through the HwyFilterFixedImpl kernel for the
+// number of sections in the filterbank, which must have HasFixedImpl.
+template <bool energy, size_t kNumSignals>
+void HwyFilterFixed(const hwy::AlignedNDArray<float, 3>& b_coeffs,
+                    const hwy::AlignedNDArray<float, 3>& a_coeffs,
+                    size_t x_buffer_length, size_t y_buffer_length,
+                    const FixedImplSignal* signals, size_t num_samples,
+                    size_t num_output_rows, size_t downscaling) {
+  switch (b_coeffs.shape()[0]) {
+    case 1:
+      HwyFilterFixedImpl<energy, 1, 3, 3, kNumSignals>(
+          b_coeffs, a_coeffs, x_buffer_length, y_buffer_length, signals,
+          num_samples, num_output_rows, downscaling);
+      return;
+    case 2:
+      HwyFilterFixedImpl<energy, 2, 3, 3, kNumSignals>(
+          b_coeffs, a_coeffs, x_buffer_length, y_buffer_length, signals,
+          num_samples, num_output_rows, downscaling);
+      return;
+    default:
+      HwyFilterFixedImpl<energy, 3, 3, 3, kNumSignals>(
+          b_coeffs, a_coeffs, x_buffer_length, y_buffer_length, signals,
+          num_samples, num_output_rows, downscaling);
+      return;
+  }
+}
+#endif  // !HWY_HAVE_SCALABLE
+
+// Filters input through the filterbank.
+//
+// If energy is false the output is stored in output_data, which has
+// input.size() rows of padded_num_filters values.
+//
+// If energy is true the squared output is instead accumulated into the
+// num_output_rows rows of output_data, each row summing downscaling
+// consecutive samples. Samples beyond num_output_rows * downscaling still
+// update the filter state but are not accumulated.
+template <bool energy>
+void HwyFilterImpl(const hwy::AlignedNDArray<float, 3>& b_coeffs,
+                   const hwy::AlignedNDArray<float, 3>& a_coeffs,
+                   hwy::AlignedNDArray<float, 3>& x_buffer,
+                   hwy::AlignedNDArray<float, 3>& y_buffer,
+                   hwy::Span<const float> input, float* output_data,
+                   size_t num_output_rows, size_t downscaling,
+                   size_t& global_sample_index) {
   const size_t num_sections = b_coeffs.shape()[0];
+#if !HWY_HAVE_SCALABLE
+  if (HasFixedImpl(b_coeffs, a_coeffs)) {
+    const FixedImplSignal signal = {
+        .input_data = input.data(),
+        .x_buffer_data = x_buffer.data(),
+        .y_buffer_data = y_buffer.data(),
+        .output_data = output_data,
+        .global_sample_index = &global_sample_index};
+    HwyFilterFixed<energy, 1>(b_coeffs, a_coeffs, x_buffer.shape()[1],
+                              y_buffer.shape()[1], &signal, input.size(),
+                              num_output_rows, downscaling);
+    return;
+  }
+#endif
 #if HWY_IS_DEBUG_BUILD
   CHECK_EQ(num_sections, a_coeffs.shape()[0]);
   CHECK_EQ(num_sections, x_buffer.shape()[0]);
@@ -92,7 +388,6 @@ void HwyFilter(const hwy::AlignedNDArray<float, 3>& b_coeffs,
   CHECK_EQ(num_filters, a_coeffs.shape()[2]);
   CHECK_EQ(num_filters, x_buffer.shape()[2]);
   CHECK_EQ(num_filters, y_buffer.shape()[2]);
-  CHECK_EQ(num_filters, output.shape()[1]);
 #endif
 
   // Using memory_shape instead of shape to get the actual padded-to-lanes
@@ -103,14 +398,9 @@ void HwyFilter(const hwy::AlignedNDArray<float, 3>& b_coeffs,
   CHECK_EQ(padded_num_filters, a_coeffs.memory_shape()[2]);
   CHECK_EQ(padded_num_filters, x_buffer.memory_shape()[2]);
   CHECK_EQ(padded_num_filters, y_buffer.memory_shape()[2]);
-  CHECK_EQ(padded_num_filters, output.memory_shape()[1]);
 #endif
 
-  const size_t num_samples = output.shape()[0];
-#if HWY_IS_DEBUG_BUILD
-  CHECK_GT(num_samples, 0);
-  CHECK_EQ(num_samples, input.size());
-#endif
+  const size_t num_samples = input.size();
 
   const size_t x_buffer_length = x_buffer.shape()[1];
   const size_t y_buffer_length = y_buffer.shape()[1];
@@ -120,7 +410,6 @@ void HwyFilter(const hwy::AlignedNDArray<float, 3>& b_coeffs,
 #endif
 
   const float* input_data = input.data();
-  float* output_data = output.data();
   float* x_buffer_data = x_buffer.data();
   float* y_buffer_data = y_buffer.data();
   const float* a_coeffs_data = a_coeffs.data();
@@ -154,6 +443,15 @@ void HwyFilter(const hwy::AlignedNDArray<float, 3>& b_coeffs,
   };
 
   for (size_t sample_index = 0; sample_index < num_samples; ++sample_index) {
+    float* output_row = nullptr;
+    if constexpr (energy) {
+      const size_t output_row_index = sample_index / downscaling;
+      if (output_row_index < num_output_rows) {
+        output_row = output_data + (padded_num_filters * output_row_index);
+      }
+    } else {
+      output_row = output_data + (padded_num_filters * sample_index);
+    }
     for (size_t section_index = 0; section_index < num_sections;
          ++section_index) {
       const size_t x_section_offset =
@@ -209,12 +507,17 @@ void HwyFilter(const hwy::AlignedNDArray<float, 3>& b_coeffs,
               circular_x(sample_index,
                          (section_index + 1) * x_buffer_values_per_section, 0) +
                   filter_index);
+        } else if constexpr (energy) {
+          // This was the last section, accumulate the energy of the final
+          // result for this filter-step.
+          if (output_row != nullptr) {
+            Store(MulAdd(result, result, Load(d, output_row + filter_index)),
+                  d, output_row + filter_index);
+          }
         } else {
           // This was the last section, and we have computed the final result
           // for this filter-step, write it to output.
-          Store(
-              result, d,
-              output_data + (padded_num_filters * sample_index) + filter_index);
+          Store(result, d, output_row + filter_index);
         }
       }
     }
@@ -222,6 +525,299 @@ void HwyFilter(const hwy::AlignedNDArray<float, 3>& b_coeffs,
   }
 }
 
+void HwyFilter(const hwy::AlignedNDArray<float, 3>& b_coeffs,
+               const hwy::AlignedNDArray<float, 3>& a_coeffs,
+               hwy::AlignedNDArray<float, 3>& x_buffer,
+               hwy::AlignedNDArray<float, 3>& y_buffer,
+               hwy::Span<const float> input, float* output_data,
+               size_t& global_sample_index) {
+  HwyFilterImpl<false>(b_coeffs, a_coeffs, x_buffer, y_buffer, input,
+                       output_data, input.size(), 1, global_sample_index);
+}
+
+void HwyFilterEnergy(const hwy::AlignedNDArray<float, 3>& b_coeffs,
+                     const hwy::AlignedNDArray<float, 3>& a_coeffs,
+                     hwy::AlignedNDArray<float, 3>& x_buffer,
+                     hwy::AlignedNDArray<float, 3>& y_buffer,
+                     hwy::Span<const float> input,
+                     hwy::AlignedNDArray<float, 2>& energy_channels,
+                     size_t& global_sample_index) {
+  const size_t num_out_samples = energy_channels.shape()[0];
+  const size_t downscaling = input.size() / num_out_samples;
+  hwy::ZeroBytes(energy_channels.data(),
+                 energy_channels.memory_size() * sizeof(float));
+  HwyFilterImpl<true>(b_coeffs, a_coeffs, x_buffer, y_buffer, input,
+                      energy_channels.data(), num_out_samples, downscaling,
+                      global_sample_index);
+  const Vec downscaling_reciprocal_vec = Set(d, 1.0f / downscaling);
+  for (size_t sample_index = 0; sample_index < num_out_samples;
+       ++sample_index) {
+    float* energy_data = energy_channels[{sample_index}].data();
+    for (size_t channel_index = 0; channel_index < energy_channels.shape()[1];
+         channel_index += Lanes(d)) {
+      Store(Mul(downscaling_reciprocal_vec,
+                Load(d, energy_data + channel_index)),
+            d, energy_data + channel_index);
+    }
+  }
+}
+
+// Like HwyFilterImpl, but steps all signals through each sample in lock
+// step.
+//
+// Signals are processed in pairs that share the coefficient loads and
+// interleave their two independent recurrences. An odd signal out is paired
+// with itself, which computes and stores identical values twice, or in the
+// energy case accumulates into a scratch row instead of its output twice.
+//
+// If energy is true the squared outputs are accumulated into the
+// num_output_rows rows of each output like in HwyFilterImpl.
+//
+// Filterbanks with HasFixedImpl instead step groups of signals through
+// HwyFilterFixedImpl.
+template <bool energy>
+void HwyFilterBatchImpl(
+    const hwy::AlignedNDArray<float, 3>& b_coeffs,
+    const hwy::AlignedNDArray<float, 3>& a_coeffs,
+    absl::Span<const hwy::Span<const float>> inputs,
+    absl::Span<FilterbankState> states,
+    absl::Span<hwy::AlignedNDArray<float, 2>* const> outputs,
+    size_t num_output_rows, size_t downscaling) {
+  const size_t num_signals = inputs.size();
+#if !HWY_HAVE_SCALABLE
+  if (HasFixedImpl(b_coeffs, a_coeffs)) {
+    std::vector<FixedImplSignal> signals(num_signals);
+    for (size_t signal_index = 0; signal_index < num_signals;
+         ++signal_index) {
+      FilterbankState& state = states[signal_index];
+      signals[signal_index] = {
+          .input_data = inputs[signal_index].data(),
+          .x_buffer_data = state.x_buffer.data(),
+          .y_buffer_data = state.y_buffer.data(),
+          .output_data = outputs[signal_index]->data(),
+          .global_sample_index = &state.global_sample_index};
+    }
+    const size_t x_buffer_length = states[0].x_buffer.shape()[1];
+    const size_t y_buffer_length = states[0].y_buffer.shape()[1];
+    const size_t num_samples = inputs[0].size();
+    size_t signal_index = 0;
+    // A single biquad is bound by the latency of its recurrence, and leaves
+    // registers for the histories of four signals. Longer cascades overlap
+    // their sections already, and only have registers for two.
+    if (b_coeffs.shape()[0] == 1) {
+      for (; signal_index + 4 <= num_signals; signal_index += 4) {
+        HwyFilterFixed<energy, 4>(b_coeffs, a_coeffs, x_buffer_length,
+                                  y_buffer_length, &signals[signal_index],
+                                  num_samples, num_output_rows, downscaling);
+      }
+    }
+    for (; signal_index + 2 <= num_signals; signal_index += 2) {
+      HwyFilterFixed<energy, 2>(b_coeffs, a_coeffs, x_buffer_length,
+                                y_buffer_length, &signals[signal_index],
+                                num_samples, num_output_rows, downscaling);
+    }
+    for (; signal_index < num_signals; ++signal_index) {
+      HwyFilterFixed<energy, 1>(b_coeffs, a_coeffs, x_buffer_length,
+                                y_buffer_length, &signals[signal_index],
+                                num_samples, num_output_rows, downscaling);
+    }
+    return;
+  }
+#endif
+  const size_t num_sections = b_coeffs.shape()[0];
+  const size_t num_b_coeffs = b_coeffs.shape()[1];
+  const size_t num_a_coeffs = a_coeffs.shape()[1];
+  const size_t num_filters = b_coeffs.shape()[2];
+  const size_t padded_num_filters = b_coeffs.memory_shape()[2];
+  const size_t num_samples = inputs[0].size();
+  const size_t x_buffer_length = states[0].x_buffer.shape()[1];
+  const size_t y_buffer_length = states[0].y_buffer.shape()[1];
+
+  const float* a_coeffs_data = a_coeffs.data();
+  const float* b_coeffs_data = b_coeffs.data();
+  const size_t b_coeff_values_per_section = num_b_coeffs * padded_num_filters;
+  const size_t a_coeff_values_per_section = num_a_coeffs * padded_num_filters;
+  const size_t x_buffer_values_per_section =
+      x_buffer_length * padded_num_filters;
+  const size_t y_buffer_values_per_section =
+      y_buffer_length * padded_num_filters;
+
+  std::vector<float*> x_buffers(num_signals);
+  std::vector<float*> y_buffers(num_signals);
+  std::vector<float*> output_datas(num_signals);
+  for (size_t signal_index = 0; signal_index < num_signals; ++signal_index) {
+    x_buffers[signal_index] = states[signal_index].x_buffer.data();
+    y_buffers[signal_index] = states[signal_index].y_buffer.data();
+    output_datas[signal_index] = outputs[signal_index]->data();
+  }
+  // Where the odd signal out accumulates the energy of its duplicate.
+  hwy::AlignedFreeUniquePtr<float[]> scratch_row;
+  if constexpr (energy) {
+    scratch_row = hwy::AllocateAligned<float>(padded_num_filters);
+  }
+
+  // Returns the offset of the value coeff_index steps back from
+  // global_sample_index in a circular buffer of buffer_length.
+  const auto circular = [&](size_t global_sample_index, size_t buffer_length,
+                            size_t coeff_index) HWY_ATTR {
+    return padded_num_filters *
+           ((global_sample_index + buffer_length - coeff_index) &
+            (buffer_length - 1));
+  };
+
+  for (size_t sample_index = 0; sample_index < num_samples; ++sample_index) {
+    // Offset of the output row of this sample, or num_output_rows *
+    // padded_num_filters if its energy is not accumulated.
+    size_t output_row_offset = padded_num_filters * sample_index;
+    if constexpr (energy) {
+      output_row_offset =
+          padded_num_filters * std::min(num_output_rows,
+                                        sample_index / downscaling);
+    }
+    for (size_t section_index = 0; section_index < num_sections;
+         ++section_index) {
+      const size_t x_section_offset =
+          (x_buffer_values_per_section * section_index);
+      const size_t y_section_offset =
+          (y_buffer_values_per_section * section_index);
+      const size_t b_section_offset =
+          (b_coeff_values_per_section * section_index);
+      const size_t a_section_offset =
+          (a_coeff_values_per_section * section_index);
+      for (size_t filter_index = 0; filter_index < num_filters;
+           filter_index += Lanes(d)) {
+        for (size_t signal_index = 0; signal_index < num_signals;
+             signal_index += 2) {
+          const size_t signal_0 = signal_index;
+          const size_t signal_1 =
+              signal_index + 1 < num_signals ? signal_index + 1 : signal_index;
+          const size_t global_0 = states[signal_0].global_sample_index;
+          const size_t global_1 = states[signal_1].global_sample_index;
+          float* x_0 = x_buffers[signal_0] + x_section_offset + filter_index;
+          float* x_1 = x_buffers[signal_1] + x_section_offset + filter_index;
+          float* y_0 = y_buffers[signal_0] + y_section_offset + filter_index;
+          float* y_1 = y_buffers[signal_1] + y_section_offset + filter_index;
+          if (section_index == 0) {
+            // Store this input sample in x_buffer as current input.
+            Store(Set(d, inputs[signal_0][sample_index]), d,
+                  x_0 + circular(global_0, x_buffer_length, 0));
+            Store(Set(d, inputs[signal_1][sample_index]), d,
+                  x_1 + circular(global_1, x_buffer_length, 0));
+          }
+          Vec numerator_0 = Zero(d);
+          Vec numerator_1 = Zero(d);
+          for (size_t b_coeff_index = 0; b_coeff_index < num_b_coeffs;
+               ++b_coeff_index) {
+            const Vec b_coeff = Load(
+                d, b_coeffs_data + b_section_offset +
+                       (padded_num_filters * b_coeff_index) + filter_index);
+            const Vec x_value_0 = Load(
+                d, x_0 + circular(global_0, x_buffer_length, b_coeff_index));
+            const Vec x_value_1 = Load(
+                d, x_1 + circular(global_1, x_buffer_length, b_coeff_index));
+            numerator_0 = MulAdd(b_coeff, x_value_0, numerator_0);
+            numerator_1 = MulAdd(b_coeff, x_value_1, numerator_1);
+          }
+          Vec denominator_0 = Zero(d);
+          Vec denominator_1 = Zero(d);
+          for (size_t a_coeff_index = 1; a_coeff_index < num_a_coeffs;
+               ++a_coeff_index) {
+            const Vec a_coeff = Load(
+                d, a_coeffs_data + a_section_offset +
+                       (padded_num_filters * a_coeff_index) + filter_index);
+            const Vec y_value_0 = Load(
+                d, y_0 + circular(global_0, y_buffer_length, a_coeff_index));
+            const Vec y_value_1 = Load(
+                d, y_1 + circular(global_1, y_buffer_length, a_coeff_index));
+            denominator_0 = MulAdd(a_coeff, y_value_0, denominator_0);
+            denominator_1 = MulAdd(a_coeff, y_value_1, denominator_1);
+          }
+          const Vec scale =
+              Load(d, a_coeffs_data + a_section_offset + filter_index);
+          const Vec result_0 = Mul(scale, Sub(numerator_0, denominator_0));
+          const Vec result_1 = Mul(scale, Sub(numerator_1, denominator_1));
+
+          // Store results in output buffers for next sample-step.
+          Store(result_0, d, y_0 + circular(global_0, y_buffer_length, 0));
+          Store(result_1, d, y_1 + circular(global_1, y_buffer_length, 0));
+          if (section_index + 1 < num_sections) {
+            // Store results in input buffers for next section-step.
+            Store(result_0, d,
+                  x_0 + x_buffer_values_per_section +
+                      circular(global_0, x_buffer_length, 0));
+            Store(result_1, d,
+                  x_1 + x_buffer_values_per_section +
+                      circular(global_1, x_buffer_length, 0));
+          } else if constexpr (energy) {
+            // This was the last section, accumulate the energy of the final
+            // results.
+            if (output_row_offset <
+                num_output_rows * padded_num_filters) {
+              float* output_0 =
+                  output_datas[signal_0] + output_row_offset + filter_index;
+              float* output_1 =
+                  signal_1 == signal_0
+                      ? scratch_row.get() + filter_index
+                      : output_datas[signal_1] + output_row_offset +
+                            filter_index;
+              Store(MulAdd(result_0, result_0, Load(d, output_0)), d,
+                    output_0);
+              Store(MulAdd(result_1, result_1, Load(d, output_1)), d,
+                    output_1);
+            }
+          } else {
+            // This was the last section, write the final results to output.
+            Store(result_0, d,
+                  output_datas[signal_0] + output_row_offset + filter_index);
+            Store(result_1, d,
+                  output_datas[signal_1] + output_row_offset + filter_index);
+          }
+        }
+      }
+    }
+    for (FilterbankState& state : states) {
+      ++state.global_sample_index;
+    }
+  }
+}
+
+void HwyFilterBatch(const hwy::AlignedNDArray<float, 3>& b_coeffs,
+                    const hwy::AlignedNDArray<float, 3>& a_coeffs,
+                    absl::Span<const hwy::Span<const float>> inputs,
+                    absl::Span<FilterbankState> states,
+                    absl::Span<hwy::AlignedNDArray<float, 2>* const> outputs) {
+  HwyFilterBatchImpl<false>(b_coeffs, a_coeffs, inputs, states, outputs,
+                            inputs[0].size(), 1);
+}
+
+void HwyFilterEnergyBatch(
+    const hwy::AlignedNDArray<float, 3>& b_coeffs,
+    const hwy::AlignedNDArray<float, 3>& a_coeffs,
+    absl::Span<const hwy::Span<const float>> inputs,
+    absl::Span<FilterbankState> states,
+    absl::Span<hwy::AlignedNDArray<float, 2>* const> energy_channels) {
+  const size_t num_out_samples = energy_channels[0]->shape()[0];
+  const size_t downscaling = inputs[0].size() / num_out_samples;
+  for (hwy::AlignedNDArray<float, 2>* energy : energy_channels) {
+    hwy::ZeroBytes(energy->data(), energy->memory_size() * sizeof(float));
+  }
+  HwyFilterBatchImpl<true>(b_coeffs, a_coeffs, inputs, states,
+                           energy_channels, num_out_samples, downscaling);
+  const Vec downscaling_reciprocal_vec = Set(d, 1.0f / downscaling);
+  for (hwy::AlignedNDArray<float, 2>* energy : energy_channels) {
+    for (size_t sample_index = 0; sample_index < num_out_samples;
+         ++sample_index) {
+      float* energy_data = (*energy)[{sample_index}].data();
+      for (size_t channel_index = 0; channel_index < energy->shape()[1];
+           channel_index += Lanes(d)) {
+        Store(Mul(downscaling_reciprocal_vec,
+                  Load(d, energy_data + channel_index)),
+              d, energy_data + channel_index);
+      }
+    }
+  }
+}
+
 }  // namespace HWY_NAMESPACE
 }  // namespace zimtohrli
 HWY_AFTER_NAMESPACE();
@@ -232,13 +828,12 @@ namespace zimtohrli {
 
 HWY_EXPORT(HwyComputeReciprocal);
 HWY_EXPORT(HwyFilter);
+HWY_EXPORT(HwyFilterBatch);
+HWY_EXPORT(HwyFilterEnergy);
+HWY_EXPORT(HwyFilterEnergyBatch);
 
 Filterbank::Filterbank(const std::vector<std::vector<BACoeffs>>& filters)
-    : b_coeffs_({filters.front().size(),
-                 filters.front().front().b_coeffs.size(), filters.size()}),
-      a_coeffs_({filters.front().size(),
-                 filters.front().front().a_coeffs.size(), filters.size()}),
-      x_buffer_shape_({filters.front().size(),
+    : x_buffer_shape_({filters.front().size(),
                        absl::bit_ceil(filters.front().front().b_coeffs.size()),
                        filters.size()}),
       y_buffer_shape_({filters.front().size(),
@@ -247,6 +842,12 @@ Filterbank::Filterbank(const std::vector<std::vector<BACoeffs>>& filters)
 #if HWY_IS_DEBUG_BUILD
   CHECK_GT(filters.size(), 0);
 #endif
+  hwy::AlignedNDArray<float, 3> b_coeffs(
+      {filters.front().size(), filters.front().front().b_coeffs.size(),
+       filters.size()});
+  hwy::AlignedNDArray<float, 3> a_coeffs(
+      {filters.front().size(), filters.front().front().a_coeffs.size(),
+       filters.size()});
   int num_sections = -1;
   for (size_t filter_index = 0; filter_index < filters.size(); ++filter_index) {
     const std::vector<BACoeffs>& filter = filters[filter_index];
@@ -264,17 +865,17 @@ Filterbank::Filterbank(const std::vector<std::vector<BACoeffs>>& filters)
          ++section_index) {
       const BACoeffs& coeffs = filter[section_index];
 #if HWY_IS_DEBUG_BUILD
-      CHECK_EQ(coeffs.b_coeffs.size(), b_coeffs_.shape()[1]);
-      CHECK_EQ(coeffs.a_coeffs.size(), a_coeffs_.shape()[1]);
+      CHECK_EQ(coeffs.b_coeffs.size(), b_coeffs.shape()[1]);
+      CHECK_EQ(coeffs.a_coeffs.size(), a_coeffs.shape()[1]);
 #endif
-      for (size_t coeff_index = 0; coeff_index < b_coeffs_.shape()[1];
+      for (size_t coeff_index = 0; coeff_index < b_coeffs.shape()[1];
            ++coeff_index) {
-        b_coeffs_[{section_index, coeff_index}][filter_index] =
+        b_coeffs[{section_index, coeff_index}][filter_index] =
             coeffs.b_coeffs[coeff_index];
       }
-      for (size_t coeff_index = 0; coeff_index < a_coeffs_.shape()[1];
+      for (size_t coeff_index = 0; coeff_index < a_coeffs.shape()[1];
            ++coeff_index) {
-        a_coeffs_[{section_index, coeff_index}][filter_index] =
+        a_coeffs[{section_index, coeff_index}][filter_index] =
             coeffs.a_coeffs[coeff_index];
       }
     }
@@ -284,8 +885,10 @@ Filterbank::Filterbank(const std::vector<std::vector<BACoeffs>>& filters)
   for (size_t section_index = 0; section_index < num_sections;
        ++section_index) {
     HWY_DYNAMIC_DISPATCH(HwyComputeReciprocal)
-    (a_coeffs_[{section_index, 0}], a_coeffs_[{section_index, 0}]);
+    (a_coeffs[{section_index, 0}], a_coeffs[{section_index, 0}]);
   }
+  coeffs_ = std::make_shared<const Coefficients>(
+      Coefficients{.b = std::move(b_coeffs), .a = std::move(a_coeffs)});
 }
 
 void Filterbank::Filter(hwy::Span<const float> input,
@@ -298,17 +901,137 @@ void Filterbank::Filter(hwy::Span<const float> input, FilterbankState& state,
                         hwy::AlignedNDArray<float, 2>& output) const {
 #if HWY_IS_DEBUG_BUILD
   CHECK_EQ(input.size(), output.shape()[0]);
-  CHECK_EQ(output.shape()[1], a_coeffs_.shape()[2]);
+  CHECK_EQ(output.shape()[1], coeffs_->a.shape()[2]);
   // Checking actual buffer shape instead of intended number of filters, since
   // that's what will actually be processed.
-  CHECK_EQ(output.memory_shape()[1], a_coeffs_.memory_shape()[2]);
+  CHECK_EQ(output.memory_shape()[1], coeffs_->a.memory_shape()[2]);
 #endif
+  FilterInto(input, state, output.data());
+}
+
+void Filterbank::FilterInto(hwy::Span<const float> input,
+                            FilterbankState& state, float* output_data) const {
+  if (input.size() == 0) {
+    return;
+  }
   HWY_DYNAMIC_DISPATCH(HwyFilter)
-  (b_coeffs_, a_coeffs_, state.x_buffer, state.y_buffer, input, output,
+  (coeffs_->b, coeffs_->a, state.x_buffer, state.y_buffer, input, output_data,
    state.global_sample_index);
 }
 
-size_t Filterbank::Size() const { return b_coeffs_.shape()[2]; }
+void Filterbank::Filter(hwy::Span<const float> input, size_t num_threads,
+                        size_t preroll_samples,
+                        hwy::AlignedNDArray<float, 2>& output) const {
+  CHECK_GT(num_threads, 0);
+  CHECK_EQ(input.size(), output.shape()[0]);
+  CHECK_EQ(output.shape()[1], coeffs_->a.shape()[2]);
+  CHECK_EQ(output.memory_shape()[1], coeffs_->a.memory_shape()[2]);
+  const size_t num_segments = std::min(num_threads, input.size());
+  if (num_segments <= 1) {
+    Filter(input, output);
+    return;
+  }
+  const size_t padded_num_filters = PaddedSize();
+  const size_t segment_length =
+      (input.size() + num_segments - 1) / num_segments;
+  // The warm-up output is discarded, so it is produced in blocks into a small
+  // scratch buffer instead of a buffer the size of the whole preroll.
+  const size_t warm_up_block_length =
+      std::min<size_t>(1024, std::max<size_t>(1, preroll_samples));
+  std::vector<std::thread> threads;
+  threads.reserve(num_segments);
+  for (size_t segment_start = 0; segment_start < input.size();
+       segment_start += segment_length) {
+    const size_t segment_end =
+        std::min(segment_start + segment_length, input.size());
+    threads.emplace_back([&, segment_start, segment_end]() {
+      FilterbankState state = NewState();
+      const size_t preroll_start =
+          segment_start - std::min(segment_start, preroll_samples);
+      if (preroll_start < segment_start) {
+        hwy::AlignedNDArray<float, 2> warm_up_output(
+            {warm_up_block_length, coeffs_->a.shape()[2]});
+        for (size_t block_start = preroll_start; block_start < segment_start;
+             block_start += warm_up_block_length) {
+          const size_t block_end =
+              std::min(block_start + warm_up_block_length, segment_start);
+          FilterInto(hwy::Span<const float>(input.data() + block_start,
+                                            block_end - block_start),
+                     state, warm_up_output.data());
+        }
+      }
+      FilterInto(hwy::Span<const float>(input.data() + segment_start,
+                                        segment_end - segment_start),
+                 state, output.data() + padded_num_filters * segment_start);
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+void Filterbank::FilterEnergy(
+    hwy::Span<const float> input, FilterbankState& state,
+    hwy::AlignedNDArray<float, 2>& energy_channels) const {
+  CHECK_GT(energy_channels.shape()[0], 0);
+  CHECK_GE(input.size(), energy_channels.shape()[0]);
+  CHECK_EQ(energy_channels.shape()[1], coeffs_->a.shape()[2]);
+  CHECK_EQ(energy_channels.memory_shape()[1], coeffs_->a.memory_shape()[2]);
+  HWY_DYNAMIC_DISPATCH(HwyFilterEnergy)
+  (coeffs_->b, coeffs_->a, state.x_buffer, state.y_buffer, input,
+   energy_channels, state.global_sample_index);
+}
+
+void Filterbank::FilterBatch(
+    absl::Span<const hwy::Span<const float>> inputs,
+    absl::Span<FilterbankState> states,
+    absl::Span<hwy::AlignedNDArray<float, 2>* const> outputs) const {
+  CHECK_EQ(inputs.size(), states.size());
+  CHECK_EQ(inputs.size(), outputs.size());
+  if (inputs.empty() || inputs[0].size() == 0) {
+    return;
+  }
+  for (size_t signal_index = 0; signal_index < inputs.size(); ++signal_index) {
+    CHECK_EQ(inputs[signal_index].size(), inputs[0].size());
+    CHECK_EQ(inputs[signal_index].size(), outputs[signal_index]->shape()[0]);
+    CHECK_EQ(outputs[signal_index]->shape()[1], coeffs_->a.shape()[2]);
+    CHECK_EQ(outputs[signal_index]->memory_shape()[1],
+             coeffs_->a.memory_shape()[2]);
+    CHECK(states[signal_index].x_buffer.shape() == x_buffer_shape_);
+    CHECK(states[signal_index].y_buffer.shape() == y_buffer_shape_);
+  }
+  HWY_DYNAMIC_DISPATCH(HwyFilterBatch)
+  (coeffs_->b, coeffs_->a, inputs, states, outputs);
+}
+
+void Filterbank::FilterEnergyBatch(
+    absl::Span<const hwy::Span<const float>> inputs,
+    absl::Span<FilterbankState> states,
+    absl::Span<hwy::AlignedNDArray<float, 2>* const> energy_channels) const {
+  CHECK_EQ(inputs.size(), states.size());
+  CHECK_EQ(inputs.size(), energy_channels.size());
+  if (inputs.empty()) {
+    return;
+  }
+  for (size_t signal_index = 0; signal_index < inputs.size(); ++signal_index) {
+    const hwy::AlignedNDArray<float, 2>& energy =
+        *energy_channels[signal_index];
+    CHECK_EQ(inputs[signal_index].size(), inputs[0].size());
+    CHECK_GT(energy.shape()[0], 0);
+    CHECK_EQ(energy.shape()[0], energy_channels[0]->shape()[0]);
+    CHECK_GE(inputs[signal_index].size(), energy.shape()[0]);
+    CHECK_EQ(energy.shape()[1], coeffs_->a.shape()[2]);
+    CHECK_EQ(energy.memory_shape()[1], coeffs_->a.memory_shape()[2]);
+    CHECK(states[signal_index].x_buffer.shape() == x_buffer_shape_);
+    CHECK(states[signal_index].y_buffer.shape() == y_buffer_shape_);
+  }
+  HWY_DYNAMIC_DISPATCH(HwyFilterEnergyBatch)
+  (coeffs_->b, coeffs_->a, inputs, states, energy_channels);
+}
+
+size_t Filterbank::Size() const { return coeffs_->b.shape()[2]; }
+
+size_t Filterbank::PaddedSize() const { return coeffs_->b.memory_shape()[2]; }
 
 FilterbankState Filterbank::NewState() const {
   return {.x_buffer = hwy::AlignedNDArray<float, 3>(x_buffer_shape_),
@@ -316,6 +1039,19 @@ FilterbankState Filterbank::NewState() const {
           .global_sample_index = 0};
 }
 
+void Filterbank::ResetState(FilterbankState& state) const {
+  if (state.x_buffer.shape() != x_buffer_shape_ ||
+      state.y_buffer.shape() != y_buffer_shape_) {
+    state = NewState();
+    return;
+  }
+  hwy::ZeroBytes(state.x_buffer.data(),
+                 state.x_buffer.memory_size() * sizeof(float));
+  hwy::ZeroBytes(state.y_buffer.data(),
+                 state.y_buffer.memory_size() * sizeof(float));
+  state.global_sample_index = 0;
+}
+
 }  // namespace zimtohrli
 
 #endif  // HWY_ONCE
@@ -14,12 +14,14 @@
 
 #include "zimt/filterbank.h"
 
+#include <array>
 #include <cmath>
 #include <cstddef>
 #include <cstring>
 #include <vector>
 
 #include "absl/log/check.h"
+#include "absl/types/span.h"
 #include "benchmark/benchmark.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -27,6 +29,7 @@
 #include "hwy/base.h"
 #include "zimt/cam.h"
 #include "zimt/elliptic.h"
+#include "zimt/masking.h"
 
 namespace zimtohrli {
 
@@ -116,6 +119,78 @@ TEST(Filterbank, MultiSectionFilterTest) {
   }
 }
 
+TEST(Filterbank, BiquadCascadeFilterTest) {
+  // Biquad cascades of 1-3 sections use register-resident kernels and longer
+  // cascades the generic one, verify both against a direct evaluation of the
+  // difference equations, also when continuing the state across chunks of
+  // different sizes.
+  const size_t num_filters = 5;
+  const size_t signal_length = 37;
+  const std::vector<size_t> chunk_sizes = {1, 2, 7, 27};
+  hwy::AlignedNDArray<float, 1> sig({signal_length});
+  for (size_t sample_index = 0; sample_index < signal_length; ++sample_index) {
+    sig[{}][sample_index] = std::sin(0.3 * sample_index);
+  }
+  sig[{}][0] = 1.0;
+  for (size_t num_sections = 1; num_sections <= 4; ++num_sections) {
+    std::vector<std::vector<BACoeffs>> coeffs(num_filters);
+    for (size_t filter_index = 0; filter_index < num_filters; ++filter_index) {
+      for (size_t section_index = 0; section_index < num_sections;
+           ++section_index) {
+        const double offset = 0.05 * filter_index + 0.1 * section_index;
+        coeffs[filter_index].push_back(
+            {.b_coeffs = {0.2 + offset, 0.3, 0.1 - offset},
+             .a_coeffs = {2.0, -1.0 + offset, 0.5}});
+      }
+    }
+
+    hwy::AlignedNDArray<float, 2> want_filtered_sig(
+        {signal_length, num_filters});
+    for (size_t filter_index = 0; filter_index < num_filters; ++filter_index) {
+      std::vector<double> section_input(sig[{}].data(),
+                                        sig[{}].data() + signal_length);
+      for (const BACoeffs& section : coeffs[filter_index]) {
+        std::vector<double> section_output(signal_length);
+        for (size_t t = 0; t < signal_length; ++t) {
+          double value = 0;
+          for (size_t k = 0; k < 3 && k <= t; ++k) {
+            value += section.b_coeffs[k] * section_input[t - k];
+          }
+          for (size_t k = 1; k < 3 && k <= t; ++k) {
+            value -= section.a_coeffs[k] * section_output[t - k];
+          }
+          section_output[t] = value / section.a_coeffs[0];
+        }
+        section_input = section_output;
+      }
+      for (size_t t = 0; t < signal_length; ++t) {
+        want_filtered_sig[{t}][filter_index] = section_input[t];
+      }
+    }
+
+    Filterbank filter(coeffs);
+    FilterbankState state = filter.NewState();
+    size_t chunk_start = 0;
+    for (size_t chunk_size : chunk_sizes) {
+      hwy::AlignedNDArray<float, 2> got_filtered_sig(
+          {chunk_size, num_filters});
+      filter.Filter(
+          hwy::Span<const float>(sig[{}].data() + chunk_start, chunk_size),
+          state, got_filtered_sig);
+      for (size_t t = 0; t < chunk_size; ++t) {
+        for (size_t f = 0; f < num_filters; ++f) {
+          ASSERT_NEAR((got_filtered_sig[{t}][f]),
+                      (want_filtered_sig[{chunk_start + t}][f]), 1e-5)
+              << "num_sections=" << num_sections
+              << ", t=" << chunk_start + t << ", f=" << f;
+        }
+      }
+      chunk_start += chunk_size;
+    }
+    EXPECT_EQ(state.global_sample_index, signal_length);
+  }
+}
+
 TEST(Filterbank, RealSignalFilterTest) {
   // Golden data produced by:
   //
@@ -330,6 +405,203 @@ TEST(Filterbank, ManyFilterTest) {
   }
 }
 
+TEST(Filterbank, ThreadedFilterTest) {
+  const size_t signal_length = 4096;
+  // A single pole filter whose impulse response decays like 0.5^n, so that a
+  // short preroll is enough to converge to the serial result.
+  Filterbank filter(
+      std::vector<std::vector<BACoeffs>>(3, {{.b_coeffs = {1.0, 0.0},
+                                              .a_coeffs = {1.0, -0.5}}}));
+
+  hwy::AlignedNDArray<float, 1> in_signal({signal_length});
+  for (size_t sample_index = 0; sample_index < signal_length; ++sample_index) {
+    in_signal[{}][sample_index] =
+        std::sin(static_cast<float>(sample_index) * 0.05f) +
+        ((sample_index * 7919) % 13) * 0.01f;
+  }
+
+  hwy::AlignedNDArray<float, 2> serial_signal({signal_length, filter.Size()});
+  filter.Filter(in_signal[{}], serial_signal);
+
+  hwy::AlignedNDArray<float, 2> exact_signal({signal_length, filter.Size()});
+  filter.Filter(in_signal[{}], /*num_threads=*/4,
+                /*preroll_samples=*/signal_length, exact_signal);
+
+  hwy::AlignedNDArray<float, 2> threaded_signal(
+      {signal_length, filter.Size()});
+  filter.Filter(in_signal[{}], /*num_threads=*/7, /*preroll_samples=*/64,
+                threaded_signal);
+
+  for (size_t sample_index = 0; sample_index < signal_length; ++sample_index) {
+    for (size_t filter_index = 0; filter_index < filter.Size();
+         ++filter_index) {
+      const float serial = serial_signal[{sample_index}][filter_index];
+      ASSERT_EQ(exact_signal[{sample_index}][filter_index], serial);
+      ASSERT_NEAR(threaded_signal[{sample_index}][filter_index], serial, 1e-5);
+    }
+  }
+}
+
+TEST(Filterbank, FilterBatchTest) {
+  const size_t sample_rate = 48000;
+  const size_t signal_length = 1024;
+  const size_t num_signals = 3;
+  const CamFilterbank cam_filterbank = Cam().CreateFilterbank(sample_rate);
+  const Filterbank& filter = cam_filterbank.filter;
+
+  std::vector<hwy::AlignedNDArray<float, 1>> in_signals;
+  std::vector<hwy::Span<const float>> inputs;
+  std::vector<FilterbankState> states;
+  std::vector<hwy::AlignedNDArray<float, 2>> out_signals;
+  std::vector<hwy::AlignedNDArray<float, 2>*> outputs;
+  for (size_t signal_index = 0; signal_index < num_signals; ++signal_index) {
+    in_signals.emplace_back(std::array<size_t, 1>{signal_length});
+    for (size_t sample_index = 0; sample_index < signal_length;
+         ++sample_index) {
+      in_signals.back()[{}][sample_index] =
+          std::sin(static_cast<float>(sample_index) * 2 * M_PI *
+                   (1000 + 500 * signal_index) / sample_rate);
+    }
+    states.push_back(filter.NewState());
+    out_signals.emplace_back(
+        std::array<size_t, 2>{signal_length, filter.Size()});
+  }
+  for (size_t signal_index = 0; signal_index < num_signals; ++signal_index) {
+    inputs.push_back(in_signals[signal_index][{}]);
+    outputs.push_back(&out_signals[signal_index]);
+  }
+
+  // Filter in two chunks to verify that the states are advanced.
+  const size_t chunk_length = signal_length / 2;
+  std::vector<hwy::Span<const float>> first_chunks;
+  std::vector<hwy::Span<const float>> second_chunks;
+  std::vector<hwy::AlignedNDArray<float, 2>> first_outputs;
+  std::vector<hwy::AlignedNDArray<float, 2>> second_outputs;
+  for (size_t signal_index = 0; signal_index < num_signals; ++signal_index) {
+    first_chunks.emplace_back(inputs[signal_index].data(), chunk_length);
+    second_chunks.emplace_back(inputs[signal_index].data() + chunk_length,
+                               signal_length - chunk_length);
+    first_outputs.emplace_back(
+        std::array<size_t, 2>{chunk_length, filter.Size()});
+    second_outputs.emplace_back(
+        std::array<size_t, 2>{signal_length - chunk_length, filter.Size()});
+  }
+  std::vector<hwy::AlignedNDArray<float, 2>*> first_output_pointers;
+  std::vector<hwy::AlignedNDArray<float, 2>*> second_output_pointers;
+  for (size_t signal_index = 0; signal_index < num_signals; ++signal_index) {
+    first_output_pointers.push_back(&first_outputs[signal_index]);
+    second_output_pointers.push_back(&second_outputs[signal_index]);
+  }
+  filter.FilterBatch(first_chunks, absl::MakeSpan(states),
+                     first_output_pointers);
+  filter.FilterBatch(second_chunks, absl::MakeSpan(states),
+                     second_output_pointers);
+
+  for (size_t signal_index = 0; signal_index < num_signals; ++signal_index) {
+    filter.Filter(inputs[signal_index], out_signals[signal_index]);
+    for (size_t sample_index = 0; sample_index < signal_length;
+         ++sample_index) {
+      const hwy::Span<float> batch_output =
+          sample_index < chunk_length
+              ? first_outputs[signal_index][{sample_index}]
+              : second_outputs[signal_index][{sample_index - chunk_length}];
+      for (size_t filter_index = 0; filter_index < filter.Size();
+           ++filter_index) {
+        ASSERT_EQ(batch_output[filter_index],
+                  (out_signals[signal_index][{sample_index}][filter_index]));
+      }
+    }
+  }
+}
+
+TEST(Filterbank, FilterEnergyTest) {
+  const size_t sample_rate = 48000;
+  // Not a multiple of the number of energy samples, to verify that the tail is
+  // handled like in ComputeEnergy.
+  const size_t signal_length = 4801;
+  const size_t num_energy_samples = 10;
+  const CamFilterbank cam_filterbank = Cam().CreateFilterbank(sample_rate);
+  const Filterbank& filter = cam_filterbank.filter;
+
+  hwy::AlignedNDArray<float, 1> in_signal({signal_length});
+  for (size_t sample_index = 0; sample_index < signal_length; ++sample_index) {
+    in_signal[{}][sample_index] = std::sin(static_cast<float>(sample_index) *
+                                           2 * M_PI * 1000 / sample_rate);
+  }
+
+  hwy::AlignedNDArray<float, 2> out_signal({signal_length, filter.Size()});
+  FilterbankState state = filter.NewState();
+  filter.Filter(in_signal[{}], state, out_signal);
+  hwy::AlignedNDArray<float, 2> want_energy(
+      {num_energy_samples, filter.Size()});
+  ComputeEnergy(out_signal, want_energy);
+
+  hwy::AlignedNDArray<float, 2> got_energy({num_energy_samples, filter.Size()});
+  FilterbankState energy_state = filter.NewState();
+  filter.FilterEnergy(in_signal[{}], energy_state, got_energy);
+
+  EXPECT_EQ(energy_state.global_sample_index, state.global_sample_index);
+  for (size_t sample_index = 0; sample_index < num_energy_samples;
+       ++sample_index) {
+    for (size_t filter_index = 0; filter_index < filter.Size();
+         ++filter_index) {
+      ASSERT_EQ(got_energy[{sample_index}][filter_index],
+                want_energy[{sample_index}][filter_index]);
+    }
+  }
+}
+
+TEST(Filterbank, FilterEnergyBatchTest) {
+  const size_t sample_rate = 48000;
+  const size_t signal_length = 4801;
+  const size_t num_energy_samples = 10;
+  // An odd number of signals, to verify that the odd signal out doesn't
+  // accumulate its energy twice.
+  const size_t num_signals = 3;
+  const CamFilterbank cam_filterbank = Cam().CreateFilterbank(sample_rate);
+  const Filterbank& filter = cam_filterbank.filter;
+
+  std::vector<hwy::AlignedNDArray<float, 1>> in_signals;
+  std::vector<hwy::Span<const float>> inputs;
+  std::vector<FilterbankState> states;
+  std::vector<hwy::AlignedNDArray<float, 2>> energies;
+  std::vector<hwy::AlignedNDArray<float, 2>*> energy_pointers;
+  for (size_t signal_index = 0; signal_index < num_signals; ++signal_index) {
+    in_signals.emplace_back(std::array<size_t, 1>{signal_length});
+    for (size_t sample_index = 0; sample_index < signal_length;
+         ++sample_index) {
+      in_signals.back()[{}][sample_index] =
+          std::sin(static_cast<float>(sample_index) * 2 * M_PI *
+                   (1000 + 500 * signal_index) / sample_rate);
+    }
+    states.push_back(filter.NewState());
+    energies.emplace_back(
+        std::array<size_t, 2>{num_energy_samples, filter.Size()});
+  }
+  for (size_t signal_index = 0; signal_index < num_signals; ++signal_index) {
+    inputs.push_back(in_signals[signal_index][{}]);
+    energy_pointers.push_back(&energies[signal_index]);
+  }
+  filter.FilterEnergyBatch(inputs, absl::MakeSpan(states), energy_pointers);
+
+  for (size_t signal_index = 0; signal_index < num_signals; ++signal_index) {
+    hwy::AlignedNDArray<float, 2> want_energy(
+        {num_energy_samples, filter.Size()});
+    FilterbankState state = filter.NewState();
+    filter.FilterEnergy(inputs[signal_index], state, want_energy);
+    EXPECT_EQ(states[signal_index].global_sample_index,
+              state.global_sample_index);
+    for (size_t sample_index = 0; sample_index < num_energy_samples;
+         ++sample_index) {
+      for (size_t filter_index = 0; filter_index < filter.Size();
+           ++filter_index) {
+        ASSERT_EQ((energies[signal_index][{sample_index}][filter_index]),
+                  (want_energy[{sample_index}][filter_index]));
+      }
+    }
+  }
+}
+
 void BM_Filterbank(benchmark::State& state) {
   const size_t sample_rate = 48000;
   const size_t filter_order = 3;
@@ -395,6 +667,103 @@ void BM_MultiSectionFilterbank(benchmark::State& state) {
 }
 BENCHMARK_RANGE(BM_MultiSectionFilterbank, 1, 64);
 
+void BM_FilterEnergy(benchmark::State& state) {
+  const size_t sample_rate = 48000;
+  const CamFilterbank cam_filterbank = Cam().CreateFilterbank(sample_rate);
+  const Filterbank& filter = cam_filterbank.filter;
+
+  hwy::AlignedNDArray<float, 1> in_signal(
+      {size_t(sample_rate * state.range(0))});
+  in_signal[{}][0] = 1;
+  hwy::AlignedNDArray<float, 2> energy_channels(
+      {size_t(100 * state.range(0)), filter.Size()});
+
+  for (auto s : state) {
+    FilterbankState filter_state = filter.NewState();
+    filter.FilterEnergy(in_signal[{}], filter_state, energy_channels);
+  }
+  state.SetItemsProcessed(in_signal.size() * filter.Size() *
+                          state.iterations());
+}
+BENCHMARK_RANGE(BM_FilterEnergy, 1, 64);
+
+void BM_FilterbankBatch(benchmark::State& state) {
+  const size_t sample_rate = 48000;
+  const size_t num_signals = state.range(0);
+  const CamFilterbank cam_filterbank = Cam().CreateFilterbank(sample_rate);
+  const Filterbank& filter = cam_filterbank.filter;
+
+  hwy::AlignedNDArray<float, 1> in_signal({sample_rate});
+  in_signal[{}][0] = 1;
+  std::vector<hwy::Span<const float>> inputs(num_signals, in_signal[{}]);
+  std::vector<FilterbankState> states;
+  std::vector<hwy::AlignedNDArray<float, 2>> out_signals;
+  for (size_t signal_index = 0; signal_index < num_signals; ++signal_index) {
+    states.push_back(filter.NewState());
+    out_signals.emplace_back(std::array<size_t, 2>{sample_rate, filter.Size()});
+  }
+  std::vector<hwy::AlignedNDArray<float, 2>*> outputs;
+  for (auto& out_signal : out_signals) {
+    outputs.push_back(&out_signal);
+  }
+
+  for (auto s : state) {
+    filter.FilterBatch(inputs, absl::MakeSpan(states), outputs);
+  }
+  state.SetItemsProcessed(num_signals * sample_rate * filter.Size() *
+                          state.iterations());
+}
+BENCHMARK_RANGE(BM_FilterbankBatch, 1, 16);
+
+void BM_FilterEnergyBatch(benchmark::State& state) {
+  const size_t sample_rate = 48000;
+  const size_t num_signals = state.range(0);
+  const CamFilterbank cam_filterbank = Cam().CreateFilterbank(sample_rate);
+  const Filterbank& filter = cam_filterbank.filter;
+
+  hwy::AlignedNDArray<float, 1> in_signal({sample_rate});
+  in_signal[{}][0] = 1;
+  std::vector<hwy::Span<const float>> inputs(num_signals, in_signal[{}]);
+  std::vector<FilterbankState> states;
+  std::vector<hwy::AlignedNDArray<float, 2>> energy_channels;
+  for (size_t signal_index = 0; signal_index < num_signals; ++signal_index) {
+    states.push_back(filter.NewState());
+    energy_channels.emplace_back(std::array<size_t, 2>{100, filter.Size()});
+  }
+  std::vector<hwy::AlignedNDArray<float, 2>*> energy_pointers;
+  for (auto& energy : energy_channels) {
+    energy_pointers.push_back(&energy);
+  }
+
+  for (auto s : state) {
+    filter.FilterEnergyBatch(inputs, absl::MakeSpan(states), energy_pointers);
+  }
+  state.SetItemsProcessed(num_signals * sample_rate * filter.Size() *
+                          state.iterations());
+}
+BENCHMARK_RANGE(BM_FilterEnergyBatch, 1, 16);
+
+void BM_ThreadedFilterbank(benchmark::State& state) {
+  const size_t sample_rate = 48000;
+  const size_t num_threads = 8;
+
+  hwy::AlignedNDArray<float, 1> in_signal(
+      {size_t(sample_rate * state.range(0))});
+  in_signal[{}][0] = 1;
+
+  Cam cam;
+  const CamFilterbank cam_filterbank = cam.CreateFilterbank(sample_rate);
+  hwy::AlignedNDArray<float, 2> out_signals(
+      {in_signal.shape()[0], cam_filterbank.filter.Size()});
+
+  for (auto s : state) {
+    cam_filterbank.filter.Filter(in_signal[{}], num_threads,
+                                 /*preroll_samples=*/sample_rate, out_signals);
+  }
+  state.SetItemsProcessed(out_signals.size() * state.iterations());
+}
+BENCHMARK_RANGE(BM_ThreadedFilterbank, 1, 64);
+
 }  // namespace
 
 }  // namespace zimtohrli
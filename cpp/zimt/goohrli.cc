@@ -16,17 +16,25 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <memory>
+#include <optional>
 #include <utility>
+#include <vector>
 
 #include "absl/log/check.h"
 #include "absl/status/statusor.h"
 #include "absl/types/span.h"
 #include "hwy/aligned_allocator.h"
 #include "hwy/base.h"
+#include "zimt/analysis_file.h"
+#include "zimt/audio.h"
 #include "zimt/cam.h"
 #include "zimt/masking.h"
 #include "zimt/mos.h"
+#include "zimt/stats.h"
+#include "zimt/thread_pool.h"
 #include "zimt/visqol.h"
 #include "zimt/zimtohrli.h"
 
@@ -46,10 +54,8 @@ int NumLoudnessTFParams() {
 }
 
 EnergyAndMaxAbsAmplitude Measure(const float* signal, int size) {
-  hwy::AlignedNDArray<float, 1> signal_array({static_cast<size_t>(size)});
-  hwy::CopyBytes(signal, signal_array.data(), size * sizeof(float));
-  const zimtohrli::EnergyAndMaxAbsAmplitude measurements =
-      zimtohrli::Measure(signal_array[{}]);
+  const zimtohrli::EnergyAndMaxAbsAmplitude measurements = zimtohrli::Measure(
+      hwy::Span<const float>(signal, static_cast<size_t>(size)));
   return EnergyAndMaxAbsAmplitude{
       .EnergyDBFS = measurements.energy_db_fs,
       .MaxAbsAmplitude = measurements.max_abs_amplitude};
@@ -57,11 +63,10 @@ EnergyAndMaxAbsAmplitude Measure(const float* signal, int size) {
 
 EnergyAndMaxAbsAmplitude NormalizeAmplitude(float max_abs_amplitude,
                                             float* signal, int size) {
-  hwy::AlignedNDArray<float, 1> signal_array({static_cast<size_t>(size)});
-  hwy::CopyBytes(signal, signal_array.data(), size * sizeof(float));
   const zimtohrli::EnergyAndMaxAbsAmplitude measurements =
-      zimtohrli::NormalizeAmplitude(max_abs_amplitude, signal_array[{}]);
-  hwy::CopyBytes(signal_array.data(), signal, size * sizeof(float));
+      zimtohrli::NormalizeAmplitude(
+          max_abs_amplitude,
+          hwy::Span<float>(signal, static_cast<size_t>(size)));
   return EnergyAndMaxAbsAmplitude{
       .EnergyDBFS = measurements.energy_db_fs,
       .MaxAbsAmplitude = measurements.max_abs_amplitude};
@@ -88,30 +93,249 @@ void FreeZimtohrli(Zimtohrli zimtohrli) {
   delete static_cast<zimtohrli::Zimtohrli*>(zimtohrli);
 }
 
+int NumChannels(Zimtohrli zimtohrli) {
+  return static_cast<int>(
+      static_cast<zimtohrli::Zimtohrli*>(zimtohrli)->NumChannels());
+}
+
+namespace {
+
+// What the C Analysis points to: either a full analysis, a compact analysis,
+// or a spectrogram loaded from an analysis file.
+struct StoredAnalysis {
+  std::optional<zimtohrli::Analysis> full;
+  std::optional<zimtohrli::CompactAnalysis> compact;
+  std::optional<hwy::AlignedNDArray<float, 2>> spectrogram;
+};
+
+// Analyzes the Go slice at data in place, without copying it.
+zimtohrli::Analysis AnalyzeData(const zimtohrli::Zimtohrli& z,
+                                const float* data, int size) {
+  return z.Analyze(hwy::Span<const float>(data, static_cast<size_t>(size)));
+}
+
+// Returns the spectrogram of analysis, widened into storage if the analysis is
+// compact.
+const hwy::AlignedNDArray<float, 2>& SpectrogramOf(
+    const StoredAnalysis& analysis,
+    std::optional<hwy::AlignedNDArray<float, 2>>& storage) {
+  if (analysis.full.has_value()) {
+    return analysis.full->spectrogram;
+  }
+  if (analysis.spectrogram.has_value()) {
+    return *analysis.spectrogram;
+  }
+  storage = zimtohrli::WidenSpectrogram(*analysis.compact);
+  return *storage;
+}
+
+}  // namespace
+
 Analysis Analyze(Zimtohrli zimtohrli, float* data, int size) {
   zimtohrli::Zimtohrli* z = static_cast<zimtohrli::Zimtohrli*>(zimtohrli);
-  hwy::AlignedNDArray<float, 1> signal({static_cast<size_t>(size)});
-  hwy::CopyBytes(data, signal.data(), size * sizeof(float));
-  hwy::AlignedNDArray<float, 2> channels(
-      {signal.shape()[0], z->cam_filterbank->filter.Size()});
-  zimtohrli::Analysis analysis = z->Analyze(signal[{}], channels);
-  return new zimtohrli::Analysis{
-      .energy_channels_db = std::move(analysis.energy_channels_db),
-      .partial_energy_channels_db =
-          std::move(analysis.partial_energy_channels_db),
-      .spectrogram = std::move(analysis.spectrogram)};
+  return new StoredAnalysis{.full = AnalyzeData(*z, data, size)};
+}
+
+Analysis AnalyzeCompact(Zimtohrli zimtohrli, float* data, int size) {
+  zimtohrli::Zimtohrli* z = static_cast<zimtohrli::Zimtohrli*>(zimtohrli);
+  return new StoredAnalysis{
+      .compact = zimtohrli::Compact(AnalyzeData(*z, data, size))};
 }
 
-void FreeAnalysis(Analysis a) { delete static_cast<zimtohrli::Analysis*>(a); }
+void FreeAnalysis(Analysis a) { delete static_cast<StoredAnalysis*>(a); }
+
+Energy ChannelEnergy(Zimtohrli zimtohrli, float* data, int size) {
+  zimtohrli::Zimtohrli* z = static_cast<zimtohrli::Zimtohrli*>(zimtohrli);
+  return new hwy::AlignedNDArray<float, 2>(
+      z->Energy(hwy::Span<const float>(data, static_cast<size_t>(size))));
+}
+
+void FreeEnergy(Energy e) {
+  delete static_cast<hwy::AlignedNDArray<float, 2>*>(e);
+}
+
+Analysis AnalyzeEnergy(Zimtohrli zimtohrli, Energy energy) {
+  zimtohrli::Zimtohrli* z = static_cast<zimtohrli::Zimtohrli*>(zimtohrli);
+  return new StoredAnalysis{.full = z->AnalyzeEnergy(
+                                *static_cast<hwy::AlignedNDArray<float, 2>*>(
+                                    energy))};
+}
 
 float AnalysisDistance(Zimtohrli zimtohrli, Analysis a, Analysis b) {
   zimtohrli::Zimtohrli* z = static_cast<zimtohrli::Zimtohrli*>(zimtohrli);
-  zimtohrli::Analysis* analysis_a = static_cast<zimtohrli::Analysis*>(a);
-  zimtohrli::Analysis* analysis_b = static_cast<zimtohrli::Analysis*>(b);
-  return z->Distance(false, analysis_a->spectrogram, analysis_b->spectrogram)
+  std::optional<hwy::AlignedNDArray<float, 2>> storage_a;
+  std::optional<hwy::AlignedNDArray<float, 2>> storage_b;
+  return z
+      ->Distance(false,
+                 SpectrogramOf(*static_cast<StoredAnalysis*>(a), storage_a),
+                 SpectrogramOf(*static_cast<StoredAnalysis*>(b), storage_b))
       .value;
 }
 
+int AnalysisDistanceBelow(Zimtohrli zimtohrli, Analysis a, Analysis b,
+                          float threshold) {
+  zimtohrli::Zimtohrli* z = static_cast<zimtohrli::Zimtohrli*>(zimtohrli);
+  std::optional<hwy::AlignedNDArray<float, 2>> storage_a;
+  std::optional<hwy::AlignedNDArray<float, 2>> storage_b;
+  return z->DistanceBelow(
+             SpectrogramOf(*static_cast<StoredAnalysis*>(a), storage_a),
+             SpectrogramOf(*static_cast<StoredAnalysis*>(b), storage_b),
+             threshold)
+             ? 1
+             : 0;
+}
+
+float ReferenceDistance(Zimtohrli zimtohrli, Analysis reference, float* data,
+                        int size) {
+  zimtohrli::Zimtohrli* z = static_cast<zimtohrli::Zimtohrli*>(zimtohrli);
+  std::optional<hwy::AlignedNDArray<float, 2>> storage;
+  const hwy::AlignedNDArray<float, 2>& spectrogram_a =
+      SpectrogramOf(*static_cast<StoredAnalysis*>(reference), storage);
+  const zimtohrli::Analysis analysis_b = AnalyzeData(*z, data, size);
+  return z->Distance(false, spectrogram_a, analysis_b.spectrogram).value;
+}
+
+void ReferenceDistances(Zimtohrli zimtohrli, Analysis reference,
+                        const float* const* data, const int* sizes,
+                        int num_signals, int num_threads, float* distances) {
+  const zimtohrli::Zimtohrli* z =
+      static_cast<zimtohrli::Zimtohrli*>(zimtohrli);
+  std::optional<hwy::AlignedNDArray<float, 2>> storage;
+  const hwy::AlignedNDArray<float, 2>& spectrogram_a =
+      SpectrogramOf(*static_cast<StoredAnalysis*>(reference), storage);
+  zimtohrli::ThreadPool pool(num_threads);
+  std::vector<zimtohrli::ZimtohrliWorkspace> workspaces(pool.NumThreads());
+  pool.ParallelFor(num_signals, [&](size_t index, size_t thread_index) {
+    zimtohrli::ZimtohrliWorkspace& workspace = workspaces[thread_index];
+    z->Analyze(
+        hwy::Span<const float>(data[index], static_cast<size_t>(sizes[index])),
+        workspace, workspace.analysis_b);
+    distances[index] = z->Distance(false, spectrogram_a,
+                                   workspace.analysis_b->spectrogram, workspace)
+                           .value;
+  });
+}
+
+void PairDistances(Zimtohrli zimtohrli, const float* const* data_a,
+                   const int* sizes_a, const float* const* data_b,
+                   const int* sizes_b, int num_pairs, int num_threads,
+                   float* distances) {
+  const zimtohrli::Zimtohrli* z =
+      static_cast<zimtohrli::Zimtohrli*>(zimtohrli);
+  zimtohrli::ThreadPool pool(num_threads);
+  std::vector<zimtohrli::ZimtohrliWorkspace> workspaces(pool.NumThreads());
+  pool.ParallelFor(num_pairs, [&](size_t index, size_t thread_index) {
+    distances[index] = z->Distance(
+        hwy::Span<const float>(data_a[index],
+                               static_cast<size_t>(sizes_a[index])),
+        hwy::Span<const float>(data_b[index],
+                               static_cast<size_t>(sizes_b[index])),
+        workspaces[thread_index]);
+  });
+}
+
+void DistanceMatrix(Zimtohrli zimtohrli, const Analysis* analyses,
+                    int num_analyses, int num_threads, float* distances) {
+  const zimtohrli::Zimtohrli* z =
+      static_cast<zimtohrli::Zimtohrli*>(zimtohrli);
+  std::vector<std::optional<hwy::AlignedNDArray<float, 2>>> storage(
+      num_analyses);
+  std::vector<const hwy::AlignedNDArray<float, 2>*> spectrograms;
+  for (int index = 0; index < num_analyses; ++index) {
+    spectrograms.push_back(&SpectrogramOf(
+        *static_cast<StoredAnalysis*>(analyses[index]), storage[index]));
+  }
+  zimtohrli::ThreadPool pool(num_threads);
+  const hwy::AlignedNDArray<float, 2> matrix =
+      z->DistanceMatrix(spectrograms, pool);
+  for (int row = 0; row < num_analyses; ++row) {
+    hwy::CopyBytes(matrix[{static_cast<size_t>(row)}].data(),
+                   distances + row * num_analyses,
+                   num_analyses * sizeof(float));
+  }
+}
+
+uint64_t AnalysisFingerprint(Zimtohrli zimtohrli) {
+  return zimtohrli::AnalysisFingerprint(
+      *static_cast<zimtohrli::Zimtohrli*>(zimtohrli));
+}
+
+int WriteAnalysis(Zimtohrli zimtohrli, Analysis analysis, const char* path) {
+  const zimtohrli::Zimtohrli* z =
+      static_cast<zimtohrli::Zimtohrli*>(zimtohrli);
+  std::optional<hwy::AlignedNDArray<float, 2>> storage;
+  return static_cast<int>(
+      zimtohrli::WriteAnalysisFile(
+          path, zimtohrli::AnalysisFingerprint(*z), z->perceptual_sample_rate,
+          SpectrogramOf(*static_cast<StoredAnalysis*>(analysis), storage))
+          .code());
+}
+
+int WriteFilterbankCache(const char* path) {
+  return static_cast<int>(zimtohrli::WriteFilterbankCache(path).code());
+}
+
+int ReadFilterbankCache(const char* path) {
+  return static_cast<int>(zimtohrli::ReadFilterbankCache(path).code());
+}
+
+int OpenAudioReader(const char* path, AudioReader* reader) {
+  absl::StatusOr<zimtohrli::AudioFileReader> opened =
+      zimtohrli::AudioFileReader::Open(path);
+  if (!opened.ok()) {
+    return static_cast<int>(opened.status().code());
+  }
+  *reader = new zimtohrli::AudioFileReader(*std::move(opened));
+  return 0;
+}
+
+void FreeAudioReader(AudioReader reader) {
+  delete static_cast<zimtohrli::AudioFileReader*>(reader);
+}
+
+int AudioReaderNumChannels(AudioReader reader) {
+  return static_cast<int>(
+      static_cast<zimtohrli::AudioFileReader*>(reader)->NumChannels());
+}
+
+int64_t AudioReaderNumFrames(AudioReader reader) {
+  return static_cast<int64_t>(
+      static_cast<zimtohrli::AudioFileReader*>(reader)->NumFrames());
+}
+
+float AudioReaderSampleRate(AudioReader reader) {
+  return static_cast<zimtohrli::AudioFileReader*>(reader)->SampleRate();
+}
+
+int ReadAudio(AudioReader reader, float* data, int64_t max_frames,
+              int64_t* num_read) {
+  zimtohrli::AudioFileReader& r =
+      *static_cast<zimtohrli::AudioFileReader*>(reader);
+  const size_t num_frames = static_cast<size_t>(max_frames);
+  // Each channel of data is max_frames samples long.
+  const absl::StatusOr<size_t> total_read =
+      r.Read(num_frames, num_frames, data);
+  if (!total_read.ok()) {
+    return static_cast<int>(total_read.status().code());
+  }
+  *num_read = static_cast<int64_t>(*total_read);
+  return 0;
+}
+
+Analysis AnalysisFromSpectrogram(const float* data, int num_steps,
+                                 int num_channels, int row_stride) {
+  CHECK_GE(row_stride, num_channels);
+  hwy::AlignedNDArray<float, 2> spectrogram(
+      {static_cast<size_t>(num_steps), static_cast<size_t>(num_channels)});
+  for (size_t step_index = 0; step_index < spectrogram.shape()[0];
+       ++step_index) {
+    hwy::CopyBytes(data + step_index * row_stride,
+                   spectrogram[{step_index}].data(),
+                   num_channels * sizeof(float));
+  }
+  return new StoredAnalysis{.spectrogram = std::move(spectrogram)};
+}
+
 ZimtohrliParameters GetZimtohrliParameters(const Zimtohrli zimtohrli) {
   zimtohrli::Zimtohrli* z = static_cast<zimtohrli::Zimtohrli*>(zimtohrli);
   ZimtohrliParameters result;
@@ -124,6 +348,7 @@ ZimtohrliParameters GetZimtohrliParameters(const Zimtohrli zimtohrli) {
   result.FullScaleSineDB = z->full_scale_sine_db;
   result.ApplyLoudness = z->apply_loudness;
   result.UnwarpWindowSeconds = z->unwarp_window_seconds;
+  result.UnwarpCorridorSeconds = z->unwarp_corridor_seconds;
   result.NSIMStepWindow = z->nsim_step_window;
   result.NSIMChannelWindow = z->nsim_channel_window;
   const zimtohrli::Masking& m = z->masking;
@@ -154,6 +379,7 @@ void SetZimtohrliParameters(Zimtohrli zimtohrli,
   z->nsim_step_window = parameters.NSIMStepWindow;
   z->nsim_channel_window = parameters.NSIMChannelWindow;
   z->unwarp_window_seconds = parameters.UnwarpWindowSeconds;
+  z->unwarp_corridor_seconds = parameters.UnwarpCorridorSeconds;
   z->masking.lower_zero_at_20 = parameters.MaskingLowerZeroAt20;
   z->masking.lower_zero_at_80 = parameters.MaskingLowerZeroAt80;
   z->masking.upper_zero_at_20 = parameters.MaskingUpperZeroAt20;
@@ -167,6 +393,37 @@ void SetZimtohrliParameters(Zimtohrli zimtohrli,
               sizeof(parameters.LoudnessTFParams));
 }
 
+void EnableZimtohrliStats(Zimtohrli zimtohrli) {
+  static_cast<zimtohrli::Zimtohrli*>(zimtohrli)->stats =
+      std::make_shared<zimtohrli::ZimtohrliStats>();
+}
+
+namespace {
+
+StageStats GetStageStats(const zimtohrli::StageStats& stage) {
+  return StageStats{
+      .Seconds = static_cast<double>(stage.nanoseconds.load()) * 1e-9,
+      .Calls = static_cast<int64_t>(stage.calls.load()),
+      .Samples = static_cast<int64_t>(stage.samples.load()),
+      .BytesAllocated = static_cast<int64_t>(stage.bytes_allocated.load())};
+}
+
+}  // namespace
+
+ZimtohrliStats GetZimtohrliStats(const Zimtohrli zimtohrli) {
+  const zimtohrli::ZimtohrliStats* stats =
+      static_cast<const zimtohrli::Zimtohrli*>(zimtohrli)->stats.get();
+  if (stats == nullptr) {
+    return ZimtohrliStats{};
+  }
+  return ZimtohrliStats{.Filterbank = GetStageStats(stats->filterbank),
+                        .Masking = GetStageStats(stats->masking),
+                        .Loudness = GetStageStats(stats->loudness),
+                        .DTW = GetStageStats(stats->dtw),
+                        .NSIM = GetStageStats(stats->nsim),
+                        .DTWCells = static_cast<int64_t>(stats->dtw_cells)};
+}
+
 ZimtohrliParameters DefaultZimtohrliParameters(float sample_rate) {
   zimtohrli::Zimtohrli default_zimtohrli{
       .cam_filterbank = zimtohrli::Cam{}.CreateFilterbank(sample_rate)};
@@ -189,4 +446,30 @@ MOSResult MOS(const ViSQOL v, float sample_rate, const float* reference,
     return MOSResult{.MOS = 0.0,
                      .Status = static_cast<int>(result.status().code())};
   }
+}
+
+ViSQOLReference CreateViSQOLReference(const ViSQOL v, float sample_rate,
+                                      const float* reference,
+                                      int reference_size) {
+  const zimtohrli::ViSQOL* visqol = static_cast<const zimtohrli::ViSQOL*>(v);
+  return new zimtohrli::ViSQOL::Reference(visqol->PrepareReference(
+      absl::Span<const float>(reference, reference_size), sample_rate));
+}
+
+void FreeViSQOLReference(ViSQOLReference r) {
+  delete static_cast<zimtohrli::ViSQOL::Reference*>(r);
+}
+
+MOSResult ReferenceMOS(const ViSQOL v, const ViSQOLReference r,
+                       const float* distorted, int distorted_size) {
+  const zimtohrli::ViSQOL* visqol = static_cast<const zimtohrli::ViSQOL*>(v);
+  const absl::StatusOr<float> result =
+      visqol->MOS(*static_cast<const zimtohrli::ViSQOL::Reference*>(r),
+                  absl::Span<const float>(distorted, distorted_size));
+  if (result.ok()) {
+    return MOSResult{.MOS = result.value(), .Status = 0};
+  } else {
+    return MOSResult{.MOS = 0.0,
+                     .Status = static_cast<int>(result.status().code())};
+  }
 }
\ No newline at end of file
@@ -0,0 +1,379 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "zimt/incremental.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "hwy/aligned_allocator.h"
+#include "hwy/base.h"
+#include "zimt/dtw.h"
+#include "zimt/filterbank.h"
+#include "zimt/nsim.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+namespace {
+
+// Returns the number of time steps of Zimtohrli::Analyze of num_samples
+// samples.
+size_t NumSteps(const Zimtohrli& zimtohrli, size_t num_samples) {
+  return static_cast<size_t>(std::max(
+      1.0f, std::ceil(static_cast<float>(num_samples) *
+                      zimtohrli.perceptual_sample_rate /
+                      zimtohrli.cam_filterbank->sample_rate)));
+}
+
+// Returns an Analysis with arrays shaped to hold num_steps time steps.
+Analysis NewBlock(const Zimtohrli& zimtohrli, size_t num_steps) {
+  return {.energy_channels_db = hwy::AlignedNDArray<float, 2>(
+              {num_steps, zimtohrli.NumChannels()}),
+          .partial_energy_channels_db = hwy::AlignedNDArray<float, 2>(
+              {num_steps, zimtohrli.NumChannels()}),
+          .spectrogram = hwy::AlignedNDArray<float, 2>(
+              {num_steps, zimtohrli.NumChannels()})};
+}
+
+// Returns the number of time steps from the last checkpoint to the end of
+// num_steps time steps.
+size_t LastBlockSteps(size_t num_steps, size_t checkpoint_steps) {
+  CHECK_GT(checkpoint_steps, 0);
+  return (num_steps - 1) % checkpoint_steps + 1;
+}
+
+void CopyState(const FilterbankState& source, FilterbankState& destination) {
+  hwy::CopyBytes(source.x_buffer.data(), destination.x_buffer.data(),
+                 source.x_buffer.memory_size() * sizeof(float));
+  hwy::CopyBytes(source.y_buffer.data(), destination.y_buffer.data(),
+                 source.y_buffer.memory_size() * sizeof(float));
+  destination.global_sample_index = source.global_sample_index;
+}
+
+// Returns whether the state of each filter in state differs less than
+// tolerance times the largest magnitude in the state of the same filter in
+// reference, or in the state of a filter with floor magnitude.
+//
+// The magnitudes include the inputs of the filter, since the rounding
+// errors of the recurrence are relative to them.
+bool StatesMatch(const FilterbankState& state,
+                 const FilterbankState& reference, size_t num_filters,
+                 float tolerance, float floor) {
+  if (state.global_sample_index != reference.global_sample_index) {
+    return false;
+  }
+  std::vector<float> max_difference(num_filters, 0.0f);
+  std::vector<float> max_magnitude(num_filters, floor);
+  for (const auto& [values, reference_values] :
+       {std::pair(&state.x_buffer, &reference.x_buffer),
+        std::pair(&state.y_buffer, &reference.y_buffer)}) {
+    for (size_t section_index = 0; section_index < values->shape()[0];
+         ++section_index) {
+      for (size_t coeff_index = 0; coeff_index < values->shape()[1];
+           ++coeff_index) {
+        const float* value_data =
+            (*values)[{section_index, coeff_index}].data();
+        const float* reference_data =
+            (*reference_values)[{section_index, coeff_index}].data();
+        for (size_t filter_index = 0; filter_index < num_filters;
+             ++filter_index) {
+          max_difference[filter_index] =
+              std::max(max_difference[filter_index],
+                       std::abs(value_data[filter_index] -
+                                reference_data[filter_index]));
+          max_magnitude[filter_index] =
+              std::max(max_magnitude[filter_index],
+                       std::abs(reference_data[filter_index]));
+        }
+      }
+    }
+  }
+  for (size_t filter_index = 0; filter_index < num_filters; ++filter_index) {
+    if (max_difference[filter_index] >
+        tolerance * max_magnitude[filter_index]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+IncrementalDistance::IncrementalDistance(const Zimtohrli& zimtohrli,
+                                         hwy::Span<const float> signal_a,
+                                         hwy::Span<const float> signal_b,
+                                         IncrementalParameters parameters)
+    : zimtohrli_(zimtohrli),
+      parameters_(parameters),
+      step_samples_(signal_b.size() / NumSteps(zimtohrli, signal_b.size())),
+      loudness_coefficients_(zimtohrli.loudness.Coefficients(
+          zimtohrli.cam_filterbank->thresholds_hz)),
+      spectrogram_a_(zimtohrli.Analyze(signal_a).spectrogram),
+      signal_b_(signal_b.data(), signal_b.data() + signal_b.size()),
+      spectrogram_b_(
+          {NumSteps(zimtohrli, signal_b.size()), zimtohrli.NumChannels()}),
+      state_(zimtohrli.cam_filterbank->filter.NewState()),
+      block_(NewBlock(zimtohrli, parameters.checkpoint_steps)),
+      last_block_(NewBlock(zimtohrli,
+                           LastBlockSteps(spectrogram_b_.shape()[0],
+                                          parameters.checkpoint_steps))),
+      nsim_(zimtohrli.NumChannels(),
+            std::min(spectrogram_a_.shape()[0], zimtohrli.nsim_step_window),
+            std::min(zimtohrli.NumChannels(), zimtohrli.nsim_channel_window)) {
+  CHECK(zimtohrli.decimated_filterbank == nullptr);
+  const size_t num_steps = spectrogram_b_.shape()[0];
+  if (zimtohrli.unwarp_window_seconds == 0) {
+    CHECK_EQ(spectrogram_a_.shape()[0], num_steps);
+  }
+  const size_t num_checkpoints =
+      (num_steps + parameters.checkpoint_steps - 1) /
+      parameters.checkpoint_steps;
+  checkpoints_.reserve(num_checkpoints);
+  for (size_t checkpoint_index = 0; checkpoint_index < num_checkpoints;
+       ++checkpoint_index) {
+    checkpoints_.push_back(zimtohrli.cam_filterbank->filter.NewState());
+  }
+  RefilterB(0, signal_b_.size());
+  UpdateNSIM(UpdateTimePairs(0, num_steps));
+}
+
+IncrementalDistance::IncrementalDistance(const Zimtohrli& zimtohrli,
+                                         hwy::Span<const float> signal_a,
+                                         hwy::Span<const float> signal_b)
+    : IncrementalDistance(zimtohrli, signal_a, signal_b,
+                          IncrementalParameters{}) {}
+
+float IncrementalDistance::Update(size_t first_sample,
+                                  hwy::Span<const float> samples) {
+  CHECK_LE(first_sample + samples.size(), signal_b_.size());
+  std::copy(samples.data(), samples.data() + samples.size(),
+            signal_b_.begin() + first_sample);
+  const size_t first_step = first_sample / step_samples_;
+  if (samples.size() == 0 || first_step >= spectrogram_b_.shape()[0]) {
+    // Samples past the last time step only affect filter outputs that
+    // Zimtohrli::Analyze discards.
+    last_recomputed_ = {};
+    return Value();
+  }
+  const size_t end_step =
+      RefilterB(first_step, first_sample + samples.size());
+  UpdateNSIM(UpdateTimePairs(first_step, end_step));
+  return Value();
+}
+
+float IncrementalDistance::Value() const {
+  // Computed like the value of Zimtohrli::Distance.
+  return 1.0f - static_cast<float>(
+                    nsim_sum_ / static_cast<double>(pair_nsim_.size() *
+                                                    nsim_.NumChannels()));
+}
+
+size_t IncrementalDistance::RefilterB(size_t first_step, size_t end_sample) {
+  const Filterbank& filter = zimtohrli_.cam_filterbank->filter;
+  const size_t num_steps = spectrogram_b_.shape()[0];
+  const size_t checkpoint_steps = parameters_.checkpoint_steps;
+  const float magnitude_floor = std::sqrt(zimtohrli_.epsilon);
+  size_t checkpoint_index = first_step / checkpoint_steps;
+  last_recomputed_.first_step = checkpoint_index * checkpoint_steps;
+  CopyState(checkpoints_[checkpoint_index], state_);
+  while (true) {
+    const size_t block_begin = checkpoint_index * checkpoint_steps;
+    const size_t block_end =
+        std::min(num_steps, block_begin + checkpoint_steps);
+    Analysis& block =
+        checkpoint_index + 1 == checkpoints_.size() ? last_block_ : block_;
+    // Each block has exactly block_end - block_begin time steps of
+    // step_samples_ samples, so it is filtered and downscaled exactly like
+    // the same samples in Zimtohrli::Analyze.
+    filter.FilterEnergy(
+        hwy::Span<const float>(signal_b_.data() + block_begin * step_samples_,
+                               (block_end - block_begin) * step_samples_),
+        state_, block.energy_channels_db);
+    zimtohrli_.SpectrogramFromEnergy(block.energy_channels_db,
+                                     block.partial_energy_channels_db,
+                                     block.spectrogram,
+                                     loudness_coefficients_);
+    for (size_t step_index = block_begin; step_index < block_end;
+         ++step_index) {
+      hwy::CopyBytes(block.spectrogram[{step_index - block_begin}].data(),
+                     spectrogram_b_[{step_index}].data(),
+                     spectrogram_b_.shape()[1] * sizeof(float));
+    }
+    ++checkpoint_index;
+    if (checkpoint_index == checkpoints_.size() ||
+        (block_end * step_samples_ >= end_sample &&
+         StatesMatch(state_, checkpoints_[checkpoint_index], filter.Size(),
+                     parameters_.state_tolerance, magnitude_floor))) {
+      last_recomputed_.end_step = block_end;
+      return block_end;
+    }
+    CopyState(state_, checkpoints_[checkpoint_index]);
+  }
+}
+
+size_t IncrementalDistance::UpdateTimePairs(size_t first_step,
+                                            size_t end_step) {
+  const size_t num_steps = spectrogram_b_.shape()[0];
+  const size_t previous_num_pairs = time_pairs_.size();
+  if (zimtohrli_.unwarp_window_seconds == 0) {
+    if (time_pairs_.empty()) {
+      for (size_t step_index = 0; step_index < num_steps; ++step_index) {
+        time_pairs_.push_back({step_index, step_index});
+      }
+      last_recomputed_.first_pair = 0;
+      last_recomputed_.end_pair = num_steps;
+      return 0;
+    }
+    last_recomputed_.first_pair = first_step;
+    last_recomputed_.end_pair = end_step;
+    return end_step;
+  }
+  const auto [window_size, warp_radius] = zimtohrli_.DTWWindowAndRadius();
+  // The range of time steps of A whose corridor changed, which the windows
+  // covering them have to be recomputed for even if they only cover unchanged
+  // time steps of B.
+  size_t first_corridor_change = std::numeric_limits<size_t>::max();
+  size_t end_corridor_change = 0;
+  std::optional<ChainDTWIterator> iterator;
+  if (const size_t corridor_radius = zimtohrli_.DTWCorridorRadius();
+      corridor_radius == 0) {
+    iterator.emplace(spectrogram_a_, spectrogram_b_, window_size, warp_radius,
+                     dtw_workspace_);
+  } else {
+    // The corridor follows the decimated dynamic time warp of all of B, so it
+    // is recomputed, and compared to the previous one.
+    const std::vector<std::pair<size_t, size_t>> previous_corridor =
+        dtw_workspace_.corridor;
+    CoarseToFineCorridor(spectrogram_a_, spectrogram_b_, window_size,
+                         warp_radius, corridor_radius, dtw_workspace_);
+    const std::vector<std::pair<size_t, size_t>>& corridor =
+        dtw_workspace_.corridor;
+    for (size_t step_index = 0; step_index < corridor.size(); ++step_index) {
+      if (previous_corridor.size() != corridor.size() ||
+          previous_corridor[step_index] != corridor[step_index]) {
+        first_corridor_change = std::min(first_corridor_change, step_index);
+        end_corridor_change = step_index + 1;
+      }
+    }
+    iterator.emplace(spectrogram_a_, spectrogram_b_, window_size, warp_radius,
+                     corridor, dtw_workspace_);
+  }
+  std::vector<std::pair<size_t, size_t>> previous_pairs;
+  std::vector<Window> previous_windows;
+  if (time_pairs_.empty()) {
+    time_pairs_.push_back({0, 0});
+    last_recomputed_.first_pair = 0;
+  } else {
+    // The first window covering first_step of B, or a step of A whose
+    // corridor changed, since the windows are ordered by offset.
+    const size_t first_window =
+        std::partition_point(windows_.begin(), windows_.end(),
+                             [&](const Window& window) {
+                               return window.offset.second + window_size <=
+                                          first_step &&
+                                      window.offset.first + window_size <=
+                                          first_corridor_change;
+                             }) -
+        windows_.begin();
+    if (first_window == windows_.size()) {
+      // The chain ended at the end of A before reaching first_step.
+      last_recomputed_.first_pair = previous_num_pairs;
+      last_recomputed_.end_pair = previous_num_pairs;
+      return previous_num_pairs;
+    }
+    previous_pairs = time_pairs_;
+    previous_windows = windows_;
+    iterator->Seek(windows_[first_window].offset);
+    time_pairs_.resize(windows_[first_window].first_pair);
+    windows_.resize(first_window);
+    last_recomputed_.first_pair = time_pairs_.size();
+  }
+  while (!iterator->Done()) {
+    const std::pair<size_t, size_t> offset = iterator->Offset();
+    if (offset.second >= end_step && offset.first >= end_corridor_change) {
+      // A window starting after the changed time steps and corridor only sees
+      // unchanged time steps, so if a previous window started at the same
+      // time pair the rest of the chain is the same as before.
+      const auto reused = std::lower_bound(
+          previous_windows.begin(), previous_windows.end(), offset,
+          [](const Window& window, const std::pair<size_t, size_t>& offset) {
+            return window.offset < offset;
+          });
+      if (reused != previous_windows.end() && reused->offset == offset) {
+        const size_t previous_end_pair = reused->first_pair;
+        last_recomputed_.end_pair = time_pairs_.size();
+        for (auto window = reused; window != previous_windows.end();
+             ++window) {
+          windows_.push_back({window->offset, window->first_pair -
+                                                  previous_end_pair +
+                                                  last_recomputed_.end_pair});
+        }
+        time_pairs_.insert(time_pairs_.end(),
+                           previous_pairs.begin() + previous_end_pair,
+                           previous_pairs.end());
+        return previous_end_pair;
+      }
+    }
+    windows_.push_back({offset, time_pairs_.size()});
+    iterator->Next(time_pairs_);
+  }
+  last_recomputed_.end_pair = time_pairs_.size();
+  return previous_num_pairs;
+}
+
+void IncrementalDistance::UpdateNSIM(size_t previous_end_pair) {
+  const size_t first_pair = last_recomputed_.first_pair;
+  const size_t end_pair = last_recomputed_.end_pair;
+  // The NSIM of a time pair depends on the window means of the step window
+  // of time pairs ending at it, and each of those on the step window ending
+  // at them.
+  const size_t reach = 2 * (nsim_.StepWindow() - 1);
+  const size_t first_nsim_pair = first_pair > reach ? first_pair - reach : 0;
+  const size_t end_nsim_pair = std::min(time_pairs_.size(), end_pair + reach);
+  std::vector<double> pair_nsim(time_pairs_.size());
+  std::copy(pair_nsim_.begin(), pair_nsim_.begin() + first_pair,
+            pair_nsim.begin());
+  // Starting reach time pairs early warms up the windows of the first
+  // recomputed time pair.
+  nsim_.Reset();
+  for (size_t pair_index = first_nsim_pair; pair_index < end_nsim_pair;
+       ++pair_index) {
+    const double previous_sum = nsim_.Sum();
+    nsim_.AddStep(spectrogram_a_[{time_pairs_[pair_index].first}],
+                  spectrogram_b_[{time_pairs_[pair_index].second}]);
+    if (pair_index >= first_pair) {
+      pair_nsim[pair_index] = nsim_.Sum() - previous_sum;
+    }
+  }
+  // The time pairs after end_pair are the ones after previous_end_pair
+  // before the update.
+  std::copy(pair_nsim_.begin() + previous_end_pair +
+                (end_nsim_pair - end_pair),
+            pair_nsim_.end(), pair_nsim.begin() + end_nsim_pair);
+  pair_nsim_.swap(pair_nsim);
+  nsim_sum_ = std::accumulate(pair_nsim_.begin(), pair_nsim_.end(), 0.0);
+  last_recomputed_.first_nsim_pair = first_nsim_pair;
+  last_recomputed_.end_nsim_pair = end_nsim_pair;
+}
+
+}  // namespace zimtohrli
@@ -0,0 +1,186 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef CPP_ZIMT_INCREMENTAL_H_
+#define CPP_ZIMT_INCREMENTAL_H_
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "hwy/aligned_allocator.h"
+#include "zimt/dtw.h"
+#include "zimt/filterbank.h"
+#include "zimt/loudness.h"
+#include "zimt/nsim.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+// Parameters of the caches kept by IncrementalDistance.
+struct IncrementalParameters {
+  // The filterbank state of sound B is cached every checkpoint_steps time
+  // steps.
+  //
+  // Smaller values refilter fewer samples before each change, at the cost of
+  // one FilterbankState of memory per checkpoint.
+  size_t checkpoint_steps = 16;
+
+  // Refiltering after a change stops at the first cached filterbank state
+  // where the state of each filter differs less than state_tolerance times
+  // the largest magnitude in its cached state.
+  //
+  // The filters are IIR filters, so a change never decays completely, and
+  // float rounding keeps differences of a few ulps of the signal level around
+  // indefinitely. The default keeps the energy error below ~1e-4 dB.
+  float state_tolerance = 1e-5;
+};
+
+// Computes the distance between a fixed sound A and a sound B that changes in
+// localized regions, e.g. the output of an encoder while tuning decisions
+// that each only affect a short part of it.
+//
+// Caches the filterbank state of B every few time steps, the spectrograms,
+// the ChainDTW windows, and the NSIM of each time pair, so that an update of
+// a range of samples of B only recomputes what the change can affect:
+//
+// - B is refiltered from the cached state before the change, until the state
+//   at a cached time step after the change matches the cached one according
+//   to IncrementalParameters::state_tolerance.
+// - The DTW is recomputed from the first window covering a changed time step
+//   of B, until a window starts at the same time pair as a cached window
+//   after the changed time steps, after which the cached windows are reused.
+//   With a coarse-to-fine corridor the corridor is recomputed for all of B,
+//   and the windows covering steps of A whose corridor changed are recomputed
+//   too.
+// - The NSIM is recomputed for the time pairs whose windows include a
+//   recomputed time pair, i.e. up to two NSIM step windows around them.
+//
+// The distance is equal to Zimtohrli::Distance of the current signals up to
+// float rounding of the NSIM sums and the state tolerance.
+//
+// Each DTW window covers unwarp_window_seconds * sample_rate time steps, so
+// with the default parameters all of a sound shorter than that is one window,
+// which is recomputed for every update. The filterbank and NSIM work is still
+// proportional to the size of the change.
+//
+// Not thread safe.
+class IncrementalDistance {
+ public:
+  // The ranges recomputed by the last update.
+  struct Recomputed {
+    // The time steps of B that were refiltered.
+    size_t first_step;
+    size_t end_step;
+    // The time pairs computed by the DTW.
+    size_t first_pair;
+    size_t end_pair;
+    // The time pairs whose NSIM was computed.
+    size_t first_nsim_pair;
+    size_t end_nsim_pair;
+  };
+
+  // The zimtohrli instance must outlive this, and must not have a
+  // decimated_filterbank.
+  IncrementalDistance(const Zimtohrli& zimtohrli,
+                      hwy::Span<const float> signal_a,
+                      hwy::Span<const float> signal_b,
+                      IncrementalParameters parameters);
+
+  // IncrementalDistance with default parameters.
+  IncrementalDistance(const Zimtohrli& zimtohrli,
+                      hwy::Span<const float> signal_a,
+                      hwy::Span<const float> signal_b);
+
+  // Replaces the samples of B starting at first_sample with samples, and
+  // returns the new distance.
+  //
+  // The length of B doesn't change, so first_sample + samples.size() must be
+  // at most the number of samples of B.
+  float Update(size_t first_sample, hwy::Span<const float> samples);
+
+  // Returns the distance between A and the current B.
+  float Value() const;
+
+  // Returns the spectrogram of the current B.
+  const hwy::AlignedNDArray<float, 2>& SpectrogramB() const {
+    return spectrogram_b_;
+  }
+
+  // Returns the time pairs of the current B.
+  const std::vector<std::pair<size_t, size_t>>& TimePairs() const {
+    return time_pairs_;
+  }
+
+  // Returns what the last update, or the construction, recomputed.
+  const Recomputed& LastRecomputed() const { return last_recomputed_; }
+
+ private:
+  // The start of a ChainDTW window.
+  struct Window {
+    // The time pair the window starts at.
+    std::pair<size_t, size_t> offset;
+    // The index in time_pairs_ of the first time pair computed by the window.
+    size_t first_pair;
+  };
+
+  // Refilters B from the checkpoint before first_step until the filterbank
+  // state converges at a checkpoint at or after end_sample, updating the
+  // checkpoints and spectrogram_b_ on the way.
+  //
+  // Returns the end of the refiltered time steps.
+  size_t RefilterB(size_t first_step, size_t end_sample);
+
+  // Recomputes the DTW windows covering the time steps of B from first_step
+  // to end_step, and populates the first and end recomputed time pairs in
+  // last_recomputed_.
+  //
+  // Returns the index in the previous time_pairs_ of the first time pair
+  // reused after the recomputed ones.
+  size_t UpdateTimePairs(size_t first_step, size_t end_step);
+
+  // Recomputes the NSIM of the time pairs affected by the time pairs
+  // recomputed by UpdateTimePairs, given the index of the first reused time
+  // pair it returned.
+  void UpdateNSIM(size_t previous_end_pair);
+
+  const Zimtohrli& zimtohrli_;
+  const IncrementalParameters parameters_;
+  // The number of samples of each time step.
+  size_t step_samples_;
+  LoudnessCoefficients loudness_coefficients_;
+  hwy::AlignedNDArray<float, 2> spectrogram_a_;
+  std::vector<float> signal_b_;
+  hwy::AlignedNDArray<float, 2> spectrogram_b_;
+  // The filterbank state before each checkpoint_steps time steps of B.
+  std::vector<FilterbankState> checkpoints_;
+  FilterbankState state_;
+  // Working memory for the analysis of checkpoint_steps time steps, and of
+  // the time steps after the last checkpoint.
+  Analysis block_;
+  Analysis last_block_;
+  DTWWorkspace dtw_workspace_;
+  std::vector<std::pair<size_t, size_t>> time_pairs_;
+  std::vector<Window> windows_;
+  StreamingNSIM nsim_;
+  // The sum of the NSIM of all channels of each time pair.
+  std::vector<double> pair_nsim_;
+  double nsim_sum_ = 0;
+  Recomputed last_recomputed_;
+};
+
+}  // namespace zimtohrli
+
+#endif  // CPP_ZIMT_INCREMENTAL_H_
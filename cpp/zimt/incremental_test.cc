@@ -0,0 +1,215 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "zimt/incremental.h"
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "gtest/gtest.h"
+#include "hwy/aligned_allocator.h"
+#include "zimt/cam.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+namespace {
+
+constexpr float kSampleRate = 48000;
+
+// Returns size samples of a sine with uniform noise.
+std::vector<float> CreateNoisySine(size_t size, float frequency,
+                                   float noise_amplitude, unsigned int seed) {
+  std::vector<float> result(size);
+  for (size_t index = 0; index < size; ++index) {
+    seed = seed * 1103515245 + 12345;
+    result[index] =
+        0.5f * std::sin(2 * M_PI * frequency * index / kSampleRate) +
+        noise_amplitude * (static_cast<float>(seed % 1000) / 1000.0f - 0.5f);
+  }
+  return result;
+}
+
+void ExpectSpectrogramNear(const hwy::AlignedNDArray<float, 2>& want,
+                           const hwy::AlignedNDArray<float, 2>& got,
+                           float tolerance) {
+  ASSERT_EQ(want.shape(), got.shape());
+  for (size_t step_index = 0; step_index < want.shape()[0]; ++step_index) {
+    for (size_t channel_index = 0; channel_index < want.shape()[1];
+         ++channel_index) {
+      ASSERT_NEAR(want[{step_index}][channel_index],
+                  got[{step_index}][channel_index], tolerance)
+          << "step_index=" << step_index
+          << ", channel_index=" << channel_index;
+    }
+  }
+}
+
+// Checks that the incremental distance tracks the full distance through
+// updates of different parts of B.
+void CheckUpdates(const Zimtohrli& z) {
+  // Not a multiple of the time step size, to leave samples past the last
+  // time step.
+  const size_t num_samples = 96100;
+  const std::vector<float> signal_a =
+      CreateNoisySine(num_samples, 1000, 0.1, 1);
+  std::vector<float> signal_b = signal_a;
+  for (size_t index = 0; index < num_samples; ++index) {
+    signal_b[index] += 0.02f * std::sin(2 * M_PI * 3000 * index / kSampleRate);
+  }
+  const hwy::Span<const float> span_a(signal_a.data(), signal_a.size());
+  const hwy::Span<const float> span_b(signal_b.data(), signal_b.size());
+  const Analysis analysis_a = z.Analyze(span_a);
+
+  IncrementalDistance incremental(z, span_a, span_b);
+  ZimtohrliWorkspace workspace;
+  EXPECT_NEAR(incremental.Value(), z.Distance(span_a, span_b, workspace),
+              1e-5);
+  ExpectSpectrogramNear(z.Analyze(span_b).spectrogram,
+                        incremental.SpectrogramB(), 1e-4);
+  EXPECT_EQ(incremental.TimePairs(),
+            z.TimePairs(analysis_a.spectrogram, incremental.SpectrogramB()));
+
+  struct Change {
+    size_t first_sample;
+    size_t num_samples;
+  };
+  // In the middle, at the start, at the end, and only past the last time
+  // step.
+  for (const Change& change : {Change{24000, 2400}, Change{1000, 500},
+                               Change{num_samples - 3000, 3000},
+                               Change{num_samples - 10, 10}}) {
+    const std::vector<float> noise =
+        CreateNoisySine(change.num_samples, 5000, 0.1, change.first_sample);
+    for (size_t index = 0; index < change.num_samples; ++index) {
+      signal_b[change.first_sample + index] += noise[index];
+    }
+    const float got = incremental.Update(
+        change.first_sample,
+        hwy::Span<const float>(signal_b.data() + change.first_sample,
+                               change.num_samples));
+    EXPECT_EQ(got, incremental.Value());
+    EXPECT_NEAR(got, z.Distance(span_a, span_b, workspace), 1e-4)
+        << "first_sample=" << change.first_sample;
+    ExpectSpectrogramNear(z.Analyze(span_b).spectrogram,
+                          incremental.SpectrogramB(), 1e-3);
+    // The DTW and NSIM of the cached spectrogram are exact up to the NSIM
+    // sums.
+    EXPECT_EQ(incremental.TimePairs(),
+              z.TimePairs(analysis_a.spectrogram, incremental.SpectrogramB()))
+        << "first_sample=" << change.first_sample;
+    EXPECT_NEAR(got,
+                z.Distance(false, analysis_a.spectrogram,
+                           incremental.SpectrogramB())
+                    .value,
+                1e-5)
+        << "first_sample=" << change.first_sample;
+  }
+}
+
+TEST(Incremental, UpdateWithoutDTWTest) {
+  const Zimtohrli z{.cam_filterbank = Cam{}.CreateFilterbank(kSampleRate),
+                    .unwarp_window_seconds = 0};
+  CheckUpdates(z);
+}
+
+TEST(Incremental, UpdateWithDTWTest) {
+  // ChainDTW windows of 40 time steps, with a warp radius of 5 time steps.
+  const Zimtohrli z{.cam_filterbank = Cam{}.CreateFilterbank(kSampleRate),
+                    .unwarp_window_seconds = 40 / kSampleRate,
+                    .unwarp_radius_seconds = 5 / kSampleRate};
+  CheckUpdates(z);
+}
+
+TEST(Incremental, UpdateWithCoarseToFineDTWTest) {
+  // ChainDTW windows of 80 time steps, refined within 2 time steps of the
+  // decimated dynamic time warp.
+  const Zimtohrli z{.cam_filterbank = Cam{}.CreateFilterbank(kSampleRate),
+                    .unwarp_window_seconds = 80 / kSampleRate,
+                    .unwarp_radius_seconds = 5 / kSampleRate,
+                    .unwarp_corridor_seconds = 2 / kSampleRate};
+  CheckUpdates(z);
+}
+
+TEST(Incremental, RecomputedTest) {
+  const Zimtohrli z{.cam_filterbank = Cam{}.CreateFilterbank(kSampleRate),
+                    .unwarp_window_seconds = 0};
+  const size_t num_samples = 96100;
+  const std::vector<float> signal_a =
+      CreateNoisySine(num_samples, 1000, 0.1, 1);
+  std::vector<float> signal_b = CreateNoisySine(num_samples, 1000, 0.1, 2);
+  IncrementalDistance incremental(
+      z, hwy::Span<const float>(signal_a.data(), signal_a.size()),
+      hwy::Span<const float>(signal_b.data(), signal_b.size()),
+      {.checkpoint_steps = 8});
+  const size_t num_steps = incremental.SpectrogramB().shape()[0];
+  EXPECT_EQ(incremental.LastRecomputed().first_step, size_t{0});
+  EXPECT_EQ(incremental.LastRecomputed().end_step, num_steps);
+  EXPECT_EQ(incremental.LastRecomputed().first_nsim_pair, size_t{0});
+  EXPECT_EQ(incremental.LastRecomputed().end_nsim_pair, num_steps);
+
+  // Changing 50ms in the middle only refilters from the checkpoint before it
+  // until the filters have forgotten it, which takes much less than a
+  // second.
+  const size_t first_sample = 24000;
+  const size_t first_step = first_sample / (num_samples / num_steps);
+  for (size_t index = first_sample; index < first_sample + 2400; ++index) {
+    signal_b[index] *= 0.5;
+  }
+  incremental.Update(first_sample, hwy::Span<const float>(
+                                       signal_b.data() + first_sample, 2400));
+  const IncrementalDistance::Recomputed& recomputed =
+      incremental.LastRecomputed();
+  EXPECT_EQ(recomputed.first_step, first_step / 8 * 8);
+  EXPECT_GT(recomputed.end_step, first_step + 5);
+  EXPECT_LT(recomputed.end_step, first_step + 100);
+  EXPECT_EQ(recomputed.first_pair, first_step);
+  EXPECT_EQ(recomputed.end_pair, recomputed.end_step);
+  EXPECT_EQ(recomputed.first_nsim_pair,
+            first_step - 2 * (z.nsim_step_window - 1));
+  EXPECT_EQ(recomputed.end_nsim_pair,
+            recomputed.end_step + 2 * (z.nsim_step_window - 1));
+}
+
+void BM_IncrementalUpdate(benchmark::State& state) {
+  const Zimtohrli z{.cam_filterbank = Cam{}.CreateFilterbank(kSampleRate),
+                    .unwarp_window_seconds = 0};
+  const size_t num_samples = static_cast<size_t>(kSampleRate) * state.range(0);
+  const std::vector<float> signal_a =
+      CreateNoisySine(num_samples, 1000, 0.1, 1);
+  const std::vector<float> signal_b =
+      CreateNoisySine(num_samples, 1000, 0.1, 2);
+  IncrementalDistance incremental(
+      z, hwy::Span<const float>(signal_a.data(), signal_a.size()),
+      hwy::Span<const float>(signal_b.data(), signal_b.size()));
+  // Alternates between two versions of 50ms in the middle of B.
+  const std::vector<float> change_a = CreateNoisySine(2400, 1000, 0.1, 3);
+  const std::vector<float> change_b = CreateNoisySine(2400, 1000, 0.1, 4);
+  size_t num_updates = 0;
+  for (auto s : state) {
+    const std::vector<float>& change = num_updates % 2 ? change_b : change_a;
+    incremental.Update(num_samples / 2,
+                       hwy::Span<const float>(change.data(), change.size()));
+    ++num_updates;
+  }
+  state.SetItemsProcessed(num_samples * state.iterations());
+}
+BENCHMARK_RANGE(BM_IncrementalUpdate, 1, 64);
+
+}  // namespace
+
+}  // namespace zimtohrli
@@ -0,0 +1,161 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zimt/intensity_pyramid.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>  // NOLINT
+#include <cstddef>
+#include <deque>
+#include <limits>
+#include <mutex>  // NOLINT
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "hwy/aligned_allocator.h"
+
+namespace zimtohrli {
+
+// Builds the levels of IntensityPyramids on a fixed set of background
+// threads.
+class PyramidBuilder {
+ public:
+  // Returns the process-wide builder.
+  static PyramidBuilder& Get() {
+    static PyramidBuilder* const builder = new PyramidBuilder(
+        std::max<size_t>(1, std::thread::hardware_concurrency() / 2));
+    return *builder;
+  }
+
+  // Queues pyramid to be built.
+  void Enqueue(IntensityPyramid* pyramid) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      queue_.push_back(pyramid);
+    }
+    work_available_.notify_one();
+  }
+
+  // Makes sure pyramid isn't built after this returns, by removing it from
+  // the queue or waiting for its ongoing build to return.
+  void Cancel(IntensityPyramid* pyramid) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    queue_.erase(std::remove(queue_.begin(), queue_.end(), pyramid),
+                 queue_.end());
+    build_done_.wait(lock, [this, pyramid]() {
+      return std::find(building_.begin(), building_.end(), pyramid) ==
+             building_.end();
+    });
+  }
+
+ private:
+  // The threads are detached, since the builder lives until the process
+  // exits.
+  explicit PyramidBuilder(size_t num_threads) {
+    for (size_t thread_index = 0; thread_index < num_threads; ++thread_index) {
+      std::thread([this]() { WorkerLoop(); }).detach();
+    }
+  }
+
+  void WorkerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      work_available_.wait(lock, [this]() { return !queue_.empty(); });
+      IntensityPyramid* pyramid = queue_.front();
+      queue_.pop_front();
+      building_.push_back(pyramid);
+      lock.unlock();
+      pyramid->Build();
+      lock.lock();
+      building_.erase(std::find(building_.begin(), building_.end(), pyramid));
+      build_done_.notify_all();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable build_done_;
+  // Pyramids waiting to be built, in the order they were queued.
+  std::deque<IntensityPyramid*> queue_;
+  // Pyramids being built right now.
+  std::vector<IntensityPyramid*> building_;
+};
+
+IntensityPyramid::IntensityPyramid(const hwy::AlignedNDArray<float, 2>& array)
+    : data_(array.data()),
+      row_stride_(array.memory_shape()[1]),
+      num_channels_(array.shape()[1]) {
+  steps_.push_back(array.shape()[0]);
+  while (steps_.back() > 1) {
+    steps_.push_back((steps_.back() + 1) / 2);
+    levels_.emplace_back(std::array<size_t, 2>{steps_.back(), num_channels_});
+  }
+  if (levels_.empty()) {
+    return;
+  }
+  PyramidBuilder::Get().Enqueue(this);
+}
+
+IntensityPyramid::~IntensityPyramid() {
+  if (levels_.empty()) {
+    return;
+  }
+  cancelled_.store(true, std::memory_order_relaxed);
+  PyramidBuilder::Get().Cancel(this);
+}
+
+float IntensityPyramid::Max(size_t first_step, size_t end_step,
+                            size_t first_channel, size_t end_channel) const {
+  const size_t num_ready_levels = NumReadyLevels();
+  float result = -std::numeric_limits<float>::infinity();
+  size_t step = first_step;
+  while (step < end_step) {
+    size_t level = 0;
+    while (level + 1 < num_ready_levels &&
+           (step & ((size_t{2} << level) - 1)) == 0 &&
+           step + (size_t{2} << level) <= end_step) {
+      ++level;
+    }
+    const float* row = Row(level, step >> level);
+    for (size_t channel = first_channel; channel < end_channel; ++channel) {
+      result = std::max(result, row[channel]);
+    }
+    step += size_t{1} << level;
+  }
+  return result;
+}
+
+void IntensityPyramid::Build() {
+  for (size_t level = 1; level < steps_.size(); ++level) {
+    if (cancelled_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    hwy::AlignedNDArray<float, 2>& output = levels_[level - 1];
+    for (size_t index = 0; index < steps_[level]; ++index) {
+      const float* first = Row(level - 1, 2 * index);
+      const float* second = 2 * index + 1 < steps_[level - 1]
+                                ? Row(level - 1, 2 * index + 1)
+                                : first;
+      float* out = output[{index}].data();
+      for (size_t channel = 0; channel < num_channels_; ++channel) {
+        out[channel] = std::max(first[channel], second[channel]);
+      }
+    }
+    num_ready_levels_.store(level + 1, std::memory_order_release);
+  }
+}
+
+}  // namespace zimtohrli
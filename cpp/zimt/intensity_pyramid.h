@@ -0,0 +1,91 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CPP_ZIMT_INTENSITY_PYRAMID_H_
+#define CPP_ZIMT_INTENSITY_PYRAMID_H_
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include "hwy/aligned_allocator.h"
+
+namespace zimtohrli {
+
+// A pyramid of successively halved copies of a (num_steps, num_channels)-shaped
+// array, where each step of a level is the max of two steps of the level
+// below, so that a long array can be rendered at a low resolution without
+// visiting every step behind each pixel, and without point sampling away the
+// transients between the sampled steps.
+//
+// Level 0 is the array itself, and the higher levels are computed on a fixed
+// set of background threads shared by all pyramids, so that opening many files
+// and channels doesn't start a thread per pyramid. Until they are ready, Max
+// reads more rows of the lower levels.
+class IntensityPyramid {
+ public:
+  // The buffer of array must outlive the pyramid, but array itself may be
+  // moved.
+  explicit IntensityPyramid(const hwy::AlignedNDArray<float, 2>& array);
+  // Waits for an ongoing build of the pyramid to stop.
+  ~IntensityPyramid();
+
+  IntensityPyramid(const IntensityPyramid&) = delete;
+  IntensityPyramid& operator=(const IntensityPyramid&) = delete;
+
+  // Returns the number of levels in the pyramid, including level 0.
+  size_t NumLevels() const { return steps_.size(); }
+
+  // Returns the number of levels that can be read, starting at level 0.
+  size_t NumReadyLevels() const {
+    return num_ready_levels_.load(std::memory_order_acquire);
+  }
+
+  // Returns the max of the array in steps [first_step, end_step) and channels
+  // [first_channel, end_channel), or -infinity if either range is empty.
+  //
+  // Covers the step range with the fewest rows of the ready levels, i.e. the
+  // rows of the highest levels whose steps lie entirely within the range, and
+  // reads every channel in the channel range of those rows.
+  float Max(size_t first_step, size_t end_step, size_t first_channel,
+            size_t end_channel) const;
+
+ private:
+  friend class PyramidBuilder;
+
+  // Computes the levels above level 0, until done or cancelled.
+  void Build();
+
+  const float* Row(size_t level, size_t index) const {
+    return level == 0 ? data_ + index * row_stride_
+                      : levels_[level - 1][{index}].data();
+  }
+
+  // Level 0, i.e. the buffer of the array, which stays in place even if the
+  // array itself is moved.
+  const float* data_;
+  size_t row_stride_;
+  size_t num_channels_;
+  // The number of steps in each level, starting at level 0.
+  std::vector<size_t> steps_;
+  // Levels 1 and up, allocated before the build is queued so that readers
+  // never see them move.
+  std::vector<hwy::AlignedNDArray<float, 2>> levels_;
+  std::atomic<size_t> num_ready_levels_ = 1;
+  std::atomic<bool> cancelled_ = false;
+};
+
+}  // namespace zimtohrli
+
+#endif  // CPP_ZIMT_INTENSITY_PYRAMID_H_
@@ -0,0 +1,156 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zimt/intensity_pyramid.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <random>
+#include <thread>  // NOLINT
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "hwy/aligned_allocator.h"
+
+namespace zimtohrli {
+
+namespace {
+
+hwy::AlignedNDArray<float, 2> RandomArray(size_t num_steps,
+                                          size_t num_channels,
+                                          std::mt19937& generator) {
+  hwy::AlignedNDArray<float, 2> array({num_steps, num_channels});
+  std::uniform_real_distribution<float> distribution(-100, 100);
+  for (size_t step = 0; step < num_steps; ++step) {
+    for (size_t channel = 0; channel < num_channels; ++channel) {
+      array[{step}][channel] = distribution(generator);
+    }
+  }
+  return array;
+}
+
+float BruteForceMax(const hwy::AlignedNDArray<float, 2>& array,
+                    size_t first_step, size_t end_step, size_t first_channel,
+                    size_t end_channel) {
+  float result = -std::numeric_limits<float>::infinity();
+  for (size_t step = first_step; step < end_step; ++step) {
+    for (size_t channel = first_channel; channel < end_channel; ++channel) {
+      result = std::max(result, array[{step}][channel]);
+    }
+  }
+  return result;
+}
+
+void WaitForBuild(const IntensityPyramid& pyramid) {
+  while (pyramid.NumReadyLevels() < pyramid.NumLevels()) {
+    std::this_thread::yield();
+  }
+}
+
+void ExpectExactMax(const hwy::AlignedNDArray<float, 2>& array,
+                    const IntensityPyramid& pyramid, std::mt19937& generator) {
+  const size_t num_steps = array.shape()[0];
+  const size_t num_channels = array.shape()[1];
+  std::uniform_int_distribution<size_t> step_distribution(0, num_steps);
+  std::uniform_int_distribution<size_t> channel_distribution(0, num_channels);
+  for (int range = 0; range < 200; ++range) {
+    size_t first_step = step_distribution(generator);
+    size_t end_step = step_distribution(generator);
+    if (first_step > end_step) {
+      std::swap(first_step, end_step);
+    }
+    size_t first_channel = channel_distribution(generator);
+    size_t end_channel = channel_distribution(generator);
+    if (first_channel > end_channel) {
+      std::swap(first_channel, end_channel);
+    }
+    ASSERT_EQ(
+        pyramid.Max(first_step, end_step, first_channel, end_channel),
+        BruteForceMax(array, first_step, end_step, first_channel, end_channel))
+        << "steps [" << first_step << ", " << end_step << "), channels ["
+        << first_channel << ", " << end_channel << ")";
+  }
+  EXPECT_EQ(pyramid.Max(0, num_steps, 0, num_channels),
+            BruteForceMax(array, 0, num_steps, 0, num_channels));
+}
+
+TEST(IntensityPyramid, NumLevelsTest) {
+  std::mt19937 generator(0);
+  for (const auto& [num_steps, num_levels] :
+       std::vector<std::pair<size_t, size_t>>{
+           {0, 1}, {1, 1}, {2, 2}, {3, 3}, {4, 3}, {5, 4}, {1024, 11}}) {
+    const hwy::AlignedNDArray<float, 2> array =
+        RandomArray(num_steps, 3, generator);
+    const IntensityPyramid pyramid(array);
+    EXPECT_EQ(pyramid.NumLevels(), num_levels) << num_steps;
+    WaitForBuild(pyramid);
+    EXPECT_EQ(pyramid.NumReadyLevels(), num_levels) << num_steps;
+  }
+}
+
+TEST(IntensityPyramid, MaxTest) {
+  std::mt19937 generator(0);
+  for (const size_t num_steps : {1, 2, 7, 64, 1000, 4099}) {
+    for (const size_t num_channels : {1, 5, 33}) {
+      const hwy::AlignedNDArray<float, 2> array =
+          RandomArray(num_steps, num_channels, generator);
+      const IntensityPyramid pyramid(array);
+      // Max is exact with any number of ready levels, so this checks it while
+      // the build may still be running.
+      ExpectExactMax(array, pyramid, generator);
+      WaitForBuild(pyramid);
+      ExpectExactMax(array, pyramid, generator);
+    }
+  }
+}
+
+TEST(IntensityPyramid, EmptyRangeTest) {
+  std::mt19937 generator(0);
+  const hwy::AlignedNDArray<float, 2> array = RandomArray(16, 4, generator);
+  const IntensityPyramid pyramid(array);
+  WaitForBuild(pyramid);
+  EXPECT_EQ(pyramid.Max(3, 3, 0, 4), -std::numeric_limits<float>::infinity());
+  EXPECT_EQ(pyramid.Max(0, 16, 2, 2), -std::numeric_limits<float>::infinity());
+}
+
+TEST(IntensityPyramid, DestroyWhileQueuedOrBuildingTest) {
+  std::mt19937 generator(0);
+  // Many large pyramids at once keep the builder busy, so that some of them
+  // are destroyed while queued and some while being built.
+  std::vector<hwy::AlignedNDArray<float, 2>> arrays;
+  for (int index = 0; index < 16; ++index) {
+    arrays.push_back(RandomArray(1 << 16, 16, generator));
+  }
+  for (int round = 0; round < 4; ++round) {
+    std::vector<std::unique_ptr<IntensityPyramid>> pyramids;
+    for (const hwy::AlignedNDArray<float, 2>& array : arrays) {
+      pyramids.push_back(std::make_unique<IntensityPyramid>(array));
+    }
+    if (round % 2 == 1) {
+      std::this_thread::yield();
+    }
+    pyramids.clear();
+  }
+  // The builder still works after the cancellations.
+  const IntensityPyramid pyramid(arrays[0]);
+  WaitForBuild(pyramid);
+  ExpectExactMax(arrays[0], pyramid, generator);
+}
+
+}  // namespace
+
+}  // namespace zimtohrli
@@ -14,8 +14,13 @@
 
 #include "zimt/loudness.h"
 
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <cstddef>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <vector>
 
 #include "absl/log/check.h"
 #include "hwy/aligned_allocator.h"
@@ -141,63 +146,85 @@ hwy::AlignedNDArray<float, 2> ExpandLaneDimension(
   return result;
 }
 
-// Defined here since Highway doesn't have a pow function.
-Vec Pow(const Vec& base, const Vec& exponent) {
-  return Exp(d, Mul(exponent, Log(d, base)));
-}
-
-// Reproduces the loudness from SPL computation in ISO 226.
-void HwyPhonsFromSPL(const Loudness& l,
-                     const hwy::AlignedNDArray<float, 2>& channels_db_spl,
-                     const hwy::AlignedNDArray<float, 2>& thresholds_hz,
-                     hwy::AlignedNDArray<float, 2>& channels_phons) {
-  const Vec point_four = Set(d, 0.4);
-  const Vec ten = Set(d, 10);
+// Populates coefficients with the per-channel parts of the ISO 226 loudness
+// from SPL computation.
+//
+// With
+//
+// expf(x) = (0.4 * 10^((x + L_U) / 10 - 9))^a_f
+//         = exp(slope * x + intercept)
+//
+// where slope = a_f * ln(10) / 10 and intercept = a_f * (ln(0.4) + ln(10) *
+// (L_U / 10 - 9)),
+//
+// the ISO 226 formula
+//
+// phons = 40 * log10(expf(x) - expf(T_f) + 0.005135) + 94
+//
+// only needs one exp and one log10 per value once the slope and intercept of
+// the exponent and the constant offset are known.
+void HwyLoudnessCoefficients(const Loudness& l,
+                             const hwy::AlignedNDArray<float, 2>& thresholds_hz,
+                             hwy::AlignedNDArray<float, 2>& coefficients) {
+  const Vec ln_10_div_10 = Set(d, std::log(10.0) / 10);
+  const Vec ln_point_four = Set(d, std::log(0.4));
   const Vec point_one = Set(d, 0.1);
   const Vec nine = Set(d, 9);
   const Vec point_005135 = Set(d, 0.005135);
-  const Vec forty = Set(d, 40);
-  const Vec ninetyfour = Set(d, 94);
   const Vec zero = Zero(d);
-  const size_t num_samples = channels_db_spl.shape()[0];
-  const size_t num_channels = channels_db_spl.shape()[1];
+  const Vec one = Set(d, 1);
+  const size_t num_channels = thresholds_hz.shape()[1];
   const hwy::AlignedNDArray<float, 2> a_f_params =
       ExpandLaneDimension(l.a_f_params);
   const hwy::AlignedNDArray<float, 2> l_u_params =
       ExpandLaneDimension(l.l_u_params);
   const hwy::AlignedNDArray<float, 2> t_f_params =
       ExpandLaneDimension(l.t_f_params);
-  hwy::AlignedNDArray<float, 1> a_f_array({num_channels});
-  hwy::AlignedNDArray<float, 1> l_u_array({num_channels});
-  hwy::AlignedNDArray<float, 1> t_f_array({num_channels});
   for (size_t channel_index = 0; channel_index < num_channels;
        channel_index += Lanes(d)) {
     const Vec center_hz = Load(d, thresholds_hz[{1}].data() + channel_index);
-    Store(Af(a_f_params, center_hz), d, a_f_array.data() + channel_index);
-    Store(Lu(l_u_params, center_hz), d, l_u_array.data() + channel_index);
-    Store(Tf(t_f_params, center_hz), d, t_f_array.data() + channel_index);
+    const Vec a_f = Af(a_f_params, center_hz);
+    const Vec l_u = Lu(l_u_params, center_hz);
+    const Vec t_f = Tf(t_f_params, center_hz);
+    const Vec slope = Mul(a_f, ln_10_div_10);
+    const Vec intercept =
+        Mul(a_f, MulAdd(Set(d, std::log(10.0)), MulSub(l_u, point_one, nine),
+                        ln_point_four));
+    const Vec offset = Sub(point_005135, Exp(d, MulAdd(slope, t_f, intercept)));
+    // Compensating for 0 dB SPL at 0 Hz (since the arrays are padded with
+    // zeros) not being properly handled by the parameterized phons-from-db
+    // function.
+    const Vec audible = IfThenElseZero(Gt(center_hz, zero), one);
+    Store(slope, d, coefficients[{0}].data() + channel_index);
+    Store(intercept, d, coefficients[{1}].data() + channel_index);
+    Store(offset, d, coefficients[{2}].data() + channel_index);
+    Store(audible, d, coefficients[{3}].data() + channel_index);
   }
+}
+
+// Reproduces the loudness from SPL computation in ISO 226.
+void HwyPhonsFromSPL(const hwy::AlignedNDArray<float, 2>& channels_db_spl,
+                     const hwy::AlignedNDArray<float, 2>& coefficients,
+                     hwy::AlignedNDArray<float, 2>& channels_phons) {
+  const Vec forty = Set(d, 40);
+  const Vec ninetyfour = Set(d, 94);
+  const Vec zero = Zero(d);
+  const size_t num_samples = channels_db_spl.shape()[0];
+  const size_t num_channels = channels_db_spl.shape()[1];
   for (size_t sample_index = 0; sample_index < num_samples; ++sample_index) {
     for (size_t channel_index = 0; channel_index < num_channels;
          channel_index += Lanes(d)) {
-      const Vec a_f = Load(d, a_f_array.data() + channel_index);
-      const Vec l_u = Load(d, l_u_array.data() + channel_index);
-      const Vec t_f = Load(d, t_f_array.data() + channel_index);
-      const auto expf = [&](const Vec& x) HWY_ATTR {
-        return Pow(
-            Mul(point_four, Pow(ten, Sub(Mul(Add(x, l_u), point_one), nine))),
-            a_f);
-      };
-      const Vec b_f =
-          Add(Sub(expf(Load(d, channels_db_spl[{sample_index}].data() +
-                                   channel_index)),
-                  expf(t_f)),
-              point_005135);
-      const Vec center_hz = Load(d, thresholds_hz[{1}].data() + channel_index);
-      // Compensating for 0 dB SPL at 0 Hz (since the arrays are padded with
-      // zeros) not being properly handled by the parameterized phons-from-db
-      // function.
-      const Vec phon = IfThenElseZero(Gt(center_hz, zero),
+      const Vec slope = Load(d, coefficients[{0}].data() + channel_index);
+      const Vec intercept = Load(d, coefficients[{1}].data() + channel_index);
+      const Vec offset = Load(d, coefficients[{2}].data() + channel_index);
+      const Vec audible = Load(d, coefficients[{3}].data() + channel_index);
+      const Vec b_f = Add(
+          Exp(d, MulAdd(slope,
+                        Load(d, channels_db_spl[{sample_index}].data() +
+                                    channel_index),
+                        intercept)),
+          offset);
+      const Vec phon = IfThenElseZero(Gt(audible, zero),
                                       MulAdd(forty, Log10(d, b_f), ninetyfour));
       Store(phon, d, channels_phons[{sample_index}].data() + channel_index);
     }
@@ -212,18 +239,67 @@ HWY_AFTER_NAMESPACE();
 
 namespace zimtohrli {
 
+HWY_EXPORT(HwyLoudnessCoefficients);
 HWY_EXPORT(HwyPhonsFromSPL);
 
+LoudnessCoefficients Loudness::Coefficients(
+    const hwy::AlignedNDArray<float, 2>& thresholds_hz) const {
+  CHECK_EQ(thresholds_hz.shape()[0], 3);
+  LoudnessCoefficients result{
+      .values = hwy::AlignedNDArray<float, 2>({4, thresholds_hz.shape()[1]})};
+  HWY_DYNAMIC_DISPATCH(HwyLoudnessCoefficients)
+  (*this, thresholds_hz, result.values);
+  return result;
+}
+
 void Loudness::PhonsFromSPL(
     const hwy::AlignedNDArray<float, 2>& channels_db_spl,
     const hwy::AlignedNDArray<float, 2>& thresholds_hz,
     hwy::AlignedNDArray<float, 2>& channels_phons) const {
+  CHECK_EQ(thresholds_hz.shape()[1], channels_db_spl.shape()[1]);
+  PhonsFromSPL(channels_db_spl, Coefficients(thresholds_hz), channels_phons);
+}
+
+void Loudness::PhonsFromSPL(
+    const hwy::AlignedNDArray<float, 2>& channels_db_spl,
+    const LoudnessCoefficients& coefficients,
+    hwy::AlignedNDArray<float, 2>& channels_phons) const {
   CHECK_EQ(channels_db_spl.shape()[0], channels_phons.shape()[0]);
   CHECK_EQ(channels_db_spl.shape()[1], channels_phons.shape()[1]);
-  CHECK_EQ(thresholds_hz.shape()[1], channels_db_spl.shape()[1]);
-  CHECK_EQ(thresholds_hz.shape()[0], 3);
+  CHECK_EQ(coefficients.values.shape()[0], 4);
+  CHECK_EQ(coefficients.values.shape()[1], channels_db_spl.shape()[1]);
   HWY_DYNAMIC_DISPATCH(HwyPhonsFromSPL)
-  (*this, channels_db_spl, thresholds_hz, channels_phons);
+  (channels_db_spl, coefficients.values, channels_phons);
+}
+
+std::shared_ptr<const LoudnessCoefficients> LoudnessCoefficientsCache::Get(
+    const Loudness& loudness,
+    const hwy::AlignedNDArray<float, 2>& thresholds_hz) {
+  const size_t num_rows = thresholds_hz.shape()[0];
+  const size_t num_channels = thresholds_hz.shape()[1];
+  std::unique_lock<std::mutex> lock(mutex_);
+  bool reusable = coefficients_ != nullptr &&
+                  thresholds_hz_.size() == num_rows * num_channels &&
+                  loudness.a_f_params == loudness_.a_f_params &&
+                  loudness.l_u_params == loudness_.l_u_params &&
+                  loudness.t_f_params == loudness_.t_f_params;
+  for (size_t row = 0; reusable && row < num_rows; ++row) {
+    const float* thresholds = thresholds_hz[{row}].data();
+    reusable = std::equal(thresholds, thresholds + num_channels,
+                          thresholds_hz_.begin() + row * num_channels);
+  }
+  if (!reusable) {
+    coefficients_ = std::make_shared<const LoudnessCoefficients>(
+        loudness.Coefficients(thresholds_hz));
+    loudness_ = loudness;
+    thresholds_hz_.clear();
+    for (size_t row = 0; row < num_rows; ++row) {
+      const float* thresholds = thresholds_hz[{row}].data();
+      thresholds_hz_.insert(thresholds_hz_.end(), thresholds,
+                            thresholds + num_channels);
+    }
+  }
+  return coefficients_;
 }
 
 }  // namespace zimtohrli
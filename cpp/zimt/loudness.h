@@ -16,11 +16,26 @@
 #define CPP_ZIMT_LOUDNESS_H_
 
 #include <array>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <vector>
 
 #include "hwy/aligned_allocator.h"
 
 namespace zimtohrli {
 
+// Per-channel coefficients of the ISO 226 loudness computation.
+//
+// Only depend on the Loudness parameters and the frequencies of the channels,
+// so they can be computed once per filterbank with Loudness::Coefficients and
+// then reused for any number of PhonsFromSPL calls.
+struct LoudnessCoefficients {
+  // (4, num_channels)-shaped array with the slope and intercept of the
+  // exponent, the constant offset, and 1 for channels with a positive center
+  // frequency (0 otherwise), for each channel.
+  hwy::AlignedNDArray<float, 2> values;
+};
+
 // Contains parameters and functions to compute perceptual loudness according to
 // ISO 226 (https://www.iso.org/standard/83117.html).
 //
@@ -44,6 +59,17 @@ struct Loudness {
                     const hwy::AlignedNDArray<float, 2>& thresholds_hz,
                     hwy::AlignedNDArray<float, 2>& channels_phons) const;
 
+  // Returns the coefficients PhonsFromSPL uses for channels with the
+  // frequencies in the (3, num_channels)-shaped thresholds_hz.
+  LoudnessCoefficients Coefficients(
+      const hwy::AlignedNDArray<float, 2>& thresholds_hz) const;
+
+  // PhonsFromSPL using coefficients precomputed by Coefficients, leaving only
+  // one exp and one log10 per value.
+  void PhonsFromSPL(const hwy::AlignedNDArray<float, 2>& channels_db_spl,
+                    const LoudnessCoefficients& coefficients,
+                    hwy::AlignedNDArray<float, 2>& channels_phons) const;
+
   // Parameters to create the ISO 226 a_f parameter for an arbitrary frequency.
   std::array<float, 10> a_f_params = {
       9.64075296e-01, 8.76031085e-02, 1.04933605e+00, 7.21105886e+00,
@@ -64,6 +90,28 @@ struct Loudness {
       -3.64426652e+01};
 };
 
+// Keeps the LoudnessCoefficients of the most recent Loudness parameters and
+// thresholds, so that repeated spectrograms with the same parameters and
+// filterbank compute them only once.
+//
+// Thread safe.
+class LoudnessCoefficientsCache {
+ public:
+  // Returns loudness.Coefficients(thresholds_hz), reusing the coefficients of
+  // the previous call if it had the same parameters and thresholds.
+  std::shared_ptr<const LoudnessCoefficients> Get(
+      const Loudness& loudness,
+      const hwy::AlignedNDArray<float, 2>& thresholds_hz);
+
+ private:
+  std::mutex mutex_;
+  // The parameters and the thresholds, row by row, coefficients_ was computed
+  // for.
+  Loudness loudness_;
+  std::vector<float> thresholds_hz_;
+  std::shared_ptr<const LoudnessCoefficients> coefficients_;
+};
+
 }  // namespace zimtohrli
 
 #endif  // CPP_ZIMT_LOUDNESS_H_
@@ -14,7 +14,9 @@
 
 #include "zimt/loudness.h"
 
+#include <cmath>
 #include <cstddef>
+#include <memory>
 #include <vector>
 
 #include "benchmark/benchmark.h"
@@ -165,6 +167,104 @@ TEST(Loudness, VeryHighFrequencyTest) {
   EXPECT_NEAR(channels_phons[{0}][0], 2.4216, 1e-2);
 }
 
+// Scalar double precision version of the a_f, L_U and T_f parameterizations
+// and the ISO 226 formula, evaluated without any precomputation.
+double ReferencePhons(const Loudness& l, double hz, double db_spl) {
+  const auto gauss = [&](double scale, double width, double center) {
+    return scale * std::exp(-width * (hz - center) * (hz - center));
+  };
+  const auto& a = l.a_f_params;
+  const double a_f = a[0] - a[1] * std::log(a[2] * (hz - a[3])) +
+                     gauss(0.04 * a[4], 0.0000001 * a[5], 14000 * a[6]) -
+                     gauss(0.03 * a[7], 0.0000001 * a[8], 5000 * a[9]);
+  const auto& u = l.l_u_params;
+  const double l_u = u[0] + u[1] * std::log(u[2] * (hz - u[3])) -
+                     gauss(5 * u[4], 0.00001 * u[5], 1500 * u[6]) +
+                     gauss(5 * u[7], 0.000001 * u[8], 3000 * u[9]) -
+                     gauss(15 * u[10], 0.0000001 * u[11], 9000 * u[12]) -
+                     gauss(5 * u[13], 0.00000001 * u[14], 12500 * u[15]);
+  const auto& t = l.t_f_params;
+  const double t_f = t[0] + t[1] * std::log(t[2] * (hz - t[3])) +
+                     gauss(5 * t[4], 0.00001 * t[5], 1200 * t[6]) -
+                     gauss(10 * t[7], 0.0000001 * t[8], 3300 * t[9]) +
+                     gauss(20 * t[10], 0.00000001 * t[11], 12000 * t[12]);
+  const auto expf = [&](double x) {
+    return std::pow(0.4 * std::pow(10, (x + l_u) / 10 - 9), a_f);
+  };
+  return 40 * std::log10(expf(db_spl) - expf(t_f) + 0.005135) + 94;
+}
+
+TEST(Loudness, CoefficientsMatchReferenceTest) {
+  const CamFilterbank filterbank = Cam().CreateFilterbank(48000);
+  const size_t num_channels = filterbank.filter.Size();
+  const Loudness l;
+  hwy::AlignedNDArray<float, 2> channels_db_spl({10, num_channels});
+  for (size_t sample_index = 0; sample_index < channels_db_spl.shape()[0];
+       ++sample_index) {
+    for (size_t channel_index = 0; channel_index < num_channels;
+         ++channel_index) {
+      channels_db_spl[{sample_index}][channel_index] = 30 + 10 * sample_index;
+    }
+  }
+  const LoudnessCoefficients coefficients =
+      l.Coefficients(filterbank.thresholds_hz);
+  hwy::AlignedNDArray<float, 2> phons(channels_db_spl.shape());
+  l.PhonsFromSPL(channels_db_spl, coefficients, phons);
+  hwy::AlignedNDArray<float, 2> phons_from_thresholds(channels_db_spl.shape());
+  l.PhonsFromSPL(channels_db_spl, filterbank.thresholds_hz,
+                 phons_from_thresholds);
+  for (size_t sample_index = 0; sample_index < channels_db_spl.shape()[0];
+       ++sample_index) {
+    for (size_t channel_index = 0; channel_index < num_channels;
+         ++channel_index) {
+      const float hz = filterbank.thresholds_hz[{1}][channel_index];
+      const float db_spl = channels_db_spl[{sample_index}][channel_index];
+      EXPECT_EQ(phons[{sample_index}][channel_index],
+                phons_from_thresholds[{sample_index}][channel_index]);
+      EXPECT_NEAR(phons[{sample_index}][channel_index],
+                  ReferencePhons(l, hz, db_spl), 1e-2)
+          << "hz=" << hz << ", dB SPL=" << db_spl;
+    }
+  }
+}
+
+TEST(Loudness, CoefficientsCacheTest) {
+  const CamFilterbank filterbank = Cam().CreateFilterbank(48000);
+  hwy::AlignedNDArray<float, 2> other_thresholds_hz(
+      filterbank.thresholds_hz.shape());
+  for (size_t row = 0; row < other_thresholds_hz.shape()[0]; ++row) {
+    for (size_t channel = 0; channel < other_thresholds_hz.shape()[1];
+         ++channel) {
+      other_thresholds_hz[{row}][channel] =
+          filterbank.thresholds_hz[{row}][channel];
+    }
+  }
+  other_thresholds_hz[{1}][0] += 1;
+  Loudness l;
+  LoudnessCoefficientsCache cache;
+  const std::shared_ptr<const LoudnessCoefficients> coefficients =
+      cache.Get(l, filterbank.thresholds_hz);
+  const LoudnessCoefficients want = l.Coefficients(filterbank.thresholds_hz);
+  ASSERT_EQ(coefficients->values.shape(), want.values.shape());
+  for (size_t row = 0; row < want.values.shape()[0]; ++row) {
+    for (size_t channel = 0; channel < want.values.shape()[1]; ++channel) {
+      EXPECT_EQ(coefficients->values[{row}][channel],
+                want.values[{row}][channel]);
+    }
+  }
+  EXPECT_EQ(cache.Get(l, filterbank.thresholds_hz), coefficients);
+
+  const std::shared_ptr<const LoudnessCoefficients> other_coefficients =
+      cache.Get(l, other_thresholds_hz);
+  EXPECT_NE(other_coefficients, coefficients);
+
+  l.a_f_params[0] *= 2;
+  const std::shared_ptr<const LoudnessCoefficients> changed_coefficients =
+      cache.Get(l, other_thresholds_hz);
+  EXPECT_NE(changed_coefficients, other_coefficients);
+  EXPECT_EQ(cache.Get(l, other_thresholds_hz), changed_coefficients);
+}
+
 void BM_PhonsFromSPL(benchmark::State& state) {
   const Cam cam;
   const CamFilterbank filterbank = cam.CreateFilterbank(48000);
@@ -178,6 +278,21 @@ void BM_PhonsFromSPL(benchmark::State& state) {
 }
 BENCHMARK_RANGE(BM_PhonsFromSPL, 1, 64);
 
+void BM_PhonsFromSPLWithCoefficients(benchmark::State& state) {
+  const Cam cam;
+  const CamFilterbank filterbank = cam.CreateFilterbank(48000);
+  hwy::AlignedNDArray<float, 2> channels(
+      {static_cast<size_t>(100 * state.range(0)), filterbank.filter.Size()});
+  const Loudness loudness;
+  const LoudnessCoefficients coefficients =
+      loudness.Coefficients(filterbank.thresholds_hz);
+  for (auto s : state) {
+    loudness.PhonsFromSPL(channels, coefficients, channels);
+  }
+  state.SetItemsProcessed(channels.size() * state.iterations());
+}
+BENCHMARK_RANGE(BM_PhonsFromSPLWithCoefficients, 1, 64);
+
 }  // namespace
 
 }  // namespace zimtohrli
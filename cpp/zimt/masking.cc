@@ -14,8 +14,10 @@
 
 #include "zimt/masking.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstddef>
+#include <limits>
 
 #include "absl/log/check.h"
 #include "hwy/aligned_allocator.h"
@@ -34,6 +36,7 @@
 // Must come after foreach_target.h to avoid redefinition errors.
 #include "hwy/contrib/math/math-inl.h"
 #include "hwy/highway.h"
+#include "zimt/fast_math-inl.h"
 
 // This is Highway magic conventions.
 HWY_BEFORE_NAMESPACE();
@@ -73,9 +76,10 @@ void HwyComputeEnergy(const hwy::AlignedNDArray<float, 2>& sample_channels,
   }
 }
 
-void HwyToDb(const hwy::AlignedNDArray<float, 2>& energy_channels_linear,
-             float full_scale_sine_db, float epsilon,
-             hwy::AlignedNDArray<float, 2>& energy_channels_db) {
+template <bool fast_math>
+void ToDbImpl(const hwy::AlignedNDArray<float, 2>& energy_channels_linear,
+              float full_scale_sine_db, float epsilon,
+              hwy::AlignedNDArray<float, 2>& energy_channels_db) {
   const Vec epsilon_vec = Set(d, epsilon);
   const Vec ten_vec = Set(d, 10);
   const Vec full_scale_sine_db_vec = Set(d, full_scale_sine_db);
@@ -85,21 +89,34 @@ void HwyToDb(const hwy::AlignedNDArray<float, 2>& energy_channels_linear,
     for (size_t channel_index = 0; channel_index < num_channels;
          channel_index += Lanes(d)) {
       Store(
-          MulAdd(
-              ten_vec,
-              Log10(d,
-                    Add(epsilon_vec,
-                        Load(d, energy_channels_linear[{sample_index}].data() +
-                                    channel_index))),
-              full_scale_sine_db_vec),
+          MulAdd(ten_vec,
+                 Log10Of<fast_math>(
+                     d, Add(epsilon_vec,
+                            Load(d, energy_channels_linear[{sample_index}]
+                                            .data() +
+                                        channel_index))),
+                 full_scale_sine_db_vec),
           d, energy_channels_db[{sample_index}].data() + channel_index);
     }
   }
 }
 
-void HwyToLinear(const hwy::AlignedNDArray<float, 2>& energy_channels_db,
-                 float full_scale_sine_db,
-                 hwy::AlignedNDArray<float, 2>& energy_channels_linear) {
+void HwyToDb(const hwy::AlignedNDArray<float, 2>& energy_channels_linear,
+             float full_scale_sine_db, float epsilon, bool fast_math,
+             hwy::AlignedNDArray<float, 2>& energy_channels_db) {
+  if (fast_math) {
+    ToDbImpl<true>(energy_channels_linear, full_scale_sine_db, epsilon,
+                   energy_channels_db);
+  } else {
+    ToDbImpl<false>(energy_channels_linear, full_scale_sine_db, epsilon,
+                    energy_channels_db);
+  }
+}
+
+template <bool fast_math>
+void ToLinearImpl(const hwy::AlignedNDArray<float, 2>& energy_channels_db,
+                  float full_scale_sine_db,
+                  hwy::AlignedNDArray<float, 2>& energy_channels_linear) {
   const Vec log_ten_mul_point_1_vec = Set(d, log(10) * 0.1);
   const Vec full_scale_sine_db_vec = Set(d, full_scale_sine_db);
   const size_t num_samples = energy_channels_db.shape()[0];
@@ -114,7 +131,8 @@ void HwyToLinear(const hwy::AlignedNDArray<float, 2>& energy_channels_db,
       // ln(y) = (x / 10) * ln(10)
       // ln(y) = x * ln(10) * 0.1
       // y = exp(x * ln(10) * 0.1)
-      Store(Exp(d, Mul(Sub(Load(d, energy_channels_db[{sample_index}].data() +
+      Store(ExpOf<fast_math>(
+                d, Mul(Sub(Load(d, energy_channels_db[{sample_index}].data() +
                                        channel_index),
                            full_scale_sine_db_vec),
                        log_ten_mul_point_1_vec)),
@@ -123,6 +141,18 @@ void HwyToLinear(const hwy::AlignedNDArray<float, 2>& energy_channels_db,
   }
 }
 
+void HwyToLinear(const hwy::AlignedNDArray<float, 2>& energy_channels_db,
+                 float full_scale_sine_db, bool fast_math,
+                 hwy::AlignedNDArray<float, 2>& energy_channels_linear) {
+  if (fast_math) {
+    ToLinearImpl<true>(energy_channels_db, full_scale_sine_db,
+                       energy_channels_linear);
+  } else {
+    ToLinearImpl<false>(energy_channels_db, full_scale_sine_db,
+                        energy_channels_linear);
+  }
+}
+
 // Reusable logic to efficiently compute full masking.
 struct FullMaskingCalculator {
   FullMaskingCalculator(const Masking& m, float cam_delta_per_channel) {
@@ -207,13 +237,42 @@ void HwyCutFullyMasked(const Masking& m,
   FullMaskingCalculator full_masking_calculator(m, cam_delta);
   const size_t num_samples = energy_channels_db.shape()[0];
   const size_t num_channels = energy_channels_db.shape()[1];
+  const size_t padded_num_channels = energy_channels_db.memory_shape()[1];
   for (size_t sample_index = 0; sample_index < num_samples; ++sample_index) {
     const float* energy_channels_db_data =
         energy_channels_db[{sample_index}].data();
+    // Maskers weaker than max_mask don't mask anything, and the spread of the
+    // others is bounded by the spread at the extremes of their level range, so
+    // per probe only the maskers in a band of constant width need visiting.
+    Vec max_level_vec = Set(d, m.max_mask);
+    for (size_t channel_index = 0; channel_index < padded_num_channels;
+         channel_index += Lanes(d)) {
+      max_level_vec =
+          Max(max_level_vec, Load(d, energy_channels_db_data + channel_index));
+    }
+    const float max_level = ReduceMax(d, max_level_vec);
+    const float lower_zero =
+        std::min(m.LowerZero(m.max_mask), m.LowerZero(max_level));
+    const float upper_zero =
+        std::max(m.UpperZero(m.max_mask), m.UpperZero(max_level));
+    // One extra channel on each side to be safe from rounding at the edges.
+    const size_t upward_spread_channels =
+        static_cast<size_t>(std::ceil(upper_zero / cam_delta)) + 1;
+    const size_t downward_spread_channels =
+        static_cast<size_t>(std::ceil(-lower_zero / cam_delta)) + 1;
     for (size_t probe_channel_index = 0; probe_channel_index < num_channels;
          ++probe_channel_index) {
       float max_masked = std::numeric_limits<float>::min();
-      for (size_t masker_channel_index = 0; masker_channel_index < num_channels;
+      const size_t first_masker_channel_index =
+          probe_channel_index > upward_spread_channels
+              ? probe_channel_index - upward_spread_channels
+              : 0;
+      const size_t end_masker_channel_index = std::min(
+          num_channels, probe_channel_index + downward_spread_channels + 1);
+      for (size_t masker_channel_index =
+               first_masker_channel_index -
+               first_masker_channel_index % Lanes(d);
+           masker_channel_index < end_masker_channel_index;
            masker_channel_index += Lanes(d)) {
         const Vec masker_level_db =
             Load(d, energy_channels_db_data + masker_channel_index);
@@ -255,19 +314,34 @@ void ComputeEnergy(const hwy::AlignedNDArray<float, 2>& sample_channels,
 void ToDb(const hwy::AlignedNDArray<float, 2>& energy_channels_linear,
           float full_scale_sine_db, float epsilon,
           hwy::AlignedNDArray<float, 2>& energy_channels_db) {
+  ToDb(energy_channels_linear, full_scale_sine_db, epsilon,
+       /*fast_math=*/false, energy_channels_db);
+}
+
+void ToDb(const hwy::AlignedNDArray<float, 2>& energy_channels_linear,
+          float full_scale_sine_db, float epsilon, bool fast_math,
+          hwy::AlignedNDArray<float, 2>& energy_channels_db) {
   CHECK_EQ(energy_channels_linear.shape()[0], energy_channels_db.shape()[0]);
   CHECK_EQ(energy_channels_linear.shape()[1], energy_channels_db.shape()[1]);
   HWY_DYNAMIC_DISPATCH(HwyToDb)
-  (energy_channels_linear, full_scale_sine_db, epsilon, energy_channels_db);
+  (energy_channels_linear, full_scale_sine_db, epsilon, fast_math,
+   energy_channels_db);
 }
 
 void ToLinear(const hwy::AlignedNDArray<float, 2>& energy_channels_db,
               float full_scale_sine_db,
               hwy::AlignedNDArray<float, 2>& energy_channels_linear) {
+  ToLinear(energy_channels_db, full_scale_sine_db, /*fast_math=*/false,
+           energy_channels_linear);
+}
+
+void ToLinear(const hwy::AlignedNDArray<float, 2>& energy_channels_db,
+              float full_scale_sine_db, bool fast_math,
+              hwy::AlignedNDArray<float, 2>& energy_channels_linear) {
   CHECK_EQ(energy_channels_linear.shape()[0], energy_channels_db.shape()[0]);
   CHECK_EQ(energy_channels_linear.shape()[1], energy_channels_db.shape()[1]);
   HWY_DYNAMIC_DISPATCH(HwyToLinear)
-  (energy_channels_db, full_scale_sine_db, energy_channels_linear);
+  (energy_channels_db, full_scale_sine_db, fast_math, energy_channels_linear);
 }
 
 void Masking::FullMasking(
@@ -281,6 +355,20 @@ void Masking::FullMasking(
   (*this, energy_channels_db, cam_delta, full_masking_db);
 }
 
+float Masking::LowerZero(float masker_level_db) const {
+  return std::min(-0.1f, lower_zero_at_20 + (masker_level_db - max_mask) *
+                                                (lower_zero_at_80 -
+                                                 lower_zero_at_20) /
+                                                60);
+}
+
+float Masking::UpperZero(float masker_level_db) const {
+  return std::max(0.1f, upper_zero_at_20 + (masker_level_db - max_mask) *
+                                               (upper_zero_at_80 -
+                                                upper_zero_at_20) /
+                                               60);
+}
+
 void Masking::CutFullyMasked(
     const hwy::AlignedNDArray<float, 2>& energy_channels_db, float cam_delta,
     hwy::AlignedNDArray<float, 2>& non_masked_db) const {
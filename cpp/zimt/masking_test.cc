@@ -14,7 +14,10 @@
 
 #include "zimt/masking.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
+#include <limits>
 #include <vector>
 
 #include "benchmark/benchmark.h"
@@ -88,6 +91,32 @@ TEST(Masking, ToDbToLinear) {
   CheckNear(energy_channels_db[{1}], {0.1, 1.0});
 }
 
+TEST(Masking, FastToDbToLinear) {
+  const size_t num_values = 1000;
+  hwy::AlignedNDArray<float, 2> energy_channels_linear({1, num_values});
+  for (size_t index = 0; index < num_values; ++index) {
+    // Energies from 1e-9 to 1e6.
+    energy_channels_linear[{0}][index] =
+        std::pow(10.0, -9.0 + 15.0 * index / num_values);
+  }
+  hwy::AlignedNDArray<float, 2> energy_channels_db({1, num_values});
+  ToDb(energy_channels_linear, 80, 1e-10, /*fast_math=*/true,
+       energy_channels_db);
+  for (size_t index = 0; index < num_values; ++index) {
+    const double want_db =
+        80 + 10 * std::log10(1e-10 + energy_channels_linear[{0}][index]);
+    EXPECT_NEAR(energy_channels_db[{0}][index], want_db, 5e-4);
+  }
+
+  hwy::AlignedNDArray<float, 2> round_trip({1, num_values});
+  ToLinear(energy_channels_db, 80, /*fast_math=*/true, round_trip);
+  for (size_t index = 0; index < num_values; ++index) {
+    const double want_linear =
+        std::pow(10.0, (energy_channels_db[{0}][index] - 80) / 10);
+    EXPECT_NEAR(round_trip[{0}][index] / want_linear, 1, 5e-6);
+  }
+}
+
 TEST(Masking, FullMasking) {
   hwy::AlignedNDArray<float, 2> energy_channels({1, 2});
   hwy::AlignedNDArray<float, 3> full_masking({1, 2, 2});
@@ -265,6 +294,63 @@ TEST(Masking, CutFullyMasked) {
   EXPECT_NEAR((non_masked[{0}][1]), -28, 1) << "20dB fully masked by 80dB";
 }
 
+TEST(Masking, CutFullyMaskedMatchesFullMasking) {
+  const size_t num_samples = 4;
+  const size_t num_channels = 300;
+  const float cam_delta = 0.1;
+  hwy::AlignedNDArray<float, 2> energy_channels({num_samples, num_channels});
+  for (size_t sample_index = 0; sample_index < num_samples; ++sample_index) {
+    for (size_t channel_index = 0; channel_index < num_channels;
+         ++channel_index) {
+      energy_channels[{sample_index}][channel_index] =
+          50 + 40 * std::sin(0.37 * channel_index + sample_index);
+    }
+  }
+  Masking m;
+  hwy::AlignedNDArray<float, 2> non_masked({num_samples, num_channels});
+  m.CutFullyMasked(energy_channels, cam_delta, non_masked);
+  hwy::AlignedNDArray<float, 3> full_masking(
+      {num_samples, num_channels, num_channels});
+  m.FullMasking(energy_channels, cam_delta, full_masking);
+  for (size_t sample_index = 0; sample_index < num_samples; ++sample_index) {
+    for (size_t probe_channel_index = 0; probe_channel_index < num_channels;
+         ++probe_channel_index) {
+      float max_masked = std::numeric_limits<float>::min();
+      for (size_t masker_channel_index = 0; masker_channel_index < num_channels;
+           ++masker_channel_index) {
+        max_masked = std::max(
+            max_masked, full_masking[{sample_index, probe_channel_index}]
+                                    [masker_channel_index]);
+      }
+      const float probe_energy_db =
+          energy_channels[{sample_index}][probe_channel_index];
+      ASSERT_EQ((non_masked[{sample_index}][probe_channel_index]),
+                max_masked > probe_energy_db ? probe_energy_db - max_masked
+                                             : probe_energy_db)
+          << "sample_index=" << sample_index
+          << " probe_channel_index=" << probe_channel_index;
+    }
+  }
+}
+
+void BM_ToDb(benchmark::State& state) {
+  hwy::AlignedNDArray<float, 2> energy_channels({100, 1024});
+  for (size_t sample_index = 0; sample_index < energy_channels.shape()[0];
+       ++sample_index) {
+    for (size_t channel_index = 0; channel_index < energy_channels.shape()[1];
+         ++channel_index) {
+      energy_channels[{sample_index}][channel_index] =
+          0.001f * (1 + sample_index + channel_index);
+    }
+  }
+  hwy::AlignedNDArray<float, 2> energy_channels_db(energy_channels.shape());
+  for (auto s : state) {
+    ToDb(energy_channels, 80, 1e-9, state.range(0) != 0, energy_channels_db);
+  }
+  state.SetItemsProcessed(energy_channels.size() * state.iterations());
+}
+BENCHMARK(BM_ToDb)->Arg(0)->Arg(1);
+
 void BM_FullMasking(benchmark::State& state) {
   const size_t sample_rate = 100;
   const hwy::AlignedNDArray<float, 2> energy_channels_db(
@@ -280,6 +366,27 @@ void BM_FullMasking(benchmark::State& state) {
 }
 BENCHMARK_RANGE(BM_FullMasking, 1, 64);
 
+void BM_CutFullyMasked(benchmark::State& state) {
+  const size_t sample_rate = 100;
+  hwy::AlignedNDArray<float, 2> energy_channels_db(
+      {sample_rate, static_cast<size_t>(state.range(0))});
+  for (size_t sample_index = 0; sample_index < energy_channels_db.shape()[0];
+       ++sample_index) {
+    for (size_t channel_index = 0;
+         channel_index < energy_channels_db.shape()[1]; ++channel_index) {
+      energy_channels_db[{sample_index}][channel_index] =
+          50 + 40 * std::sin(0.37 * channel_index + sample_index);
+    }
+  }
+  hwy::AlignedNDArray<float, 2> non_masked_db(energy_channels_db.shape());
+  Masking m;
+  for (auto s : state) {
+    m.CutFullyMasked(energy_channels_db, 0.1, non_masked_db);
+  }
+  state.SetItemsProcessed(energy_channels_db.size() * state.iterations());
+}
+BENCHMARK_RANGE(BM_CutFullyMasked, 64, 4096);
+
 }  // namespace
 
 }  // namespace zimtohrli
@@ -0,0 +1,513 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "zimt/metric_server.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <set>
+#include <string>
+#include <thread>  // NOLINT
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "hwy/aligned_allocator.h"
+#include "zimt/cam.h"
+#include "zimt/multi_rate.h"
+#include "zimt/thread_pool.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+namespace {
+
+// Requests with larger payloads end the connection, to avoid allocating
+// arbitrary amounts of memory for a corrupt header.
+constexpr uint32_t kMaxPayloadSize = 1 << 28;
+
+absl::Status ErrnoError(const std::string& message) {
+  return absl::InternalError(absl::StrCat(message, ": ", std::strerror(errno)));
+}
+
+// The wire format of a signal.
+struct Signal {
+  uint32_t buffer_id;
+  float sample_rate;
+  uint64_t offset;
+  uint64_t num_samples;
+};
+static_assert(sizeof(Signal) == 24);
+
+// A file of floats mapped read-only.
+//
+// Keeps the file open to check before each use that it wasn't truncated, since
+// reading a mapped page past the end of the file raises SIGBUS.
+class MappedBuffer {
+ public:
+  static absl::StatusOr<std::unique_ptr<MappedBuffer>> Open(
+      const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return ErrnoError(absl::StrCat("unable to open ", path));
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+      const absl::Status status =
+          ErrnoError(absl::StrCat("unable to stat ", path));
+      close(fd);
+      return status;
+    }
+    const size_t size = static_cast<size_t>(file_stat.st_size);
+    if (size < sizeof(float)) {
+      close(fd);
+      return absl::InvalidArgumentError(
+          absl::StrCat(path, " doesn't contain any samples"));
+    }
+    void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      const absl::Status status =
+          ErrnoError(absl::StrCat("unable to map ", path));
+      close(fd);
+      return status;
+    }
+    return std::unique_ptr<MappedBuffer>(new MappedBuffer(fd, data, size));
+  }
+
+  MappedBuffer(const MappedBuffer&) = delete;
+  MappedBuffer& operator=(const MappedBuffer&) = delete;
+  ~MappedBuffer() {
+    munmap(data_, size_);
+    close(fd_);
+  }
+
+  // Returns an error if the file is now shorter than when it was mapped.
+  absl::Status CheckSize() const {
+    struct stat file_stat;
+    if (fstat(fd_, &file_stat) != 0) {
+      return ErrnoError("unable to stat mapped buffer");
+    }
+    if (static_cast<size_t>(file_stat.st_size) < size_) {
+      return absl::FailedPreconditionError(
+          absl::StrCat("mapped buffer was truncated from ", size_, " to ",
+                       file_stat.st_size, " bytes"));
+    }
+    return absl::OkStatus();
+  }
+
+  // Returns the whole floats in the buffer.
+  hwy::Span<const float> Floats() const {
+    return hwy::Span<const float>(static_cast<const float*>(data_),
+                                  size_ / sizeof(float));
+  }
+
+ private:
+  MappedBuffer(int fd, void* data, size_t size)
+      : fd_(fd), data_(data), size_(size) {}
+
+  int fd_;
+  void* data_;
+  size_t size_;
+};
+
+// Reads values from a request payload.
+class PayloadReader {
+ public:
+  explicit PayloadReader(const std::string& payload) : payload_(payload) {}
+
+  template <typename T>
+  absl::Status Read(T& value) {
+    if (payload_.size() - offset_ < sizeof(T)) {
+      return absl::InvalidArgumentError("request payload is too short");
+    }
+    std::memcpy(&value, payload_.data() + offset_, sizeof(T));
+    offset_ += sizeof(T);
+    return absl::OkStatus();
+  }
+
+  // Returns an error if there are unread bytes in the payload.
+  absl::Status Done() const {
+    if (offset_ != payload_.size()) {
+      return absl::InvalidArgumentError("request payload is too long");
+    }
+    return absl::OkStatus();
+  }
+
+ private:
+  const std::string& payload_;
+  size_t offset_ = 0;
+};
+
+// Reads size bytes from fd into data.
+//
+// Returns false if the connection was closed before any byte was read.
+absl::StatusOr<bool> ReadFully(int fd, void* data, size_t size) {
+  char* bytes = static_cast<char*>(data);
+  size_t num_read = 0;
+  while (num_read < size) {
+    const ssize_t result = read(fd, bytes + num_read, size - num_read);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return ErrnoError("unable to read request");
+    }
+    if (result == 0) {
+      if (num_read == 0) {
+        return false;
+      }
+      return absl::DataLossError("connection closed in the middle of a read");
+    }
+    num_read += static_cast<size_t>(result);
+  }
+  return true;
+}
+
+absl::Status WriteFully(int fd, const void* data, size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  size_t num_written = 0;
+  while (num_written < size) {
+    const ssize_t result =
+        send(fd, bytes + num_written, size - num_written, MSG_NOSIGNAL);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return ErrnoError("unable to write response");
+    }
+    num_written += static_cast<size_t>(result);
+  }
+  return absl::OkStatus();
+}
+
+template <typename T>
+void Append(const T& value, std::string& out) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+}  // namespace
+
+struct MetricServer::Connection {
+  struct Reference {
+    const Zimtohrli* zimtohrli;
+    Analysis analysis;
+  };
+
+  // Returns the samples of signal, and the instance to analyze them with.
+  absl::StatusOr<std::pair<hwy::Span<const float>, const Zimtohrli*>> Resolve(
+      MetricServer& server, const Signal& signal) const {
+    const auto buffer = buffers.find(signal.buffer_id);
+    if (buffer == buffers.end()) {
+      return absl::NotFoundError(
+          absl::StrCat("no buffer with id ", signal.buffer_id));
+    }
+    if (absl::Status status = buffer->second->CheckSize(); !status.ok()) {
+      return status;
+    }
+    const hwy::Span<const float> floats = buffer->second->Floats();
+    if (signal.num_samples == 0 || signal.offset > floats.size() ||
+        floats.size() - signal.offset < signal.num_samples) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          signal.num_samples, " samples at offset ", signal.offset,
+          " aren't within the ", floats.size(), " samples of buffer ",
+          signal.buffer_id));
+    }
+    const absl::StatusOr<const Zimtohrli*> zimtohrli =
+        server.ForSampleRate(signal.sample_rate);
+    if (!zimtohrli.ok()) {
+      return zimtohrli.status();
+    }
+    return std::make_pair(
+        hwy::Span<const float>(floats.data() + signal.offset,
+                               static_cast<size_t>(signal.num_samples)),
+        *zimtohrli);
+  }
+
+  std::map<uint32_t, std::unique_ptr<MappedBuffer>> buffers;
+  uint32_t next_buffer_id = 1;
+  std::map<uint64_t, Reference> references;
+};
+
+MetricServer::MetricServer(const Cam& cam, Zimtohrli prototype,
+                           size_t num_threads)
+    : zimtohrli_(cam, std::move(prototype)), pool_(num_threads) {
+  // Makes sure that the filterbanks of all accepted sample rates have
+  // channels.
+  CHECK_LT(cam.low_threshold_hz, kMinSampleRate * 0.5f);
+}
+
+absl::StatusOr<const Zimtohrli*> MetricServer::ForSampleRate(
+    float sample_rate) {
+  if (!std::isfinite(sample_rate) || sample_rate < kMinSampleRate ||
+      sample_rate > kMaxSampleRate) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("sample rate ", sample_rate, " isn't between ",
+                     kMinSampleRate, " and ", kMaxSampleRate, " Hz"));
+  }
+  {
+    std::lock_guard<std::mutex> lock(sample_rates_mutex_);
+    if (sample_rates_.size() >= kMaxSampleRates &&
+        sample_rates_.count(sample_rate) == 0) {
+      return absl::ResourceExhaustedError(absl::StrCat(
+          "already serving ", kMaxSampleRates, " different sample rates"));
+    }
+    sample_rates_.insert(sample_rate);
+  }
+  return &zimtohrli_.ForSampleRate(sample_rate);
+}
+
+absl::StatusOr<std::string> MetricServer::Handle(uint32_t type,
+                                                 const std::string& payload,
+                                                 Connection& connection) {
+  PayloadReader reader(payload);
+  std::string response;
+  switch (type) {
+    case kMapBuffer: {
+      absl::StatusOr<std::unique_ptr<MappedBuffer>> buffer =
+          MappedBuffer::Open(payload);
+      if (!buffer.ok()) {
+        return buffer.status();
+      }
+      const uint32_t buffer_id = connection.next_buffer_id++;
+      connection.buffers[buffer_id] = *std::move(buffer);
+      Append(buffer_id, response);
+      return response;
+    }
+    case kUnmapBuffer: {
+      uint32_t buffer_id;
+      if (absl::Status status = reader.Read(buffer_id); !status.ok()) {
+        return status;
+      }
+      if (absl::Status status = reader.Done(); !status.ok()) {
+        return status;
+      }
+      if (connection.buffers.erase(buffer_id) == 0) {
+        return absl::NotFoundError(
+            absl::StrCat("no buffer with id ", buffer_id));
+      }
+      return response;
+    }
+    case kAnalyzeReference: {
+      uint64_t reference_id;
+      Signal signal;
+      if (absl::Status status = reader.Read(reference_id); !status.ok()) {
+        return status;
+      }
+      if (absl::Status status = reader.Read(signal); !status.ok()) {
+        return status;
+      }
+      if (absl::Status status = reader.Done(); !status.ok()) {
+        return status;
+      }
+      const auto resolved = connection.Resolve(*this, signal);
+      if (!resolved.ok()) {
+        return resolved.status();
+      }
+      const Zimtohrli* z = resolved->second;
+      connection.references.insert_or_assign(
+          reference_id, Connection::Reference{
+                            .zimtohrli = z,
+                            .analysis = z->Analyze(resolved->first)});
+      return response;
+    }
+    case kForgetReference: {
+      uint64_t reference_id;
+      if (absl::Status status = reader.Read(reference_id); !status.ok()) {
+        return status;
+      }
+      if (absl::Status status = reader.Done(); !status.ok()) {
+        return status;
+      }
+      if (connection.references.erase(reference_id) == 0) {
+        return absl::NotFoundError(
+            absl::StrCat("no reference with id ", reference_id));
+      }
+      return response;
+    }
+    case kDistances: {
+      uint32_t num_pairs;
+      if (absl::Status status = reader.Read(num_pairs); !status.ok()) {
+        return status;
+      }
+      struct Pair {
+        const Connection::Reference* reference;
+        hwy::Span<const float> samples;
+        const Zimtohrli* zimtohrli;
+      };
+      std::vector<Pair> pairs;
+      for (uint32_t pair_index = 0; pair_index < num_pairs; ++pair_index) {
+        uint64_t reference_id;
+        Signal signal;
+        if (absl::Status status = reader.Read(reference_id); !status.ok()) {
+          return status;
+        }
+        if (absl::Status status = reader.Read(signal); !status.ok()) {
+          return status;
+        }
+        const auto reference = connection.references.find(reference_id);
+        if (reference == connection.references.end()) {
+          return absl::NotFoundError(
+              absl::StrCat("no reference with id ", reference_id));
+        }
+        const auto resolved = connection.Resolve(*this, signal);
+        if (!resolved.ok()) {
+          return resolved.status();
+        }
+        if (!zimtohrli_.Comparable(
+                reference->second.zimtohrli->cam_filterbank->sample_rate,
+                signal.sample_rate)) {
+          return absl::InvalidArgumentError(absl::StrCat(
+              "signals at ",
+              reference->second.zimtohrli->cam_filterbank->sample_rate,
+              " and ", signal.sample_rate, " Hz aren't comparable"));
+        }
+        pairs.push_back({.reference = &reference->second,
+                         .samples = resolved->first,
+                         .zimtohrli = resolved->second});
+      }
+      if (absl::Status status = reader.Done(); !status.ok()) {
+        return status;
+      }
+      std::vector<float> distances(pairs.size());
+      {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        pool_.ParallelFor(pairs.size(), [&](size_t pair_index) {
+          const Pair& pair = pairs[pair_index];
+          const Analysis analysis = pair.zimtohrli->Analyze(pair.samples);
+          distances[pair_index] =
+              pair.reference->zimtohrli
+                  ->Distance(false, pair.reference->analysis.spectrogram,
+                             analysis.spectrogram)
+                  .value;
+        });
+      }
+      response.append(reinterpret_cast<const char*>(distances.data()),
+                      distances.size() * sizeof(float));
+      return response;
+    }
+  }
+  return absl::InvalidArgumentError(
+      absl::StrCat("unknown request type ", type));
+}
+
+absl::Status MetricServer::Serve(int fd) {
+  Connection connection;
+  std::string payload;
+  while (true) {
+    uint32_t header[2];
+    absl::StatusOr<bool> read = ReadFully(fd, header, sizeof(header));
+    if (!read.ok()) {
+      return read.status();
+    }
+    if (!*read) {
+      return absl::OkStatus();
+    }
+    if (header[1] > kMaxPayloadSize) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("request payload of ", header[1], " bytes is too big"));
+    }
+    payload.resize(header[1]);
+    read = ReadFully(fd, payload.data(), payload.size());
+    if (!read.ok()) {
+      return read.status();
+    }
+    if (!*read && !payload.empty()) {
+      return absl::DataLossError("connection closed in the middle of a read");
+    }
+    const absl::StatusOr<std::string> response =
+        Handle(header[0], payload, connection);
+    const std::string& response_payload =
+        response.ok() ? *response : std::string(response.status().message());
+    const uint32_t response_header[2] = {
+        static_cast<uint32_t>(response.status().code()),
+        static_cast<uint32_t>(response_payload.size())};
+    if (absl::Status status =
+            WriteFully(fd, response_header, sizeof(response_header));
+        !status.ok()) {
+      return status;
+    }
+    if (absl::Status status =
+            WriteFully(fd, response_payload.data(), response_payload.size());
+        !status.ok()) {
+      return status;
+    }
+  }
+}
+
+absl::Status ListenAndServe(MetricServer& server,
+                            const std::string& socket_path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("socket path ", socket_path, " is too long"));
+  }
+  std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+  // Replaces sockets left behind by previous servers, but nothing else.
+  struct stat file_stat;
+  if (stat(socket_path.c_str(), &file_stat) == 0 &&
+      S_ISSOCK(file_stat.st_mode)) {
+    unlink(socket_path.c_str());
+  }
+  const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    return ErrnoError("unable to create socket");
+  }
+  if (bind(listen_fd, reinterpret_cast<const sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0) {
+    const absl::Status status =
+        ErrnoError(absl::StrCat("unable to listen on ", socket_path));
+    close(listen_fd);
+    return status;
+  }
+  while (true) {
+    const int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      const absl::Status status = ErrnoError("unable to accept connection");
+      close(listen_fd);
+      return status;
+    }
+    std::thread([&server, fd]() {
+      const absl::Status status = server.Serve(fd);
+      if (!status.ok()) {
+        std::cerr << "Connection failed: " << status.message() << std::endl;
+      }
+      close(fd);
+    }).detach();
+  }
+}
+
+}  // namespace zimtohrli
@@ -0,0 +1,134 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef CPP_ZIMT_METRIC_SERVER_H_
+#define CPP_ZIMT_METRIC_SERVER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>  // NOLINT
+#include <set>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "zimt/cam.h"
+#include "zimt/multi_rate.h"
+#include "zimt/thread_pool.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+// Long-lived Zimtohrli metric serving batched distance requests over a binary
+// protocol on stream sockets.
+//
+// Keeps the filterbank for each sample rate, the reference analyses of each
+// client, and a thread pool warm between requests, and reads samples from
+// shared memory files mapped by the clients instead of receiving them through
+// the socket.
+//
+// Each request and response starts with two uint32s, in native byte order
+// since clients run on the same machine: the request type or response
+// absl::StatusCode, and the size in bytes of the payload that follows. Error
+// responses have the error message as payload.
+//
+// Samples are referred to by a signal: 24 bytes with a uint32 buffer id, a
+// float sample rate, and a uint64 offset and uint64 number of samples in the
+// buffer, both counted in floats.
+//
+// A buffer id, or a reference id, only refers to its buffer or reference on
+// the connection that created it.
+//
+// Signals must have a sample rate between kMinSampleRate and kMaxSampleRate,
+// and at most kMaxSampleRates different sample rates are served, since the
+// filterbank of each is kept for the lifetime of the server.
+class MetricServer {
+ public:
+  static constexpr float kMinSampleRate = 8000;
+  static constexpr float kMaxSampleRate = 384000;
+  static constexpr size_t kMaxSampleRates = 16;
+
+  enum RequestType : uint32_t {
+    // Payload is the path of a file of native floats, typically in /dev/shm,
+    // which the server maps until kUnmapBuffer or the end of the connection.
+    // Responds with the uint32 id of the buffer.
+    //
+    // The mapping is shared, so clients can write new samples to the file
+    // between requests without mapping it again. The file must not be
+    // modified while a request reading from it is in progress, and must never
+    // shrink while it is mapped: requests on a buffer whose file got shorter
+    // fail, but a file truncated during a request crashes the server.
+    kMapBuffer = 1,
+    // Payload is a uint32 buffer id. Responds with an empty payload.
+    kUnmapBuffer = 2,
+    // Payload is a uint64 reference id chosen by the client, followed by a
+    // signal. Analyzes the signal and keeps the analysis as the
+    // reference with that id. Responds with an empty payload.
+    kAnalyzeReference = 3,
+    // Payload is a uint64 reference id. Responds with an empty payload.
+    kForgetReference = 4,
+    // Payload is a uint32 number of pairs, followed by that many pairs of a
+    // uint64 reference id and a signal. Responds with the float
+    // distance between the reference and the signal of each pair.
+    //
+    // The pairs are analyzed and compared in parallel.
+    kDistances = 5,
+  };
+
+  // Creates a server using cam and the parameters of prototype for the
+  // instances of each sample rate, see MultiRateZimtohrli, and computing
+  // distances on num_threads threads.
+  //
+  // cam.low_threshold_hz must be below the Nyquist frequency of
+  // kMinSampleRate.
+  MetricServer(const Cam& cam, Zimtohrli prototype, size_t num_threads);
+
+  // Serves the requests of one client on the connected socket fd, until the
+  // client closes the connection.
+  //
+  // Can be called concurrently for different connections. Invalid requests
+  // get error responses without closing the connection, and only I/O errors
+  // end the connection early.
+  absl::Status Serve(int fd);
+
+ private:
+  // The buffers and references of one connection.
+  struct Connection;
+
+  // Returns the instance for signals at sample_rate, or an error if
+  // sample_rate isn't supported.
+  absl::StatusOr<const Zimtohrli*> ForSampleRate(float sample_rate);
+
+  // Returns the response payload for a request, or the error to respond with.
+  absl::StatusOr<std::string> Handle(uint32_t type, const std::string& payload,
+                                     Connection& connection);
+
+  MultiRateZimtohrli zimtohrli_;
+  // Guards sample_rates_, the sample rates served so far.
+  std::mutex sample_rates_mutex_;
+  std::set<float> sample_rates_;
+  // Guards pool_, which runs one batch at a time.
+  std::mutex pool_mutex_;
+  ThreadPool pool_;
+};
+
+// Accepts connections on a Unix domain socket at socket_path, serving each on
+// its own thread, until accepting a connection fails.
+absl::Status ListenAndServe(MetricServer& server,
+                            const std::string& socket_path);
+
+}  // namespace zimtohrli
+
+#endif  // CPP_ZIMT_METRIC_SERVER_H_
@@ -0,0 +1,188 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "zimt/metric_server.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>  // NOLINT
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "gtest/gtest.h"
+#include "hwy/aligned_allocator.h"
+#include "zimt/cam.h"
+#include "zimt/multi_rate.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+namespace {
+
+template <typename T>
+void Append(const T& value, std::string& out) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void AppendSignal(uint32_t buffer_id, float sample_rate, uint64_t offset,
+                  uint64_t num_samples, std::string& out) {
+  Append(buffer_id, out);
+  Append(sample_rate, out);
+  Append(offset, out);
+  Append(num_samples, out);
+}
+
+// Sends a request on fd and returns the status code and payload of the
+// response.
+std::pair<uint32_t, std::string> Call(int fd, uint32_t type,
+                                      const std::string& payload) {
+  const uint32_t header[2] = {type, static_cast<uint32_t>(payload.size())};
+  CHECK_EQ(write(fd, header, sizeof(header)),
+           static_cast<ssize_t>(sizeof(header)));
+  CHECK_EQ(write(fd, payload.data(), payload.size()),
+           static_cast<ssize_t>(payload.size()));
+  uint32_t response_header[2];
+  CHECK_EQ(read(fd, response_header, sizeof(response_header)),
+           static_cast<ssize_t>(sizeof(response_header)));
+  std::string response(response_header[1], '\0');
+  size_t num_read = 0;
+  while (num_read < response.size()) {
+    const ssize_t result =
+        read(fd, response.data() + num_read, response.size() - num_read);
+    CHECK_GT(result, 0);
+    num_read += static_cast<size_t>(result);
+  }
+  return {response_header[0], response};
+}
+
+TEST(MetricServer, DistancesTest) {
+  const float sample_rate = 48000;
+  const size_t num_samples = static_cast<size_t>(sample_rate / 4);
+  std::vector<float> samples;
+  for (const float hz : {1000.0f, 1000.0f, 1100.0f}) {
+    for (size_t index = 0; index < num_samples; ++index) {
+      samples.push_back(0.5 * std::sin(2 * M_PI * hz * index / sample_rate));
+    }
+  }
+  const std::string path = testing::TempDir() + "/metric_server_samples";
+  {
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(samples.data()),
+               samples.size() * sizeof(float));
+  }
+
+  const Zimtohrli prototype{.full_scale_sine_db = 90};
+  MetricServer server(Cam{}, prototype, 2);
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  absl::Status serve_status;
+  std::thread serve_thread([&server, &serve_status, &fds]() {
+    serve_status = server.Serve(fds[1]);
+  });
+
+  const auto [map_code, map_response] =
+      Call(fds[0], MetricServer::kMapBuffer, path);
+  ASSERT_EQ(map_code, 0) << map_response;
+  ASSERT_EQ(map_response.size(), sizeof(uint32_t));
+  uint32_t buffer_id;
+  std::memcpy(&buffer_id, map_response.data(), sizeof(buffer_id));
+
+  std::string analyze_request;
+  Append(uint64_t{7}, analyze_request);
+  AppendSignal(buffer_id, sample_rate, 0, num_samples, analyze_request);
+  EXPECT_EQ(
+      Call(fds[0], MetricServer::kAnalyzeReference, analyze_request).first,
+      0);
+
+  std::string distances_request;
+  Append(uint32_t{2}, distances_request);
+  for (const uint64_t offset : {num_samples, 2 * num_samples}) {
+    Append(uint64_t{7}, distances_request);
+    AppendSignal(buffer_id, sample_rate, offset, num_samples,
+                 distances_request);
+  }
+  const auto [distances_code, distances_response] =
+      Call(fds[0], MetricServer::kDistances, distances_request);
+  ASSERT_EQ(distances_code, 0) << distances_response;
+  ASSERT_EQ(distances_response.size(), 2 * sizeof(float));
+  float distances[2];
+  std::memcpy(distances, distances_response.data(), sizeof(distances));
+
+  MultiRateZimtohrli z(Cam{}, prototype);
+  const Analysis reference = z.Analyze(
+      sample_rate, hwy::Span<const float>(samples.data(), num_samples));
+  const Analysis other = z.Analyze(
+      sample_rate,
+      hwy::Span<const float>(samples.data() + 2 * num_samples, num_samples));
+  EXPECT_NEAR(distances[0], 0, 1e-3);
+  EXPECT_EQ(distances[1],
+            z.ForSampleRate(sample_rate)
+                .Distance(false, reference.spectrogram, other.spectrogram)
+                .value);
+
+  // Invalid requests get errors without closing the connection.
+  std::string unknown_request;
+  Append(uint32_t{1}, unknown_request);
+  Append(uint64_t{8}, unknown_request);
+  AppendSignal(buffer_id, sample_rate, 0, num_samples, unknown_request);
+  EXPECT_EQ(Call(fds[0], MetricServer::kDistances, unknown_request).first,
+            static_cast<uint32_t>(absl::StatusCode::kNotFound));
+  std::string out_of_bounds_request;
+  Append(uint64_t{8}, out_of_bounds_request);
+  AppendSignal(buffer_id, sample_rate, 2 * num_samples, num_samples + 1,
+               out_of_bounds_request);
+  EXPECT_EQ(
+      Call(fds[0], MetricServer::kAnalyzeReference, out_of_bounds_request)
+          .first,
+      static_cast<uint32_t>(absl::StatusCode::kInvalidArgument));
+  std::string forget_request;
+  Append(uint64_t{7}, forget_request);
+  EXPECT_EQ(Call(fds[0], MetricServer::kForgetReference, forget_request).first,
+            0);
+  EXPECT_EQ(Call(fds[0], MetricServer::kDistances, distances_request).first,
+            static_cast<uint32_t>(absl::StatusCode::kNotFound));
+  for (const float invalid_sample_rate : {40.0f, NAN, INFINITY}) {
+    std::string invalid_rate_request;
+    Append(uint64_t{7}, invalid_rate_request);
+    AppendSignal(buffer_id, invalid_sample_rate, 0, num_samples,
+                 invalid_rate_request);
+    EXPECT_EQ(
+        Call(fds[0], MetricServer::kAnalyzeReference, invalid_rate_request)
+            .first,
+        static_cast<uint32_t>(absl::StatusCode::kInvalidArgument));
+  }
+  ASSERT_EQ(truncate(path.c_str(), num_samples * sizeof(float)), 0);
+  EXPECT_EQ(
+      Call(fds[0], MetricServer::kAnalyzeReference, analyze_request).first,
+      static_cast<uint32_t>(absl::StatusCode::kFailedPrecondition));
+
+  close(fds[0]);
+  serve_thread.join();
+  close(fds[1]);
+  EXPECT_TRUE(serve_status.ok()) << serve_status;
+}
+
+}  // namespace
+
+}  // namespace zimtohrli
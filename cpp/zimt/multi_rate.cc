@@ -0,0 +1,59 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zimt/multi_rate.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <utility>
+
+#include "absl/log/check.h"
+#include "hwy/aligned_allocator.h"
+#include "zimt/cam.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+MultiRateZimtohrli::MultiRateZimtohrli(const Cam& cam, Zimtohrli prototype)
+    : cam_(cam), prototype_(std::move(prototype)) {}
+
+float MultiRateZimtohrli::HighThresholdHz(float sample_rate) const {
+  return std::min(cam_.high_threshold_hz, sample_rate * 0.5f);
+}
+
+const Zimtohrli& MultiRateZimtohrli::ForSampleRate(float sample_rate) {
+  CHECK_GT(sample_rate, 0);
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_ptr<Zimtohrli>& result = by_sample_rate_[sample_rate];
+  if (result == nullptr) {
+    Cam cam = cam_;
+    cam.high_threshold_hz = HighThresholdHz(sample_rate);
+    result = std::make_unique<Zimtohrli>(
+        prototype_.WithFilterbank(cam.CreateFilterbank(sample_rate)));
+  }
+  return *result;
+}
+
+Analysis MultiRateZimtohrli::Analyze(float sample_rate,
+                                     hwy::Span<const float> signal) {
+  return ForSampleRate(sample_rate).Analyze(signal);
+}
+
+bool MultiRateZimtohrli::Comparable(float sample_rate_a,
+                                    float sample_rate_b) const {
+  return HighThresholdHz(sample_rate_a) == HighThresholdHz(sample_rate_b);
+}
+
+}  // namespace zimtohrli
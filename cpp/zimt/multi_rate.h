@@ -0,0 +1,76 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CPP_ZIMT_MULTI_RATE_H_
+#define CPP_ZIMT_MULTI_RATE_H_
+
+#include <map>
+#include <memory>
+#include <mutex>  // NOLINT
+
+#include "hwy/aligned_allocator.h"
+#include "zimt/cam.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+// Zimtohrli instances sharing the same parameters, but with filterbanks
+// designed for different input sample rates.
+//
+// The channels of a Cam filterbank only depend on the Cam parameters, as long
+// as high_threshold_hz is below the Nyquist frequency of the sample rate, and
+// the perceptual time steps only depend on the duration of the signal. So
+// analyses of signals at e.g. 44.1, 48, and 96 kHz land on the same perceptual
+// grid, and can be compared with each other directly instead of resampling
+// the signals to a common rate first.
+//
+// The instance for each sample rate is created the first time it's needed and
+// kept until the MultiRateZimtohrli is destroyed.
+//
+// Safe for concurrent use.
+class MultiRateZimtohrli {
+ public:
+  // cam is used to create the filterbank for each sample rate, with its
+  // high_threshold_hz clamped to the Nyquist frequency of the sample rate.
+  //
+  // All other parameters are copied from prototype, whose cam_filterbank is
+  // ignored.
+  MultiRateZimtohrli(const Cam& cam, Zimtohrli prototype);
+
+  // Returns the instance for signals at sample_rate.
+  //
+  // The returned reference stays valid for the lifetime of this instance.
+  const Zimtohrli& ForSampleRate(float sample_rate);
+
+  // Returns an analysis of signal, sampled at sample_rate.
+  Analysis Analyze(float sample_rate, hwy::Span<const float> signal);
+
+  // Returns whether analyses of signals at sample_rate_a and sample_rate_b are
+  // on the same perceptual grid, i.e. whether both rates get the same
+  // channels.
+  bool Comparable(float sample_rate_a, float sample_rate_b) const;
+
+ private:
+  // Returns the high threshold of the filterbank for sample_rate.
+  float HighThresholdHz(float sample_rate) const;
+
+  const Cam cam_;
+  const Zimtohrli prototype_;
+  std::mutex mutex_;
+  std::map<float, std::unique_ptr<Zimtohrli>> by_sample_rate_;
+};
+
+}  // namespace zimtohrli
+
+#endif  // CPP_ZIMT_MULTI_RATE_H_
@@ -0,0 +1,76 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zimt/multi_rate.h"
+
+#include <cmath>
+#include <cstddef>
+
+#include "gtest/gtest.h"
+#include "hwy/aligned_allocator.h"
+#include "zimt/cam.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+namespace {
+
+Analysis AnalyzeTone(MultiRateZimtohrli& z, float sample_rate, float hz) {
+  hwy::AlignedNDArray<float, 1> signal({static_cast<size_t>(sample_rate / 2)});
+  for (size_t index = 0; index < signal.shape()[0]; ++index) {
+    signal[{}][index] = 0.5 * std::sin(2 * M_PI * hz * index / sample_rate);
+  }
+  return z.Analyze(sample_rate, signal[{}]);
+}
+
+TEST(MultiRateZimtohrli, ForSampleRateTest) {
+  MultiRateZimtohrli z(Cam{}, Zimtohrli{.full_scale_sine_db = 90});
+  const Zimtohrli& z48 = z.ForSampleRate(48000);
+  EXPECT_EQ(&z48, &z.ForSampleRate(48000));
+  EXPECT_EQ(z48.cam_filterbank->sample_rate, 48000);
+  EXPECT_EQ(z48.full_scale_sine_db, 90);
+  const Zimtohrli& z44 = z.ForSampleRate(44100);
+  EXPECT_NE(&z44, &z48);
+  EXPECT_EQ(z44.cam_filterbank->sample_rate, 44100);
+  EXPECT_EQ(z44.NumChannels(), z48.NumChannels());
+  EXPECT_LT(z.ForSampleRate(16000).NumChannels(), z48.NumChannels());
+}
+
+TEST(MultiRateZimtohrli, ComparableTest) {
+  MultiRateZimtohrli z(Cam{}, Zimtohrli{});
+  EXPECT_TRUE(z.Comparable(44100, 48000));
+  EXPECT_TRUE(z.Comparable(48000, 96000));
+  EXPECT_FALSE(z.Comparable(16000, 48000));
+  EXPECT_TRUE(z.Comparable(16000, 16000));
+}
+
+TEST(MultiRateZimtohrli, CrossRateDistanceTest) {
+  MultiRateZimtohrli z(Cam{}, Zimtohrli{});
+  const Analysis a48 = AnalyzeTone(z, 48000, 1000);
+  const Zimtohrli& z48 = z.ForSampleRate(48000);
+  for (const float sample_rate : {44100.0f, 96000.0f}) {
+    const Analysis a = AnalyzeTone(z, sample_rate, 1000);
+    ASSERT_EQ(a.spectrogram.shape(), a48.spectrogram.shape());
+    const float cross_rate_distance =
+        z48.Distance(false, a48.spectrogram, a.spectrogram).value;
+    const Analysis other_tone = AnalyzeTone(z, sample_rate, 1100);
+    const float other_tone_distance =
+        z48.Distance(false, a48.spectrogram, other_tone.spectrogram).value;
+    EXPECT_LT(cross_rate_distance * 10, other_tone_distance) << sample_rate;
+  }
+}
+
+}  // namespace
+
+}  // namespace zimtohrli
@@ -14,6 +14,9 @@
 
 #include "zimt/nsim.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include <utility>
 #include <vector>
 
@@ -149,85 +152,147 @@ hwy::AlignedNDArray<float, 2> HwyWindowMeanArray(
       });
 }
 
-float HwyNSIM(const hwy::AlignedNDArray<float, 2>& a,
-              const hwy::AlignedNDArray<float, 2>& b,
-              const std::vector<std::pair<size_t, size_t>>& time_pairs,
-              size_t step_window, size_t channel_window) {
-  const size_t num_channels = a.shape()[1];
-  const size_t num_steps = time_pairs.size();
-
-  hwy::AlignedNDArray<float, 2> mean_a =
-      HwyWindowMean(num_steps, num_channels, step_window, channel_window,
-                    [&](size_t step_index, size_t channel_index) -> Vec {
-                      return Load(d, a[{time_pairs[step_index].first}].data() +
-                                         channel_index);
-                    });
-  hwy::AlignedNDArray<float, 2> mean_b =
-      HwyWindowMean(num_steps, num_channels, step_window, channel_window,
-                    [&](size_t step_index, size_t channel_index) -> Vec {
-                      return Load(d, b[{time_pairs[step_index].second}].data() +
-                                         channel_index);
-                    });
-  // NB: This computes is (value - mean) using the mean computed for the window
-  // at the same position as the value, so that each value gets a different mean
-  // subtracted.
-  hwy::AlignedNDArray<float, 2> var_a = HwyWindowMean(
-      num_steps, num_channels, step_window, channel_window,
-      [&](size_t step_index, size_t channel_index) -> Vec {
-        const Vec delta = Sub(
-            Load(d, a[{time_pairs[step_index].first}].data() + channel_index),
-            Load(d, mean_a[{step_index}].data() + channel_index));
-        return Mul(delta, delta);
-      });
-  hwy::AlignedNDArray<float, 2> var_b = HwyWindowMean(
-      num_steps, num_channels, step_window, channel_window,
-      [&](size_t step_index, size_t channel_index) -> Vec {
-        const Vec delta = Sub(
-            Load(d, b[{time_pairs[step_index].second}].data() + channel_index),
-            Load(d, mean_b[{step_index}].data() + channel_index));
-        return Mul(delta, delta);
-      });
-  hwy::AlignedNDArray<float, 2> cov = HwyWindowMean(
-      num_steps, num_channels, step_window, channel_window,
-      [&](size_t step_index, size_t channel_index) -> Vec {
-        const Vec delta_a = Sub(
-            Load(d, a[{time_pairs[step_index].first}].data() + channel_index),
-            Load(d, mean_a[{step_index}].data() + channel_index));
-        const Vec delta_b = Sub(
-            Load(d, b[{time_pairs[step_index].second}].data() + channel_index),
-            Load(d, mean_b[{step_index}].data() + channel_index));
-        return Mul(delta_a, delta_b);
-      });
+// Populates result with the channel_window-wide zero-padded windowed sums of
+// step_sums across the channel axis, multiplied by reciprocal.
+void WindowMeanAcrossChannels(const float* step_sums, size_t num_channels,
+                              size_t channel_window, float reciprocal,
+                              float* result) {
+  float window_sum = 0;
+  for (size_t channel_index = 0; channel_index < num_channels;
+       ++channel_index) {
+    window_sum += step_sums[channel_index];
+    if (channel_index >= channel_window) {
+      window_sum -= step_sums[channel_index - channel_window];
+    }
+    result[channel_index] = window_sum * reciprocal;
+  }
+}
+
+// Replaces ring_row with the values in row, and updates the running
+// step_sums across the rows of the ring accordingly.
+void HwyReplaceRingRow(const float* row, size_t num_channels, float* ring_row,
+                       float* step_sums) {
+  for (size_t channel_index = 0; channel_index < num_channels;
+       channel_index += Lanes(d)) {
+    const Vec new_value = Load(d, row + channel_index);
+    Store(Add(Sub(Load(d, step_sums + channel_index),
+                  Load(d, ring_row + channel_index)),
+              new_value),
+          d, step_sums + channel_index);
+    Store(new_value, d, ring_row + channel_index);
+  }
+}
+
+// Populates step_sums with the exact sums across the rows of rings[ring], to
+// keep the rounding errors of the running sums from accumulating.
+void HwyRecomputeStepSums(const hwy::AlignedNDArray<float, 3>& rings,
+                          size_t ring, float* step_sums) {
+  const size_t step_window = rings.shape()[1];
+  const size_t num_channels = rings.shape()[2];
+  for (size_t channel_index = 0; channel_index < num_channels;
+       channel_index += Lanes(d)) {
+    Vec sum = Zero(d);
+    for (size_t row_index = 0; row_index < step_window; ++row_index) {
+      sum = Add(sum, Load(d, rings[{ring, row_index}].data() + channel_index));
+    }
+    Store(sum, d, step_sums + channel_index);
+  }
+}
+
+// Adds the steps a and b to the ring buffers, updates the running sums, and
+// returns the sum of the NSIM values of the new step across all channels.
+//
+// rings is a (5, step_window, num_channels)-shaped array of the last values
+// of a, b, (a - mean_a)^2, (b - mean_b)^2 and (a - mean_a) * (b - mean_b).
+//
+// step_sums is a (5, num_channels)-shaped array with the sums across the step
+// axis of each ring.
+//
+// scratch is (5, num_channels)-shaped working memory.
+float HwyStreamingNSIMStep(const float* a, const float* b, size_t ring_index,
+                           size_t channel_window,
+                           hwy::AlignedNDArray<float, 3>& rings,
+                           hwy::AlignedNDArray<float, 2>& step_sums,
+                           hwy::AlignedNDArray<float, 2>& scratch) {
+  const size_t step_window = rings.shape()[1];
+  const size_t num_channels = rings.shape()[2];
+  const float reciprocal =
+      1.0f / static_cast<float>(step_window * channel_window);
+  float* mean_a = scratch[{0}].data();
+  float* mean_b = scratch[{1}].data();
+  float* var_a = scratch[{2}].data();
+  float* var_b = scratch[{3}].data();
+  float* cov = scratch[{4}].data();
+
+  if (ring_index == 0) {
+    for (size_t ring = 0; ring < 5; ++ring) {
+      HwyRecomputeStepSums(rings, ring, step_sums[{ring}].data());
+    }
+  }
+
+  HwyReplaceRingRow(a, num_channels, rings[{0, ring_index}].data(),
+                    step_sums[{0}].data());
+  HwyReplaceRingRow(b, num_channels, rings[{1, ring_index}].data(),
+                    step_sums[{1}].data());
+  WindowMeanAcrossChannels(step_sums[{0}].data(), num_channels, channel_window,
+                           reciprocal, mean_a);
+  WindowMeanAcrossChannels(step_sums[{1}].data(), num_channels, channel_window,
+                           reciprocal, mean_b);
+
+  // NB: Each value gets the mean computed for the window at its own position
+  // subtracted, so the deltas of a step never change once computed.
+  const float* ring_a = rings[{0, ring_index}].data();
+  const float* ring_b = rings[{1, ring_index}].data();
+  // The products are temporarily stored where the variances and covariance
+  // end up.
+  float* delta_products[3] = {var_a, var_b, cov};
+  for (size_t channel_index = 0; channel_index < num_channels;
+       channel_index += Lanes(d)) {
+    const Vec delta_a = Sub(Load(d, ring_a + channel_index),
+                            Load(d, mean_a + channel_index));
+    const Vec delta_b = Sub(Load(d, ring_b + channel_index),
+                            Load(d, mean_b + channel_index));
+    Store(Mul(delta_a, delta_a), d, delta_products[0] + channel_index);
+    Store(Mul(delta_b, delta_b), d, delta_products[1] + channel_index);
+    Store(Mul(delta_a, delta_b), d, delta_products[2] + channel_index);
+  }
+  for (size_t product_index = 0; product_index < 3; ++product_index) {
+    HwyReplaceRingRow(delta_products[product_index], num_channels,
+                      rings[{product_index + 2, ring_index}].data(),
+                      step_sums[{product_index + 2}].data());
+  }
+  WindowMeanAcrossChannels(step_sums[{2}].data(), num_channels, channel_window,
+                           reciprocal, var_a);
+  WindowMeanAcrossChannels(step_sums[{3}].data(), num_channels, channel_window,
+                           reciprocal, var_b);
+  WindowMeanAcrossChannels(step_sums[{4}].data(), num_channels, channel_window,
+                           reciprocal, cov);
+
   const Vec two = Set(d, 2.0);
   const Vec C1 = Set(d, 0.1);
   const Vec C3 = Set(d, 0.1);
-  float nsim_sum = 0.0;
   const Vec num_channels_vec = Set(d, num_channels);
   const Vec zero = Zero(d);
-  for (size_t step_index = 0; step_index < num_steps; ++step_index) {
-    for (size_t channel_index = 0; channel_index < num_channels;
-         channel_index += Lanes(d)) {
-      const Vec mean_a_vec =
-          Load(d, mean_a[{step_index}].data() + channel_index);
-      const Vec mean_b_vec =
-          Load(d, mean_b[{step_index}].data() + channel_index);
-      const Vec std_a_vec =
-          Sqrt(Load(d, var_a[{step_index}].data() + channel_index));
-      const Vec std_b_vec =
-          Sqrt(Load(d, var_b[{step_index}].data() + channel_index));
-      const Vec cov_vec = Load(d, cov[{step_index}].data() + channel_index);
-      const Vec intensity = Div(
-          MulAdd(two, Mul(mean_a_vec, mean_b_vec), C1),
-          MulAdd(mean_a_vec, mean_a_vec, MulAdd(mean_b_vec, mean_b_vec, C1)));
-      const Vec structure =
-          Div(Add(cov_vec, C3), MulAdd(std_a_vec, std_b_vec, C3));
-      const Vec channel_index_vec = Iota(d, channel_index);
-      const Vec nsim = IfThenElse(Lt(channel_index_vec, num_channels_vec),
-                                  Mul(intensity, structure), zero);
-      nsim_sum += ReduceSum(d, nsim);
-    }
+  float nsim_sum = 0.0;
+  for (size_t channel_index = 0; channel_index < num_channels;
+       channel_index += Lanes(d)) {
+    const Vec mean_a_vec = Load(d, mean_a + channel_index);
+    const Vec mean_b_vec = Load(d, mean_b + channel_index);
+    // The running sums can round to slightly below zero.
+    const Vec std_a_vec = Sqrt(Max(zero, Load(d, var_a + channel_index)));
+    const Vec std_b_vec = Sqrt(Max(zero, Load(d, var_b + channel_index)));
+    const Vec cov_vec = Load(d, cov + channel_index);
+    const Vec intensity = Div(
+        MulAdd(two, Mul(mean_a_vec, mean_b_vec), C1),
+        MulAdd(mean_a_vec, mean_a_vec, MulAdd(mean_b_vec, mean_b_vec, C1)));
+    const Vec structure =
+        Div(Add(cov_vec, C3), MulAdd(std_a_vec, std_b_vec, C3));
+    const Vec channel_index_vec = Iota(d, channel_index);
+    const Vec nsim = IfThenElse(Lt(channel_index_vec, num_channels_vec),
+                                Mul(intensity, structure), zero);
+    nsim_sum += ReduceSum(d, nsim);
   }
-  return nsim_sum / static_cast<float>(num_steps * num_channels);
+  return nsim_sum;
 }
 
 }  // namespace HWY_NAMESPACE
@@ -240,7 +305,7 @@ HWY_AFTER_NAMESPACE();
 namespace zimtohrli {
 
 HWY_EXPORT(HwyWindowMeanArray);
-HWY_EXPORT(HwyNSIM);
+HWY_EXPORT(HwyStreamingNSIMStep);
 
 hwy::AlignedNDArray<float, 2> WindowMean(
     const hwy::AlignedNDArray<float, 2>& source, size_t step_window,
@@ -258,11 +323,109 @@ float NSIM(const hwy::AlignedNDArray<float, 2>& a,
   CHECK_GT(a.shape()[0], 0);
   CHECK_GT(b.shape()[0], 0);
   CHECK_GT(a.shape()[1], 0);
-  CHECK_GT(b.shape()[1], 0);
+  CHECK_EQ(a.shape()[1], b.shape()[1]);
+  CHECK_GT(step_window, 0);
+  CHECK_GT(channel_window, 0);
+  StreamingNSIM streaming_nsim(a.shape()[1], step_window, channel_window);
+  return NSIM(a, b, time_pairs, streaming_nsim);
+}
+
+float NSIM(const hwy::AlignedNDArray<float, 2>& a,
+           const hwy::AlignedNDArray<float, 2>& b,
+           const std::vector<std::pair<size_t, size_t>>& time_pairs,
+           StreamingNSIM& streaming_nsim) {
+  CHECK_EQ(a.shape()[1], streaming_nsim.NumChannels());
+  CHECK_EQ(b.shape()[1], streaming_nsim.NumChannels());
+  streaming_nsim.Reset();
+  const size_t row_bytes = streaming_nsim.NumChannels() * sizeof(float);
+  const auto same_step = [row_bytes](const hwy::AlignedNDArray<float, 2>& ary,
+                                     size_t index, size_t other_index) {
+    return index == other_index ||
+           std::memcmp(ary[{index}].data(), ary[{other_index}].data(),
+                       row_bytes) == 0;
+  };
+  size_t pair_index = 0;
+  while (pair_index < time_pairs.size()) {
+    const auto [a_index, b_index] = time_pairs[pair_index];
+    // Stretches where the energy is far enough below the epsilon of ToDb
+    // produce identical steps, so silence turns into runs of them.
+    size_t run_end = pair_index + 1;
+    while (run_end < time_pairs.size() &&
+           same_step(a, a_index, time_pairs[run_end].first) &&
+           same_step(b, b_index, time_pairs[run_end].second)) {
+      ++run_end;
+    }
+    streaming_nsim.AddSteps(a[{a_index}], b[{b_index}], run_end - pair_index);
+    pair_index = run_end;
+  }
+  return streaming_nsim.Value();
+}
+
+StreamingNSIM::StreamingNSIM(size_t num_channels, size_t step_window,
+                             size_t channel_window)
+    : channel_window_(channel_window),
+      rings_({5, step_window, num_channels}),
+      step_sums_({5, num_channels}),
+      scratch_({5, num_channels}),
+      step_a_({num_channels}),
+      step_b_({num_channels}) {
+  CHECK_GT(num_channels, 0);
   CHECK_GT(step_window, 0);
   CHECK_GT(channel_window, 0);
-  return HWY_DYNAMIC_DISPATCH(HwyNSIM)(a, b, time_pairs, step_window,
-                                       channel_window);
+  CHECK_GE(num_channels, channel_window);
+}
+
+void StreamingNSIM::AddStep(hwy::Span<const float> a,
+                            hwy::Span<const float> b) {
+  const size_t num_channels = rings_.shape()[2];
+  CHECK_GE(a.size(), num_channels);
+  CHECK_GE(b.size(), num_channels);
+  // Copied to make sure the kernel can load entire vectors from them.
+  hwy::CopyBytes(a.data(), step_a_.data(), num_channels * sizeof(float));
+  hwy::CopyBytes(b.data(), step_b_.data(), num_channels * sizeof(float));
+  last_step_nsim_ = HWY_DYNAMIC_DISPATCH(HwyStreamingNSIMStep)(
+      step_a_.data(), step_b_.data(), num_steps_ % rings_.shape()[1],
+      channel_window_, rings_, step_sums_, scratch_);
+  nsim_sum_ += last_step_nsim_;
+  ++num_steps_;
+}
+
+void StreamingNSIM::AddSteps(hwy::Span<const float> a,
+                             hwy::Span<const float> b, size_t count) {
+  const size_t step_window = rings_.shape()[1];
+  // After step_window steps the rings of a and b, and thereby the window
+  // means, only depend on the step, and after another step_window steps so do
+  // the rings of the deltas from the means. The running sums still carry the
+  // rounding errors from the steps before the run until they are recomputed
+  // at ring index 0, so the last step added the regular way is one where they
+  // were just recomputed. The ring index doesn't matter once all rows of the
+  // rings are identical.
+  size_t num_added_steps = 0;
+  while (num_added_steps < count &&
+         (num_added_steps < 2 * step_window ||
+          (num_steps_ - 1) % step_window != 0)) {
+    AddStep(a, b);
+    ++num_added_steps;
+  }
+  const size_t num_repeated_steps = count - num_added_steps;
+  nsim_sum_ += static_cast<double>(num_repeated_steps) * last_step_nsim_;
+  num_steps_ += num_repeated_steps;
+}
+
+void StreamingNSIM::Reset() {
+  num_steps_ = 0;
+  nsim_sum_ = 0;
+  last_step_nsim_ = 0;
+  hwy::ZeroBytes(rings_.data(), rings_.memory_size() * sizeof(float));
+  hwy::ZeroBytes(step_sums_.data(), step_sums_.memory_size() * sizeof(float));
+}
+
+float StreamingNSIM::Value() const {
+  if (num_steps_ == 0) {
+    return 1.0f;
+  }
+  return static_cast<float>(
+      nsim_sum_ / static_cast<double>(num_steps_ * rings_.shape()[2]));
 }
 
 }  // namespace zimtohrli
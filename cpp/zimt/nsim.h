@@ -15,6 +15,7 @@
 #ifndef CPP_ZIMT_NSIM_H_
 #define CPP_ZIMT_NSIM_H_
 
+#include <cstddef>
 #include <utility>
 #include <vector>
 
@@ -40,12 +41,94 @@ hwy::AlignedNDArray<float, 2> WindowMean(
 // i.e. pairs of time step indices where array a and array b are considered to
 // match each other in time.
 //
+// Computed in a single pass over time_pairs using StreamingNSIM, so it only
+// keeps step_window time steps of intermediate values in memory. Runs of
+// consecutive time pairs with identical steps, e.g. where both a and b are
+// silent, are added with StreamingNSIM::AddSteps.
+//
 // See https://doi.org/10.1016/j.specom.2011.09.004 for details.
 float NSIM(const hwy::AlignedNDArray<float, 2>& a,
            const hwy::AlignedNDArray<float, 2>& b,
            const std::vector<std::pair<size_t, size_t>>& time_pairs,
            size_t step_window, size_t channel_window);
 
+// Incrementally computes the NSIM between two sequences of time steps.
+//
+// Only keeps the last step_window time steps in memory, so it can consume
+// arbitrarily long sequences. Keeps running sums of the window means,
+// variances and covariances across the step axis, so each step costs the same
+// regardless of step_window.
+//
+// The result after adding the steps a[time_pairs[i].first] and
+// b[time_pairs[i].second] for all i is equivalent to NSIM(a, b, time_pairs,
+// step_window, channel_window).
+class StreamingNSIM {
+ public:
+  StreamingNSIM(size_t num_channels, size_t step_window,
+                size_t channel_window);
+
+  // Adds one pair of matching time steps, each with num_channels values.
+  void AddStep(hwy::Span<const float> a, hwy::Span<const float> b);
+
+  // Equivalent to calling AddStep(a, b) count times, up to float rounding:
+  // the repeated steps all add the NSIM of the step after a recomputation of
+  // the running sums, while separate AddStep calls also add the rounding
+  // errors the running sums accumulate between recomputations, so Value can
+  // differ in the last bits.
+  //
+  // Once the ring buffers only hold copies of the step, and the running sums
+  // have been recomputed from them, each further step adds the same NSIM. That
+  // takes less than 3 * step_window steps, so long runs of identical steps
+  // (like the frames of a silent stretch) cost no more than that.
+  void AddSteps(hwy::Span<const float> a, hwy::Span<const float> b,
+                size_t count);
+
+  // Returns the NSIM of all steps added so far.
+  float Value() const;
+
+  // Returns the sum of the NSIM of each channel of each step added so far,
+  // i.e. Value() * NumSteps() * NumChannels() before rounding to float.
+  //
+  // The NSIM of each channel of a step is between -1 and 1, so the sum bounds
+  // the Value() after more steps are added.
+  double Sum() const { return nsim_sum_; }
+
+  // Returns the number of steps added so far.
+  size_t NumSteps() const { return num_steps_; }
+
+  // Removes all steps added so far, without reallocating the buffers.
+  void Reset();
+
+  // Returns the parameters this instance was constructed with.
+  size_t NumChannels() const { return rings_.shape()[2]; }
+  size_t StepWindow() const { return rings_.shape()[1]; }
+  size_t ChannelWindow() const { return channel_window_; }
+
+ private:
+  size_t channel_window_;
+  size_t num_steps_ = 0;
+  double nsim_sum_ = 0;
+  // The sum of the NSIM values of the last step added.
+  float last_step_nsim_ = 0;
+  // (5, step_window, num_channels)-shaped ring buffers of the last steps of a,
+  // b, and their squared and multiplied deltas from their window means.
+  hwy::AlignedNDArray<float, 3> rings_;
+  // (5, num_channels)-shaped sums across the step axis of rings_.
+  hwy::AlignedNDArray<float, 2> step_sums_;
+  // (5, num_channels)-shaped working memory.
+  hwy::AlignedNDArray<float, 2> scratch_;
+  // Padded copies of the step being added.
+  hwy::AlignedNDArray<float, 1> step_a_;
+  hwy::AlignedNDArray<float, 1> step_b_;
+};
+
+// NSIM using the windows of, and the memory in, streaming_nsim, which is reset
+// before use.
+float NSIM(const hwy::AlignedNDArray<float, 2>& a,
+           const hwy::AlignedNDArray<float, 2>& b,
+           const std::vector<std::pair<size_t, size_t>>& time_pairs,
+           StreamingNSIM& streaming_nsim);
+
 }  // namespace zimtohrli
 
 #endif  // CPP_ZIMT_NSIM_H_
\ No newline at end of file
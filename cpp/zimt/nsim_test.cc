@@ -14,6 +14,8 @@
 
 #include "zimt/nsim.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <utility>
 #include <vector>
@@ -71,6 +73,136 @@ TEST(NSIM, NSIMTest) {
   EXPECT_THAT(NSIM(a, c, {{0, 0}, {1, 1}, {2, 2}, {3, 3}, {4, 4}}, 3, 3), 1);
 }
 
+TEST(NSIM, StreamingNSIMTest) {
+  hwy::AlignedNDArray<float, 2> a({5, 5});
+  a[{0}] = {0, 1, 2, 3, 4};
+  a[{1}] = {5, 6, 7, 8, 9};
+  a[{2}] = {10, 11, 12, 13, 14};
+  a[{3}] = {15, 16, 17, 18, 19};
+  a[{4}] = {20, 21, 22, 23, 24};
+  hwy::AlignedNDArray<float, 2> b({5, 5});
+  b[{0}] = {5, 6, 7, 8, 9};
+  b[{1}] = {10, 11, 12, 13, 14};
+  b[{2}] = {15, 16, 17, 18, 19};
+  b[{3}] = {20, 21, 22, 23, 24};
+  b[{4}] = {25, 26, 27, 28, 29};
+  const std::vector<std::pair<size_t, size_t>> time_pairs = {
+      {0, 0}, {1, 0}, {2, 1}, {3, 3}, {4, 4}};
+  StreamingNSIM streaming_nsim(5, 3, 3);
+  for (const auto& time_pair : time_pairs) {
+    streaming_nsim.AddStep(a[{time_pair.first}], b[{time_pair.second}]);
+  }
+  EXPECT_EQ(streaming_nsim.NumSteps(), 5);
+  EXPECT_EQ(streaming_nsim.Value(), NSIM(a, b, time_pairs, 3, 3));
+}
+
+// Computes NSIM the straightforward way, with full arrays of window means,
+// variances, and covariances.
+float ReferenceNSIM(const hwy::AlignedNDArray<float, 2>& a,
+                    const hwy::AlignedNDArray<float, 2>& b,
+                    size_t step_window, size_t channel_window) {
+  const size_t num_steps = a.shape()[0];
+  const size_t num_channels = a.shape()[1];
+  const hwy::AlignedNDArray<float, 2> mean_a =
+      WindowMean(a, step_window, channel_window);
+  const hwy::AlignedNDArray<float, 2> mean_b =
+      WindowMean(b, step_window, channel_window);
+  hwy::AlignedNDArray<float, 2> delta_aa({num_steps, num_channels});
+  hwy::AlignedNDArray<float, 2> delta_bb({num_steps, num_channels});
+  hwy::AlignedNDArray<float, 2> delta_ab({num_steps, num_channels});
+  for (size_t step_index = 0; step_index < num_steps; ++step_index) {
+    for (size_t channel_index = 0; channel_index < num_channels;
+         ++channel_index) {
+      const float delta_a =
+          a[{step_index}][channel_index] - mean_a[{step_index}][channel_index];
+      const float delta_b =
+          b[{step_index}][channel_index] - mean_b[{step_index}][channel_index];
+      delta_aa[{step_index}][channel_index] = delta_a * delta_a;
+      delta_bb[{step_index}][channel_index] = delta_b * delta_b;
+      delta_ab[{step_index}][channel_index] = delta_a * delta_b;
+    }
+  }
+  const hwy::AlignedNDArray<float, 2> var_a =
+      WindowMean(delta_aa, step_window, channel_window);
+  const hwy::AlignedNDArray<float, 2> var_b =
+      WindowMean(delta_bb, step_window, channel_window);
+  const hwy::AlignedNDArray<float, 2> cov =
+      WindowMean(delta_ab, step_window, channel_window);
+  double nsim_sum = 0;
+  for (size_t step_index = 0; step_index < num_steps; ++step_index) {
+    for (size_t channel_index = 0; channel_index < num_channels;
+         ++channel_index) {
+      const double m_a = mean_a[{step_index}][channel_index];
+      const double m_b = mean_b[{step_index}][channel_index];
+      const double intensity =
+          (2 * m_a * m_b + 0.1) / (m_a * m_a + m_b * m_b + 0.1);
+      const double structure =
+          (cov[{step_index}][channel_index] + 0.1) /
+          (std::sqrt(std::max(0.0f, var_a[{step_index}][channel_index])) *
+               std::sqrt(std::max(0.0f, var_b[{step_index}][channel_index])) +
+           0.1);
+      nsim_sum += intensity * structure;
+    }
+  }
+  return nsim_sum / static_cast<double>(num_steps * num_channels);
+}
+
+TEST(NSIM, NSIMMatchesReferenceTest) {
+  const size_t num_steps = 1000;
+  const size_t num_channels = 40;
+  hwy::AlignedNDArray<float, 2> a({num_steps, num_channels});
+  hwy::AlignedNDArray<float, 2> b({num_steps, num_channels});
+  std::vector<std::pair<size_t, size_t>> time_pairs(num_steps);
+  for (size_t step_index = 0; step_index < num_steps; ++step_index) {
+    time_pairs[step_index] = {step_index, step_index};
+    for (size_t channel_index = 0; channel_index < num_channels;
+         ++channel_index) {
+      a[{step_index}][channel_index] =
+          50 + 30 * std::sin(0.1 * step_index + 0.3 * channel_index);
+      b[{step_index}][channel_index] =
+          50 + 30 * std::sin(0.11 * step_index + 0.3 * channel_index);
+    }
+  }
+  EXPECT_NEAR(NSIM(a, b, time_pairs, 16, 8), ReferenceNSIM(a, b, 16, 8), 1e-3);
+}
+
+TEST(NSIM, AddStepsTest) {
+  const size_t num_steps = 300;
+  const size_t num_channels = 20;
+  hwy::AlignedNDArray<float, 2> a({num_steps, num_channels});
+  hwy::AlignedNDArray<float, 2> b({num_steps, num_channels});
+  std::vector<std::pair<size_t, size_t>> time_pairs(num_steps);
+  for (size_t step_index = 0; step_index < num_steps; ++step_index) {
+    time_pairs[step_index] = {step_index, step_index};
+    // A silent stretch in the middle, offset by a few steps between a and b.
+    const bool silent_a = step_index >= 50 && step_index < 200;
+    const bool silent_b = step_index >= 55 && step_index < 210;
+    for (size_t channel_index = 0; channel_index < num_channels;
+         ++channel_index) {
+      a[{step_index}][channel_index] =
+          silent_a ? -10 + 0.1 * channel_index
+                   : 50 + 30 * std::sin(0.1 * step_index + 0.3 * channel_index);
+      b[{step_index}][channel_index] =
+          silent_b
+              ? -10 + 0.1 * channel_index
+              : 50 + 30 * std::sin(0.11 * step_index + 0.3 * channel_index);
+    }
+  }
+  StreamingNSIM streaming_nsim(num_channels, 8, 4);
+  for (const auto& time_pair : time_pairs) {
+    streaming_nsim.AddStep(a[{time_pair.first}], b[{time_pair.second}]);
+  }
+  const float step_by_step = streaming_nsim.Value();
+  EXPECT_NEAR(NSIM(a, b, time_pairs, streaming_nsim), step_by_step, 1e-6);
+  EXPECT_EQ(streaming_nsim.NumSteps(), num_steps);
+  EXPECT_NEAR(NSIM(a, b, time_pairs, 8, 4), ReferenceNSIM(a, b, 8, 4), 1e-3);
+
+  streaming_nsim.Reset();
+  streaming_nsim.AddSteps(a[{100}], b[{100}], 3);
+  streaming_nsim.AddSteps(a[{0}], b[{0}], 0);
+  EXPECT_EQ(streaming_nsim.NumSteps(), size_t{3});
+}
+
 void BM_NSIM(benchmark::State& state) {
   hwy::AlignedNDArray<float, 2> a(
       {static_cast<size_t>(state.range(0)) * 100, 1000});
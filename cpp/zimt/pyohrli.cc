@@ -12,16 +12,26 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
 #include <utility>
+#include <vector>
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 
 #include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
 #include "hwy/aligned_allocator.h"
 #include "hwy/base.h"
 #include "structmember.h"  // NOLINT // For PyMemberDef
+#include "zimt/analysis_file.h"
 #include "zimt/cam.h"
 #include "zimt/mos.h"
+#include "zimt/stats.h"
+#include "zimt/thread_pool.h"
 #include "zimt/zimtohrli.h"
 
 namespace {
@@ -30,6 +40,12 @@ struct AnalysisObject {
   // clang-format off
   PyObject_HEAD
   zimtohrli::Analysis *analysis;
+  // Set instead of analysis when the analysis was loaded from an analysis
+  // file, which only contains the spectrogram.
+  hwy::AlignedNDArray<float, 2> *loaded_spectrogram;
+  // The shape and strides of the buffers exporting the spectrogram.
+  Py_ssize_t spectrogram_shape[2];
+  Py_ssize_t spectrogram_strides[2];
   // clang-format on
 };
 
@@ -38,9 +54,214 @@ void Analysis_dealloc(AnalysisObject* self) {
     delete self->analysis;
     self->analysis = nullptr;
   }
+  if (self->loaded_spectrogram) {
+    delete self->loaded_spectrogram;
+    self->loaded_spectrogram = nullptr;
+  }
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+// Populates view with a read-only (num_steps, num_channels)-shaped view of
+// array for the buffer protocol, with row strides skipping the padding of the
+// rows.
+//
+// shape and strides hold the shape and strides of the view, and must live as
+// long as exporter, which owns array.
+//
+// If the return value is -1 that means a Python error is set, like the
+// bf_getbuffer slot expects.
+int GetArrayBuffer(PyObject* exporter,
+                   const hwy::AlignedNDArray<float, 2>& array,
+                   Py_ssize_t* shape, Py_ssize_t* strides, Py_buffer* view,
+                   int flags) {
+  if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE) {
+    PyErr_SetString(PyExc_BufferError, "analysis arrays are read-only");
+    view->obj = nullptr;
+    return -1;
+  }
+  shape[0] = static_cast<Py_ssize_t>(array.shape()[0]);
+  shape[1] = static_cast<Py_ssize_t>(array.shape()[1]);
+  strides[0] = static_cast<Py_ssize_t>(array.memory_shape()[1] * sizeof(float));
+  strides[1] = sizeof(float);
+  *view = Py_buffer{
+      .buf = const_cast<float*>(array.data()),
+      .len = shape[0] * shape[1] * static_cast<Py_ssize_t>(sizeof(float)),
+      .itemsize = sizeof(float),
+      .readonly = 1,
+      .ndim = 2,
+      .format = (flags & PyBUF_FORMAT) == PyBUF_FORMAT ? const_cast<char*>("f")
+                                                       : nullptr,
+      .shape = shape,
+      .strides = strides,
+  };
+  // Consumers not asking for strides, or asking for a contiguous layout,
+  // can't use arrays with padded rows.
+  char order = '\0';
+  if ((flags & PyBUF_C_CONTIGUOUS) == PyBUF_C_CONTIGUOUS) {
+    order = 'C';
+  } else if ((flags & PyBUF_F_CONTIGUOUS) == PyBUF_F_CONTIGUOUS) {
+    order = 'F';
+  } else if ((flags & PyBUF_ANY_CONTIGUOUS) == PyBUF_ANY_CONTIGUOUS) {
+    order = 'A';
+  } else if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES) {
+    order = 'C';
+  }
+  if (order != '\0' && !PyBuffer_IsContiguous(view, order)) {
+    PyErr_SetString(PyExc_BufferError,
+                    "analysis arrays are not contiguous, request strides");
+    view->obj = nullptr;
+    return -1;
+  }
+  if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES) {
+    view->strides = nullptr;
+  }
+  if ((flags & PyBUF_ND) != PyBUF_ND) {
+    view->ndim = 1;
+    view->shape = nullptr;
+  }
+  view->obj = Py_NewRef(exporter);
+  return 0;
+}
+
+// A view of one of the arrays of an Analysis for the buffer protocol.
+struct AnalysisArrayObject {
+  // clang-format off
+  PyObject_HEAD
+  // The Analysis owning array, kept alive as long as the view.
+  PyObject *owner;
+  const hwy::AlignedNDArray<float, 2> *array;
+  Py_ssize_t shape[2];
+  Py_ssize_t strides[2];
+  // clang-format on
+};
+
+void AnalysisArray_dealloc(AnalysisArrayObject* self) {
+  Py_XDECREF(self->owner);
   Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
+int AnalysisArray_getbuffer(AnalysisArrayObject* self, Py_buffer* view,
+                            int flags) {
+  return GetArrayBuffer((PyObject*)self, *self->array, self->shape,
+                        self->strides, view, flags);
+}
+
+PyBufferProcs AnalysisArray_as_buffer = {
+    .bf_getbuffer = (getbufferproc)AnalysisArray_getbuffer,
+    .bf_releasebuffer = nullptr,
+};
+
+PyTypeObject AnalysisArrayType = {
+    // clang-format off
+    .ob_base = PyVarObject_HEAD_INIT(nullptr, 0)
+    .tp_name = "pyohrli.AnalysisArray",
+    // clang-format on
+    .tp_basicsize = sizeof(AnalysisArrayObject),
+    .tp_itemsize = 0,
+    .tp_dealloc = (destructor)AnalysisArray_dealloc,
+    .tp_as_buffer = &AnalysisArray_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = PyDoc_STR("Read-only view of an array of a pyohrli.Analysis."),
+};
+
+// Returns a memoryview of array, which is owned by the analysis.
+PyObject* AnalysisArrayView(AnalysisObject* analysis,
+                            const hwy::AlignedNDArray<float, 2>& array) {
+  AnalysisArrayObject* array_object =
+      PyObject_New(AnalysisArrayObject, &AnalysisArrayType);
+  if (array_object == nullptr) {
+    return nullptr;
+  }
+  array_object->owner = Py_NewRef((PyObject*)analysis);
+  array_object->array = &array;
+  PyObject* result = PyMemoryView_FromObject((PyObject*)array_object);
+  Py_DECREF((PyObject*)array_object);
+  return result;
+}
+
+// Returns the analysis, or sets an AttributeError if only the spectrogram was
+// loaded from an analysis file.
+const zimtohrli::Analysis* FullAnalysis(AnalysisObject* self) {
+  if (self->analysis == nullptr) {
+    PyErr_SetString(PyExc_AttributeError,
+                    "analysis loaded from an analysis file only contains "
+                    "the spectrogram");
+  }
+  return self->analysis;
+}
+
+PyObject* Analysis_get_energy_channels_db(AnalysisObject* self, void*) {
+  const zimtohrli::Analysis* analysis = FullAnalysis(self);
+  if (analysis == nullptr) {
+    return nullptr;
+  }
+  return AnalysisArrayView(self, analysis->energy_channels_db);
+}
+
+PyObject* Analysis_get_partial_energy_channels_db(AnalysisObject* self,
+                                                  void*) {
+  const zimtohrli::Analysis* analysis = FullAnalysis(self);
+  if (analysis == nullptr) {
+    return nullptr;
+  }
+  return AnalysisArrayView(self, analysis->partial_energy_channels_db);
+}
+
+// Returns the spectrogram of the analysis, or sets an exception of
+// exception_type if the Analysis instance was created directly rather than by
+// a Pyohrli instance, and so has no spectrogram.
+const hwy::AlignedNDArray<float, 2>* Spectrogram(
+    PyObject* analysis_object, PyObject* exception_type = PyExc_ValueError) {
+  const AnalysisObject* analysis = (AnalysisObject*)analysis_object;
+  if (analysis->analysis != nullptr) {
+    return &analysis->analysis->spectrogram;
+  }
+  if (analysis->loaded_spectrogram == nullptr) {
+    PyErr_SetString(exception_type,
+                    "Analysis instance was not created by a Pyohrli instance");
+  }
+  return analysis->loaded_spectrogram;
+}
+
+PyObject* Analysis_get_spectrogram(AnalysisObject* self, void*) {
+  const hwy::AlignedNDArray<float, 2>* spectrogram =
+      Spectrogram((PyObject*)self);
+  if (spectrogram == nullptr) {
+    return nullptr;
+  }
+  return AnalysisArrayView(self, *spectrogram);
+}
+
+PyGetSetDef Analysis_getset[] = {
+    {"energy_channels_db", (getter)Analysis_get_energy_channels_db, nullptr,
+     "Read-only memoryview of the energy of the channels in dB SPL.", nullptr},
+    {"partial_energy_channels_db",
+     (getter)Analysis_get_partial_energy_channels_db, nullptr,
+     "Read-only memoryview of the partial energy of the channels, after "
+     "masking, in dB SPL.",
+     nullptr},
+    {"spectrogram", (getter)Analysis_get_spectrogram, nullptr,
+     "Read-only memoryview of the spectrogram in Phons.", nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr},
+};
+
+// Analysis instances export their spectrogram through the buffer protocol.
+int Analysis_getbuffer(AnalysisObject* self, Py_buffer* view, int flags) {
+  const hwy::AlignedNDArray<float, 2>* spectrogram =
+      Spectrogram((PyObject*)self, PyExc_BufferError);
+  if (spectrogram == nullptr) {
+    view->obj = nullptr;
+    return -1;
+  }
+  return GetArrayBuffer((PyObject*)self, *spectrogram, self->spectrogram_shape,
+                        self->spectrogram_strides, view, flags);
+}
+
+PyBufferProcs Analysis_as_buffer = {
+    .bf_getbuffer = (getbufferproc)Analysis_getbuffer,
+    .bf_releasebuffer = nullptr,
+};
+
 PyTypeObject AnalysisType = {
     // clang-format off
     .ob_base = PyVarObject_HEAD_INIT(nullptr, 0)
@@ -49,8 +270,12 @@ PyTypeObject AnalysisType = {
     .tp_basicsize = sizeof(AnalysisObject),
     .tp_itemsize = 0,
     .tp_dealloc = (destructor)Analysis_dealloc,
+    .tp_as_buffer = &Analysis_as_buffer,
     .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_doc = PyDoc_STR("Python wrapper around C++ zimtohrli::Analysis."),
+    .tp_doc = PyDoc_STR(
+        "Python wrapper around C++ zimtohrli::Analysis.\n\n"
+        "Exports the spectrogram through the buffer protocol."),
+    .tp_getset = Analysis_getset,
     .tp_new = PyType_GenericNew,
 };
 
@@ -99,8 +324,43 @@ struct BufferDeleter {
   void operator()(Py_buffer* buffer) const { PyBuffer_Release(buffer); }
 };
 
+// Populates buffer_view with a view of the signal in buffer_object, which must
+// be a one-dimensional buffer of floats.
+//
+// If the return value is false that means a Python error is set and the
+// current operation should be terminated ASAP. Otherwise buffer_view must be
+// released with PyBuffer_Release.
+bool GetSignalBuffer(PyObject* buffer_object, Py_buffer& buffer_view) {
+  if (PyObject_GetBuffer(buffer_object, &buffer_view, PyBUF_C_CONTIGUOUS)) {
+    PyErr_SetString(PyExc_TypeError, "object is not buffer");
+    return false;
+  }
+  if (buffer_view.itemsize != sizeof(float)) {
+    PyBuffer_Release(&buffer_view);
+    PyErr_SetString(PyExc_TypeError, "buffer does not contain floats");
+    return false;
+  }
+  if (buffer_view.ndim != 1) {
+    PyBuffer_Release(&buffer_view);
+    PyErr_SetString(PyExc_TypeError, "buffer has more than 1 axis");
+    return false;
+  }
+  return true;
+}
+
+// Returns a span viewing the signal in a buffer populated by GetSignalBuffer.
+//
+// Zimtohrli doesn't need aligned or padded signals, so the buffer is used in
+// place.
+hwy::Span<const float> SignalSpan(const Py_buffer& buffer_view) {
+  return hwy::Span<const float>(static_cast<const float*>(buffer_view.buf),
+                                buffer_view.len / sizeof(float));
+}
+
 // Plain C++ function to analyze a Python buffer object using Zimtohrli.
 //
+// Releases the GIL while analyzing.
+//
 // Calls to Analyze never need to be cleaned up (with e.g. delete or DECREF)
 // afterwards.
 //
@@ -109,26 +369,52 @@ struct BufferDeleter {
 std::optional<zimtohrli::Analysis> Analyze(
     const zimtohrli::Zimtohrli& zimtohrli, PyObject* buffer_object) {
   Py_buffer buffer_view;
-  if (PyObject_GetBuffer(buffer_object, &buffer_view, PyBUF_C_CONTIGUOUS)) {
-    PyErr_SetString(PyExc_TypeError, "object is not buffer");
+  if (!GetSignalBuffer(buffer_object, buffer_view)) {
     return std::nullopt;
   }
   std::unique_ptr<Py_buffer, BufferDeleter> buffer_view_deleter(&buffer_view);
-  if (buffer_view.itemsize != sizeof(float)) {
-    PyErr_SetString(PyExc_TypeError, "buffer does not contain floats");
-    return std::nullopt;
+  std::optional<zimtohrli::Analysis> result;
+  Py_BEGIN_ALLOW_THREADS;
+  result = zimtohrli.Analyze(SignalSpan(buffer_view));
+  Py_END_ALLOW_THREADS;
+  return result;
+}
+
+// Views of all signals in a Python sequence, released when destroyed.
+class SignalBuffers {
+ public:
+  explicit SignalBuffers(size_t num_signals) : views_(num_signals) {}
+  SignalBuffers(const SignalBuffers&) = delete;
+  SignalBuffers& operator=(const SignalBuffers&) = delete;
+  ~SignalBuffers() {
+    for (size_t index = 0; index < num_acquired_; ++index) {
+      PyBuffer_Release(&views_[index]);
+    }
   }
-  if (buffer_view.ndim != 1) {
-    PyErr_SetString(PyExc_TypeError, "buffer has more than 1 axis");
-    return std::nullopt;
+
+  // Acquires views of all signals in the fast sequence.
+  //
+  // If the return value is false that means a Python error is set and the
+  // current operation should be terminated ASAP.
+  bool Acquire(PyObject* fast_sequence) {
+    for (; num_acquired_ < views_.size(); ++num_acquired_) {
+      if (!GetSignalBuffer(
+              PySequence_Fast_GET_ITEM(fast_sequence, num_acquired_),
+              views_[num_acquired_])) {
+        return false;
+      }
+    }
+    return true;
   }
-  hwy::AlignedNDArray<float, 1> signal_array({buffer_view.len / sizeof(float)});
-  hwy::CopyBytes(buffer_view.buf, signal_array.data(), buffer_view.len);
-  hwy::AlignedNDArray<float, 2> channels(
-      {signal_array.size(), zimtohrli.cam_filterbank->filter.Size()});
-  return std::optional<zimtohrli::Analysis>{
-      zimtohrli.Analyze(signal_array[{}], channels)};
-}
+
+  hwy::Span<const float> operator[](size_t index) const {
+    return SignalSpan(views_[index]);
+  }
+
+ private:
+  std::vector<Py_buffer> views_;
+  size_t num_acquired_ = 0;
+};
 
 PyObject* BadArgument(const std::string& message) {
   PyErr_SetString(PyExc_TypeError, message.c_str());
@@ -149,6 +435,7 @@ PyObject* Pyohrli_analyze(PyohrliObject* self, PyObject* const* args,
   if (result == nullptr) {
     return nullptr;
   }
+  result->loaded_spectrogram = nullptr;
   try {
     result->analysis = new zimtohrli::Analysis{
         .energy_channels_db = std::move(analysis->energy_channels_db),
@@ -164,16 +451,38 @@ PyObject* Pyohrli_analyze(PyohrliObject* self, PyObject* const* args,
   }
 }
 
-// Plain C++ function to compute distance between two zimtohrli::Analysis.
+// Plain C++ function to compute distance between the spectrograms of two
+// zimtohrli::Analysis.
 //
 // Calls to Distance never need to be cleaned up (with e.g. delete or DECREF)
 // afterwards.
 PyObject* Distance(const zimtohrli::Zimtohrli& zimtohrli,
-                   const zimtohrli::Analysis& analysis_a,
-                   const zimtohrli::Analysis& analysis_b) {
-  const zimtohrli::Distance distance =
-      zimtohrli.Distance(false, analysis_a.spectrogram, analysis_b.spectrogram);
-  return PyFloat_FromDouble(distance.value);
+                   const hwy::AlignedNDArray<float, 2>& spectrogram_a,
+                   const hwy::AlignedNDArray<float, 2>& spectrogram_b) {
+  float distance;
+  Py_BEGIN_ALLOW_THREADS;
+  distance = zimtohrli.Distance(false, spectrogram_a, spectrogram_b).value;
+  Py_END_ALLOW_THREADS;
+  return PyFloat_FromDouble(distance);
+}
+
+// Returns a bytes object containing the floats in values, for
+// numpy.frombuffer.
+PyObject* FloatBytes(const std::vector<float>& values) {
+  return PyBytes_FromStringAndSize(reinterpret_cast<const char*>(values.data()),
+                                   values.size() * sizeof(float));
+}
+
+// Returns the number of threads in a Python int, or 0 with a Python error set.
+size_t NumThreads(PyObject* num_threads_object) {
+  const size_t num_threads = PyLong_AsSize_t(num_threads_object);
+  if (num_threads == static_cast<size_t>(-1) && PyErr_Occurred()) {
+    return 0;
+  }
+  if (num_threads == 0) {
+    PyErr_SetString(PyExc_ValueError, "num_threads must be positive");
+  }
+  return num_threads;
 }
 
 PyObject* Pyohrli_analysis_distance(PyohrliObject* self, PyObject* const* args,
@@ -187,8 +496,15 @@ PyObject* Pyohrli_analysis_distance(PyohrliObject* self, PyObject* const* args,
   if (!Py_IS_TYPE(args[1], &AnalysisType)) {
     return BadArgument("argument 1 is not an Analysis instance");
   }
-  return Distance(*self->zimtohrli, *((AnalysisObject*)args[0])->analysis,
-                  *((AnalysisObject*)args[1])->analysis);
+  const hwy::AlignedNDArray<float, 2>* spectrogram_a = Spectrogram(args[0]);
+  if (spectrogram_a == nullptr) {
+    return nullptr;
+  }
+  const hwy::AlignedNDArray<float, 2>* spectrogram_b = Spectrogram(args[1]);
+  if (spectrogram_b == nullptr) {
+    return nullptr;
+  }
+  return Distance(*self->zimtohrli, *spectrogram_a, *spectrogram_b);
 }
 
 PyObject* Pyohrli_distance(PyohrliObject* self, PyObject* const* args,
@@ -206,9 +522,340 @@ PyObject* Pyohrli_distance(PyohrliObject* self, PyObject* const* args,
   if (!analysis_b.has_value()) {
     return nullptr;
   }
-  return Distance(*self->zimtohrli, analysis_a.value(), analysis_b.value());
+  return Distance(*self->zimtohrli, analysis_a->spectrogram,
+                  analysis_b->spectrogram);
 }
 
+PyObject* Pyohrli_reference_distance(PyohrliObject* self,
+                                     PyObject* const* args, Py_ssize_t nargs) {
+  if (nargs != 2) {
+    return BadArgument("not exactly 2 arguments provided");
+  }
+  if (!Py_IS_TYPE(args[0], &AnalysisType)) {
+    return BadArgument("argument 0 is not an Analysis instance");
+  }
+  const hwy::AlignedNDArray<float, 2>* spectrogram_a = Spectrogram(args[0]);
+  if (spectrogram_a == nullptr) {
+    return nullptr;
+  }
+  const std::optional<zimtohrli::Analysis> analysis_b =
+      Analyze(*self->zimtohrli, args[1]);
+  if (!analysis_b.has_value()) {
+    return nullptr;
+  }
+  return Distance(*self->zimtohrli, *spectrogram_a, analysis_b->spectrogram);
+}
+
+PyObject* Pyohrli_distance_batch(PyohrliObject* self, PyObject* const* args,
+                                 Py_ssize_t nargs) {
+  if (nargs != 3) {
+    return BadArgument("not exactly 3 arguments provided");
+  }
+  if (!Py_IS_TYPE(args[0], &AnalysisType)) {
+    return BadArgument("argument 0 is not an Analysis instance");
+  }
+  const hwy::AlignedNDArray<float, 2>* reference = Spectrogram(args[0]);
+  if (reference == nullptr) {
+    return nullptr;
+  }
+  const size_t num_threads = NumThreads(args[2]);
+  if (num_threads == 0) {
+    return nullptr;
+  }
+  PyObject* signals = PySequence_Fast(args[1], "argument 1 is not a sequence");
+  if (signals == nullptr) {
+    return nullptr;
+  }
+  const size_t num_signals = PySequence_Fast_GET_SIZE(signals);
+  std::vector<float> distances(num_signals);
+  {
+    SignalBuffers buffers(num_signals);
+    if (!buffers.Acquire(signals)) {
+      Py_DECREF(signals);
+      return nullptr;
+    }
+    const zimtohrli::Zimtohrli& zimtohrli = *self->zimtohrli;
+    Py_BEGIN_ALLOW_THREADS;
+    {
+      zimtohrli::ThreadPool pool(num_threads);
+      pool.ParallelFor(num_signals, [&](size_t signal_index) {
+        const zimtohrli::Analysis analysis =
+            zimtohrli.Analyze(buffers[signal_index]);
+        distances[signal_index] =
+            zimtohrli.Distance(false, *reference, analysis.spectrogram).value;
+      });
+    }
+    Py_END_ALLOW_THREADS;
+  }
+  Py_DECREF(signals);
+  return FloatBytes(distances);
+}
+
+// Populates spectrograms with the spectrograms of the Analysis instances in
+// the fast sequence.
+//
+// If the return value is false that means a Python error is set and the
+// current operation should be terminated ASAP.
+bool GetSpectrograms(
+    PyObject* fast_sequence,
+    std::vector<const hwy::AlignedNDArray<float, 2>*>& spectrograms) {
+  for (Py_ssize_t index = 0; index < PySequence_Fast_GET_SIZE(fast_sequence);
+       ++index) {
+    PyObject* item = PySequence_Fast_GET_ITEM(fast_sequence, index);
+    if (!Py_IS_TYPE(item, &AnalysisType)) {
+      BadArgument("sequence contains a non Analysis instance");
+      return false;
+    }
+    const hwy::AlignedNDArray<float, 2>* spectrogram = Spectrogram(item);
+    if (spectrogram == nullptr) {
+      return false;
+    }
+    spectrograms.push_back(spectrogram);
+  }
+  return true;
+}
+
+PyObject* Pyohrli_analysis_distance_matrix(PyohrliObject* self,
+                                           PyObject* const* args,
+                                           Py_ssize_t nargs) {
+  if (nargs != 3) {
+    return BadArgument("not exactly 3 arguments provided");
+  }
+  const size_t num_threads = NumThreads(args[2]);
+  if (num_threads == 0) {
+    return nullptr;
+  }
+  PyObject* analyses_a =
+      PySequence_Fast(args[0], "argument 0 is not a sequence");
+  if (analyses_a == nullptr) {
+    return nullptr;
+  }
+  PyObject* analyses_b =
+      PySequence_Fast(args[1], "argument 1 is not a sequence");
+  if (analyses_b == nullptr) {
+    Py_DECREF(analyses_a);
+    return nullptr;
+  }
+  std::vector<const hwy::AlignedNDArray<float, 2>*> spectrograms_a;
+  std::vector<const hwy::AlignedNDArray<float, 2>*> spectrograms_b;
+  if (!GetSpectrograms(analyses_a, spectrograms_a) ||
+      !GetSpectrograms(analyses_b, spectrograms_b)) {
+    Py_DECREF(analyses_a);
+    Py_DECREF(analyses_b);
+    return nullptr;
+  }
+  const size_t num_b = spectrograms_b.size();
+  std::vector<float> distances(spectrograms_a.size() * num_b);
+  const zimtohrli::Zimtohrli& zimtohrli = *self->zimtohrli;
+  Py_BEGIN_ALLOW_THREADS;
+  {
+    zimtohrli::ThreadPool pool(num_threads);
+    pool.ParallelFor(distances.size(), [&](size_t pair_index) {
+      distances[pair_index] =
+          zimtohrli
+              .Distance(false, *spectrograms_a[pair_index / num_b],
+                        *spectrograms_b[pair_index % num_b])
+              .value;
+    });
+  }
+  Py_END_ALLOW_THREADS;
+  Py_DECREF(analyses_a);
+  Py_DECREF(analyses_b);
+  return FloatBytes(distances);
+}
+
+PyObject* Pyohrli_distance_matrix(PyohrliObject* self, PyObject* const* args,
+                                  Py_ssize_t nargs) {
+  if (nargs != 2) {
+    return BadArgument("not exactly 2 arguments provided");
+  }
+  const size_t num_threads = NumThreads(args[1]);
+  if (num_threads == 0) {
+    return nullptr;
+  }
+  PyObject* analyses = PySequence_Fast(args[0], "argument 0 is not a sequence");
+  if (analyses == nullptr) {
+    return nullptr;
+  }
+  std::vector<const hwy::AlignedNDArray<float, 2>*> spectrograms;
+  if (!GetSpectrograms(analyses, spectrograms)) {
+    Py_DECREF(analyses);
+    return nullptr;
+  }
+  const size_t num_analyses = spectrograms.size();
+  std::vector<float> distances(num_analyses * num_analyses);
+  if (num_analyses > 0) {
+    const zimtohrli::Zimtohrli& zimtohrli = *self->zimtohrli;
+    Py_BEGIN_ALLOW_THREADS;
+    {
+      zimtohrli::ThreadPool pool(num_threads);
+      const hwy::AlignedNDArray<float, 2> matrix =
+          zimtohrli.DistanceMatrix(spectrograms, pool);
+      for (size_t row = 0; row < num_analyses; ++row) {
+        hwy::CopyBytes(matrix[{row}].data(),
+                       distances.data() + row * num_analyses,
+                       num_analyses * sizeof(float));
+      }
+    }
+    Py_END_ALLOW_THREADS;
+  }
+  Py_DECREF(analyses);
+  return FloatBytes(distances);
+}
+
+PyObject* Pyohrli_fingerprint(PyohrliObject* self, PyObject* const* args,
+                              Py_ssize_t nargs) {
+  if (nargs != 0) {
+    return BadArgument("arguments provided");
+  }
+  return PyLong_FromUnsignedLongLong(
+      zimtohrli::AnalysisFingerprint(*self->zimtohrli));
+}
+
+PyObject* Pyohrli_enable_stats(PyohrliObject* self, PyObject* const* args,
+                               Py_ssize_t nargs) {
+  if (nargs != 0) {
+    return BadArgument("arguments provided");
+  }
+  try {
+    self->zimtohrli->stats = std::make_shared<zimtohrli::ZimtohrliStats>();
+  } catch (const std::bad_alloc&) {
+    return PyErr_NoMemory();
+  }
+  Py_RETURN_NONE;
+}
+
+// Returns a dict with the counters of stage.
+PyObject* StageStatsDict(const zimtohrli::StageStats& stage) {
+  return Py_BuildValue(
+      "{s:d,s:K,s:K,s:K}", "seconds",
+      static_cast<double>(stage.nanoseconds.load()) * 1e-9, "calls",
+      static_cast<unsigned long long>(stage.calls.load()), "samples",
+      static_cast<unsigned long long>(stage.samples.load()), "bytes_allocated",
+      static_cast<unsigned long long>(stage.bytes_allocated.load()));
+}
+
+PyObject* Pyohrli_stats(PyohrliObject* self, PyObject* const* args,
+                        Py_ssize_t nargs) {
+  if (nargs != 0) {
+    return BadArgument("arguments provided");
+  }
+  const zimtohrli::ZimtohrliStats empty_stats;
+  const zimtohrli::ZimtohrliStats& stats =
+      self->zimtohrli->stats ? *self->zimtohrli->stats : empty_stats;
+  return Py_BuildValue(
+      "{s:N,s:N,s:N,s:N,s:N,s:K}", "filterbank",
+      StageStatsDict(stats.filterbank), "masking",
+      StageStatsDict(stats.masking), "loudness", StageStatsDict(stats.loudness),
+      "dtw", StageStatsDict(stats.dtw), "nsim", StageStatsDict(stats.nsim),
+      "dtw_cells", static_cast<unsigned long long>(stats.dtw_cells.load()));
+}
+
+PyObject* Pyohrli_save_analysis(PyohrliObject* self, PyObject* const* args,
+                                Py_ssize_t nargs) {
+  if (nargs != 2) {
+    return BadArgument("not exactly 2 arguments provided");
+  }
+  if (!Py_IS_TYPE(args[0], &AnalysisType)) {
+    return BadArgument("argument 0 is not an Analysis instance");
+  }
+  const hwy::AlignedNDArray<float, 2>* spectrogram = Spectrogram(args[0]);
+  if (spectrogram == nullptr) {
+    return nullptr;
+  }
+  const char* path = PyUnicode_AsUTF8(args[1]);
+  if (path == nullptr) {
+    return nullptr;
+  }
+  const absl::Status status = zimtohrli::WriteAnalysisFile(
+      path, zimtohrli::AnalysisFingerprint(*self->zimtohrli),
+      self->zimtohrli->perceptual_sample_rate, *spectrogram);
+  if (!status.ok()) {
+    PyErr_SetString(PyExc_OSError, status.ToString().c_str());
+    return nullptr;
+  }
+  Py_RETURN_NONE;
+}
+
+PyObject* Pyohrli_load_analysis(PyohrliObject* self, PyObject* const* args,
+                                Py_ssize_t nargs) {
+  if (nargs != 1) {
+    return BadArgument("not exactly 1 argument provided");
+  }
+  const char* path = PyUnicode_AsUTF8(args[0]);
+  if (path == nullptr) {
+    return nullptr;
+  }
+  absl::StatusOr<zimtohrli::MappedAnalysisFile> file =
+      zimtohrli::MappedAnalysisFile::Open(
+          path, zimtohrli::AnalysisFingerprint(*self->zimtohrli));
+  if (!file.ok()) {
+    PyErr_SetString(
+        file.status().code() == absl::StatusCode::kFailedPrecondition
+            ? PyExc_ValueError
+            : PyExc_OSError,
+        file.status().ToString().c_str());
+    return nullptr;
+  }
+  AnalysisObject* result = PyObject_New(AnalysisObject, &AnalysisType);
+  if (result == nullptr) {
+    return nullptr;
+  }
+  result->analysis = nullptr;
+  try {
+    result->loaded_spectrogram =
+        new hwy::AlignedNDArray<float, 2>(file->Spectrogram());
+    return (PyObject*)result;
+  } catch (const std::bad_alloc&) {
+    result->loaded_spectrogram = nullptr;
+    Py_XDECREF((PyObject*)result);
+    return PyErr_NoMemory();
+  }
+}
+
+// Sets field to the float value, or sets a Python error and returns -1 like
+// the setter slot expects.
+int SetFloat(PyObject* value, float& field) {
+  if (value == nullptr) {
+    PyErr_SetString(PyExc_TypeError, "attribute can't be deleted");
+    return -1;
+  }
+  const double float_value = PyFloat_AsDouble(value);
+  if (float_value == -1 && PyErr_Occurred()) {
+    return -1;
+  }
+  field = static_cast<float>(float_value);
+  return 0;
+}
+
+PyObject* Pyohrli_get_unwarp_window(PyohrliObject* self, void*) {
+  return PyFloat_FromDouble(self->zimtohrli->unwarp_window_seconds);
+}
+
+int Pyohrli_set_unwarp_window(PyohrliObject* self, PyObject* value, void*) {
+  return SetFloat(value, self->zimtohrli->unwarp_window_seconds);
+}
+
+PyObject* Pyohrli_get_unwarp_corridor(PyohrliObject* self, void*) {
+  return PyFloat_FromDouble(self->zimtohrli->unwarp_corridor_seconds);
+}
+
+int Pyohrli_set_unwarp_corridor(PyohrliObject* self, PyObject* value, void*) {
+  return SetFloat(value, self->zimtohrli->unwarp_corridor_seconds);
+}
+
+PyGetSetDef Pyohrli_getset[] = {
+    {"unwarp_window", (getter)Pyohrli_get_unwarp_window,
+     (setter)Pyohrli_set_unwarp_window,
+     "Length of the dynamic time warp window in seconds.", nullptr},
+    {"unwarp_corridor", (getter)Pyohrli_get_unwarp_corridor,
+     (setter)Pyohrli_set_unwarp_corridor,
+     "Radius in seconds of the corridor the coarse-to-fine dynamic time warp "
+     "is refined in, or 0 to disable it.",
+     nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr},
+};
+
 PyMethodDef Pyohrli_methods[] = {
     {"analyze", (PyCFunction)Pyohrli_analyze, METH_FASTCALL,
      "Returns an analysis of the provided signal."},
@@ -216,6 +863,32 @@ PyMethodDef Pyohrli_methods[] = {
      "Returns the distance between the two provided analyses."},
     {"distance", (PyCFunction)Pyohrli_distance, METH_FASTCALL,
      "Returns the distance between the two provided signals."},
+    {"reference_distance", (PyCFunction)Pyohrli_reference_distance,
+     METH_FASTCALL,
+     "Returns the distance between the provided analysis and signal."},
+    {"distance_batch", (PyCFunction)Pyohrli_distance_batch, METH_FASTCALL,
+     "Returns the distances between the provided analysis and each of the "
+     "provided signals, computed using the provided number of threads, as "
+     "float32 bytes."},
+    {"analysis_distance_matrix", (PyCFunction)Pyohrli_analysis_distance_matrix,
+     METH_FASTCALL,
+     "Returns the distances between each of the first and each of the second "
+     "provided analyses, computed using the provided number of threads, as "
+     "row-major float32 bytes."},
+    {"distance_matrix", (PyCFunction)Pyohrli_distance_matrix, METH_FASTCALL,
+     "Returns the distances between all pairs of the provided analyses, "
+     "computed once per pair using the provided number of threads, as "
+     "row-major float32 bytes."},
+    {"fingerprint", (PyCFunction)Pyohrli_fingerprint, METH_FASTCALL,
+     "Returns a hash of the parameters affecting analyses."},
+    {"enable_stats", (PyCFunction)Pyohrli_enable_stats, METH_FASTCALL,
+     "Makes the instance record counters of the work done by each stage."},
+    {"stats", (PyCFunction)Pyohrli_stats, METH_FASTCALL,
+     "Returns the counters recorded since enable_stats, as a dict."},
+    {"save_analysis", (PyCFunction)Pyohrli_save_analysis, METH_FASTCALL,
+     "Writes the provided analysis to the provided path."},
+    {"load_analysis", (PyCFunction)Pyohrli_load_analysis, METH_FASTCALL,
+     "Returns the analysis stored at the provided path."},
     {nullptr} /* Sentinel */
 };
 
@@ -231,6 +904,7 @@ PyTypeObject PyohrliType = {
     .tp_doc =
         PyDoc_STR("Python wrapper around the C++ zimtohrli::Zimtohrli type."),
     .tp_methods = Pyohrli_methods,
+    .tp_getset = Pyohrli_getset,
     .tp_init = (initproc)Pyohrli_init,
     .tp_new = PyType_GenericNew,
 };
@@ -244,10 +918,44 @@ PyObject* MOSFromZimtohrli(PyohrliObject* self, PyObject* const* args,
       zimtohrli::MOSFromZimtohrli(PyFloat_AsDouble(args[0])));
 }
 
+PyObject* FilterbankCacheCall(PyObject* const* args, Py_ssize_t nargs,
+                              absl::Status (*call)(const std::string&)) {
+  if (nargs != 1) {
+    return BadArgument("not exactly 1 argument provided");
+  }
+  const char* path = PyUnicode_AsUTF8(args[0]);
+  if (path == nullptr) {
+    return nullptr;
+  }
+  const absl::Status status = call(path);
+  if (!status.ok()) {
+    PyErr_SetString(PyExc_OSError, status.ToString().c_str());
+    return nullptr;
+  }
+  Py_RETURN_NONE;
+}
+
+PyObject* WriteFilterbankCache(PyObject* self, PyObject* const* args,
+                               Py_ssize_t nargs) {
+  return FilterbankCacheCall(args, nargs, zimtohrli::WriteFilterbankCache);
+}
+
+PyObject* ReadFilterbankCache(PyObject* self, PyObject* const* args,
+                              Py_ssize_t nargs) {
+  return FilterbankCacheCall(args, nargs, zimtohrli::ReadFilterbankCache);
+}
+
 static PyMethodDef PyohrliModuleMethods[] = {
     {"MOSFromZimtohrli", (PyCFunction)MOSFromZimtohrli, METH_FASTCALL,
      "Returns an approximate mean opinion score based on the provided "
      "Zimtohrli distance."},
+    {"write_filterbank_cache", (PyCFunction)WriteFilterbankCache,
+     METH_FASTCALL,
+     "Writes the filterbank designs cached in this process to the provided "
+     "path."},
+    {"read_filterbank_cache", (PyCFunction)ReadFilterbankCache, METH_FASTCALL,
+     "Adds the filterbank designs in the provided path to the cache of this "
+     "process."},
     {NULL, NULL, 0, NULL},
 };
 
@@ -263,6 +971,10 @@ PyMODINIT_FUNC PyInit__pyohrli(void) {
   PyObject* m = PyModule_Create(&PyohrliModule);
   if (m == nullptr) return nullptr;
 
+  if (PyType_Ready(&AnalysisArrayType) < 0) {
+    Py_DECREF(m);
+    return nullptr;
+  }
   if (PyType_Ready(&AnalysisType) < 0) {
     Py_DECREF(m);
     return nullptr;
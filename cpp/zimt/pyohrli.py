@@ -13,22 +13,138 @@
 # limitations under the License.
 """Pyohrli is a Zimtohrli wrapper in Python."""
 
+import dataclasses
+import os
+from typing import Any, Optional, Sequence, Union
+
 import numpy as np
 import numpy.typing as npt
 
 import _pyohrli
 
+# Layout of the header of an analysis file, see zimt/analysis_file.h.
+_ANALYSIS_FILE_HEADER_DTYPE = np.dtype(
+    [
+        ("magic", "S8"),
+        ("version", "<u4"),
+        ("header_size", "<u4"),
+        ("fingerprint", "<u8"),
+        ("num_steps", "<u8"),
+        ("num_channels", "<u8"),
+        ("row_stride", "<u8"),
+        ("perceptual_sample_rate", "<f4"),
+        ("reserved", "V12"),
+    ]
+)
+_ANALYSIS_FILE_MAGIC = b"ZIMTSPEC"
+_ANALYSIS_FILE_VERSION = 1
+
+
+@dataclasses.dataclass(frozen=True)
+class MappedSpectrogram:
+    """A spectrogram memory mapped from an analysis file.
+
+    Attributes:
+      fingerprint: Hash of the parameters of the Pyohrli instance that produced
+        the spectrogram, see 'Pyohrli.fingerprint'.
+      perceptual_sample_rate: The sample rate of the spectrogram steps.
+      spectrogram: A read-only (num_steps, num_channels)-shaped array of Phons
+        values, viewing the mapped file directly through row strides.
+    """
+
+    fingerprint: int
+    perceptual_sample_rate: float
+    spectrogram: np.ndarray
+
+
+def map_spectrogram(path: str) -> MappedSpectrogram:
+    """Memory maps the spectrogram of an analysis file without copying it.
+
+    Args:
+      path: Path to an analysis file, e.g. written by 'Pyohrli.save_analysis'.
+
+    Returns:
+      A MappedSpectrogram viewing the file.
+    """
+    header = np.fromfile(path, dtype=_ANALYSIS_FILE_HEADER_DTYPE, count=1)
+    if len(header) != 1 or header["magic"][0] != _ANALYSIS_FILE_MAGIC:
+        raise ValueError(f"{path} is not an analysis file")
+    if header["version"][0] != _ANALYSIS_FILE_VERSION:
+        raise ValueError(
+            f"{path} has version {header['version'][0]}, want {_ANALYSIS_FILE_VERSION}"
+        )
+    num_steps = int(header["num_steps"][0])
+    num_channels = int(header["num_channels"][0])
+    rows = np.memmap(
+        path,
+        dtype="<f4",
+        mode="r",
+        offset=int(header["header_size"][0]),
+        shape=(num_steps, int(header["row_stride"][0])),
+    )
+    return MappedSpectrogram(
+        fingerprint=int(header["fingerprint"][0]),
+        perceptual_sample_rate=float(header["perceptual_sample_rate"][0]),
+        spectrogram=rows[:, :num_channels],
+    )
+
 
 def mos_from_zimtohrli(zimtohrli_distance: float) -> float:
     """Returns an approximate mean opinion score based on the provided Zimtohrli distance."""
     return _pyohrli.MOSFromZimtohrli(zimtohrli_distance)
 
 
+def save_filterbank_cache(path: str):
+    """Writes the filterbank designs created so far in this process to path.
+
+    Short-lived processes creating the same Pyohrli instances every time they
+    start can load the designs with load_filterbank_cache, which is much
+    faster than designing the filters again.
+    """
+    _pyohrli.write_filterbank_cache(path)
+
+
+def load_filterbank_cache(path: str):
+    """Adds the filterbank designs saved by save_filterbank_cache to this process.
+
+    Pyohrli instances created afterwards with matching parameters skip the
+    filter design.
+    """
+    _pyohrli.read_filterbank_cache(path)
+
+
 class Analysis:
-    """Wrapper around C++ zimtohrli::Analysis."""
+    """Wrapper around C++ zimtohrli::Analysis.
+
+    The arrays are read-only (num_steps, num_channels)-shaped views of the C++
+    analysis through row strides, and are not copied.
+    """
 
     _cc_analysis: _pyohrli.Analysis
 
+    @property
+    def energy_channels_db(self) -> np.ndarray:
+        """The energy of the channels in dB SPL.
+
+        Raises AttributeError for analyses loaded from analysis files, which
+        only contain the spectrogram.
+        """
+        return np.asarray(self._cc_analysis.energy_channels_db)
+
+    @property
+    def partial_energy_channels_db(self) -> np.ndarray:
+        """The energy of the channels after masking in dB SPL.
+
+        Raises AttributeError for analyses loaded from analysis files, which
+        only contain the spectrogram.
+        """
+        return np.asarray(self._cc_analysis.partial_energy_channels_db)
+
+    @property
+    def spectrogram(self) -> np.ndarray:
+        """The spectrogram in Phons."""
+        return np.asarray(self._cc_analysis.spectrogram)
+
 
 class Pyohrli:
     """Wrapper around C++ zimtohrli::Zimtohrli."""
@@ -83,6 +199,25 @@ class Pyohrli:
             analysis_b._cc_analysis,  # pylint: disable=protected-access
         )
 
+    def reference_distance(self, reference: Analysis, signal: npt.ArrayLike) -> float:
+        """Computes the distance between a reference analysis and a signal.
+
+        Useful when the same reference is compared to many signals, since the
+        reference only has to be analyzed once. See 'analyze' for the signal
+        format.
+
+        Args:
+          reference: An Analysis instance to compare.
+          signal: A signal to compare with.
+
+        Returns:
+          The Zimtohrli distance between the reference and the signal.
+        """
+        return self._cc_pyohrli.reference_distance(
+            reference._cc_analysis,  # pylint: disable=protected-access
+            np.asarray(signal).astype(np.float32).ravel().data,
+        )
+
     def distance(self, signal_a: npt.ArrayLike, signal_b: npt.ArrayLike) -> float:
         """Computes the distance between two signals.
 
@@ -100,6 +235,153 @@ class Pyohrli:
             np.asarray(signal_b).astype(np.float32).ravel().data,
         )
 
+    def distance_batch(
+        self,
+        reference: Union[Analysis, npt.ArrayLike],
+        signals: Sequence[npt.ArrayLike],
+        num_threads: Optional[int] = None,
+    ) -> np.ndarray:
+        """Computes the distances between a reference and many signals.
+
+        The signals are analyzed and compared on native threads, without
+        holding the GIL. See 'analyze' for the signal format.
+
+        Args:
+          reference: An Analysis instance, or a signal to analyze.
+          signals: The signals to compare with the reference.
+          num_threads: The number of threads to use, defaults to the number of
+            CPUs.
+
+        Returns:
+          A (len(signals),)-shaped float32 array with the Zimtohrli distance
+          between the reference and each signal.
+        """
+        if not isinstance(reference, Analysis):
+            reference = self.analyze(reference)
+        return np.frombuffer(
+            self._cc_pyohrli.distance_batch(
+                reference._cc_analysis,  # pylint: disable=protected-access
+                [np.asarray(signal).astype(np.float32).ravel().data for signal in signals],
+                num_threads or os.cpu_count() or 1,
+            ),
+            dtype=np.float32,
+        )
+
+    def analysis_distance_matrix(
+        self,
+        analyses_a: Sequence[Analysis],
+        analyses_b: Sequence[Analysis],
+        num_threads: Optional[int] = None,
+    ) -> np.ndarray:
+        """Computes the distances between all pairs of two lists of analyses.
+
+        The distances are computed on native threads, without holding the GIL.
+
+        Args:
+          analyses_a: Analysis instances to compare.
+          analyses_b: Analysis instances to compare with.
+          num_threads: The number of threads to use, defaults to the number of
+            CPUs.
+
+        Returns:
+          A (len(analyses_a), len(analyses_b))-shaped float32 array where
+          element [i, j] is the Zimtohrli distance between analyses_a[i] and
+          analyses_b[j].
+        """
+        return np.frombuffer(
+            self._cc_pyohrli.analysis_distance_matrix(
+                # Disabling protected-access to avoid making
+                # Analysis._cc_pyohrli public.
+                [a._cc_analysis for a in analyses_a],  # pylint: disable=protected-access
+                [b._cc_analysis for b in analyses_b],  # pylint: disable=protected-access
+                num_threads or os.cpu_count() or 1,
+            ),
+            dtype=np.float32,
+        ).reshape((len(analyses_a), len(analyses_b)))
+
+    def distance_matrix(
+        self, analyses: Sequence[Analysis], num_threads: Optional[int] = None
+    ) -> np.ndarray:
+        """Computes the distances between all pairs of analyses.
+
+        Distances are symmetric, so each pair is only computed once. The pairs
+        are computed on native threads, without holding the GIL.
+
+        Args:
+          analyses: Analysis instances to compare.
+          num_threads: The number of threads to use, defaults to the number of
+            CPUs.
+
+        Returns:
+          A (len(analyses), len(analyses))-shaped float32 array where element
+          [i, j] is the Zimtohrli distance between analyses[i] and analyses[j].
+        """
+        return np.frombuffer(
+            self._cc_pyohrli.distance_matrix(
+                [a._cc_analysis for a in analyses],  # pylint: disable=protected-access
+                num_threads or os.cpu_count() or 1,
+            ),
+            dtype=np.float32,
+        ).reshape((len(analyses), len(analyses)))
+
+    @property
+    def fingerprint(self) -> int:
+        """Hash of the parameters affecting the analyses of this instance.
+
+        Analysis files record the fingerprint of the instance that wrote them,
+        and can only be loaded by instances with the same fingerprint.
+        """
+        return self._cc_pyohrli.fingerprint()
+
+    def enable_stats(self):
+        """Makes this instance record counters of the work done by each stage.
+
+        The counters start at zero, and are returned by 'stats'.
+        """
+        self._cc_pyohrli.enable_stats()
+
+    def stats(self) -> dict[str, Any]:
+        """Returns the counters recorded since 'enable_stats'.
+
+        Returns:
+          A dict with one dict per stage ('filterbank', 'masking', 'loudness',
+          'dtw', and 'nsim') containing 'seconds', 'calls', 'samples', and
+          'bytes_allocated', and the number of cost matrix cells evaluated by the
+          dynamic time warp as 'dtw_cells'. All counters are zero if
+          'enable_stats' wasn't called or the module was built without stats.
+        """
+        return self._cc_pyohrli.stats()
+
+    def save_analysis(self, analysis: Analysis, path: str):
+        """Writes the spectrogram of an analysis to an analysis file.
+
+        Args:
+          analysis: An Analysis instance produced by this Pyohrli instance.
+          path: The path to write to.
+        """
+        self._cc_pyohrli.save_analysis(
+            analysis._cc_analysis, path  # pylint: disable=protected-access
+        )
+
+    def load_analysis(self, path: str) -> Analysis:
+        """Loads an analysis file, skipping the analysis of the signal.
+
+        Args:
+          path: Path to an analysis file written by an instance with the same
+            fingerprint as this one.
+
+        Returns:
+          An Analysis instance usable wherever one returned by 'analyze' is.
+
+        Raises:
+          ValueError: If the file was written with different parameters.
+        """
+        result = Analysis()
+        result._cc_analysis = (  # pylint: disable=protected-access
+            self._cc_pyohrli.load_analysis(path)
+        )
+        return result
+
     @property
     def full_scale_sine_db(self) -> float:
         """Reference intensity for an amplitude 1.0 sine wave at 1kHz.
@@ -138,3 +420,19 @@ class Pyohrli:
     @unwarp_window.setter
     def unwarp_window(self, value: float):
         self._cc_pyohrli.unwarp_window = value
+
+    @property
+    def unwarp_corridor(self) -> float:
+        """Radius of the coarse-to-fine dynamic time warp corridor in seconds.
+
+        If nonzero, the dynamic time warp is first computed on time decimated
+        spectrograms, and then only refined within this radius of the path
+        found on them, which makes long unwarp windows affordable. Like
+        unwarp_window it is converted to time steps with the sample rate of
+        the signals. Defaults to 0, which disables it.
+        """
+        return self._cc_pyohrli.unwarp_corridor
+
+    @unwarp_corridor.setter
+    def unwarp_corridor(self, value: float):
+        self._cc_pyohrli.unwarp_corridor = value
@@ -15,6 +15,8 @@
 
 import numpy as np
 
+import os
+import tempfile
 import unittest
 import pyohrli
 import functools
@@ -62,6 +64,8 @@ class PyohrliTest(unittest.TestCase):
         self.assertLess(abs(analysis_distance - distance), 1e-3)
         distance = metric.distance(signal_a, signal_b)
         self.assertLess(abs(distance - distance), 1e-3)
+        reference_distance = metric.reference_distance(analysis_a, signal_b)
+        self.assertLess(abs(reference_distance - analysis_distance), 1e-3)
 
     def test_nyquist_threshold(self):
         sample_rate = 12000.0
@@ -71,6 +75,164 @@ class PyohrliTest(unittest.TestCase):
         # threshold to half the sample rate.
         metric.analyze(signal)
 
+    def test_unwarp_corridor(self):
+        sample_rate = 48000.0
+        metric = pyohrli.Pyohrli(sample_rate)
+        signal_a = np.sin(np.linspace(0.0, np.pi * 2 * 1000.0, int(sample_rate)))
+        signal_b = np.sin(np.linspace(0.0, np.pi * 2 * 1100.0, int(sample_rate)))
+        distance = metric.distance(signal_a, signal_b)
+        self.assertEqual(metric.unwarp_corridor, 0)
+        metric.unwarp_corridor = 4 / sample_rate
+        self.assertAlmostEqual(metric.unwarp_corridor, 4 / sample_rate)
+        self.assertAlmostEqual(metric.distance(signal_a, signal_b), distance, places=4)
+
+    def test_analysis_file(self):
+        sample_rate = 48000.0
+        metric = pyohrli.Pyohrli(sample_rate)
+        signal_a = np.sin(np.linspace(0.0, np.pi * 2 * 1000.0, int(sample_rate)))
+        signal_b = np.sin(np.linspace(0.0, np.pi * 2 * 2000.0, int(sample_rate)))
+        analysis_a = metric.analyze(signal_a)
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            path = os.path.join(tmp_dir, "a.zspec")
+            metric.save_analysis(analysis_a, path)
+
+            mapped = pyohrli.map_spectrogram(path)
+            self.assertEqual(mapped.fingerprint, metric.fingerprint)
+            self.assertEqual(mapped.spectrogram.ndim, 2)
+            self.assertGreater(mapped.spectrogram.shape[0], 0)
+            self.assertTrue(np.all(np.isfinite(mapped.spectrogram)))
+
+            loaded_a = metric.load_analysis(path)
+            self.assertEqual(
+                metric.reference_distance(loaded_a, signal_b),
+                metric.reference_distance(analysis_a, signal_b),
+            )
+            np.testing.assert_array_equal(
+                loaded_a.spectrogram, analysis_a.spectrogram
+            )
+            with self.assertRaises(AttributeError):
+                loaded_a.energy_channels_db
+
+            other_metric = pyohrli.Pyohrli(44100.0)
+            with self.assertRaises(ValueError):
+                other_metric.load_analysis(path)
+
+    def test_analysis_arrays(self):
+        sample_rate = 48000.0
+        metric = pyohrli.Pyohrli(sample_rate)
+        signal = np.sin(np.linspace(0.0, np.pi * 2 * 1000.0, int(sample_rate)))
+        analysis = metric.analyze(signal)
+        spectrogram = analysis.spectrogram
+        self.assertEqual(spectrogram.ndim, 2)
+        self.assertEqual(spectrogram.dtype, np.float32)
+        self.assertGreater(spectrogram.shape[0], 0)
+        self.assertFalse(spectrogram.flags.writeable)
+        self.assertTrue(np.shares_memory(spectrogram, analysis.spectrogram))
+        for array in (
+            analysis.energy_channels_db,
+            analysis.partial_energy_channels_db,
+        ):
+            self.assertEqual(array.shape, spectrogram.shape)
+            self.assertTrue(np.all(np.isfinite(array)))
+        # The views keep the analysis alive.
+        del analysis
+        self.assertTrue(np.all(np.isfinite(spectrogram)))
+
+    def test_empty_analysis(self):
+        metric = pyohrli.Pyohrli(48000.0)
+        empty = pyohrli._pyohrli.Analysis()
+        with self.assertRaises(ValueError):
+            empty.spectrogram
+        with self.assertRaises(BufferError):
+            memoryview(empty)
+        with self.assertRaises(ValueError):
+            metric._cc_pyohrli.analysis_distance(empty, empty)
+
+    def test_filterbank_cache(self):
+        sample_rate = 48000.0
+        metric = pyohrli.Pyohrli(sample_rate)
+        signal_a = np.sin(np.linspace(0.0, np.pi * 2 * 1000.0, int(sample_rate)))
+        signal_b = np.sin(np.linspace(0.0, np.pi * 2 * 2000.0, int(sample_rate)))
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            path = os.path.join(tmp_dir, "filterbanks")
+            pyohrli.save_filterbank_cache(path)
+            pyohrli.load_filterbank_cache(path)
+            self.assertEqual(
+                pyohrli.Pyohrli(sample_rate).distance(signal_a, signal_b),
+                metric.distance(signal_a, signal_b),
+            )
+            with self.assertRaises(OSError):
+                pyohrli.load_filterbank_cache(os.path.join(tmp_dir, "missing"))
+
+    def test_stats(self):
+        sample_rate = 48000.0
+        metric = pyohrli.Pyohrli(sample_rate)
+        self.assertEqual(metric.stats()["filterbank"]["calls"], 0)
+        metric.enable_stats()
+        signal_a = np.sin(np.linspace(0.0, np.pi * 2 * 1000.0, int(sample_rate)))
+        signal_b = np.sin(np.linspace(0.0, np.pi * 2 * 1100.0, int(sample_rate)))
+        metric.distance(signal_a, signal_b)
+        stats = metric.stats()
+        if stats["filterbank"]["calls"] == 0:
+            self.skipTest("built without ZIMTOHRLI_STATS")
+        self.assertEqual(stats["filterbank"]["calls"], 2)
+        self.assertEqual(stats["filterbank"]["samples"], 2 * int(sample_rate))
+        for stage in ["masking", "loudness", "dtw", "nsim"]:
+            self.assertGreater(stats[stage]["calls"], 0)
+        self.assertGreater(stats["dtw_cells"], 0)
+
+    def test_distance_batch(self):
+        sample_rate = 48000.0
+        metric = pyohrli.Pyohrli(sample_rate)
+        reference = np.sin(np.linspace(0.0, np.pi * 2 * 1000.0, int(sample_rate)))
+        signals = [
+            np.sin(np.linspace(0.0, np.pi * 2 * hz, int(sample_rate)))
+            for hz in [1000.0, 1100.0, 2000.0, 4000.0]
+        ]
+        distances = metric.distance_batch(reference, signals, num_threads=3)
+        self.assertEqual(distances.shape, (len(signals),))
+        analysis = metric.analyze(reference)
+        for signal, distance in zip(signals, distances):
+            self.assertAlmostEqual(
+                distance, metric.reference_distance(analysis, signal), places=6
+            )
+
+    def test_analysis_distance_matrix(self):
+        sample_rate = 48000.0
+        metric = pyohrli.Pyohrli(sample_rate)
+        analyses = [
+            metric.analyze(np.sin(np.linspace(0.0, np.pi * 2 * hz, int(sample_rate))))
+            for hz in [1000.0, 2000.0, 4000.0]
+        ]
+        matrix = metric.analysis_distance_matrix(analyses, analyses[:2])
+        self.assertEqual(matrix.shape, (3, 2))
+        for a_index, analysis_a in enumerate(analyses):
+            for b_index, analysis_b in enumerate(analyses[:2]):
+                self.assertAlmostEqual(
+                    matrix[a_index, b_index],
+                    metric.analysis_distance(analysis_a, analysis_b),
+                    places=6,
+                )
+
+    def test_distance_matrix(self):
+        sample_rate = 48000.0
+        metric = pyohrli.Pyohrli(sample_rate)
+        analyses = [
+            metric.analyze(np.sin(np.linspace(0.0, np.pi * 2 * hz, int(sample_rate))))
+            for hz in [1000.0, 2000.0, 4000.0]
+        ]
+        matrix = metric.distance_matrix(analyses, num_threads=2)
+        self.assertEqual(matrix.shape, (3, 3))
+        for row in range(3):
+            self.assertEqual(matrix[row, row], 0)
+            for column in range(row + 1, 3):
+                self.assertAlmostEqual(
+                    matrix[row, column],
+                    metric.analysis_distance(analyses[row], analyses[column]),
+                    places=6,
+                )
+                self.assertEqual(matrix[column, row], matrix[row, column])
+
     @parameterize(
         dict(zimtohrli_distance=0.0, mos=5.0),
         dict(zimtohrli_distance=0.1, mos=3.8630697727203369),
@@ -0,0 +1,117 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zimt/screening.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#include "absl/log/check.h"
+#include "hwy/aligned_allocator.h"
+#include "zimt/cam.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+namespace {
+
+// Returns the coarse version of prototype according to parameters.
+Zimtohrli CoarseZimtohrli(const Zimtohrli& prototype, const Cam& cam,
+                          float sample_rate,
+                          const ScreeningParameters& parameters) {
+  CHECK_GE(parameters.bandwidth_factor, 1);
+  CHECK_GE(parameters.time_factor, 1);
+  Cam coarse_cam = cam;
+  coarse_cam.minimum_bandwidth_hz *= parameters.bandwidth_factor;
+  Zimtohrli result =
+      prototype.WithFilterbank(coarse_cam.CreateFilterbank(sample_rate));
+  result.perceptual_sample_rate /= parameters.time_factor;
+  // Keep the NSIM windows covering the same time and frequency spans.
+  result.nsim_step_window = std::max<size_t>(
+      1, static_cast<size_t>(std::round(prototype.nsim_step_window /
+                                        parameters.time_factor)));
+  result.nsim_channel_window = std::max<size_t>(
+      1, static_cast<size_t>(std::round(prototype.nsim_channel_window /
+                                        parameters.bandwidth_factor)));
+  return result;
+}
+
+// Returns the distance between spectrogram_a and signal_b according to z,
+// analyzing signal_b into workspace.
+float DistanceToSignal(const Zimtohrli& z,
+                       const hwy::AlignedNDArray<float, 2>& spectrogram_a,
+                       hwy::Span<const float> signal_b,
+                       ZimtohrliWorkspace& workspace) {
+  z.Analyze(signal_b, workspace, workspace.analysis_b);
+  return z
+      .Distance(false, spectrogram_a, workspace.analysis_b->spectrogram,
+                workspace)
+      .value;
+}
+
+}  // namespace
+
+ScreeningZimtohrli::ScreeningZimtohrli(const Cam& cam,
+                                       const Zimtohrli& prototype,
+                                       float sample_rate,
+                                       ScreeningParameters parameters)
+    : parameters_(parameters),
+      coarse_(CoarseZimtohrli(prototype, cam, sample_rate, parameters)),
+      fine_(prototype.WithFilterbank(cam.CreateFilterbank(sample_rate))) {}
+
+ScreeningZimtohrli::Result ScreeningZimtohrli::Screen(
+    hwy::Span<const float> signal_a, hwy::Span<const float> signal_b,
+    float threshold, ScreeningWorkspace& workspace) const {
+  Result result;
+  result.coarse_distance =
+      coarse_.Distance(signal_a, signal_b, workspace.coarse);
+  if (std::abs(result.coarse_distance - threshold) <= parameters_.margin) {
+    result.distance = fine_.Distance(signal_a, signal_b, workspace.fine);
+    result.below_threshold = *result.distance < threshold;
+  } else {
+    result.below_threshold = result.coarse_distance < threshold;
+  }
+  return result;
+}
+
+ScreeningZimtohrli::Result ScreeningZimtohrli::Screen(
+    hwy::Span<const float> signal_a, hwy::Span<const float> signal_b,
+    float threshold) const {
+  ScreeningWorkspace workspace;
+  return Screen(signal_a, signal_b, threshold, workspace);
+}
+
+ScreeningZimtohrli::ReferenceAnalysis ScreeningZimtohrli::AnalyzeReference(
+    hwy::Span<const float> signal) const {
+  return {.coarse = coarse_.Analyze(signal), .fine = fine_.Analyze(signal)};
+}
+
+ScreeningZimtohrli::Result ScreeningZimtohrli::Screen(
+    const ReferenceAnalysis& reference, hwy::Span<const float> signal_b,
+    float threshold, ScreeningWorkspace& workspace) const {
+  Result result;
+  result.coarse_distance = DistanceToSignal(
+      coarse_, reference.coarse.spectrogram, signal_b, workspace.coarse);
+  if (std::abs(result.coarse_distance - threshold) <= parameters_.margin) {
+    result.distance = DistanceToSignal(fine_, reference.fine.spectrogram,
+                                       signal_b, workspace.fine);
+    result.below_threshold = *result.distance < threshold;
+  } else {
+    result.below_threshold = result.coarse_distance < threshold;
+  }
+  return result;
+}
+
+}  // namespace zimtohrli
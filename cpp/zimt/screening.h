@@ -0,0 +1,130 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CPP_ZIMT_SCREENING_H_
+#define CPP_ZIMT_SCREENING_H_
+
+#include <optional>
+
+#include "hwy/aligned_allocator.h"
+#include "zimt/cam.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+// Parameters of the coarse analysis used by ScreeningZimtohrli.
+struct ScreeningParameters {
+  // The minimum_bandwidth_hz of the coarse Cam is this factor larger than
+  // that of the full resolution Cam, which gives roughly this factor fewer
+  // channels.
+  //
+  // Widening the bands instead of keeping every Nth band of the full
+  // resolution filterbank keeps the whole spectrum covered.
+  float bandwidth_factor = 4;
+
+  // The perceptual_sample_rate of the coarse instance is this factor smaller
+  // than that of the full resolution instance.
+  float time_factor = 2;
+
+  // Pairs whose coarse distance is within margin of the threshold are analyzed
+  // at full resolution.
+  //
+  // The coarse distance is only an approximation of the full resolution
+  // distance, so the margin must be at least the largest difference between
+  // them that matters, calibrated with Coarse() and Fine() on representative
+  // pairs.
+  float margin = 0.01;
+};
+
+// Working memory for ScreeningZimtohrli::Screen.
+//
+// Not thread safe, each thread needs its own workspace.
+struct ScreeningWorkspace {
+  ZimtohrliWorkspace coarse;
+  ZimtohrliWorkspace fine;
+};
+
+// A full resolution Zimtohrli instance paired with a coarse one, to quickly
+// tell which side of a threshold the distances of many pairs of sounds fall.
+//
+// Every pair is compared by the coarse instance, with wider bands and a lower
+// perceptual sample rate, and only the pairs whose coarse distance lands near
+// the threshold are compared again at full resolution.
+class ScreeningZimtohrli {
+ public:
+  // The result of screening a pair of sounds.
+  struct Result {
+    // The distance according to the coarse instance.
+    float coarse_distance;
+    // The distance according to the full resolution instance, only populated
+    // when coarse_distance was within the margin of the threshold.
+    std::optional<float> distance;
+    // Whether the distance is below the threshold, decided by distance if
+    // populated and by coarse_distance otherwise.
+    bool below_threshold;
+  };
+
+  // The analyses of a reference sound by both instances, to screen many
+  // sounds against it without analyzing it again for each of them.
+  struct ReferenceAnalysis {
+    Analysis coarse;
+    Analysis fine;
+  };
+
+  // cam is used to create the full resolution filterbank for sample_rate, and
+  // the coarse one with its minimum_bandwidth_hz scaled by parameters.
+  //
+  // All other parameters of both instances are copied from prototype, whose
+  // cam_filterbank is ignored. The NSIM windows of the coarse instance are
+  // scaled down to cover the same time and frequency spans.
+  ScreeningZimtohrli(const Cam& cam, const Zimtohrli& prototype,
+                     float sample_rate, ScreeningParameters parameters);
+
+  // Returns the coarse instance.
+  const Zimtohrli& Coarse() const { return coarse_; }
+
+  // Returns the full resolution instance.
+  const Zimtohrli& Fine() const { return fine_; }
+
+  // Returns the screening of signal_a and signal_b, sampled at the sample rate
+  // of this instance, against threshold.
+  Result Screen(hwy::Span<const float> signal_a,
+                hwy::Span<const float> signal_b, float threshold,
+                ScreeningWorkspace& workspace) const;
+
+  // Screen with a temporary workspace.
+  Result Screen(hwy::Span<const float> signal_a,
+                hwy::Span<const float> signal_b, float threshold) const;
+
+  // Returns the analyses of signal, sampled at the sample rate of this
+  // instance, for screening other signals against it.
+  ReferenceAnalysis AnalyzeReference(hwy::Span<const float> signal) const;
+
+  // Screen of the signal that reference was analyzed from and signal_b.
+  //
+  // Only analyzes signal_b, so screening many signals against the same
+  // reference doesn't repeat its analysis.
+  Result Screen(const ReferenceAnalysis& reference,
+                hwy::Span<const float> signal_b, float threshold,
+                ScreeningWorkspace& workspace) const;
+
+ private:
+  const ScreeningParameters parameters_;
+  const Zimtohrli coarse_;
+  const Zimtohrli fine_;
+};
+
+}  // namespace zimtohrli
+
+#endif  // CPP_ZIMT_SCREENING_H_
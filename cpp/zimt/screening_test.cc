@@ -0,0 +1,109 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "zimt/screening.h"
+
+#include <cmath>
+#include <cstddef>
+
+#include "gtest/gtest.h"
+#include "hwy/aligned_allocator.h"
+#include "zimt/cam.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+namespace {
+
+constexpr float kSampleRate = 48000;
+
+hwy::AlignedNDArray<float, 1> Tone(float hz, float noise) {
+  hwy::AlignedNDArray<float, 1> signal({static_cast<size_t>(kSampleRate / 2)});
+  for (size_t index = 0; index < signal.shape()[0]; ++index) {
+    signal[{}][index] =
+        0.5 * std::sin(2 * M_PI * hz * index / kSampleRate) +
+        noise * std::sin(static_cast<float>(index * index % 1237));
+  }
+  return signal;
+}
+
+TEST(ScreeningZimtohrli, CoarseTest) {
+  const ScreeningZimtohrli z(Cam{}, Zimtohrli{}, kSampleRate,
+                             ScreeningParameters{});
+  EXPECT_EQ(z.Fine().cam_filterbank->sample_rate, kSampleRate);
+  EXPECT_EQ(z.Coarse().cam_filterbank->sample_rate, kSampleRate);
+  EXPECT_LT(z.Coarse().NumChannels() * 2, z.Fine().NumChannels());
+  EXPECT_EQ(z.Coarse().perceptual_sample_rate,
+            z.Fine().perceptual_sample_rate / 2);
+  EXPECT_EQ(z.Coarse().nsim_step_window, z.Fine().nsim_step_window / 2);
+  EXPECT_EQ(z.Coarse().nsim_channel_window, z.Fine().nsim_channel_window / 4);
+}
+
+TEST(ScreeningZimtohrli, ScreenTest) {
+  const ScreeningZimtohrli z(Cam{}, Zimtohrli{}, kSampleRate,
+                             ScreeningParameters{.margin = 0.001});
+  const hwy::AlignedNDArray<float, 1> signal_a = Tone(1000, 0);
+  const hwy::AlignedNDArray<float, 1> signal_b = Tone(1000, 0.1);
+  ScreeningWorkspace workspace;
+
+  // Far from the threshold, only the coarse distance is computed.
+  const ScreeningZimtohrli::Result far =
+      z.Screen(signal_a[{}], signal_b[{}], 1, workspace);
+  EXPECT_GT(far.coarse_distance, 0);
+  EXPECT_FALSE(far.distance.has_value());
+  EXPECT_TRUE(far.below_threshold);
+
+  // Near the threshold, the full resolution distance decides.
+  const ScreeningZimtohrli::Result near = z.Screen(
+      signal_a[{}], signal_b[{}], far.coarse_distance + 0.0005, workspace);
+  EXPECT_EQ(near.coarse_distance, far.coarse_distance);
+  ASSERT_TRUE(near.distance.has_value());
+  const Analysis fine_a = z.Fine().Analyze(signal_a[{}]);
+  const Analysis fine_b = z.Fine().Analyze(signal_b[{}]);
+  EXPECT_EQ(*near.distance,
+            z.Fine().Distance(false, fine_a.spectrogram, fine_b.spectrogram)
+                .value);
+  EXPECT_EQ(near.below_threshold,
+            *near.distance < far.coarse_distance + 0.0005);
+}
+
+TEST(ScreeningZimtohrli, ScreenReferenceTest) {
+  const ScreeningZimtohrli z(Cam{}, Zimtohrli{}, kSampleRate,
+                             ScreeningParameters{.margin = 0.001});
+  const hwy::AlignedNDArray<float, 1> signal_a = Tone(1000, 0);
+  const ScreeningZimtohrli::ReferenceAnalysis reference =
+      z.AnalyzeReference(signal_a[{}]);
+  ScreeningWorkspace workspace;
+  for (const float noise : {0.05f, 0.1f}) {
+    const hwy::AlignedNDArray<float, 1> signal_b = Tone(1000, noise);
+    const ScreeningZimtohrli::Result far =
+        z.Screen(signal_a[{}], signal_b[{}], 1, workspace);
+    // Screens both far from the threshold and near it, where the full
+    // resolution distance decides.
+    for (const float threshold : {1.0f, far.coarse_distance + 0.0005f}) {
+      const ScreeningZimtohrli::Result got =
+          z.Screen(reference, signal_b[{}], threshold, workspace);
+      const ScreeningZimtohrli::Result from_signals =
+          z.Screen(signal_a[{}], signal_b[{}], threshold, workspace);
+      EXPECT_EQ(got.coarse_distance, from_signals.coarse_distance);
+      EXPECT_EQ(got.distance, from_signals.distance);
+      EXPECT_EQ(got.below_threshold, from_signals.below_threshold);
+    }
+  }
+}
+
+}  // namespace
+
+}  // namespace zimtohrli
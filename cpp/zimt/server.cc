@@ -0,0 +1,86 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//
+// Serves Zimtohrli distances to local clients, see zimt/metric_server.h for
+// the protocol.
+//
+// To run:
+//
+// $ zimtohrli_server --socket=/tmp/zimtohrli.sock
+//
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <thread>  // NOLINT
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/status/status.h"
+#include "zimt/cam.h"
+#include "zimt/metric_server.h"
+#include "zimt/zimtohrli.h"
+
+ABSL_FLAG(std::string, socket, "", "path of the Unix domain socket to serve");
+ABSL_FLAG(float, frequency_resolution, zimtohrli::Cam{}.minimum_bandwidth_hz,
+          "maximum frequency resolution, Hz");
+ABSL_FLAG(float, perceptual_sample_rate,
+          zimtohrli::Zimtohrli{}.perceptual_sample_rate,
+          "the frequency corresponding to the maximum time resolution, Hz");
+ABSL_FLAG(float, full_scale_sine_db, 80,
+          "reference dB SPL for a sine signal of amplitude 1");
+ABSL_FLAG(float, unwarp_window, 2.0f, "unwarp window length in seconds");
+ABSL_FLAG(float, unwarp_radius, 0.0f,
+          "maximum warp in seconds considered when unwarping, converted to "
+          "time steps like the unwarp window, 0 means only limited by the "
+          "unwarp window");
+ABSL_FLAG(size_t, num_threads, std::thread::hardware_concurrency(),
+          "number of threads computing distances");
+
+namespace zimtohrli {
+
+namespace {
+
+int Main(int argc, char* argv[]) {
+  absl::ParseCommandLine(argc, argv);
+  const std::string socket_path = absl::GetFlag(FLAGS_socket);
+  if (socket_path.empty()) {
+    std::cerr << "A socket has to be specified." << std::endl;
+    return 1;
+  }
+  const float frequency_resolution = absl::GetFlag(FLAGS_frequency_resolution);
+  if (frequency_resolution < 1) {
+    std::cerr << "Maximum frequency resolution must be >= 1." << std::endl;
+    return 2;
+  }
+  MetricServer server(
+      Cam{.minimum_bandwidth_hz = frequency_resolution},
+      Zimtohrli{
+          .perceptual_sample_rate = absl::GetFlag(FLAGS_perceptual_sample_rate),
+          .unwarp_window_seconds = absl::GetFlag(FLAGS_unwarp_window),
+          .unwarp_radius_seconds = absl::GetFlag(FLAGS_unwarp_radius),
+          .full_scale_sine_db = absl::GetFlag(FLAGS_full_scale_sine_db),
+      },
+      absl::GetFlag(FLAGS_num_threads));
+  const absl::Status status = ListenAndServe(server, socket_path);
+  std::cerr << status.message() << std::endl;
+  return 3;
+}
+
+}  // namespace
+
+}  // namespace zimtohrli
+
+int main(int argc, char* argv[]) { return zimtohrli::Main(argc, argv); }
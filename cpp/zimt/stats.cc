@@ -0,0 +1,91 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "zimt/stats.h"
+
+#include <atomic>
+#include <chrono>  // NOLINT
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace zimtohrli {
+
+namespace {
+
+void ResetStage(StageStats& stage) {
+  stage.nanoseconds = 0;
+  stage.calls = 0;
+  stage.samples = 0;
+  stage.bytes_allocated = 0;
+}
+
+void PrintStage(std::ostream& outs, const char* name,
+                const StageStats& stage) {
+  outs << "  " << name << ": "
+       << static_cast<double>(stage.nanoseconds.load()) * 1e-9 << " s, "
+       << stage.calls.load() << " calls, " << stage.samples.load()
+       << " samples, " << stage.bytes_allocated.load() << " bytes allocated"
+       << std::endl;
+}
+
+}  // namespace
+
+void ZimtohrliStats::Reset() {
+  ResetStage(filterbank);
+  ResetStage(masking);
+  ResetStage(loudness);
+  ResetStage(dtw);
+  ResetStage(nsim);
+  dtw_cells = 0;
+}
+
+std::ostream& operator<<(std::ostream& outs, const ZimtohrliStats& stats) {
+  PrintStage(outs, "Filterbank", stats.filterbank);
+  PrintStage(outs, "Masking", stats.masking);
+  PrintStage(outs, "Loudness", stats.loudness);
+  PrintStage(outs, "DTW", stats.dtw);
+  outs << "    " << stats.dtw_cells.load() << " cells evaluated" << std::endl;
+  PrintStage(outs, "NSIM", stats.nsim);
+  return outs;
+}
+
+#ifdef ZIMTOHRLI_STATS
+
+StageTimer::StageTimer(ZimtohrliStats* stats,
+                       StageStats ZimtohrliStats::* stage, size_t samples)
+    : stage_(stats == nullptr ? nullptr : &(stats->*stage)) {
+  if (stage_ == nullptr) {
+    return;
+  }
+  stage_->calls.fetch_add(1, std::memory_order_relaxed);
+  stage_->samples.fetch_add(samples, std::memory_order_relaxed);
+  start_ = std::chrono::steady_clock::now();
+}
+
+StageTimer::~StageTimer() {
+  if (stage_ == nullptr) {
+    return;
+  }
+  stage_->nanoseconds.fetch_add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start_)
+          .count(),
+      std::memory_order_relaxed);
+}
+
+#endif  // ZIMTOHRLI_STATS
+
+}  // namespace zimtohrli
@@ -0,0 +1,114 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef CPP_ZIMT_STATS_H_
+#define CPP_ZIMT_STATS_H_
+
+#include <atomic>
+#include <chrono>  // NOLINT
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace zimtohrli {
+
+// Counters of the work done by one stage of the Zimtohrli pipeline.
+//
+// Updated atomically, so that stages running on different threads can record
+// in the same instance.
+struct StageStats {
+  // Wall time spent in the stage.
+  std::atomic<uint64_t> nanoseconds{0};
+  // Number of times the stage ran.
+  std::atomic<uint64_t> calls{0};
+  // Number of samples processed by the stage. Audio samples for the
+  // filterbank, and time steps for the other stages.
+  std::atomic<uint64_t> samples{0};
+  // Bytes of the arrays allocated by the stage to hold its output.
+  std::atomic<uint64_t> bytes_allocated{0};
+};
+
+// Counters of the work done by the stages of the Zimtohrli pipeline, updated
+// by the Zimtohrli instances pointing to it.
+//
+// The counters are only updated when built with ZIMTOHRLI_STATS defined;
+// otherwise the instrumentation compiles to nothing and the counters stay
+// zero.
+struct ZimtohrliStats {
+  // Sets all counters to zero.
+  void Reset();
+
+  // The filterbank and energy computation of Spectrogram.
+  StageStats filterbank;
+  // The dB conversion and masking of Spectrogram.
+  StageStats masking;
+  // The loudness model of Spectrogram.
+  StageStats loudness;
+  // The dynamic time warp of Distance, DistanceBelow, and Compare.
+  StageStats dtw;
+  // The NSIM of Distance and DistanceBelow.
+  StageStats nsim;
+  // Number of cells of the cost matrix evaluated by the dynamic time warp.
+  std::atomic<uint64_t> dtw_cells{0};
+};
+
+// Writes one line per stage with its counters.
+std::ostream& operator<<(std::ostream& outs, const ZimtohrliStats& stats);
+
+#ifdef ZIMTOHRLI_STATS
+
+// Records the wall time of its own lifetime in a stage of stats, unless stats
+// is nullptr.
+class StageTimer {
+ public:
+  StageTimer(ZimtohrliStats* stats, StageStats ZimtohrliStats::* stage,
+             size_t samples);
+  ~StageTimer();
+
+  StageTimer(const StageTimer&) = delete;
+  StageTimer& operator=(const StageTimer&) = delete;
+
+ private:
+  StageStats* stage_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Records the enclosing scope as a run of stage in stats, processing samples.
+#define ZIMTOHRLI_STAGE_TIMER(stats, stage, samples)     \
+  ::zimtohrli::StageTimer zimtohrli_stage_timer(         \
+      (stats), &::zimtohrli::ZimtohrliStats::stage, (samples))
+
+// Adds value to the counter field of stats, unless stats is nullptr.
+#define ZIMTOHRLI_STATS_ADD(stats, counter, value)                        \
+  do {                                                                    \
+    ::zimtohrli::ZimtohrliStats* const zimtohrli_stats = (stats);         \
+    if (zimtohrli_stats != nullptr) {                                     \
+      zimtohrli_stats->counter.fetch_add((value),                         \
+                                         std::memory_order_relaxed);      \
+    }                                                                     \
+  } while (false)
+
+#else
+
+#define ZIMTOHRLI_STAGE_TIMER(stats, stage, samples)
+#define ZIMTOHRLI_STATS_ADD(stats, counter, value) \
+  do {                                             \
+  } while (false)
+
+#endif  // ZIMTOHRLI_STATS
+
+}  // namespace zimtohrli
+
+#endif  // CPP_ZIMT_STATS_H_
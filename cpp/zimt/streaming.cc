@@ -0,0 +1,162 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zimt/streaming.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "hwy/aligned_allocator.h"
+#include "hwy/base.h"
+#include "zimt/filterbank.h"
+#include "zimt/masking.h"
+#include "zimt/nsim.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+namespace {
+
+size_t BlockSizeFor(const Zimtohrli& zimtohrli) {
+  CHECK(zimtohrli.cam_filterbank.has_value());
+  return static_cast<size_t>(std::max(
+      1.0f, std::round(zimtohrli.cam_filterbank->sample_rate /
+                       zimtohrli.perceptual_sample_rate)));
+}
+
+}  // namespace
+
+StreamingAnalyzer::StreamingAnalyzer(const Zimtohrli& zimtohrli)
+    : zimtohrli_(zimtohrli),
+      state_(zimtohrli.cam_filterbank->filter.NewState()),
+      channels_({BlockSizeFor(zimtohrli), zimtohrli.NumChannels()}),
+      loudness_coefficients_(zimtohrli.loudness.Coefficients(
+          zimtohrli.cam_filterbank->thresholds_hz)) {
+  CHECK(zimtohrli.decimated_filterbank == nullptr);
+}
+
+std::optional<Analysis> StreamingAnalyzer::Push(hwy::Span<const float> signal) {
+  const Filterbank& filter = zimtohrli_.cam_filterbank->filter;
+  const size_t block_size = BlockSize();
+  const size_t num_new_steps =
+      (num_buffered_samples_ + signal.size()) / block_size;
+  std::optional<hwy::AlignedNDArray<float, 2>> energy_channels;
+  if (num_new_steps > 0) {
+    energy_channels.emplace(
+        std::array<size_t, 2>{num_new_steps, filter.Size()});
+  }
+  hwy::AlignedNDArray<float, 2> step_energy({1, filter.Size()});
+  size_t step_index = 0;
+  size_t signal_offset = 0;
+  while (signal_offset < signal.size()) {
+    const size_t num_samples = std::min(block_size - num_buffered_samples_,
+                                        signal.size() - signal_offset);
+    filter.FilterInto(
+        hwy::Span<const float>(signal.data() + signal_offset, num_samples),
+        state_, channels_[{num_buffered_samples_}].data());
+    num_buffered_samples_ += num_samples;
+    signal_offset += num_samples;
+    if (num_buffered_samples_ == block_size) {
+      ComputeEnergy(channels_, step_energy);
+      hwy::CopyBytes(step_energy.data(),
+                     (*energy_channels)[{step_index}].data(),
+                     filter.PaddedSize() * sizeof(float));
+      ++step_index;
+      num_buffered_samples_ = 0;
+    }
+  }
+  if (!energy_channels.has_value()) {
+    return std::nullopt;
+  }
+  num_steps_ += num_new_steps;
+  return Finish(std::move(*energy_channels));
+}
+
+std::optional<Analysis> StreamingAnalyzer::Flush() {
+  const Filterbank& filter = zimtohrli_.cam_filterbank->filter;
+  std::optional<Analysis> result;
+  if (num_buffered_samples_ > 0) {
+    hwy::AlignedNDArray<float, 2> partial_channels(
+        {num_buffered_samples_, filter.Size()});
+    hwy::CopyBytes(channels_.data(), partial_channels.data(),
+                   num_buffered_samples_ * filter.PaddedSize() *
+                       sizeof(float));
+    hwy::AlignedNDArray<float, 2> energy_channels({1, filter.Size()});
+    ComputeEnergy(partial_channels, energy_channels);
+    result = Finish(std::move(energy_channels));
+  }
+  state_ = filter.NewState();
+  num_buffered_samples_ = 0;
+  num_steps_ = 0;
+  return result;
+}
+
+Analysis StreamingAnalyzer::Finish(
+    hwy::AlignedNDArray<float, 2> energy_channels) const {
+  hwy::AlignedNDArray<float, 2> partial_energy_channels_db(
+      energy_channels.shape());
+  hwy::AlignedNDArray<float, 2> spectrogram(energy_channels.shape());
+  zimtohrli_.SpectrogramFromEnergy(energy_channels, partial_energy_channels_db,
+                                   spectrogram, loudness_coefficients_);
+  return {.energy_channels_db = std::move(energy_channels),
+          .partial_energy_channels_db = std::move(partial_energy_channels_db),
+          .spectrogram = std::move(spectrogram)};
+}
+
+StreamingDistance::StreamingDistance(const Zimtohrli& zimtohrli)
+    : nsim_(zimtohrli.NumChannels(), zimtohrli.nsim_step_window,
+            std::min(zimtohrli.NumChannels(), zimtohrli.nsim_channel_window)) {}
+
+void StreamingDistance::AddA(
+    const hwy::AlignedNDArray<float, 2>& spectrogram_rows) {
+  for (size_t step_index = 0; step_index < spectrogram_rows.shape()[0];
+       ++step_index) {
+    const hwy::Span<const float> row = spectrogram_rows[{step_index}];
+    pending_a_.emplace_back(row.begin(), row.end());
+  }
+  Match();
+}
+
+void StreamingDistance::AddB(
+    const hwy::AlignedNDArray<float, 2>& spectrogram_rows) {
+  for (size_t step_index = 0; step_index < spectrogram_rows.shape()[0];
+       ++step_index) {
+    const hwy::Span<const float> row = spectrogram_rows[{step_index}];
+    pending_b_.emplace_back(row.begin(), row.end());
+  }
+  Match();
+}
+
+void StreamingDistance::Match() {
+  while (!pending_a_.empty() && !pending_b_.empty()) {
+    nsim_.AddStep(hwy::Span<const float>(pending_a_.front().data(),
+                                         pending_a_.front().size()),
+                  hwy::Span<const float>(pending_b_.front().data(),
+                                         pending_b_.front().size()));
+    pending_a_.pop_front();
+    pending_b_.pop_front();
+  }
+}
+
+// Since NSIM is a similarity measure, where 1.0 is "perfectly similar", we
+// subtract it from 1.0 to get a distance metric instead.
+float StreamingDistance::Value() const { return 1.0f - nsim_.Value(); }
+
+}  // namespace zimtohrli
@@ -0,0 +1,118 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CPP_ZIMT_STREAMING_H_
+#define CPP_ZIMT_STREAMING_H_
+
+#include <cstddef>
+#include <deque>
+#include <optional>
+#include <vector>
+
+#include "hwy/aligned_allocator.h"
+#include "zimt/filterbank.h"
+#include "zimt/loudness.h"
+#include "zimt/nsim.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+// Incrementally analyzes a signal pushed in chunks of arbitrary size.
+//
+// Only keeps one perceptual time step worth of filtered channel samples in
+// memory, so memory use is independent of the length of the signal.
+//
+// Each time step covers a block of round(sample_rate / perceptual_sample_rate)
+// samples. For signals whose length is a multiple of the block size the
+// concatenated output is identical to that of Zimtohrli::Analyze.
+class StreamingAnalyzer {
+ public:
+  // The zimtohrli instance must outlive the analyzer, and must not have a
+  // decimated_filterbank.
+  explicit StreamingAnalyzer(const Zimtohrli& zimtohrli);
+
+  // Pushes the next chunk of the signal.
+  //
+  // signal is a span of audio samples between -1 and 1.
+  //
+  // Returns an Analysis with one row for each time step completed by this
+  // chunk, or nullopt if no time step was completed.
+  std::optional<Analysis> Push(hwy::Span<const float> signal);
+
+  // Returns an Analysis of the incomplete time step at the end of the signal,
+  // or nullopt if there is none, and resets the analyzer for a new signal.
+  std::optional<Analysis> Flush();
+
+  // Returns the number of samples in each time step.
+  size_t BlockSize() const { return channels_.shape()[0]; }
+
+  // Returns the number of time steps emitted so far.
+  size_t NumSteps() const { return num_steps_; }
+
+ private:
+  // Computes the rows of an Analysis from the linear energy in
+  // energy_channels.
+  Analysis Finish(hwy::AlignedNDArray<float, 2> energy_channels) const;
+
+  const Zimtohrli& zimtohrli_;
+  FilterbankState state_;
+  // (block_size, num_channels)-shaped array of the filtered samples of the
+  // current time step.
+  hwy::AlignedNDArray<float, 2> channels_;
+  // The loudness coefficients of the filterbank, computed once.
+  LoudnessCoefficients loudness_coefficients_;
+  // Number of rows in channels_ populated for the current time step.
+  size_t num_buffered_samples_ = 0;
+  size_t num_steps_ = 0;
+};
+
+// Incrementally computes the distance between two spectrograms produced, for
+// example, by two StreamingAnalyzer instances.
+//
+// Rows of A and B are matched in the order they are added, without dynamic
+// time warping, and rows of the sound that is ahead are buffered until the
+// other sound catches up.
+//
+// The result is equivalent to the value of Zimtohrli::Distance with
+// unwarp_window_seconds == 0 for spectrograms with at least nsim_step_window
+// time steps.
+class StreamingDistance {
+ public:
+  // The zimtohrli instance must outlive the distance.
+  explicit StreamingDistance(const Zimtohrli& zimtohrli);
+
+  // Adds the next rows of the spectrogram of sound A.
+  void AddA(const hwy::AlignedNDArray<float, 2>& spectrogram_rows);
+
+  // Adds the next rows of the spectrogram of sound B.
+  void AddB(const hwy::AlignedNDArray<float, 2>& spectrogram_rows);
+
+  // Returns the distance between all matched rows so far.
+  float Value() const;
+
+  // Returns the number of matched rows so far.
+  size_t NumSteps() const { return nsim_.NumSteps(); }
+
+ private:
+  // Feeds all pairs of pending rows to nsim_.
+  void Match();
+
+  StreamingNSIM nsim_;
+  std::deque<std::vector<float>> pending_a_;
+  std::deque<std::vector<float>> pending_b_;
+};
+
+}  // namespace zimtohrli
+
+#endif  // CPP_ZIMT_STREAMING_H_
@@ -0,0 +1,176 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zimt/streaming.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "gtest/gtest.h"
+#include "hwy/aligned_allocator.h"
+#include "zimt/cam.h"
+#include "zimt/zimtohrli.h"
+
+namespace zimtohrli {
+
+namespace {
+
+hwy::AlignedNDArray<float, 1> CreateNoisySine(float sample_rate, size_t size,
+                                              float frequency,
+                                              unsigned int seed) {
+  hwy::AlignedNDArray<float, 1> result({size});
+  for (size_t index = 0; index < size; ++index) {
+    seed = seed * 1103515245 + 12345;
+    result[{}][index] =
+        0.5f * std::sin(2 * M_PI * frequency * index / sample_rate) +
+        0.1f * (static_cast<float>(seed % 1000) / 1000.0f - 0.5f);
+  }
+  return result;
+}
+
+void CheckRowsNear(const hwy::AlignedNDArray<float, 2>& want,
+                   const std::vector<std::vector<float>>& got) {
+  ASSERT_EQ(want.shape()[0], got.size());
+  for (size_t step_index = 0; step_index < got.size(); ++step_index) {
+    for (size_t channel_index = 0; channel_index < want.shape()[1];
+         ++channel_index) {
+      ASSERT_NEAR(want[{step_index}][channel_index],
+                  got[step_index][channel_index], 1e-3)
+          << "step_index=" << step_index
+          << ", channel_index=" << channel_index;
+    }
+  }
+}
+
+void AppendRows(const hwy::AlignedNDArray<float, 2>& rows,
+                std::vector<std::vector<float>>& result) {
+  for (size_t step_index = 0; step_index < rows.shape()[0]; ++step_index) {
+    const hwy::Span<const float> row = rows[{step_index}];
+    result.emplace_back(row.begin(), row.end());
+  }
+}
+
+TEST(Streaming, StreamingAnalyzerTest) {
+  const float sample_rate = 48000;
+  const Zimtohrli z{.cam_filterbank = Cam().CreateFilterbank(sample_rate)};
+  hwy::AlignedNDArray<float, 1> signal =
+      CreateNoisySine(sample_rate, 48000 / 4, 1000, 1);
+
+  hwy::AlignedNDArray<float, 2> channels(
+      {signal.shape()[0], z.cam_filterbank->filter.Size()});
+  const Analysis want = z.Analyze(signal[{}], channels);
+
+  StreamingAnalyzer analyzer(z);
+  EXPECT_EQ(analyzer.BlockSize(), 480);
+  std::vector<std::vector<float>> energy_channels_db;
+  std::vector<std::vector<float>> partial_energy_channels_db;
+  std::vector<std::vector<float>> spectrogram;
+  // Push chunks not aligned with the time steps.
+  const std::vector<size_t> chunk_sizes = {1, 17, 479, 1000, 3, 960};
+  size_t offset = 0;
+  for (size_t chunk_index = 0; offset < signal.shape()[0]; ++chunk_index) {
+    const size_t chunk_size =
+        std::min(chunk_sizes[chunk_index % chunk_sizes.size()],
+                 signal.shape()[0] - offset);
+    std::optional<Analysis> rows = analyzer.Push(
+        hwy::Span<const float>(signal[{}].data() + offset, chunk_size));
+    if (rows.has_value()) {
+      AppendRows(rows->energy_channels_db, energy_channels_db);
+      AppendRows(rows->partial_energy_channels_db, partial_energy_channels_db);
+      AppendRows(rows->spectrogram, spectrogram);
+    }
+    offset += chunk_size;
+  }
+  EXPECT_FALSE(analyzer.Flush().has_value());
+
+  CheckRowsNear(want.energy_channels_db, energy_channels_db);
+  CheckRowsNear(want.partial_energy_channels_db, partial_energy_channels_db);
+  CheckRowsNear(want.spectrogram, spectrogram);
+}
+
+TEST(Streaming, StreamingDistanceTest) {
+  const float sample_rate = 48000;
+  const Zimtohrli z{.cam_filterbank = Cam().CreateFilterbank(sample_rate),
+                    .unwarp_window_seconds = 0};
+  const size_t num_samples = 48000 / 2;
+  hwy::AlignedNDArray<float, 1> signal_a =
+      CreateNoisySine(sample_rate, num_samples, 1000, 1);
+  hwy::AlignedNDArray<float, 1> signal_b =
+      CreateNoisySine(sample_rate, num_samples, 1100, 2);
+
+  hwy::AlignedNDArray<float, 2> channels(
+      {num_samples, z.cam_filterbank->filter.Size()});
+  const Analysis analysis_a = z.Analyze(signal_a[{}], channels);
+  const Analysis analysis_b = z.Analyze(signal_b[{}], channels);
+  const float want =
+      z.Distance(false, analysis_a.spectrogram, analysis_b.spectrogram).value;
+
+  StreamingAnalyzer analyzer_a(z);
+  StreamingAnalyzer analyzer_b(z);
+  StreamingDistance distance(z);
+  // Push A and B in differently sized chunks to exercise the buffering.
+  const size_t chunk_size_a = 4096;
+  const size_t chunk_size_b = 1500;
+  size_t offset_a = 0;
+  size_t offset_b = 0;
+  while (offset_a < num_samples || offset_b < num_samples) {
+    if (offset_a < num_samples) {
+      const size_t size = std::min(chunk_size_a, num_samples - offset_a);
+      std::optional<Analysis> rows = analyzer_a.Push(
+          hwy::Span<const float>(signal_a[{}].data() + offset_a, size));
+      if (rows.has_value()) {
+        distance.AddA(rows->spectrogram);
+      }
+      offset_a += size;
+    }
+    if (offset_b < num_samples) {
+      const size_t size = std::min(chunk_size_b, num_samples - offset_b);
+      std::optional<Analysis> rows = analyzer_b.Push(
+          hwy::Span<const float>(signal_b[{}].data() + offset_b, size));
+      if (rows.has_value()) {
+        distance.AddB(rows->spectrogram);
+      }
+      offset_b += size;
+    }
+  }
+  EXPECT_EQ(distance.NumSteps(), analysis_a.spectrogram.shape()[0]);
+  EXPECT_NEAR(distance.Value(), want, 1e-3);
+}
+
+void BM_StreamingAnalyzer(benchmark::State& state) {
+  const float sample_rate = 48000;
+  const Zimtohrli z{.cam_filterbank = Cam().CreateFilterbank(sample_rate)};
+  hwy::AlignedNDArray<float, 1> signal = CreateNoisySine(
+      sample_rate, static_cast<size_t>(sample_rate) * state.range(0), 1000, 1);
+  const size_t chunk_size = 4096;
+  for (auto s : state) {
+    StreamingAnalyzer analyzer(z);
+    for (size_t offset = 0; offset < signal.shape()[0]; offset += chunk_size) {
+      analyzer.Push(hwy::Span<const float>(
+          signal[{}].data() + offset,
+          std::min(chunk_size, signal.shape()[0] - offset)));
+    }
+  }
+  state.SetItemsProcessed(signal.size() * state.iterations());
+}
+BENCHMARK_RANGE(BM_StreamingAnalyzer, 1, 8);
+
+}  // namespace
+
+}  // namespace zimtohrli
@@ -0,0 +1,101 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zimt/thread_pool.h"
+
+#include <condition_variable>  // NOLINT
+#include <cstddef>
+#include <functional>
+#include <mutex>  // NOLINT
+#include <thread>  // NOLINT
+
+namespace zimtohrli {
+
+ThreadPool::ThreadPool(size_t num_threads) {
+  if (num_threads > 1) {
+    workers_.reserve(num_threads - 1);
+    for (size_t thread_index = 0; thread_index + 1 < num_threads;
+         ++thread_index) {
+      // The calling thread of ParallelFor has thread index 0.
+      workers_.emplace_back(
+          [this, thread_index]() { WorkerLoop(thread_index + 1); });
+    }
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_available_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::ParallelFor(size_t num_tasks,
+                             const std::function<void(size_t)>& task) {
+  ParallelFor(num_tasks,
+              [&task](size_t task_index, size_t) { task(task_index); });
+}
+
+void ThreadPool::ParallelFor(
+    size_t num_tasks, const std::function<void(size_t, size_t)>& task) {
+  if (workers_.empty() || num_tasks < 2) {
+    for (size_t task_index = 0; task_index < num_tasks; ++task_index) {
+      task(task_index, 0);
+    }
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  task_ = &task;
+  num_tasks_ = num_tasks;
+  next_task_ = 0;
+  unfinished_tasks_ = num_tasks;
+  work_available_.notify_all();
+  RunTasks(lock, 0);
+  work_done_.wait(lock, [this]() { return unfinished_tasks_ == 0; });
+  task_ = nullptr;
+  num_tasks_ = 0;
+  next_task_ = 0;
+}
+
+void ThreadPool::RunTasks(std::unique_lock<std::mutex>& lock,
+                          size_t thread_index) {
+  while (next_task_ < num_tasks_) {
+    const size_t task_index = next_task_++;
+    const std::function<void(size_t, size_t)>& task = *task_;
+    lock.unlock();
+    task(task_index, thread_index);
+    lock.lock();
+    if (--unfinished_tasks_ == 0) {
+      work_done_.notify_all();
+    }
+  }
+}
+
+void ThreadPool::WorkerLoop(size_t thread_index) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    work_available_.wait(
+        lock, [this]() { return stop_ || next_task_ < num_tasks_; });
+    if (stop_) {
+      return;
+    }
+    RunTasks(lock, thread_index);
+  }
+}
+
+}  // namespace zimtohrli
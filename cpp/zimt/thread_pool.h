@@ -0,0 +1,81 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CPP_ZIMT_THREAD_POOL_H_
+#define CPP_ZIMT_THREAD_POOL_H_
+
+#include <condition_variable>  // NOLINT
+#include <cstddef>
+#include <functional>
+#include <mutex>  // NOLINT
+#include <thread>  // NOLINT
+#include <vector>
+
+namespace zimtohrli {
+
+// Runs batches of independent tasks on a fixed set of threads.
+//
+// The threads are started once, in the constructor, so a pool can be reused
+// for many batches without paying the thread startup cost each time.
+class ThreadPool {
+ public:
+  // Creates a pool running tasks on num_threads threads, including the thread
+  // calling ParallelFor. A pool with 0 or 1 threads runs all tasks in the
+  // calling thread.
+  explicit ThreadPool(size_t num_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Returns the number of threads running tasks, including the calling thread.
+  size_t NumThreads() const { return workers_.size() + 1; }
+
+  // Runs task(task_index) for each task_index in [0, num_tasks), and returns
+  // when all of them have returned.
+  //
+  // Tasks run concurrently and in no particular order, so to get deterministic
+  // output each task must write its results to a slot given by its index.
+  //
+  // Must not be called concurrently, or from within a task.
+  void ParallelFor(size_t num_tasks, const std::function<void(size_t)>& task);
+
+  // Runs task(task_index, thread_index) for each task_index in [0, num_tasks),
+  // where thread_index in [0, NumThreads()) identifies the thread running the
+  // task.
+  //
+  // No two tasks with the same thread_index run concurrently, so tasks can
+  // reuse per-thread working memory indexed by thread_index.
+  void ParallelFor(size_t num_tasks,
+                   const std::function<void(size_t, size_t)>& task);
+
+ private:
+  // Runs tasks of the current batch until there are none left to claim.
+  void RunTasks(std::unique_lock<std::mutex>& lock, size_t thread_index);
+  void WorkerLoop(size_t thread_index);
+
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable work_done_;
+  const std::function<void(size_t, size_t)>* task_ = nullptr;
+  size_t num_tasks_ = 0;
+  size_t next_task_ = 0;
+  size_t unfinished_tasks_ = 0;
+  bool stop_ = false;
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace zimtohrli
+
+#endif  // CPP_ZIMT_THREAD_POOL_H_
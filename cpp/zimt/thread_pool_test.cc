@@ -0,0 +1,89 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zimt/thread_pool.h"
+
+#include <atomic>
+#include <cstddef>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace zimtohrli {
+
+namespace {
+
+TEST(ThreadPool, RunsEachTaskOnceTest) {
+  for (const size_t num_threads : {0, 1, 2, 7}) {
+    ThreadPool pool(num_threads);
+    for (const size_t num_tasks : {0, 1, 5, 1000}) {
+      std::vector<std::atomic<int>> calls(num_tasks);
+      pool.ParallelFor(num_tasks,
+                       [&](size_t task_index) { calls[task_index]++; });
+      for (size_t task_index = 0; task_index < num_tasks; ++task_index) {
+        EXPECT_EQ(calls[task_index], 1);
+      }
+    }
+  }
+}
+
+TEST(ThreadPool, UsesThreadsTest) {
+  ThreadPool pool(4);
+  EXPECT_EQ(pool.NumThreads(), size_t{4});
+  // Each task waits for all the others to start, which only finishes if all
+  // tasks run concurrently.
+  std::atomic<size_t> started = 0;
+  pool.ParallelFor(pool.NumThreads(), [&](size_t task_index) {
+    started++;
+    while (started < pool.NumThreads()) {
+      std::this_thread::yield();
+    }
+  });
+  EXPECT_EQ(started, pool.NumThreads());
+}
+
+TEST(ThreadPool, SerialPoolRunsInOrderTest) {
+  ThreadPool pool(1);
+  EXPECT_EQ(pool.NumThreads(), size_t{1});
+  std::vector<size_t> order;
+  pool.ParallelFor(10, [&](size_t task_index) { order.push_back(task_index); });
+  const std::vector<size_t> want_order = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+  EXPECT_EQ(order, want_order);
+}
+
+TEST(ThreadPool, ThreadIndexTest) {
+  for (const size_t num_threads : {1, 4}) {
+    ThreadPool pool(num_threads);
+    std::vector<std::atomic<int>> running(pool.NumThreads());
+    std::atomic<int> overlaps = 0;
+    std::vector<std::atomic<int>> calls(1000);
+    pool.ParallelFor(calls.size(), [&](size_t task_index, size_t thread_index) {
+      ASSERT_LT(thread_index, pool.NumThreads());
+      if (running[thread_index]++ != 0) {
+        overlaps++;
+      }
+      calls[task_index]++;
+      running[thread_index]--;
+    });
+    EXPECT_EQ(overlaps, 0);
+    for (const std::atomic<int>& task_calls : calls) {
+      EXPECT_EQ(task_calls, 1);
+    }
+  }
+}
+
+}  // namespace
+
+}  // namespace zimtohrli
@@ -0,0 +1,370 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+//
+// Measures the end-to-end throughput of Zimtohrli on clips of realistic
+// lengths, and how the time splits between the stages of the pipeline.
+//
+// To run:
+//
+// $ zimtohrli_throughput_benchmark --durations=5,60,600 \
+//     --sample_rates=44100,48000 --channels=1,2 --threads=1,8 > results.json
+//
+// Without --path_a and --path_b the clips are synthetic music-like signals
+// and 8 bit quantized versions of them. With them, the files are looped or
+// truncated to each duration and compared at their own sample rate and
+// channel count, i.e. --sample_rates and --channels are ignored.
+//
+// Outputs a JSON object with one result per case, where each case is a
+// combination of duration, sample rate, and channel count:
+//
+// {"cases": [{"duration_seconds": 5, "sample_rate": 48000, "channels": 2,
+//   "filterbank_seconds": ..., "stage_seconds": {"filter_energy": ...,
+//   "db": ..., "masking": ..., "loudness": ..., "dtw": ..., "nsim": ...},
+//   "compare": [{"threads": 1, "seconds": ..., "realtime_factor": ...}],
+//   "peak_rss_bytes": ...}]}
+//
+// The stage times are the single threaded sums over all audio channels of
+// both clips. The filterbank and energy computation are fused in the
+// pipeline, so they are reported as one stage. The peak RSS is that of the
+// whole process up to the end of each case, so it never decreases between
+// cases.
+//
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/log/check.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "hwy/aligned_allocator.h"
+#include "zimt/audio.h"
+#include "zimt/cam.h"
+#include "zimt/loudness.h"
+#include "zimt/masking.h"
+#include "zimt/multi_rate.h"
+#include "zimt/thread_pool.h"
+#include "zimt/zimtohrli.h"
+
+ABSL_FLAG(std::vector<std::string>, durations,
+          std::vector<std::string>({"5", "60", "600"}),
+          "clip durations to measure, seconds");
+ABSL_FLAG(std::vector<std::string>, sample_rates,
+          std::vector<std::string>({"44100", "48000"}),
+          "sample rates of the synthetic clips, Hz");
+ABSL_FLAG(std::vector<std::string>, channels,
+          std::vector<std::string>({"1", "2"}),
+          "audio channel counts of the synthetic clips");
+ABSL_FLAG(std::vector<std::string>, threads,
+          std::vector<std::string>({"1", "4"}),
+          "thread counts to run Compare with");
+ABSL_FLAG(size_t, repetitions, 1,
+          "number of times to run each measurement, the fastest run is "
+          "reported");
+ABSL_FLAG(std::string, path_a, "", "reference file to use instead of a "
+          "synthetic clip");
+ABSL_FLAG(std::string, path_b, "", "distorted file to use instead of a "
+          "synthetic clip");
+
+namespace zimtohrli {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Returns the fastest of repetitions runs of f, in seconds.
+double Time(size_t repetitions, const std::function<void()>& f) {
+  double result = 0;
+  for (size_t repetition = 0; repetition < repetitions; ++repetition) {
+    const Clock::time_point start = Clock::now();
+    f();
+    const double seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    if (repetition == 0 || seconds < result) {
+      result = seconds;
+    }
+  }
+  return result;
+}
+
+size_t PeakRSSBytes() {
+  rusage usage;
+  CHECK_EQ(getrusage(RUSAGE_SELF, &usage), 0);
+  // Linux reports ru_maxrss in kilobytes.
+  return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
+
+std::vector<size_t> ParseSizes(const std::vector<std::string>& values) {
+  std::vector<size_t> result;
+  for (const std::string& value : values) {
+    size_t parsed;
+    CHECK(absl::SimpleAtoi(value, &parsed)) << value;
+    result.push_back(parsed);
+  }
+  return result;
+}
+
+// A reference clip and a distorted version of it, as (num_audio_channels,
+// num_samples)-shaped arrays.
+struct Clips {
+  float sample_rate;
+  hwy::AlignedNDArray<float, 2> a;
+  hwy::AlignedNDArray<float, 2> b;
+};
+
+// Returns chords of harmonic notes changing every half second, with a decay
+// envelope and a little noise, so that every part of the spectrum and every
+// stage of the pipeline has something to do. The channels play the chords
+// slightly detuned, and the distorted clip is the reference quantized to 8
+// bits, like a low quality codec.
+Clips SyntheticClips(float duration_seconds, float sample_rate,
+                     size_t num_channels) {
+  const size_t num_samples =
+      static_cast<size_t>(duration_seconds * sample_rate);
+  Clips result = {.sample_rate = sample_rate,
+                  .a = hwy::AlignedNDArray<float, 2>({num_channels,
+                                                      num_samples}),
+                  .b = hwy::AlignedNDArray<float, 2>({num_channels,
+                                                      num_samples})};
+  constexpr float kNoteHz[] = {110.0f, 146.8f, 164.8f, 196.0f,
+                               220.0f, 261.6f, 329.6f, 392.0f};
+  constexpr size_t kNumNotes = sizeof(kNoteHz) / sizeof(kNoteHz[0]);
+  const size_t chord_samples = static_cast<size_t>(sample_rate / 2);
+  std::mt19937 generator(0);
+  std::normal_distribution<float> noise(0.0f, 0.003f);
+  for (size_t channel_index = 0; channel_index < num_channels;
+       ++channel_index) {
+    const float detune = 1.0f + 0.002f * static_cast<float>(channel_index);
+    for (size_t sample_index = 0; sample_index < num_samples; ++sample_index) {
+      const size_t chord_index = sample_index / chord_samples;
+      const float t = static_cast<float>(sample_index) / sample_rate;
+      const float chord_t =
+          static_cast<float>(sample_index % chord_samples) / sample_rate;
+      const float envelope = std::exp(-4.0f * chord_t);
+      float sample = noise(generator);
+      for (size_t note = 0; note < 3; ++note) {
+        const float note_hz =
+            kNoteHz[(chord_index * 3 + note * 2) % kNumNotes] * detune;
+        for (size_t harmonic = 1; harmonic <= 4; ++harmonic) {
+          sample += envelope * 0.08f / static_cast<float>(harmonic) *
+                    std::sin(2 * M_PI * note_hz * harmonic * t);
+        }
+      }
+      result.a[{channel_index}][sample_index] = sample;
+      result.b[{channel_index}][sample_index] =
+          std::round(sample * 127.0f) / 127.0f;
+    }
+  }
+  return result;
+}
+
+// Returns frames looped or truncated to duration_seconds.
+hwy::AlignedNDArray<float, 2> Fit(const hwy::AlignedNDArray<float, 2>& frames,
+                                  float sample_rate, float duration_seconds) {
+  const size_t num_samples =
+      static_cast<size_t>(duration_seconds * sample_rate);
+  hwy::AlignedNDArray<float, 2> result({frames.shape()[0], num_samples});
+  for (size_t channel_index = 0; channel_index < frames.shape()[0];
+       ++channel_index) {
+    for (size_t sample_index = 0; sample_index < num_samples; ++sample_index) {
+      result[{channel_index}][sample_index] =
+          frames[{channel_index}][sample_index % frames.shape()[1]];
+    }
+  }
+  return result;
+}
+
+// The time spent in each stage of the pipeline.
+struct StageSeconds {
+  double filter_energy = 0;
+  double db = 0;
+  double masking = 0;
+  double loudness = 0;
+  double dtw = 0;
+  double nsim = 0;
+};
+
+// Runs the stages of Zimtohrli::Analyze and Zimtohrli::Distance one at a time
+// on signal_a and signal_b, adding their times to stage_seconds.
+void TimeStages(const Zimtohrli& z, hwy::Span<const float> signal_a,
+                hwy::Span<const float> signal_b, size_t repetitions,
+                StageSeconds& stage_seconds) {
+  const LoudnessCoefficients loudness_coefficients =
+      z.loudness.Coefficients(z.cam_filterbank->thresholds_hz);
+  std::vector<hwy::AlignedNDArray<float, 2>> spectrograms;
+  for (const hwy::Span<const float>& signal : {signal_a, signal_b}) {
+    std::optional<hwy::AlignedNDArray<float, 2>> energy;
+    stage_seconds.filter_energy +=
+        Time(repetitions, [&]() { energy = z.Energy(signal); });
+    hwy::AlignedNDArray<float, 2> energy_db(energy->shape());
+    stage_seconds.db += Time(repetitions, [&]() {
+      ToDb(*energy, z.full_scale_sine_db, z.epsilon, z.fast_math, energy_db);
+    });
+    hwy::AlignedNDArray<float, 2> partial_energy_db(energy->shape());
+    stage_seconds.masking += Time(repetitions, [&]() {
+      z.masking.CutFullyMasked(energy_db, z.cam_filterbank->cam_delta,
+                               partial_energy_db);
+    });
+    hwy::AlignedNDArray<float, 2> spectrogram(energy->shape());
+    stage_seconds.loudness += Time(repetitions, [&]() {
+      z.loudness.PhonsFromSPL(partial_energy_db, loudness_coefficients,
+                              spectrogram);
+    });
+    spectrograms.push_back(std::move(spectrogram));
+  }
+  std::vector<std::pair<size_t, size_t>> time_pairs;
+  stage_seconds.dtw += Time(repetitions, [&]() {
+    time_pairs = z.TimePairs(spectrograms[0], spectrograms[1]);
+  });
+  stage_seconds.nsim += Time(repetitions, [&]() {
+    z.Distance(false, spectrograms[0], spectrograms[1], time_pairs);
+  });
+}
+
+// Measures one case and returns its JSON object.
+std::string RunCase(const Cam& cam, float duration_seconds, const Clips& clips,
+                    const std::vector<size_t>& threads, size_t repetitions) {
+  const size_t num_channels = clips.a.shape()[0];
+  std::optional<MultiRateZimtohrli> multi_rate_z;
+  const Zimtohrli* z = nullptr;
+  const double filterbank_seconds = Time(1, [&]() {
+    multi_rate_z.emplace(cam, Zimtohrli{});
+    z = &multi_rate_z->ForSampleRate(clips.sample_rate);
+  });
+
+  StageSeconds stage_seconds;
+  for (size_t channel_index = 0; channel_index < num_channels;
+       ++channel_index) {
+    TimeStages(*z, clips.a[{channel_index}], clips.b[{channel_index}],
+               repetitions, stage_seconds);
+  }
+
+  const std::vector<const hwy::AlignedNDArray<float, 2>*> frames_b = {
+      &clips.b};
+  std::vector<std::string> compare_results;
+  for (const size_t num_threads : threads) {
+    ThreadPool pool(num_threads);
+    const double seconds = Time(
+        repetitions, [&]() { z->Compare(clips.a, frames_b, pool); });
+    compare_results.push_back(absl::StrCat(
+        "{\"threads\": ", num_threads, ", \"seconds\": ", seconds,
+        ", \"realtime_factor\": ", duration_seconds / seconds, "}"));
+  }
+
+  return absl::StrCat(
+      "{\"duration_seconds\": ", duration_seconds,
+      ", \"sample_rate\": ", clips.sample_rate, ", \"channels\": ",
+      num_channels, ", \"filterbank_seconds\": ", filterbank_seconds,
+      ", \"stage_seconds\": {\"filter_energy\": ", stage_seconds.filter_energy,
+      ", \"db\": ", stage_seconds.db, ", \"masking\": ", stage_seconds.masking,
+      ", \"loudness\": ", stage_seconds.loudness, ", \"dtw\": ",
+      stage_seconds.dtw, ", \"nsim\": ", stage_seconds.nsim,
+      "}, \"compare\": [", absl::StrJoin(compare_results, ", "),
+      "], \"peak_rss_bytes\": ", PeakRSSBytes(), "}");
+}
+
+int Main(int argc, char* argv[]) {
+  absl::ParseCommandLine(argc, argv);
+  const std::vector<size_t> durations =
+      ParseSizes(absl::GetFlag(FLAGS_durations));
+  const std::vector<size_t> sample_rates =
+      ParseSizes(absl::GetFlag(FLAGS_sample_rates));
+  const std::vector<size_t> channels =
+      ParseSizes(absl::GetFlag(FLAGS_channels));
+  const std::vector<size_t> threads = ParseSizes(absl::GetFlag(FLAGS_threads));
+  const size_t repetitions = absl::GetFlag(FLAGS_repetitions);
+  if (repetitions < 1) {
+    std::cerr << "Repetitions must be >= 1." << std::endl;
+    return 1;
+  }
+  const std::string path_a = absl::GetFlag(FLAGS_path_a);
+  const std::string path_b = absl::GetFlag(FLAGS_path_b);
+  if (path_a.empty() != path_b.empty()) {
+    std::cerr << "Either both or none of path_a and path_b have to be "
+                 "specified."
+              << std::endl;
+    return 2;
+  }
+  std::optional<AudioFile> file_a;
+  std::optional<AudioFile> file_b;
+  if (!path_a.empty()) {
+    absl::StatusOr<AudioFile> loaded_a = AudioFile::Load(path_a);
+    if (!loaded_a.ok()) {
+      std::cerr << loaded_a.status().message() << std::endl;
+      return 3;
+    }
+    absl::StatusOr<AudioFile> loaded_b = AudioFile::Load(path_b);
+    if (!loaded_b.ok()) {
+      std::cerr << loaded_b.status().message() << std::endl;
+      return 3;
+    }
+    if (loaded_a->Info().channels != loaded_b->Info().channels ||
+        loaded_a->Info().samplerate != loaded_b->Info().samplerate) {
+      std::cerr << "The files must have the same channels and sample rate."
+                << std::endl;
+      return 4;
+    }
+    file_a.emplace(*std::move(loaded_a));
+    file_b.emplace(*std::move(loaded_b));
+  }
+
+  const Cam cam;
+  std::vector<std::string> cases;
+  for (const size_t duration : durations) {
+    const float duration_seconds = static_cast<float>(duration);
+    if (file_a.has_value()) {
+      const float sample_rate = file_a->SampleRate();
+      const Clips clips = {
+          .sample_rate = sample_rate,
+          .a = Fit(file_a->Frames(), sample_rate, duration_seconds),
+          .b = Fit(file_b->Frames(), sample_rate, duration_seconds)};
+      cases.push_back(
+          RunCase(cam, duration_seconds, clips, threads, repetitions));
+      continue;
+    }
+    for (const size_t sample_rate : sample_rates) {
+      for (const size_t num_channels : channels) {
+        const Clips clips =
+            SyntheticClips(duration_seconds, static_cast<float>(sample_rate),
+                           num_channels);
+        cases.push_back(
+            RunCase(cam, duration_seconds, clips, threads, repetitions));
+      }
+    }
+  }
+  std::cout << "{\"cases\": [" << absl::StrJoin(cases, ",\n  ") << "]}"
+            << std::endl;
+  return 0;
+}
+
+}  // namespace
+
+}  // namespace zimtohrli
+
+int main(int argc, char* argv[]) { return zimtohrli::Main(argc, argv); }
@@ -54,6 +54,7 @@
 #include "zimt/cam.h"
 #include "zimt/elliptic.h"
 #include "zimt/filterbank.h"
+#include "zimt/intensity_pyramid.h"
 #include "zimt/zimtohrli.h"
 
 // This file uses a lot of magic from the SIMD library Highway.
@@ -191,6 +192,7 @@ struct Image {
         size_t channel_index, SpectrogramType spectrogram_type)
       : clamp(clamp),
         intensities(array),
+        pyramid(std::make_unique<IntensityPyramid>(*array)),
         crosshair_manager(crosshair_manager),
         select_manager(select_manager),
         image_type(image_type),
@@ -204,11 +206,23 @@ struct Image {
     render_scale = {
         static_cast<float>(intensities->shape()[0]) / render_size.x,
         static_cast<float>(intensities->shape()[1]) / render_size.y};
+    drawn_pyramid_levels = pyramid->NumReadyLevels();
+    // The [first, end) range of intensities behind render position p along
+    // an axis with size intensities and scale intensities per pixel.
+    const auto covered = [](size_t p, float scale, size_t size) {
+      const size_t first = std::min(size - 1, static_cast<size_t>(scale * p));
+      const size_t end =
+          std::min(size, static_cast<size_t>(std::ceil(scale * (p + 1))));
+      return std::make_pair(first, std::max(first + 1, end));
+    };
     for (size_t render_x = 0; render_x < render_size.x; ++render_x) {
+      const auto [first_step, end_step] =
+          covered(render_x, render_scale.x, intensities->shape()[0]);
       for (size_t render_y = 0; render_y < render_size.y; ++render_y) {
+        const auto [first_channel, end_channel] =
+            covered(render_y, render_scale.y, intensities->shape()[1]);
         uint8_t value = clamp.Uint8(
-            (*intensities)[{static_cast<size_t>(render_scale.x * render_x)}]
-                          [static_cast<size_t>(render_scale.y * render_y)]);
+            pyramid->Max(first_step, end_step, first_channel, end_channel));
         uint8_t* data_ptr =
             pixels.get() +
             (static_cast<size_t>(render_y * render_size.x) + render_x) * 4;
@@ -366,6 +380,9 @@ struct Image {
       render_size = new_render_size_floor;
       RedrawPixels();
       needs_redraw = true;
+    } else if (drawn_pyramid_levels != pyramid->NumReadyLevels()) {
+      RedrawPixels();
+      needs_redraw = true;
     }
     if (needs_redraw) {
       RedrawExtras();
@@ -380,6 +397,13 @@ struct Image {
 
   Clamp clamp;
   hwy::AlignedNDArray<float, 2>* intensities;
+  // Max pyramid of the intensities, to render long arrays at screen
+  // resolution.
+  std::unique_ptr<IntensityPyramid> pyramid;
+  size_t drawn_pyramid_levels = 0;
+  // Time steps per intensity along both axes, for images of arrays that are
+  // downsampled versions of the analysis.
+  size_t steps_per_intensity = 1;
   CrosshairManager crosshair_manager;
   SelectManager select_manager;
   absl::flat_hash_map<std::string, int> vertical_lines;
@@ -509,22 +533,42 @@ struct DTWMouseHighlight {
   float time_b;
 };
 
+// The largest number of time steps along each axis of a DTW image matrix,
+// above which multiple time steps share each element of the matrix.
+constexpr size_t kMaxDTWPixelsSteps = 2048;
+
+// Returns the number of time steps per element of the DTW image matrix of dtw,
+// to keep the matrix of long sounds from growing quadratically.
+size_t DTWStepsPerPixel(const std::vector<std::pair<size_t, size_t>>& dtw) {
+  const size_t max_length =
+      std::max(dtw.back().first - dtw.front().first,
+               dtw.back().second - dtw.front().second) +
+      1;
+  return (max_length + kMaxDTWPixelsSteps - 1) / kMaxDTWPixelsSteps;
+}
+
 // Generates a matrix of pixels for a dynamic time warp output, highlighting the
 // optimal unwarped path between two sequences.
+//
+// Each element of the matrix covers DTWStepsPerPixel(dtw) time steps along
+// both axes.
 hwy::AlignedNDArray<float, 2> DTWPixels(
     const std::vector<std::pair<size_t, size_t>>& dtw) {
+  const size_t steps_per_pixel = DTWStepsPerPixel(dtw);
   const size_t first_a = dtw.front().first;
   const size_t first_b = dtw.front().second;
   const size_t last_a = dtw.back().first;
   const size_t last_b = dtw.back().second;
   hwy::AlignedNDArray<float, 2> pixels(
-      {last_a - first_a + 1, last_b - first_b + 1});
+      {(last_a - first_a) / steps_per_pixel + 1,
+       (last_b - first_b) / steps_per_pixel + 1});
   const size_t min_length = std::min(dtw.back().first, dtw.back().second);
-  for (size_t p = 0; p < min_length; ++p) {
-    pixels[{p}][p] = 0.5f;
+  for (size_t p = 0; p < min_length; p += steps_per_pixel) {
+    pixels[{p / steps_per_pixel}][p / steps_per_pixel] = 0.5f;
   }
   for (const auto& [a, b] : dtw) {
-    pixels[{a - first_a}][b - first_b] = 1.0f;
+    pixels[{(a - first_a) / steps_per_pixel}][(b - first_b) /
+                                              steps_per_pixel] = 1.0f;
   }
   return pixels;
 }
@@ -563,7 +607,13 @@ struct DTWImages {
         spectrogram(&spectrogram_pixels, Clamp(spectrogram_pixels),
                     crosshair_manager, select_manager, ImageTypeDTW,
                     FileTypeDTW, b_index, channel_index,
-                    SpectrogramTypeSpectrogram) {}
+                    SpectrogramTypeSpectrogram) {
+    energy_channels_db.steps_per_intensity =
+        DTWStepsPerPixel(analysis.energy_channels_db);
+    partial_energy_channels_db.steps_per_intensity =
+        DTWStepsPerPixel(analysis.partial_energy_channels_db);
+    spectrogram.steps_per_intensity = DTWStepsPerPixel(analysis.spectrogram);
+  }
   void Paint(ImGuiIO* io, const ImVec2& size) {
     const ImVec2 dtw_size = {size.x / 3, size.y};
     if (ImGui::BeginTable("A", 3)) {
@@ -1238,9 +1288,11 @@ struct RenderContext {
   void ManageDTWCrosshairs(const std::optional<ImVec2>& position,
                            Image& crosshair_image) {
     if (position.has_value()) {
-      const float step_a = position->x * crosshair_image.render_scale.x;
+      const float step_a = position->x * crosshair_image.render_scale.x *
+                           crosshair_image.steps_per_intensity;
       const float time_a = step_a / perceptual_sample_rate;
-      const float step_b = position->y * crosshair_image.render_scale.y;
+      const float step_b = position->y * crosshair_image.render_scale.y *
+                           crosshair_image.steps_per_intensity;
       const float time_b = step_b / perceptual_sample_rate;
       EachSpectrogram([&](SpectrogramImages& image, const Analysis& analysis) {
         if (image.file_type == FileTypeA) {
@@ -18,7 +18,10 @@
 #include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <memory>
+#include <mutex>  // NOLINT
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "absl/log/check.h"
@@ -55,13 +58,15 @@ ViSQOL::ViSQOL() {
 
 ViSQOL::~ViSQOL() { std::filesystem::remove(model_path_); }
 
-absl::StatusOr<float> ViSQOL::MOS(absl::Span<const float> reference,
-                                  absl::Span<const float> degraded,
-                                  float sample_rate) const {
-  std::vector<double> resampled_reference =
-      Resample<double>(reference, sample_rate, SAMPLE_RATE);
-  std::vector<double> resampled_degraded =
-      Resample<double>(degraded, sample_rate, SAMPLE_RATE);
+std::unique_ptr<Visqol::VisqolApi> ViSQOL::AcquireApi() const {
+  {
+    std::lock_guard<std::mutex> lock(apis_mutex_);
+    if (!idle_apis_.empty()) {
+      std::unique_ptr<Visqol::VisqolApi> result = std::move(idle_apis_.back());
+      idle_apis_.pop_back();
+      return result;
+    }
+  }
 
   Visqol::VisqolConfig config;
   config.mutable_options()->set_svr_model_path(model_path_);
@@ -83,14 +88,39 @@ absl::StatusOr<float> ViSQOL::MOS(absl::Span<const float> reference,
   // NSIM score will instead be mapped to a MOS-LQO of ~4.x.
   config.mutable_options()->set_use_unscaled_speech_mos_mapping(false);
 
-  Visqol::VisqolApi visqol;
-  CHECK_OK(visqol.Create(config));
+  auto result = std::make_unique<Visqol::VisqolApi>();
+  CHECK_OK(result->Create(config));
+  return result;
+}
+
+void ViSQOL::ReleaseApi(std::unique_ptr<Visqol::VisqolApi> api) const {
+  std::lock_guard<std::mutex> lock(apis_mutex_);
+  idle_apis_.push_back(std::move(api));
+}
 
+ViSQOL::Reference ViSQOL::PrepareReference(absl::Span<const float> reference,
+                                           float sample_rate) const {
+  Reference result;
+  result.sample_rate_ = sample_rate;
+  result.samples_ = Resample<double>(reference, sample_rate, SAMPLE_RATE);
+  return result;
+}
+
+absl::StatusOr<float> ViSQOL::MOS(const Reference& reference,
+                                  absl::Span<const float> degraded) const {
+  // Measure takes mutable spans, so each call gets its own copy of the
+  // reference.
+  std::vector<double> resampled_reference = reference.samples_;
+  std::vector<double> resampled_degraded =
+      Resample<double>(degraded, reference.sample_rate_, SAMPLE_RATE);
+
+  std::unique_ptr<Visqol::VisqolApi> visqol = AcquireApi();
   absl::StatusOr<Visqol::SimilarityResultMsg> comparison_status_or =
-      visqol.Measure(absl::Span<double>(resampled_reference.data(),
-                                        resampled_reference.size()),
-                     absl::Span<double>(resampled_degraded.data(),
-                                        resampled_degraded.size()));
+      visqol->Measure(absl::Span<double>(resampled_reference.data(),
+                                         resampled_reference.size()),
+                      absl::Span<double>(resampled_degraded.data(),
+                                         resampled_degraded.size()));
+  ReleaseApi(std::move(visqol));
   if (!comparison_status_or.ok()) {
     return absl::Status(comparison_status_or.status().code(),
                         "when calling visqol.Measure");
@@ -101,4 +131,10 @@ absl::StatusOr<float> ViSQOL::MOS(absl::Span<const float> reference,
   return similarity_result.moslqo();
 }
 
+absl::StatusOr<float> ViSQOL::MOS(absl::Span<const float> reference,
+                                  absl::Span<const float> degraded,
+                                  float sample_rate) const {
+  return MOS(PrepareReference(reference, sample_rate), degraded);
+}
+
 }  // namespace zimtohrli
\ No newline at end of file
@@ -16,22 +16,66 @@
 #define CPP_ZIMT_VISQOL_H_
 
 #include <filesystem>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <vector>
 
 #include "absl/status/statusor.h"
 #include "absl/types/span.h"
 
+namespace Visqol {
+class VisqolApi;
+}  // namespace Visqol
+
 namespace zimtohrli {
 
+// Adapter computing ViSQOL MOS scores.
+//
+// Keeps the initialized ViSQOL instances between calls, so that the SVR model
+// is loaded once per concurrent caller instead of once per score. Safe for
+// concurrent use.
 class ViSQOL {
  public:
+  // A reference signal resampled to the ViSQOL sample rate, for scoring many
+  // degraded signals against the same reference.
+  class Reference {
+   public:
+    // Returns the sample rate of the signals this reference is compared to.
+    float sample_rate() const { return sample_rate_; }
+
+   private:
+    friend class ViSQOL;
+    float sample_rate_ = 0;
+    std::vector<double> samples_;
+  };
+
   ViSQOL();
   ~ViSQOL();
+
+  // Returns reference resampled for MOS.
+  Reference PrepareReference(absl::Span<const float> reference,
+                             float sample_rate) const;
+
+  // Returns the MOS of degraded compared to reference.
+  //
+  // degraded must have the sample rate reference was prepared with.
+  absl::StatusOr<float> MOS(const Reference& reference,
+                            absl::Span<const float> degraded) const;
+
+  // Returns the MOS of degraded compared to reference.
   absl::StatusOr<float> MOS(absl::Span<const float> reference,
                             absl::Span<const float> degraded,
                             float sample_rate) const;
 
  private:
+  // Returns an idle ViSQOL instance, creating one if all are busy.
+  std::unique_ptr<Visqol::VisqolApi> AcquireApi() const;
+  // Returns api to the idle instances.
+  void ReleaseApi(std::unique_ptr<Visqol::VisqolApi> api) const;
+
   std::filesystem::path model_path_;
+  mutable std::mutex apis_mutex_;
+  mutable std::vector<std::unique_ptr<Visqol::VisqolApi>> idle_apis_;
 };
 
 }  // namespace zimtohrli
@@ -15,9 +15,12 @@
 #include "zimt/zimtohrli.h"
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <limits>
+#include <memory>
 #include <optional>
 #include <utility>
 #include <vector>
@@ -29,6 +32,8 @@
 #include "zimt/filterbank.h"
 #include "zimt/masking.h"
 #include "zimt/nsim.h"
+#include "zimt/stats.h"
+#include "zimt/thread_pool.h"
 
 // This file uses a lot of magic from the SIMD library Highway.
 // In simplified terms, it will compile the code for multiple architectures
@@ -44,6 +49,7 @@
 // Must come after foreach_target.h to avoid redefinition errors.
 #include "hwy/contrib/math/math-inl.h"
 #include "hwy/highway.h"
+#include "zimt/fast_math-inl.h"
 
 // This is Highway magic conventions.
 HWY_BEFORE_NAMESPACE();
@@ -73,21 +79,25 @@ void HwyAbsDiff(const hwy::AlignedNDArray<float, 2>& array_a,
 // y = 10^(db / 20)
 // ln(y) = db/20 * ln(10)
 // y = e^(db/20 * ln(10))
+template <bool fast_math>
 Vec LinearAmplitudeFromDb(const Vec& db, const Vec& log_10_div_20) {
-  return Exp(d, Mul(db, log_10_div_20));
+  return ExpOf<fast_math>(d, Mul(db, log_10_div_20));
 }
 
 // Returns 20 * log10(linear_amplitude + epsilon).
+template <bool fast_math>
 Vec DbFromLinearAmplitude(const Vec& linear_amplitude, const Vec& epsilon_vec,
                           const Vec& twenty_vec) {
-  return Mul(twenty_vec, Log10(d, Add(linear_amplitude, epsilon_vec)));
+  return Mul(twenty_vec,
+             Log10Of<fast_math>(d, Add(linear_amplitude, epsilon_vec)));
 }
 
-void HwySubtractDb(const Zimtohrli& z,
-                   const hwy::AlignedNDArray<float, 2>& array_a,
-                   const hwy::AlignedNDArray<float, 2>& array_b,
-                   hwy::AlignedNDArray<float, 2>& result,
-                   const std::vector<std::pair<size_t, size_t>>& time_pairs) {
+template <bool fast_math>
+void SubtractDb(const Zimtohrli& z,
+                const hwy::AlignedNDArray<float, 2>& array_a,
+                const hwy::AlignedNDArray<float, 2>& array_b,
+                hwy::AlignedNDArray<float, 2>& result,
+                const std::vector<std::pair<size_t, size_t>>& time_pairs) {
   const Vec log_10_div_20 = Set(d, log(10) / 20);
   const Vec twenty_vec = Set(d, 20);
   const size_t num_channels = array_a.shape()[1];
@@ -95,79 +105,177 @@ void HwySubtractDb(const Zimtohrli& z,
   for (const auto& sample_pair : time_pairs) {
     for (size_t channel_index = 0; channel_index < num_channels;
          channel_index += Lanes(d)) {
-      const Vec array_a_linear_amplitude = LinearAmplitudeFromDb(
+      const Vec array_a_linear_amplitude = LinearAmplitudeFromDb<fast_math>(
           Load(d, array_a[{sample_pair.first}].data() + channel_index),
           log_10_div_20);
-      const Vec array_b_linear_amplitude = LinearAmplitudeFromDb(
+      const Vec array_b_linear_amplitude = LinearAmplitudeFromDb<fast_math>(
           Load(d, array_b[{sample_pair.second}].data() + channel_index),
           log_10_div_20);
       const Vec noise_linear_amplitude =
           AbsDiff(array_a_linear_amplitude, array_b_linear_amplitude);
-      Store(DbFromLinearAmplitude(noise_linear_amplitude, epsilon_vec,
-                                  twenty_vec),
+      Store(DbFromLinearAmplitude<fast_math>(noise_linear_amplitude,
+                                             epsilon_vec, twenty_vec),
             d, result[{sample_pair.first}].data() + channel_index);
     }
   }
 }
 
+// Populates delta with frames_a - frames_b for the blocks of block_size
+// samples matched by time_pairs, where the delta of each block is at the
+// offset of the block in frames_a.
+void HwyFramesDelta(const float* frames_a, const float* frames_b,
+                    const std::vector<std::pair<size_t, size_t>>& time_pairs,
+                    size_t block_size, float* delta) {
+  for (const auto& block_pair : time_pairs) {
+    const float* block_a = frames_a + block_pair.first * block_size;
+    const float* block_b = frames_b + block_pair.second * block_size;
+    float* block_delta = delta + block_pair.first * block_size;
+    size_t index = 0;
+    for (; index + Lanes(d) <= block_size; index += Lanes(d)) {
+      StoreU(Sub(LoadU(d, block_a + index), LoadU(d, block_b + index)), d,
+             block_delta + index);
+    }
+    if (index < block_size) {
+      const size_t remaining = block_size - index;
+      StoreN(Sub(LoadN(d, block_a + index, remaining),
+                 LoadN(d, block_b + index, remaining)),
+             d, block_delta + index, remaining);
+    }
+  }
+}
+
+void HwySubtractDb(const Zimtohrli& z,
+                   const hwy::AlignedNDArray<float, 2>& array_a,
+                   const hwy::AlignedNDArray<float, 2>& array_b,
+                   hwy::AlignedNDArray<float, 2>& result,
+                   const std::vector<std::pair<size_t, size_t>>& time_pairs) {
+  if (z.fast_math) {
+    SubtractDb<true>(z, array_a, array_b, result, time_pairs);
+  } else {
+    SubtractDb<false>(z, array_a, array_b, result, time_pairs);
+  }
+}
+
+const hwy::HWY_NAMESPACE::RebindToSigned<decltype(d)> di;
+using VecI = hwy::HWY_NAMESPACE::Vec<decltype(di)>;
+
+// Updates the per lane maxima in max with vec, and the positions in max_index
+// where they occurred with index, which holds the lane positions of vec.
+//
+// Ties keep the earlier position, like a serial scan.
+void UpdateArgMax(const Vec& vec, const VecI& index, Vec& max,
+                  VecI& max_index) {
+  const auto greater = Gt(vec, max);
+  max = IfThenElse(greater, vec, max);
+  max_index = IfThenElse(RebindMask(di, greater), index, max_index);
+}
+
+// Returns the maximum of all lanes of max, and the first of the positions in
+// max_index where it occurred, if the maximum is greater than zero.
+std::optional<std::pair<float, size_t>> ReduceArgMax(const Vec& max,
+                                                     const VecI& max_index) {
+  HWY_ALIGN float max_values[MaxLanes(d)];
+  HWY_ALIGN int32_t max_indices[MaxLanes(di)];
+  Store(max, d, max_values);
+  Store(max_index, di, max_indices);
+  std::optional<std::pair<float, size_t>> result;
+  for (size_t lane = 0; lane < Lanes(d); ++lane) {
+    const std::pair<float, size_t> lane_max = {
+        max_values[lane], static_cast<size_t>(max_indices[lane])};
+    if (lane_max.first <= 0) {
+      continue;
+    }
+    if (!result.has_value() || lane_max.first > result->first ||
+        (lane_max.first == result->first && lane_max.second < result->second)) {
+      result = lane_max;
+    }
+  }
+  return result;
+}
+
+// Populates the max_absolute_delta and max_relative_delta of result.
+//
+// Keeps per lane maxima through the loop, and only reduces them to the
+// position of the maximum at the end.
+template <bool fast_math>
+void FindMaxDeltas(const Zimtohrli& z,
+                   const hwy::AlignedNDArray<float, 2>& spectrogram_a,
+                   const hwy::AlignedNDArray<float, 2>& spectrogram_b,
+                   const std::vector<std::pair<size_t, size_t>>& time_pairs,
+                   Distance& result) {
+  const Vec log_10_div_20 = Set(d, log(10) / 20);
+  const Vec twenty_vec = Set(d, 20);
+  const size_t num_channels = spectrogram_a.shape()[1];
+  const Vec epsilon_vec = Set(d, z.epsilon);
+  // Positions count the lanes visited, so each time pair spans a stride of
+  // the channels rounded up to whole vectors.
+  const size_t stride = hwy::RoundUpTo(num_channels, Lanes(d));
+  CHECK_LE(time_pairs.size() * stride,
+           static_cast<size_t>(std::numeric_limits<int32_t>::max()));
+  const VecI lanes_vec = Set(di, static_cast<int32_t>(Lanes(d)));
+  VecI index_vec = Iota(di, 0);
+  Vec absolute_max = Zero(d);
+  VecI absolute_max_index = Zero(di);
+  Vec relative_max = Zero(d);
+  VecI relative_max_index = Zero(di);
+  for (size_t time_index = 0; time_index < time_pairs.size(); ++time_index) {
+    const std::pair<size_t, size_t> t = time_pairs[time_index];
+    for (size_t channel_index = 0; channel_index < num_channels;
+         channel_index += Lanes(d)) {
+      const Vec spec_a_db =
+          Load(d, spectrogram_a[{t.first}].data() + channel_index);
+      const Vec spec_b_db =
+          Load(d, spectrogram_b[{t.second}].data() + channel_index);
+      const Vec spec_a_linear_amplitude =
+          LinearAmplitudeFromDb<fast_math>(spec_a_db, log_10_div_20);
+      const Vec spec_b_linear_amplitude =
+          LinearAmplitudeFromDb<fast_math>(spec_b_db, log_10_div_20);
+      const Vec noise_linear_amplitude =
+          AbsDiff(spec_a_linear_amplitude, spec_b_linear_amplitude);
+      UpdateArgMax(DbFromLinearAmplitude<fast_math>(
+                       noise_linear_amplitude, epsilon_vec, twenty_vec),
+                   index_vec, absolute_max, absolute_max_index);
+      UpdateArgMax(AbsDiff(spec_a_db, spec_b_db), index_vec, relative_max,
+                   relative_max_index);
+      index_vec = Add(index_vec, lanes_vec);
+    }
+  }
+  const auto populate = [&](const std::optional<std::pair<float, size_t>>& max,
+                            SpectrogramDelta& target) {
+    if (!max.has_value()) {
+      return;
+    }
+    const std::pair<size_t, size_t> t = time_pairs[max->second / stride];
+    const size_t channel_index = max->second % stride;
+    target = {.value = max->first,
+              .spectrogram_a_value = spectrogram_a[{t.first}][channel_index],
+              .spectrogram_b_value = spectrogram_b[{t.second}][channel_index],
+              .sample_a_index = t.first,
+              .sample_b_index = t.second,
+              .channel_index = channel_index};
+  };
+  populate(ReduceArgMax(absolute_max, absolute_max_index),
+           result.max_absolute_delta);
+  populate(ReduceArgMax(relative_max, relative_max_index),
+           result.max_relative_delta);
+}
+
 template <bool verbose>
 Distance HwyDistance(const Zimtohrli& z,
                      const hwy::AlignedNDArray<float, 2>& spectrogram_a,
                      const hwy::AlignedNDArray<float, 2>& spectrogram_b,
-                     const std::vector<std::pair<size_t, size_t>>& time_pairs) {
+                     const std::vector<std::pair<size_t, size_t>>& time_pairs,
+                     StreamingNSIM& nsim) {
   // Since NSIM is a similarity measure, where 1.0 is "perfectly similar", we
   // subtract it from 1.0 to get a distance metric instead.
   Distance result{
-      .value = 1.0f -
-               NSIM(spectrogram_a, spectrogram_b, time_pairs,
-                    std::min(spectrogram_a.shape()[0], z.nsim_step_window),
-                    std::min(spectrogram_a.shape()[1], z.nsim_channel_window))};
+      .value = 1.0f - NSIM(spectrogram_a, spectrogram_b, time_pairs, nsim)};
   if constexpr (verbose) {
-    const Vec log_10_div_20 = Set(d, log(10) / 20);
-    const Vec twenty_vec = Set(d, 20);
-    const size_t num_channels = spectrogram_a.shape()[1];
-    const Vec epsilon_vec = Set(d, z.epsilon);
-    for (size_t time_index = 0; time_index < time_pairs.size(); ++time_index) {
-      const std::pair<size_t, size_t> t = time_pairs[time_index];
-      for (size_t channel_index = 0; channel_index < num_channels;
-           channel_index += Lanes(d)) {
-        const Vec spec_a_db =
-            Load(d, spectrogram_a[{t.first}].data() + channel_index);
-        const Vec spec_b_db =
-            Load(d, spectrogram_b[{t.second}].data() + channel_index);
-        const auto manage_local_maximum = [&](const Vec& vec,
-                                              SpectrogramDelta& target) {
-          if (ReduceMax(d, vec) > target.value) {
-            hwy::AlignedNDArray<float, 1> lane_values({Lanes(d)});
-            Store(vec, d, lane_values.data());
-            for (size_t index = 0; index < Lanes(d); ++index) {
-              if (lane_values[{}][index] > target.value) {
-                const size_t local_channel_index = channel_index + index;
-                target.value = lane_values[{}][index];
-                target.spectrogram_a_value =
-                    spectrogram_a[{t.first}][local_channel_index];
-                target.spectrogram_b_value =
-                    spectrogram_b[{t.second}][local_channel_index];
-                target.sample_a_index = t.first;
-                target.sample_b_index = t.second;
-                target.channel_index = local_channel_index;
-              }
-            }
-          }
-        };
-
-        const Vec spec_a_linear_amplitude =
-            LinearAmplitudeFromDb(spec_a_db, log_10_div_20);
-        const Vec spec_b_linear_amplitude =
-            LinearAmplitudeFromDb(spec_b_db, log_10_div_20);
-        const Vec noise_linear_amplitude =
-            AbsDiff(spec_a_linear_amplitude, spec_b_linear_amplitude);
-        const Vec noise_db_vec = DbFromLinearAmplitude(noise_linear_amplitude,
-                                                       epsilon_vec, twenty_vec);
-        manage_local_maximum(noise_db_vec, result.max_absolute_delta);
-        const Vec delta_db_vec = AbsDiff(spec_a_db, spec_b_db);
-        manage_local_maximum(delta_db_vec, result.max_relative_delta);
-      }
+    if (z.fast_math) {
+      FindMaxDeltas<true>(z, spectrogram_a, spectrogram_b, time_pairs, result);
+    } else {
+      FindMaxDeltas<false>(z, spectrogram_a, spectrogram_b, time_pairs,
+                           result);
     }
   }
   return result;
@@ -176,53 +284,105 @@ Distance HwyDistance(const Zimtohrli& z,
 Distance HwyDistanceVerbose(
     const Zimtohrli& z, const hwy::AlignedNDArray<float, 2>& spectrogram_a,
     const hwy::AlignedNDArray<float, 2>& spectrogram_b,
-    const std::vector<std::pair<size_t, size_t>>& time_pairs) {
-  return HwyDistance<true>(z, spectrogram_a, spectrogram_b, time_pairs);
+    const std::vector<std::pair<size_t, size_t>>& time_pairs,
+    StreamingNSIM& nsim) {
+  return HwyDistance<true>(z, spectrogram_a, spectrogram_b, time_pairs, nsim);
 }
 
 Distance HwyDistanceFast(
     const Zimtohrli& z, const hwy::AlignedNDArray<float, 2>& spectrogram_a,
     const hwy::AlignedNDArray<float, 2>& spectrogram_b,
-    const std::vector<std::pair<size_t, size_t>>& time_pairs) {
-  return HwyDistance<false>(z, spectrogram_a, spectrogram_b, time_pairs);
+    const std::vector<std::pair<size_t, size_t>>& time_pairs,
+    StreamingNSIM& nsim) {
+  return HwyDistance<false>(z, spectrogram_a, spectrogram_b, time_pairs, nsim);
 }
 
 EnergyAndMaxAbsAmplitude HwyMeasure(hwy::Span<const float> signal) {
   const size_t signal_samples = signal.size();
   const float* signal_data = signal.data();
-  float signal_max = 0;
-  float signal_energy = 0;
-  for (size_t index = 0; index < signal_samples; index += Lanes(d)) {
-    const Vec amplitude = Load(d, signal_data + index);
-    signal_energy += ReduceSum(d, Mul(amplitude, amplitude));
-    signal_max = std::max(signal_max, ReduceMax(d, Abs(amplitude)));
+  Vec energy = Zero(d);
+  Vec max_abs = Zero(d);
+  size_t index = 0;
+  for (; index + Lanes(d) <= signal_samples; index += Lanes(d)) {
+    const Vec amplitude = LoadU(d, signal_data + index);
+    energy = MulAdd(amplitude, amplitude, energy);
+    max_abs = Max(max_abs, Abs(amplitude));
   }
-  return {.energy_db_fs = 20 * std::log10(signal_energy /
+  if (index < signal_samples) {
+    // LoadN zeroes the lanes past the end, which don't affect either sum.
+    const Vec amplitude =
+        LoadN(d, signal_data + index, signal_samples - index);
+    energy = MulAdd(amplitude, amplitude, energy);
+    max_abs = Max(max_abs, Abs(amplitude));
+  }
+  return {.energy_db_fs = 20 * std::log10(ReduceSum(d, energy) /
                                           static_cast<float>(signal_samples)),
-          .max_abs_amplitude = signal_max};
+          .max_abs_amplitude = ReduceMax(d, max_abs)};
 }
 
 EnergyAndMaxAbsAmplitude HwyNormalizeAmplitude(float max_abs_amplitude,
                                                hwy::Span<float> signal) {
   const size_t signal_samples = signal.size();
   float* signal_data = signal.data();
-  float signal_max = 0;
-  float signal_energy = 0;
-  for (size_t index = 0; index < signal_samples; index += Lanes(d)) {
-    signal_max =
-        std::max(signal_max, ReduceMax(d, Abs(Load(d, signal_data + index))));
-  }
-  const Vec scaling = Set(d, max_abs_amplitude / signal_max);
-  for (size_t index = 0; index < signal_samples; index += Lanes(d)) {
-    const Vec new_amplitude = Mul(scaling, Load(d, signal_data + index));
-    signal_energy += ReduceSum(d, new_amplitude * new_amplitude);
-    Store(new_amplitude, d, signal_data + index);
+  const size_t vector_samples = signal_samples - signal_samples % Lanes(d);
+  Vec max_abs = Zero(d);
+  for (size_t index = 0; index < vector_samples; index += Lanes(d)) {
+    max_abs = Max(max_abs, Abs(LoadU(d, signal_data + index)));
+  }
+  if (vector_samples < signal_samples) {
+    max_abs = Max(max_abs, Abs(LoadN(d, signal_data + vector_samples,
+                                     signal_samples - vector_samples)));
+  }
+  const float scale = max_abs_amplitude / ReduceMax(d, max_abs);
+  const Vec scaling = Set(d, scale);
+  Vec energy = Zero(d);
+  for (size_t index = 0; index < vector_samples; index += Lanes(d)) {
+    const Vec new_amplitude = Mul(scaling, LoadU(d, signal_data + index));
+    energy = MulAdd(new_amplitude, new_amplitude, energy);
+    StoreU(new_amplitude, d, signal_data + index);
+  }
+  float signal_energy = ReduceSum(d, energy);
+  for (size_t index = vector_samples; index < signal_samples; ++index) {
+    signal_data[index] *= scale;
+    signal_energy += signal_data[index] * signal_data[index];
   }
   return {.energy_db_fs = 20 * std::log10(signal_energy /
                                           static_cast<float>(signal_samples)),
           .max_abs_amplitude = max_abs_amplitude};
 }
 
+void HwyCompact(const hwy::AlignedNDArray<float, 2>& spectrogram,
+                hwy::AlignedNDArray<hwy::float16_t, 2>& compact_spectrogram) {
+  const hwy::HWY_NAMESPACE::Rebind<hwy::float16_t, decltype(d)> d16;
+  for (size_t step_index = 0; step_index < spectrogram.shape()[0];
+       ++step_index) {
+    const float* row = spectrogram[{step_index}].data();
+    hwy::float16_t* compact_row = compact_spectrogram[{step_index}].data();
+    for (size_t channel_index = 0; channel_index < spectrogram.shape()[1];
+         channel_index += Lanes(d)) {
+      Store(DemoteTo(d16, Load(d, row + channel_index)), d16,
+            compact_row + channel_index);
+    }
+  }
+}
+
+void HwyWidenSpectrogram(
+    const hwy::AlignedNDArray<hwy::float16_t, 2>& compact_spectrogram,
+    hwy::AlignedNDArray<float, 2>& spectrogram) {
+  const hwy::HWY_NAMESPACE::Rebind<hwy::float16_t, decltype(d)> d16;
+  for (size_t step_index = 0; step_index < spectrogram.shape()[0];
+       ++step_index) {
+    const hwy::float16_t* compact_row =
+        compact_spectrogram[{step_index}].data();
+    float* row = spectrogram[{step_index}].data();
+    for (size_t channel_index = 0; channel_index < spectrogram.shape()[1];
+         channel_index += Lanes(d)) {
+      Store(PromoteTo(d, Load(d16, compact_row + channel_index)), d,
+            row + channel_index);
+    }
+  }
+}
+
 }  // namespace HWY_NAMESPACE
 
 }  // namespace zimtohrli
@@ -237,35 +397,325 @@ HWY_EXPORT(HwyMeasure);
 HWY_EXPORT(HwyDistanceVerbose);
 HWY_EXPORT(HwyDistanceFast);
 HWY_EXPORT(HwyAbsDiff);
+HWY_EXPORT(HwyFramesDelta);
 HWY_EXPORT(HwySubtractDb);
+HWY_EXPORT(HwyCompact);
+HWY_EXPORT(HwyWidenSpectrogram);
 
-Distance Zimtohrli::Distance(
-    bool verbose, const hwy::AlignedNDArray<float, 2>& spectrogram_a,
-    const hwy::AlignedNDArray<float, 2>& spectrogram_b) const {
-  if (unwarp_window_seconds == 0) {
+namespace {
+
+// Populates time_pairs with the time steps of spectrogram_a and spectrogram_b
+// that Distance compares.
+void PopulateTimePairs(const Zimtohrli& z,
+                       const hwy::AlignedNDArray<float, 2>& spectrogram_a,
+                       const hwy::AlignedNDArray<float, 2>& spectrogram_b,
+                       DTWWorkspace& workspace,
+                       std::vector<std::pair<size_t, size_t>>& time_pairs) {
+  if (z.unwarp_window_seconds == 0) {
     CHECK_EQ(spectrogram_a.shape()[0], spectrogram_b.shape()[0]);
   }
   CHECK_EQ(spectrogram_a.shape()[1], spectrogram_b.shape()[1]);
-  std::vector<std::pair<size_t, size_t>> time_pairs;
-  if (unwarp_window_seconds != 0) {
-    time_pairs = ChainDTW(spectrogram_a, spectrogram_b,
-                          static_cast<size_t>(unwarp_window_seconds *
-                                              cam_filterbank->sample_rate));
+  if (z.unwarp_window_seconds != 0) {
+    ZIMTOHRLI_STAGE_TIMER(z.stats.get(), dtw, spectrogram_a.shape()[0]);
+    const auto [window_size, warp_radius] = z.DTWWindowAndRadius();
+    workspace.num_cells = 0;
+    if (const size_t corridor_radius = z.DTWCorridorRadius();
+        corridor_radius != 0) {
+      CoarseToFineChainDTW(spectrogram_a, spectrogram_b, window_size,
+                           warp_radius, corridor_radius, workspace,
+                           time_pairs);
+    } else {
+      ChainDTW(spectrogram_a, spectrogram_b, window_size, warp_radius,
+               workspace, time_pairs);
+    }
+    ZIMTOHRLI_STATS_ADD(z.stats.get(), dtw_cells, workspace.num_cells);
   } else {
-    time_pairs.reserve(spectrogram_a.shape()[0]);
+    time_pairs.clear();
     for (size_t index = 0; index < spectrogram_a.shape()[0]; ++index) {
       time_pairs.push_back({index, index});
     }
   }
+}
+
+// Makes nsim hold a StreamingNSIM with the windows Distance uses for
+// spectrograms like spectrogram_a, only constructing a new one if it doesn't
+// already.
+StreamingNSIM& PrepareNSIM(const Zimtohrli& z,
+                           const hwy::AlignedNDArray<float, 2>& spectrogram_a,
+                           std::optional<StreamingNSIM>& nsim) {
+  const size_t num_channels = spectrogram_a.shape()[1];
+  const size_t step_window =
+      std::min(spectrogram_a.shape()[0], z.nsim_step_window);
+  const size_t channel_window = std::min(num_channels, z.nsim_channel_window);
+  if (!nsim.has_value() || nsim->NumChannels() != num_channels ||
+      nsim->StepWindow() != step_window ||
+      nsim->ChannelWindow() != channel_window) {
+    nsim.emplace(num_channels, step_window, channel_window);
+  }
+  return *nsim;
+}
+
+// The slack DistanceBelow leaves for float rounding of the NSIM, which can
+// make the NSIM of a channel of a step marginally exceed [-1, 1].
+constexpr double kDistanceBoundMargin = 1e-4;
+
+// Returns whether the distance of all steps will be below threshold, or
+// nullopt if that isn't known yet, given the steps added to nsim so far and
+// that there will be at most max_steps steps in total.
+std::optional<bool> BoundDistanceBelow(const StreamingNSIM& nsim,
+                                       size_t max_steps, float threshold) {
+  const double num_channels = static_cast<double>(nsim.NumChannels());
+  // Sum of (1 - NSIM) over each channel of each step added so far.
+  const double dissimilarity =
+      static_cast<double>(nsim.NumSteps()) * num_channels - nsim.Sum();
+  const double max_values = static_cast<double>(max_steps) * num_channels;
+  // The remaining steps add between 0 and 2 dissimilarity per channel, and
+  // both bounds grow with the number of steps, so they are largest with
+  // max_steps steps.
+  const double min_distance = dissimilarity / max_values;
+  const double max_distance =
+      (dissimilarity +
+       2.0 * static_cast<double>(max_steps - nsim.NumSteps()) * num_channels) /
+      max_values;
+  if (min_distance >= threshold + kDistanceBoundMargin) {
+    return false;
+  }
+  if (max_distance < threshold - kDistanceBoundMargin) {
+    return true;
+  }
+  return std::nullopt;
+}
+
+}  // namespace
+
+Zimtohrli Zimtohrli::WithFilterbank(CamFilterbank filterbank) const {
+  Zimtohrli result{
+      .perceptual_sample_rate = perceptual_sample_rate,
+      .cam_filterbank = std::move(filterbank),
+      .nsim_step_window = nsim_step_window,
+      .nsim_channel_window = nsim_channel_window,
+      .unwarp_window_seconds = unwarp_window_seconds,
+      .unwarp_radius_seconds = unwarp_radius_seconds,
+      .unwarp_corridor_seconds = unwarp_corridor_seconds,
+      .share_dtw = share_dtw,
+      .full_scale_sine_db = full_scale_sine_db,
+      .epsilon = epsilon,
+      .masking = masking,
+      .loudness = loudness,
+      .apply_masking = apply_masking,
+      .apply_loudness = apply_loudness,
+      .fast_math = fast_math,
+      .stats = stats,
+  };
+  if (decimated_filterbank != nullptr) {
+    result.decimated_filterbank = std::make_shared<const DecimatedFilterbank>(
+        *result.cam_filterbank, decimated_filterbank->MaxDecimation());
+  }
+  return result;
+}
+
+Distance Zimtohrli::Distance(
+    bool verbose, const hwy::AlignedNDArray<float, 2>& spectrogram_a,
+    const hwy::AlignedNDArray<float, 2>& spectrogram_b) const {
+  return Distance(verbose, spectrogram_a, spectrogram_b,
+                  TimePairs(spectrogram_a, spectrogram_b));
+}
+
+Distance Zimtohrli::Distance(
+    bool verbose, const hwy::AlignedNDArray<float, 2>& spectrogram_a,
+    const hwy::AlignedNDArray<float, 2>& spectrogram_b,
+    const std::vector<std::pair<size_t, size_t>>& time_pairs) const {
+  CHECK_EQ(spectrogram_a.shape()[1], spectrogram_b.shape()[1]);
+  std::optional<StreamingNSIM> nsim;
+  PrepareNSIM(*this, spectrogram_a, nsim);
+  ZIMTOHRLI_STAGE_TIMER(stats.get(), nsim, time_pairs.size());
+  if (verbose) {
+    return HWY_DYNAMIC_DISPATCH(HwyDistanceVerbose)(
+        *this, spectrogram_a, spectrogram_b, time_pairs, *nsim);
+  } else {
+    return HWY_DYNAMIC_DISPATCH(HwyDistanceFast)(
+        *this, spectrogram_a, spectrogram_b, time_pairs, *nsim);
+  }
+}
+
+Distance Zimtohrli::Distance(bool verbose,
+                             const hwy::AlignedNDArray<float, 2>& spectrogram_a,
+                             const hwy::AlignedNDArray<float, 2>& spectrogram_b,
+                             ZimtohrliWorkspace& workspace) const {
+  PopulateTimePairs(*this, spectrogram_a, spectrogram_b, workspace.dtw,
+                    workspace.time_pairs);
+  StreamingNSIM& nsim = PrepareNSIM(*this, spectrogram_a, workspace.nsim);
+  ZIMTOHRLI_STAGE_TIMER(stats.get(), nsim, workspace.time_pairs.size());
   if (verbose) {
-    return HWY_DYNAMIC_DISPATCH(HwyDistanceVerbose)(*this, spectrogram_a,
-                                                    spectrogram_b, time_pairs);
+    return HWY_DYNAMIC_DISPATCH(HwyDistanceVerbose)(
+        *this, spectrogram_a, spectrogram_b, workspace.time_pairs, nsim);
   } else {
-    return HWY_DYNAMIC_DISPATCH(HwyDistanceFast)(*this, spectrogram_a,
-                                                 spectrogram_b, time_pairs);
+    return HWY_DYNAMIC_DISPATCH(HwyDistanceFast)(
+        *this, spectrogram_a, spectrogram_b, workspace.time_pairs, nsim);
   }
 }
 
+float Zimtohrli::Distance(hwy::Span<const float> signal_a,
+                          hwy::Span<const float> signal_b,
+                          ZimtohrliWorkspace& workspace) const {
+  Analyze(signal_a, workspace, workspace.analysis_a);
+  Analyze(signal_b, workspace, workspace.analysis_b);
+  return Distance(false, workspace.analysis_a->spectrogram,
+                  workspace.analysis_b->spectrogram, workspace)
+      .value;
+}
+
+bool Zimtohrli::DistanceBelow(
+    const hwy::AlignedNDArray<float, 2>& spectrogram_a,
+    const hwy::AlignedNDArray<float, 2>& spectrogram_b, float threshold) const {
+  ZimtohrliWorkspace workspace;
+  return DistanceBelow(spectrogram_a, spectrogram_b, threshold, workspace);
+}
+
+bool Zimtohrli::DistanceBelow(
+    const hwy::AlignedNDArray<float, 2>& spectrogram_a,
+    const hwy::AlignedNDArray<float, 2>& spectrogram_b, float threshold,
+    ZimtohrliWorkspace& workspace) const {
+  CHECK_EQ(spectrogram_a.shape()[1], spectrogram_b.shape()[1]);
+  StreamingNSIM& nsim = PrepareNSIM(*this, spectrogram_a, workspace.nsim);
+  nsim.Reset();
+  std::vector<std::pair<size_t, size_t>>& time_pairs = workspace.time_pairs;
+  time_pairs.clear();
+  std::optional<ChainDTWIterator> dtw;
+  if (unwarp_window_seconds == 0) {
+    CHECK_EQ(spectrogram_a.shape()[0], spectrogram_b.shape()[0]);
+    for (size_t index = 0; index < spectrogram_a.shape()[0]; ++index) {
+      time_pairs.push_back({index, index});
+    }
+  } else {
+    const std::pair<size_t, size_t> window_and_radius = DTWWindowAndRadius();
+    if (const size_t corridor_radius = DTWCorridorRadius();
+        corridor_radius != 0) {
+      ZIMTOHRLI_STAGE_TIMER(stats.get(), dtw, 0);
+      workspace.dtw.num_cells = 0;
+      CoarseToFineCorridor(spectrogram_a, spectrogram_b,
+                           window_and_radius.first, window_and_radius.second,
+                           corridor_radius, workspace.dtw);
+      ZIMTOHRLI_STATS_ADD(stats.get(), dtw_cells, workspace.dtw.num_cells);
+      dtw.emplace(spectrogram_a, spectrogram_b, window_and_radius.first,
+                  window_and_radius.second, workspace.dtw.corridor,
+                  workspace.dtw);
+    } else {
+      dtw.emplace(spectrogram_a, spectrogram_b, window_and_radius.first,
+                  window_and_radius.second, workspace.dtw);
+    }
+    time_pairs.push_back({0, 0});
+  }
+  // A dynamic time warp has at most one step per step of either
+  // spectrogram, minus the shared first step.
+  const size_t max_dtw_steps =
+      spectrogram_a.shape()[0] + spectrogram_b.shape()[0] - 1;
+  size_t num_added = 0;
+  while (true) {
+    const bool all_pairs_known = !dtw.has_value() || dtw->Done();
+    const size_t max_steps =
+        all_pairs_known ? time_pairs.size() : max_dtw_steps;
+    {
+      ZIMTOHRLI_STAGE_TIMER(stats.get(), nsim, time_pairs.size() - num_added);
+      for (; num_added < time_pairs.size(); ++num_added) {
+        nsim.AddStep(spectrogram_a[{time_pairs[num_added].first}],
+                     spectrogram_b[{time_pairs[num_added].second}]);
+        const std::optional<bool> below =
+            BoundDistanceBelow(nsim, max_steps, threshold);
+        if (below.has_value()) {
+          return *below;
+        }
+      }
+    }
+    if (all_pairs_known) {
+      break;
+    }
+    ZIMTOHRLI_STAGE_TIMER(stats.get(), dtw, 0);
+    workspace.dtw.num_cells = 0;
+    dtw->Next(time_pairs);
+    ZIMTOHRLI_STATS_ADD(stats.get(), dtw_cells, workspace.dtw.num_cells);
+  }
+  // Computed exactly like the value of Distance, so that the answer matches
+  // it when the bound never decided it.
+  return 1.0f - nsim.Value() < threshold;
+}
+
+hwy::AlignedNDArray<float, 2> Zimtohrli::DistanceMatrix(
+    absl::Span<const hwy::AlignedNDArray<float, 2>* const> spectrograms,
+    ThreadPool& pool) const {
+  const size_t num_spectrograms = spectrograms.size();
+  CHECK_GT(num_spectrograms, 0);
+  hwy::AlignedNDArray<float, 2> result({num_spectrograms, num_spectrograms});
+  std::vector<std::pair<size_t, size_t>> pairs;
+  pairs.reserve(num_spectrograms * (num_spectrograms - 1) / 2);
+  for (size_t row = 0; row < num_spectrograms; ++row) {
+    for (size_t column = row + 1; column < num_spectrograms; ++column) {
+      pairs.push_back({row, column});
+    }
+  }
+  std::vector<ZimtohrliWorkspace> workspaces(pool.NumThreads());
+  pool.ParallelFor(pairs.size(), [&](size_t pair_index, size_t thread_index) {
+    const size_t row = pairs[pair_index].first;
+    const size_t column = pairs[pair_index].second;
+    const float distance = Distance(false, *spectrograms[row],
+                                    *spectrograms[column],
+                                    workspaces[thread_index])
+                               .value;
+    result[{row}][column] = distance;
+    result[{column}][row] = distance;
+  });
+  return result;
+}
+
+hwy::AlignedNDArray<float, 2> Zimtohrli::DistanceMatrix(
+    absl::Span<const Analysis* const> analyses, ThreadPool& pool) const {
+  std::vector<const hwy::AlignedNDArray<float, 2>*> spectrograms;
+  spectrograms.reserve(analyses.size());
+  for (const Analysis* analysis : analyses) {
+    spectrograms.push_back(&analysis->spectrogram);
+  }
+  return DistanceMatrix(spectrograms, pool);
+}
+
+namespace {
+
+// Returns the number of time steps of the dynamic time warp for the seconds of
+// one of the unwarp_*_seconds fields of z.
+//
+// All of them are converted with the audio sample rate, not
+// perceptual_sample_rate, see Zimtohrli::unwarp_window_seconds.
+size_t DTWTimeSteps(const Zimtohrli& z, float seconds) {
+  return static_cast<size_t>(seconds * z.cam_filterbank->sample_rate);
+}
+
+}  // namespace
+
+std::pair<size_t, size_t> Zimtohrli::DTWWindowAndRadius() const {
+  const size_t window_size = DTWTimeSteps(*this, unwarp_window_seconds);
+  if (unwarp_radius_seconds == 0) {
+    return {window_size, window_size};
+  }
+  return {window_size, std::max<size_t>(
+                           1, DTWTimeSteps(*this, unwarp_radius_seconds))};
+}
+
+size_t Zimtohrli::DTWCorridorRadius() const {
+  if (unwarp_corridor_seconds == 0) {
+    return 0;
+  }
+  return std::max<size_t>(1, DTWTimeSteps(*this, unwarp_corridor_seconds));
+}
+
+std::vector<std::pair<size_t, size_t>> Zimtohrli::TimePairs(
+    const hwy::AlignedNDArray<float, 2>& spectrogram_a,
+    const hwy::AlignedNDArray<float, 2>& spectrogram_b) const {
+  DTWWorkspace workspace;
+  std::vector<std::pair<size_t, size_t>> time_pairs;
+  PopulateTimePairs(*this, spectrogram_a, spectrogram_b, workspace,
+                    time_pairs);
+  return time_pairs;
+}
+
 void Zimtohrli::Spectrogram(
     hwy::Span<const float> signal, FilterbankState& state,
     hwy::AlignedNDArray<float, 2>& channels,
@@ -281,20 +731,87 @@ void Zimtohrli::Spectrogram(
            partial_energy_channels_db.shape()[1]);
   CHECK_EQ(partial_energy_channels_db.shape()[0], spectrogram.shape()[0]);
   CHECK_EQ(partial_energy_channels_db.shape()[1], spectrogram.shape()[1]);
-  cam_filterbank->filter.Filter(signal, state, channels);
-  ComputeEnergy(channels, energy_channels_db);
-  ToDb(energy_channels_db, full_scale_sine_db, epsilon, energy_channels_db);
-  if (apply_masking) {
-    masking.CutFullyMasked(energy_channels_db, cam_filterbank->cam_delta,
-                           partial_energy_channels_db);
-  } else {
-    hwy::CopyBytes(energy_channels_db.data(), partial_energy_channels_db.data(),
-                   energy_channels_db.memory_size() * sizeof(float));
+  {
+    ZIMTOHRLI_STAGE_TIMER(stats.get(), filterbank, signal.size());
+    cam_filterbank->filter.Filter(signal, state, channels);
+    ComputeEnergy(channels, energy_channels_db);
   }
-  if (apply_loudness) {
-    loudness.PhonsFromSPL(partial_energy_channels_db,
-                          cam_filterbank->thresholds_hz, spectrogram);
+  SpectrogramFromEnergy(energy_channels_db, partial_energy_channels_db,
+                        spectrogram);
+}
+
+void Zimtohrli::Spectrogram(
+    hwy::Span<const float> signal, FilterbankState& state,
+    hwy::AlignedNDArray<float, 2>& energy_channels_db,
+    hwy::AlignedNDArray<float, 2>& partial_energy_channels_db,
+    hwy::AlignedNDArray<float, 2>& spectrogram) const {
+  CHECK_GE(signal.size(), energy_channels_db.shape()[0]);
+  {
+    ZIMTOHRLI_STAGE_TIMER(stats.get(), filterbank, signal.size());
+    cam_filterbank->filter.FilterEnergy(signal, state, energy_channels_db);
+  }
+  SpectrogramFromEnergy(energy_channels_db, partial_energy_channels_db,
+                        spectrogram);
+}
+
+void Zimtohrli::Spectrogram(
+    hwy::Span<const float> signal,
+    hwy::AlignedNDArray<float, 2>& energy_channels_db,
+    hwy::AlignedNDArray<float, 2>& partial_energy_channels_db,
+    hwy::AlignedNDArray<float, 2>& spectrogram) const {
+  FilterbankState new_state = cam_filterbank->filter.NewState();
+  Spectrogram(signal, new_state, energy_channels_db,
+              partial_energy_channels_db, spectrogram);
+}
 
+void Zimtohrli::SpectrogramFromEnergy(
+    hwy::AlignedNDArray<float, 2>& energy_channels_db,
+    hwy::AlignedNDArray<float, 2>& partial_energy_channels_db,
+    hwy::AlignedNDArray<float, 2>& spectrogram) const {
+  SpectrogramFromEnergy(energy_channels_db, partial_energy_channels_db,
+                        spectrogram, *CachedLoudnessCoefficients());
+}
+
+std::shared_ptr<const LoudnessCoefficients>
+Zimtohrli::CachedLoudnessCoefficients() const {
+  if (loudness_coefficients_cache == nullptr) {
+    return std::make_shared<const LoudnessCoefficients>(
+        loudness.Coefficients(cam_filterbank->thresholds_hz));
+  }
+  return loudness_coefficients_cache->Get(loudness,
+                                          cam_filterbank->thresholds_hz);
+}
+
+void Zimtohrli::SpectrogramFromEnergy(
+    hwy::AlignedNDArray<float, 2>& energy_channels_db,
+    hwy::AlignedNDArray<float, 2>& partial_energy_channels_db,
+    hwy::AlignedNDArray<float, 2>& spectrogram,
+    const LoudnessCoefficients& loudness_coefficients) const {
+  CHECK_EQ(energy_channels_db.shape()[0],
+           partial_energy_channels_db.shape()[0]);
+  CHECK_EQ(energy_channels_db.shape()[1],
+           partial_energy_channels_db.shape()[1]);
+  CHECK_EQ(partial_energy_channels_db.shape()[0], spectrogram.shape()[0]);
+  CHECK_EQ(partial_energy_channels_db.shape()[1], spectrogram.shape()[1]);
+  {
+    ZIMTOHRLI_STAGE_TIMER(stats.get(), masking,
+                          energy_channels_db.shape()[0]);
+    ToDb(energy_channels_db, full_scale_sine_db, epsilon, fast_math,
+         energy_channels_db);
+    if (apply_masking) {
+      masking.CutFullyMasked(energy_channels_db, cam_filterbank->cam_delta,
+                             partial_energy_channels_db);
+    } else {
+      hwy::CopyBytes(energy_channels_db.data(),
+                     partial_energy_channels_db.data(),
+                     energy_channels_db.memory_size() * sizeof(float));
+    }
+  }
+  if (apply_loudness) {
+    ZIMTOHRLI_STAGE_TIMER(stats.get(), loudness,
+                          partial_energy_channels_db.shape()[0]);
+    loudness.PhonsFromSPL(partial_energy_channels_db, loudness_coefficients,
+                          spectrogram);
   } else {
     hwy::CopyBytes(partial_energy_channels_db.data(), spectrogram.data(),
                    partial_energy_channels_db.memory_size() * sizeof(float));
@@ -311,23 +828,53 @@ void Zimtohrli::Spectrogram(
               partial_energy_channels_db, spectrogram);
 }
 
+namespace {
+
+// Returns the shape of the Analysis arrays for num_samples samples.
+std::array<size_t, 2> AnalysisShape(const Zimtohrli& z, size_t num_samples) {
+  return {z.NumSteps(num_samples), z.NumChannels()};
+}
+
+// Returns an Analysis with arrays shaped to hold the analysis of num_samples
+// samples.
+Analysis NewAnalysis(const Zimtohrli& z, size_t num_samples) {
+  const size_t num_downscaled_samples = AnalysisShape(z, num_samples)[0];
+  ZIMTOHRLI_STATS_ADD(
+      z.stats.get(), filterbank.bytes_allocated,
+      3 * num_downscaled_samples * z.NumChannels() * sizeof(float));
+  return {.energy_channels_db = hwy::AlignedNDArray<float, 2>(
+              {num_downscaled_samples, z.NumChannels()}),
+          .partial_energy_channels_db = hwy::AlignedNDArray<float, 2>(
+              {num_downscaled_samples, z.NumChannels()}),
+          .spectrogram = hwy::AlignedNDArray<float, 2>(
+              {num_downscaled_samples, z.NumChannels()})};
+}
+
+// Populates energy_channels with the energy of signal according to the
+// decimated_filterbank of z.
+void DecimatedFilterEnergy(const Zimtohrli& z, hwy::Span<const float> signal,
+                           hwy::AlignedNDArray<float, 2>& energy_channels) {
+  CHECK_EQ(z.decimated_filterbank->Size(), z.NumChannels());
+  ZIMTOHRLI_STAGE_TIMER(z.stats.get(), filterbank, signal.size());
+  z.decimated_filterbank->FilterEnergy(signal, energy_channels);
+}
+
+}  // namespace
+
+size_t Zimtohrli::NumSteps(size_t num_samples) const {
+  return static_cast<size_t>(std::max(
+      1.0f, std::ceil(static_cast<float>(num_samples) * perceptual_sample_rate /
+                      cam_filterbank->sample_rate)));
+}
+
 Analysis Zimtohrli::Analyze(hwy::Span<const float> signal,
                             FilterbankState& state,
                             hwy::AlignedNDArray<float, 2>& channels) const {
-  const size_t num_downscaled_samples = static_cast<size_t>(std::max(
-      1.0f, std::ceil(static_cast<float>(signal.size()) *
-                      perceptual_sample_rate / cam_filterbank->sample_rate)));
-  hwy::AlignedNDArray<float, 2> energy_channels_db(
-      {num_downscaled_samples, cam_filterbank->filter.Size()});
-  hwy::AlignedNDArray<float, 2> partial_energy_channels_db(
-      {num_downscaled_samples, cam_filterbank->filter.Size()});
-  hwy::AlignedNDArray<float, 2> spectrogram(
-      {num_downscaled_samples, cam_filterbank->filter.Size()});
-  Spectrogram(signal, state, channels, energy_channels_db,
-              partial_energy_channels_db, spectrogram);
-  return {.energy_channels_db = std::move(energy_channels_db),
-          .partial_energy_channels_db = std::move(partial_energy_channels_db),
-          .spectrogram = std::move(spectrogram)};
+  CHECK(decimated_filterbank == nullptr);
+  Analysis result = NewAnalysis(*this, signal.size());
+  Spectrogram(signal, state, channels, result.energy_channels_db,
+              result.partial_energy_channels_db, result.spectrogram);
+  return result;
 }
 
 Analysis Zimtohrli::Analyze(hwy::Span<const float> signal,
@@ -336,18 +883,171 @@ Analysis Zimtohrli::Analyze(hwy::Span<const float> signal,
   return Analyze(signal, new_state, channels);
 }
 
+Analysis Zimtohrli::Analyze(hwy::Span<const float> signal,
+                            FilterbankState& state) const {
+  CHECK(decimated_filterbank == nullptr);
+  Analysis result = NewAnalysis(*this, signal.size());
+  Spectrogram(signal, state, result.energy_channels_db,
+              result.partial_energy_channels_db, result.spectrogram);
+  return result;
+}
+
+void Zimtohrli::Analyze(hwy::Span<const float> signal,
+                        ZimtohrliWorkspace& workspace,
+                        std::optional<Analysis>& analysis) const {
+  const std::array<size_t, 2> shape = AnalysisShape(*this, signal.size());
+  if (!analysis.has_value() || analysis->energy_channels_db.shape() != shape ||
+      analysis->partial_energy_channels_db.shape() != shape ||
+      analysis->spectrogram.shape() != shape) {
+    analysis = NewAnalysis(*this, signal.size());
+  }
+  if (decimated_filterbank != nullptr) {
+    DecimatedFilterEnergy(*this, signal, analysis->energy_channels_db);
+    SpectrogramFromEnergy(analysis->energy_channels_db,
+                          analysis->partial_energy_channels_db,
+                          analysis->spectrogram);
+    return;
+  }
+  if (workspace.filterbank_state.has_value()) {
+    cam_filterbank->filter.ResetState(*workspace.filterbank_state);
+  } else {
+    workspace.filterbank_state = cam_filterbank->filter.NewState();
+  }
+  Spectrogram(signal, *workspace.filterbank_state,
+              analysis->energy_channels_db,
+              analysis->partial_energy_channels_db, analysis->spectrogram);
+}
+
+Analysis Zimtohrli::Analyze(hwy::Span<const float> signal) const {
+  if (decimated_filterbank != nullptr) {
+    Analysis result = NewAnalysis(*this, signal.size());
+    DecimatedFilterEnergy(*this, signal, result.energy_channels_db);
+    SpectrogramFromEnergy(result.energy_channels_db,
+                          result.partial_energy_channels_db,
+                          result.spectrogram);
+    return result;
+  }
+  FilterbankState new_state = cam_filterbank->filter.NewState();
+  return Analyze(signal, new_state);
+}
+
+std::vector<Analysis> Zimtohrli::AnalyzeBatch(
+    absl::Span<const hwy::Span<const float>> signals) const {
+  std::vector<Analysis> result;
+  result.reserve(signals.size());
+  if (signals.empty()) {
+    return result;
+  }
+  const size_t num_samples = signals[0].size();
+  for (const hwy::Span<const float>& signal : signals) {
+    CHECK_EQ(signal.size(), num_samples);
+  }
+  for (size_t signal_index = 0; signal_index < signals.size();
+       ++signal_index) {
+    result.push_back(NewAnalysis(*this, num_samples));
+  }
+  if (decimated_filterbank != nullptr) {
+    for (size_t signal_index = 0; signal_index < signals.size();
+         ++signal_index) {
+      DecimatedFilterEnergy(*this, signals[signal_index],
+                            result[signal_index].energy_channels_db);
+    }
+  } else {
+    std::vector<FilterbankState> states;
+    states.reserve(signals.size());
+    std::vector<hwy::AlignedNDArray<float, 2>*> energy_channels;
+    energy_channels.reserve(signals.size());
+    for (Analysis& analysis : result) {
+      states.push_back(cam_filterbank->filter.NewState());
+      energy_channels.push_back(&analysis.energy_channels_db);
+    }
+    ZIMTOHRLI_STAGE_TIMER(stats.get(), filterbank,
+                          signals.size() * num_samples);
+    cam_filterbank->filter.FilterEnergyBatch(
+        signals, absl::MakeSpan(states), absl::MakeConstSpan(energy_channels));
+  }
+  // The stages after the filterbank are the same for both filterbanks, and
+  // share the loudness coefficients.
+  const std::shared_ptr<const LoudnessCoefficients> loudness_coefficients =
+      CachedLoudnessCoefficients();
+  for (Analysis& analysis : result) {
+    SpectrogramFromEnergy(analysis.energy_channels_db,
+                          analysis.partial_energy_channels_db,
+                          analysis.spectrogram, *loudness_coefficients);
+  }
+  return result;
+}
+
+std::vector<Analysis> Zimtohrli::AnalyzeAudioChannels(
+    const hwy::AlignedNDArray<float, 2>& frames) const {
+  std::vector<hwy::Span<const float>> signals;
+  signals.reserve(frames.shape()[0]);
+  for (size_t audio_channel_index = 0; audio_channel_index < frames.shape()[0];
+       ++audio_channel_index) {
+    signals.push_back(frames[{audio_channel_index}]);
+  }
+  return AnalyzeBatch(signals);
+}
+
+hwy::AlignedNDArray<float, 2> Zimtohrli::Energy(
+    hwy::Span<const float> signal) const {
+  hwy::AlignedNDArray<float, 2> energy_channels(
+      AnalysisShape(*this, signal.size()));
+  ZIMTOHRLI_STATS_ADD(stats.get(), filterbank.bytes_allocated,
+                      energy_channels.memory_size() * sizeof(float));
+  if (decimated_filterbank != nullptr) {
+    DecimatedFilterEnergy(*this, signal, energy_channels);
+    return energy_channels;
+  }
+  FilterbankState new_state = cam_filterbank->filter.NewState();
+  ZIMTOHRLI_STAGE_TIMER(stats.get(), filterbank, signal.size());
+  cam_filterbank->filter.FilterEnergy(signal, new_state, energy_channels);
+  return energy_channels;
+}
+
+Analysis Zimtohrli::AnalyzeEnergy(
+    const hwy::AlignedNDArray<float, 2>& energy_channels) const {
+  CHECK_EQ(energy_channels.shape()[1], NumChannels());
+  Analysis result = {
+      .energy_channels_db =
+          hwy::AlignedNDArray<float, 2>(energy_channels.shape()),
+      .partial_energy_channels_db =
+          hwy::AlignedNDArray<float, 2>(energy_channels.shape()),
+      .spectrogram = hwy::AlignedNDArray<float, 2>(energy_channels.shape())};
+  hwy::CopyBytes(energy_channels.data(), result.energy_channels_db.data(),
+                 energy_channels.memory_size() * sizeof(float));
+  SpectrogramFromEnergy(result.energy_channels_db,
+                        result.partial_energy_channels_db, result.spectrogram);
+  return result;
+}
+
 AnalysisDTW::AnalysisDTW(const Analysis& analysis_a, const Analysis& analysis_b,
-                         size_t window_size) {
-  this->energy_channels_db =
-      ChainDTW(analysis_a.energy_channels_db, analysis_b.energy_channels_db,
-               window_size);
-  this->partial_energy_channels_db =
-      ChainDTW(analysis_a.partial_energy_channels_db,
-               analysis_b.partial_energy_channels_db, window_size);
-  this->spectrogram =
-      ChainDTW(analysis_a.spectrogram, analysis_b.spectrogram, window_size);
+                         size_t window_size, size_t warp_radius,
+                         size_t corridor_radius) {
+  DTWWorkspace workspace;
+  const auto dtw = [&](const hwy::AlignedNDArray<float, 2>& array_a,
+                       const hwy::AlignedNDArray<float, 2>& array_b,
+                       std::vector<std::pair<size_t, size_t>>& time_pairs) {
+    if (corridor_radius == 0) {
+      ChainDTW(array_a, array_b, window_size, warp_radius, workspace,
+               time_pairs);
+    } else {
+      CoarseToFineChainDTW(array_a, array_b, window_size, warp_radius,
+                           corridor_radius, workspace, time_pairs);
+    }
+  };
+  dtw(analysis_a.energy_channels_db, analysis_b.energy_channels_db,
+      this->energy_channels_db);
+  dtw(analysis_a.partial_energy_channels_db,
+      analysis_b.partial_energy_channels_db, this->partial_energy_channels_db);
+  dtw(analysis_a.spectrogram, analysis_b.spectrogram, this->spectrogram);
 }
 
+AnalysisDTW::AnalysisDTW(std::vector<std::pair<size_t, size_t>> time_pairs)
+    : energy_channels_db(time_pairs),
+      partial_energy_channels_db(time_pairs),
+      spectrogram(std::move(time_pairs)) {}
+
 AnalysisDTW::AnalysisDTW(size_t length) {
   std::vector<std::pair<size_t, size_t>> time_pairs(length);
   for (size_t index = 0; index < length; ++index) {
@@ -362,134 +1062,242 @@ Comparison Zimtohrli::Compare(
     const hwy::AlignedNDArray<float, 2>& frames_a,
     absl::Span<const hwy::AlignedNDArray<float, 2>* const> frames_b_span)
     const {
+  ThreadPool pool(1);
+  return Compare(frames_a, frames_b_span, pool);
+}
+
+Comparison Zimtohrli::Compare(
+    absl::Span<const Analysis> analysis_a,
+    const hwy::AlignedNDArray<float, 2>& frames_a,
+    absl::Span<const hwy::AlignedNDArray<float, 2>* const> frames_b_span)
+    const {
+  ThreadPool pool(1);
+  return Compare(analysis_a, frames_a, frames_b_span, pool);
+}
+
+namespace {
+
+// The comparison of one audio channel of sound A with the same audio channel
+// of one sound B.
+struct ChannelComparison {
+  Analysis analysis_b;
+  AnalysisDTW dtw;
+};
+
+// The deltas between one audio channel of sound A and the same audio channel
+// of one sound B.
+struct ChannelDeltas {
+  Analysis analysis_absolute_delta;
+  Analysis analysis_relative_delta;
+};
+
+// Populates the analysis_b and dtw fields of the comparison of the sounds B
+// in frames_b_span with sound A, whose audio channels are frames_a and have
+// the analyses analysis_a.
+void CompareWithAnalyses(
+    const Zimtohrli& z, absl::Span<const Analysis> analysis_a,
+    const hwy::AlignedNDArray<float, 2>& frames_a,
+    absl::Span<const hwy::AlignedNDArray<float, 2>* const> frames_b_span,
+    ThreadPool& pool, Comparison& comparison) {
+  CHECK_EQ(analysis_a.size(), frames_a.shape()[0]);
   for (const auto& frames_b : frames_b_span) {
-    if (unwarp_window_seconds == 0) {
+    if (z.unwarp_window_seconds == 0) {
       CHECK_EQ(frames_a.shape()[0], frames_b->shape()[0]);
     }
     CHECK_EQ(frames_a.shape()[1], frames_b->shape()[1]);
   }
   const size_t num_audio_channels = frames_a.shape()[0];
-  std::vector<hwy::AlignedNDArray<float, 2>> audio_delta_vector;
-  audio_delta_vector.reserve(frames_b_span.size());
-  std::vector<Analysis> analysis_a;
-  analysis_a.reserve(frames_b_span.size());
-  std::vector<std::vector<Analysis>> analysis_b_vector(frames_b_span.size());
-  std::vector<std::vector<Analysis>> analysis_absolute_delta_vector(
-      frames_b_span.size());
-  std::vector<std::vector<Analysis>> analysis_relative_delta_vector(
-      frames_b_span.size());
-  std::vector<std::vector<AnalysisDTW>> dtw(frames_b_span.size());
-  for (size_t audio_channel_index = 0; audio_channel_index < num_audio_channels;
-       ++audio_channel_index) {
-    hwy::AlignedNDArray<float, 2> channels_a(
-        {frames_a.shape()[1], cam_filterbank->filter.Size()});
-    Analysis current_analysis_a =
-        Analyze(frames_a[{audio_channel_index}], channels_a);
-    for (size_t b_index = 0; b_index < frames_b_span.size(); ++b_index) {
-      hwy::AlignedNDArray<float, 2> channels_b(
-          {frames_b_span[b_index]->shape()[1], cam_filterbank->filter.Size()});
-      Analysis current_analysis_b =
-          Analyze((*frames_b_span[b_index])[{audio_channel_index}], channels_b);
-
-      const AnalysisDTW current_analysis_dtw =
-          unwarp_window_seconds == 0
-              ? AnalysisDTW(current_analysis_a.spectrogram.shape()[0])
-              : AnalysisDTW(current_analysis_a, current_analysis_b,
-                            static_cast<size_t>(unwarp_window_seconds *
-                                                cam_filterbank->sample_rate));
-
-      const hwy::AlignedNDArray<float, 2>& frames_b = *frames_b_span[b_index];
-      if (audio_channel_index == 0) {
-        audio_delta_vector.push_back(hwy::AlignedNDArray<float, 2>(
-            {num_audio_channels, frames_a.shape()[1]}));
-      }
-      hwy::AlignedNDArray<float, 2>& audio_delta = audio_delta_vector[b_index];
-      const size_t dtw_block_size =
-          frames_a.shape()[1] /
-          current_analysis_a.energy_channels_db.shape()[0];
-      for (const auto& dtw_block_pair :
-           current_analysis_dtw.energy_channels_db) {
-        const size_t first_dtw_offset = dtw_block_pair.first * dtw_block_size;
-        float* audio_delta_data =
-            audio_delta[{audio_channel_index}].data() + first_dtw_offset;
-        const float* frames_a_data =
-            frames_a[{audio_channel_index}].data() + first_dtw_offset;
-        const float* frames_b_data = frames_b[{audio_channel_index}].data() +
-                                     dtw_block_pair.second * dtw_block_size;
-        for (size_t index = 0; index < dtw_block_size; ++index) {
-          audio_delta_data[index] = frames_a_data[index] - frames_b_data[index];
-        }
-      }
+  // Each task compares one pair of audio channel and sound B, and only writes
+  // to its own slot in channel_comparisons, so the tasks can run in any order.
+  std::vector<std::optional<ChannelComparison>> channel_comparisons(
+      num_audio_channels * frames_b_span.size());
+  pool.ParallelFor(channel_comparisons.size(), [&](size_t task_index) {
+    const size_t audio_channel_index = task_index / frames_b_span.size();
+    const size_t b_index = task_index % frames_b_span.size();
+    const Analysis& current_analysis_a = analysis_a[audio_channel_index];
+    Analysis current_analysis_b =
+        z.Analyze((*frames_b_span[b_index])[{audio_channel_index}]);
 
-      hwy::AlignedNDArray<float, 2> absolute_delta_energy_channels_db(
-          {current_analysis_dtw.energy_channels_db.back().first + 1,
-           current_analysis_a.energy_channels_db.shape()[1]});
-      HWY_DYNAMIC_DISPATCH(HwySubtractDb)
-      (*this, current_analysis_a.energy_channels_db,
-       current_analysis_b.energy_channels_db, absolute_delta_energy_channels_db,
-       current_analysis_dtw.energy_channels_db);
-
-      hwy::AlignedNDArray<float, 2> relative_delta_energy_channels_db(
-          {current_analysis_dtw.energy_channels_db.back().first + 1,
-           current_analysis_a.energy_channels_db.shape()[1]});
-      HWY_DYNAMIC_DISPATCH(HwyAbsDiff)
-      (current_analysis_a.energy_channels_db,
-       current_analysis_b.energy_channels_db, relative_delta_energy_channels_db,
-       current_analysis_dtw.energy_channels_db);
-
-      hwy::AlignedNDArray<float, 2> absolute_delta_partial_energy_channels_db(
-          {current_analysis_dtw.partial_energy_channels_db.back().first + 1,
-           current_analysis_a.partial_energy_channels_db.shape()[1]});
-      HWY_DYNAMIC_DISPATCH(HwySubtractDb)
-      (*this, current_analysis_a.partial_energy_channels_db,
-       current_analysis_b.partial_energy_channels_db,
-       absolute_delta_partial_energy_channels_db,
-       current_analysis_dtw.partial_energy_channels_db);
-
-      hwy::AlignedNDArray<float, 2> relative_delta_partial_energy_channels_db(
-          {current_analysis_dtw.partial_energy_channels_db.back().first + 1,
-           current_analysis_a.partial_energy_channels_db.shape()[1]});
-      HWY_DYNAMIC_DISPATCH(HwyAbsDiff)
-      (current_analysis_a.partial_energy_channels_db,
-       current_analysis_b.partial_energy_channels_db,
-       relative_delta_partial_energy_channels_db,
-       current_analysis_dtw.partial_energy_channels_db);
-
-      hwy::AlignedNDArray<float, 2> absolute_delta_spectrogram(
-          {current_analysis_dtw.spectrogram.back().first + 1,
-           current_analysis_a.spectrogram.shape()[1]});
-      HWY_DYNAMIC_DISPATCH(HwySubtractDb)
-      (*this, current_analysis_a.spectrogram, current_analysis_b.spectrogram,
-       absolute_delta_spectrogram, current_analysis_dtw.spectrogram);
-
-      hwy::AlignedNDArray<float, 2> relative_delta_spectrogram(
-          {current_analysis_dtw.spectrogram.back().first + 1,
-           current_analysis_a.spectrogram.shape()[1]});
-      HWY_DYNAMIC_DISPATCH(HwyAbsDiff)
-      (current_analysis_a.spectrogram, current_analysis_b.spectrogram,
-       relative_delta_spectrogram, current_analysis_dtw.spectrogram);
-
-      analysis_b_vector[b_index].push_back(std::move(current_analysis_b));
-      dtw[b_index].push_back(std::move(current_analysis_dtw));
-      analysis_absolute_delta_vector[b_index].push_back(Analysis{
-          .energy_channels_db = std::move(absolute_delta_energy_channels_db),
-          .partial_energy_channels_db =
-              std::move(absolute_delta_partial_energy_channels_db),
-          .spectrogram = std::move(absolute_delta_spectrogram)});
-      analysis_relative_delta_vector[b_index].push_back(Analysis{
-          .energy_channels_db = std::move(relative_delta_energy_channels_db),
-          .partial_energy_channels_db =
-              std::move(relative_delta_partial_energy_channels_db),
-          .spectrogram = std::move(relative_delta_spectrogram)});
+    const auto [dtw_window_size, dtw_warp_radius] = z.DTWWindowAndRadius();
+    AnalysisDTW current_analysis_dtw =
+        z.unwarp_window_seconds == 0
+            ? AnalysisDTW(current_analysis_a.spectrogram.shape()[0])
+            : (z.share_dtw
+                   ? AnalysisDTW(z.TimePairs(current_analysis_a.spectrogram,
+                                             current_analysis_b.spectrogram))
+                   : AnalysisDTW(current_analysis_a, current_analysis_b,
+                                 dtw_window_size, dtw_warp_radius,
+                                 z.DTWCorridorRadius()));
+
+    channel_comparisons[task_index] =
+        ChannelComparison{.analysis_b = std::move(current_analysis_b),
+                          .dtw = std::move(current_analysis_dtw)};
+  });
+
+  comparison.analysis_b.resize(frames_b_span.size());
+  comparison.dtw.resize(frames_b_span.size());
+  for (size_t task_index = 0; task_index < channel_comparisons.size();
+       ++task_index) {
+    const size_t b_index = task_index % frames_b_span.size();
+    ChannelComparison& channel_comparison = *channel_comparisons[task_index];
+    comparison.analysis_b[b_index].push_back(
+        std::move(channel_comparison.analysis_b));
+    comparison.dtw[b_index].push_back(std::move(channel_comparison.dtw));
+  }
+}
+
+hwy::AlignedNDArray<float, 2> CopyArray(
+    const hwy::AlignedNDArray<float, 2>& array) {
+  hwy::AlignedNDArray<float, 2> result(array.shape());
+  hwy::CopyBytes(array.data(), result.data(),
+                 array.memory_size() * sizeof(float));
+  return result;
+}
+
+}  // namespace
+
+Comparison Zimtohrli::Compare(
+    const hwy::AlignedNDArray<float, 2>& frames_a,
+    absl::Span<const hwy::AlignedNDArray<float, 2>* const> frames_b_span,
+    ThreadPool& pool) const {
+  Comparison result;
+  if (pool.NumThreads() == 1) {
+    // Without threads to analyze the audio channels in parallel, stepping them
+    // through the filterbank together is faster than one at a time.
+    result.analysis_a = AnalyzeAudioChannels(frames_a);
+  } else {
+    std::vector<std::optional<Analysis>> analyses(frames_a.shape()[0]);
+    pool.ParallelFor(analyses.size(), [&](size_t audio_channel_index) {
+      analyses[audio_channel_index] = Analyze(frames_a[{audio_channel_index}]);
+    });
+    result.analysis_a.reserve(analyses.size());
+    for (std::optional<Analysis>& analysis : analyses) {
+      result.analysis_a.push_back(*std::move(analysis));
     }
-    analysis_a.push_back(std::move(current_analysis_a));
   }
-  return {.analysis_a = std::move(analysis_a),
-          .analysis_b = std::move(analysis_b_vector),
-          .dtw = std::move(dtw),
-          .analysis_absolute_delta = std::move(analysis_absolute_delta_vector),
-          .analysis_relative_delta = std::move(analysis_relative_delta_vector),
-          .frames_delta = std::move(audio_delta_vector)};
+  CompareWithAnalyses(*this, result.analysis_a, frames_a, frames_b_span, pool,
+                      result);
+  return result;
+}
+
+Comparison Zimtohrli::Compare(
+    absl::Span<const Analysis> analysis_a,
+    const hwy::AlignedNDArray<float, 2>& frames_a,
+    absl::Span<const hwy::AlignedNDArray<float, 2>* const> frames_b_span,
+    ThreadPool& pool) const {
+  Comparison result;
+  CompareWithAnalyses(*this, analysis_a, frames_a, frames_b_span, pool,
+                      result);
+  result.analysis_a.reserve(analysis_a.size());
+  for (const Analysis& analysis : analysis_a) {
+    result.analysis_a.push_back(
+        {.energy_channels_db = CopyArray(analysis.energy_channels_db),
+         .partial_energy_channels_db =
+             CopyArray(analysis.partial_energy_channels_db),
+         .spectrogram = CopyArray(analysis.spectrogram)});
+  }
+  return result;
+}
+
+void Zimtohrli::ComputeDeltas(
+    const hwy::AlignedNDArray<float, 2>& frames_a,
+    absl::Span<const hwy::AlignedNDArray<float, 2>* const> frames_b_span,
+    Comparison& comparison) const {
+  ThreadPool pool(1);
+  ComputeDeltas(frames_a, frames_b_span, comparison, pool);
+}
+
+void Zimtohrli::ComputeDeltas(
+    const hwy::AlignedNDArray<float, 2>& frames_a,
+    absl::Span<const hwy::AlignedNDArray<float, 2>* const> frames_b_span,
+    Comparison& comparison, ThreadPool& pool) const {
+  const size_t num_audio_channels = frames_a.shape()[0];
+  CHECK_EQ(comparison.analysis_a.size(), num_audio_channels);
+  CHECK_EQ(comparison.analysis_b.size(), frames_b_span.size());
+  std::vector<hwy::AlignedNDArray<float, 2>> frames_delta;
+  frames_delta.reserve(frames_b_span.size());
+  for (size_t b_index = 0; b_index < frames_b_span.size(); ++b_index) {
+    frames_delta.push_back(hwy::AlignedNDArray<float, 2>(
+        {num_audio_channels, frames_a.shape()[1]}));
+  }
+  // Each task computes the deltas of one pair of audio channel and sound B,
+  // and only writes to its own slot in channel_deltas and its own row in
+  // frames_delta, so the tasks can run in any order.
+  std::vector<std::optional<ChannelDeltas>> channel_deltas(
+      num_audio_channels * frames_b_span.size());
+  pool.ParallelFor(channel_deltas.size(), [&](size_t task_index) {
+    const size_t audio_channel_index = task_index / frames_b_span.size();
+    const size_t b_index = task_index % frames_b_span.size();
+    const Analysis& analysis_a = comparison.analysis_a[audio_channel_index];
+    const Analysis& analysis_b =
+        comparison.analysis_b[b_index][audio_channel_index];
+    const AnalysisDTW& dtw = comparison.dtw[b_index][audio_channel_index];
+
+    HWY_DYNAMIC_DISPATCH(HwyFramesDelta)
+    (frames_a[{audio_channel_index}].data(),
+     (*frames_b_span[b_index])[{audio_channel_index}].data(),
+     dtw.energy_channels_db,
+     frames_a.shape()[1] / analysis_a.energy_channels_db.shape()[0],
+     frames_delta[b_index][{audio_channel_index}].data());
+
+    // Returns the absolute and relative deltas of array_a and array_b at the
+    // time steps matched by time_pairs.
+    const auto deltas =
+        [&](const hwy::AlignedNDArray<float, 2>& array_a,
+            const hwy::AlignedNDArray<float, 2>& array_b,
+            const std::vector<std::pair<size_t, size_t>>& time_pairs) {
+          std::pair<hwy::AlignedNDArray<float, 2>,
+                    hwy::AlignedNDArray<float, 2>>
+              result = {hwy::AlignedNDArray<float, 2>(
+                            {time_pairs.back().first + 1, array_a.shape()[1]}),
+                        hwy::AlignedNDArray<float, 2>(
+                            {time_pairs.back().first + 1, array_a.shape()[1]})};
+          HWY_DYNAMIC_DISPATCH(HwySubtractDb)
+          (*this, array_a, array_b, result.first, time_pairs);
+          HWY_DYNAMIC_DISPATCH(HwyAbsDiff)
+          (array_a, array_b, result.second, time_pairs);
+          return result;
+        };
+    auto [absolute_energy_channels_db, relative_energy_channels_db] =
+        deltas(analysis_a.energy_channels_db, analysis_b.energy_channels_db,
+               dtw.energy_channels_db);
+    auto [absolute_partial_energy_channels_db,
+          relative_partial_energy_channels_db] =
+        deltas(analysis_a.partial_energy_channels_db,
+               analysis_b.partial_energy_channels_db,
+               dtw.partial_energy_channels_db);
+    auto [absolute_spectrogram, relative_spectrogram] = deltas(
+        analysis_a.spectrogram, analysis_b.spectrogram, dtw.spectrogram);
+
+    channel_deltas[task_index] = ChannelDeltas{
+        .analysis_absolute_delta =
+            Analysis{.energy_channels_db =
+                         std::move(absolute_energy_channels_db),
+                     .partial_energy_channels_db =
+                         std::move(absolute_partial_energy_channels_db),
+                     .spectrogram = std::move(absolute_spectrogram)},
+        .analysis_relative_delta =
+            Analysis{.energy_channels_db =
+                         std::move(relative_energy_channels_db),
+                     .partial_energy_channels_db =
+                         std::move(relative_partial_energy_channels_db),
+                     .spectrogram = std::move(relative_spectrogram)}};
+  });
+
+  comparison.analysis_absolute_delta =
+      std::vector<std::vector<Analysis>>(frames_b_span.size());
+  comparison.analysis_relative_delta =
+      std::vector<std::vector<Analysis>>(frames_b_span.size());
+  for (size_t task_index = 0; task_index < channel_deltas.size();
+       ++task_index) {
+    const size_t b_index = task_index % frames_b_span.size();
+    ChannelDeltas& deltas = *channel_deltas[task_index];
+    comparison.analysis_absolute_delta[b_index].push_back(
+        std::move(deltas.analysis_absolute_delta));
+    comparison.analysis_relative_delta[b_index].push_back(
+        std::move(deltas.analysis_relative_delta));
+  }
+  comparison.frames_delta = std::move(frames_delta);
 }
 
 EnergyAndMaxAbsAmplitude Measure(hwy::Span<const float> signal) {
@@ -501,6 +1309,21 @@ EnergyAndMaxAbsAmplitude NormalizeAmplitude(float max_abs_amplitude,
   return HWY_DYNAMIC_DISPATCH(HwyNormalizeAmplitude)(max_abs_amplitude, signal);
 }
 
+CompactAnalysis Compact(const Analysis& analysis) {
+  CompactAnalysis result{.spectrogram = hwy::AlignedNDArray<hwy::float16_t, 2>(
+                             analysis.spectrogram.shape())};
+  HWY_DYNAMIC_DISPATCH(HwyCompact)(analysis.spectrogram, result.spectrogram);
+  return result;
+}
+
+hwy::AlignedNDArray<float, 2> WidenSpectrogram(
+    const CompactAnalysis& compact_analysis) {
+  hwy::AlignedNDArray<float, 2> result(compact_analysis.spectrogram.shape());
+  HWY_DYNAMIC_DISPATCH(HwyWidenSpectrogram)
+  (compact_analysis.spectrogram, result);
+  return result;
+}
+
 }  // namespace zimtohrli
 
 #endif  // HWY_ONCE
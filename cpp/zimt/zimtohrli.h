@@ -16,6 +16,7 @@
 #define CPP_ZIMT_ZIMTOHRLI_H_
 
 #include <cstddef>
+#include <memory>
 #include <optional>
 #include <utility>
 #include <vector>
@@ -23,8 +24,14 @@
 #include "absl/types/span.h"
 #include "hwy/aligned_allocator.h"
 #include "zimt/cam.h"
+#include "zimt/decimated_filterbank.h"
+#include "zimt/dtw.h"
+#include "zimt/filterbank.h"
 #include "zimt/loudness.h"
 #include "zimt/masking.h"
+#include "zimt/nsim.h"
+#include "zimt/stats.h"
+#include "zimt/thread_pool.h"
 
 namespace zimtohrli {
 
@@ -74,15 +81,31 @@ struct Analysis {
   hwy::AlignedNDArray<float, 2> spectrogram;
 };
 
+// Compact container for the part of an Analysis needed to compute distances.
+//
+// Drops the energy arrays and stores the spectrogram as 16-bit floats, so it
+// uses a sixth of the memory of an Analysis. Meant for long-lived caches of
+// reference analyses.
+//
+// Values below 128 Phons are rounded by at most 2^-5 Phons, which changes
+// distances by much less than the differences between sounds.
+struct CompactAnalysis {
+  hwy::AlignedNDArray<hwy::float16_t, 2> spectrogram;
+};
+
 // Convenient container for the output of a DTW between two Analysis instances.
 struct AnalysisDTW {
   // Constructs a fake AnalysisDTW that assumes two sequences of the given
   // length with no warping.
   AnalysisDTW(size_t length);
+  // Constructs an AnalysisDTW that uses the same time_pairs for all fields.
+  explicit AnalysisDTW(std::vector<std::pair<size_t, size_t>> time_pairs);
   // Constructs an AnalysisDTW from two Analysis instances by running ChainDTW
-  // with the provided window_size.
+  // on each field with the provided window_size and warp_radius, or
+  // CoarseToFineChainDTW if corridor_radius is nonzero.
   AnalysisDTW(const Analysis& analysis_a, const Analysis& analysis_b,
-              size_t window_size);
+              size_t window_size, size_t warp_radius,
+              size_t corridor_radius = 0);
   // The DTW between the energy_channels_db field of two Analysis instances.
   std::vector<std::pair<size_t, size_t>> energy_channels_db;
   // The DTW between the partial_energy_channels_db field of two Analysis
@@ -108,8 +131,13 @@ struct Comparison {
   //
   // dtw[sound_b_index][channel_index].X contains the outputs of calling
   // ChainDTW(analysis_a[channel_index].X,
-  // analysis_b[sound_b_index][channel_index].X, perceptual_sample_rate).
+  // analysis_b[sound_b_index][channel_index].X, perceptual_sample_rate), or
+  // if Zimtohrli::share_dtw is set, all fields contain the output of
+  // Zimtohrli::TimePairs on the spectrograms.
   std::vector<std::vector<AnalysisDTW>> dtw;
+  // The deltas below are only populated by Zimtohrli::ComputeDeltas, and are
+  // empty in the output of Zimtohrli::Compare.
+  //
   // The amplitude of analysis B subtracted from analysis A, in dB.
   //
   // analysis_absolute_delta[sound_b_index][channel_index] contains the delta
@@ -165,20 +193,71 @@ struct EnergyAndMaxAbsAmplitude {
 };
 
 // Returns the energy and maximum absolute amplitude of a signal.
+//
+// signal doesn't have to be aligned or padded, so it can view memory owned by
+// the caller, e.g. a Go slice or a Python buffer.
 EnergyAndMaxAbsAmplitude Measure(hwy::Span<const float> signal);
 
 // Normalizes the amplitude of the signal array to have the provided maximum
 // absolute amplitude.
 //
+// Like for Measure, signal doesn't have to be aligned or padded.
+//
 // Returns the energy in dB FS, and maximum absolute amplitude, of the result.
 EnergyAndMaxAbsAmplitude NormalizeAmplitude(float max_abs_amplitude,
                                             hwy::Span<float> signal);
 
+// Returns a CompactAnalysis with the spectrogram of analysis rounded to 16-bit
+// floats.
+CompactAnalysis Compact(const Analysis& analysis);
+
+// Returns the spectrogram of compact_analysis widened to 32-bit floats.
+hwy::AlignedNDArray<float, 2> WidenSpectrogram(
+    const CompactAnalysis& compact_analysis);
+
+// Working memory for the Zimtohrli methods taking a workspace argument.
+//
+// Lets a long-lived caller, e.g. a worker thread, analyze and compare signals
+// with the Analyze, Distance, and DistanceBelow overloads taking a workspace
+// without heap allocations once the buffers have been shaped by a first call.
+// Arrays are only reallocated when a call needs a different shape, so the
+// steady state is allocation free as long as the signals have the same
+// length, except for the decimated filterbank of decimated_filterbank and the
+// coarse passes of unwarp_corridor_seconds, which allocate their own working
+// memory. Compare doesn't take a workspace, and allocates its analyses and
+// results in every call.
+//
+// Not thread safe, each thread needs its own workspace.
+struct ZimtohrliWorkspace {
+  // Filterbank state, reset before each analysis.
+  std::optional<FilterbankState> filterbank_state;
+  // The analyses of the signals compared by Zimtohrli::Distance.
+  std::optional<Analysis> analysis_a;
+  std::optional<Analysis> analysis_b;
+  // The dynamic time warp working memory and its result.
+  DTWWorkspace dtw;
+  std::vector<std::pair<size_t, size_t>> time_pairs;
+  // The NSIM working memory.
+  std::optional<StreamingNSIM> nsim;
+};
+
 // Contains parameters and code to compute perceptual spectrograms of sounds.
 struct Zimtohrli {
   // Returns the number of channels used in this instance.
   size_t NumChannels() const { return cam_filterbank->filter.Size(); }
 
+  // Returns the number of time steps in the analysis of num_samples samples.
+  size_t NumSteps(size_t num_samples) const;
+
+  // Returns a copy of this instance using filterbank instead of
+  // cam_filterbank, with a decimated version of filterbank if this instance
+  // has a decimated_filterbank.
+  //
+  // Zimtohrli instances can't be copied directly since CamFilterbank owns
+  // aligned arrays, so this is the way to derive instances with the same
+  // parameters, e.g. for a different sample rate.
+  Zimtohrli WithFilterbank(CamFilterbank filterbank) const;
+
   // Populates the spectrogram with the perception of frequency channels over
   // time.
   //
@@ -226,6 +305,55 @@ struct Zimtohrli {
                    hwy::AlignedNDArray<float, 2>& partial_energy_channels_db,
                    hwy::AlignedNDArray<float, 2>& spectrogram) const;
 
+  // Spectrogram without populating the channels array.
+  //
+  // Computes the energy of the channels while filtering, so the
+  // (num_samples, num_channels)-shaped channels array is never materialized.
+  // Produces the same results as the version that populates channels.
+  void Spectrogram(hwy::Span<const float> signal, FilterbankState& state,
+                   hwy::AlignedNDArray<float, 2>& energy_channels_db,
+                   hwy::AlignedNDArray<float, 2>& partial_energy_channels_db,
+                   hwy::AlignedNDArray<float, 2>& spectrogram) const;
+
+  // Spectrogram without chunk processing or populating the channels array.
+  void Spectrogram(hwy::Span<const float> signal,
+                   hwy::AlignedNDArray<float, 2>& energy_channels_db,
+                   hwy::AlignedNDArray<float, 2>& partial_energy_channels_db,
+                   hwy::AlignedNDArray<float, 2>& spectrogram) const;
+
+  // Populates partial_energy_channels_db and spectrogram from linear energy.
+  //
+  // energy_channels_db is a (num_downscaled_samples, num_channels)-shaped array
+  // that contains linear energy when called, and will be converted to dB SPL in
+  // place.
+  //
+  // Processes each time step independently, which allows computing the
+  // spectrogram of an arbitrary subset of time steps.
+  //
+  // partial_energy_channels_db and spectrogram can be the same arrays.
+  void SpectrogramFromEnergy(
+      hwy::AlignedNDArray<float, 2>& energy_channels_db,
+      hwy::AlignedNDArray<float, 2>& partial_energy_channels_db,
+      hwy::AlignedNDArray<float, 2>& spectrogram) const;
+
+  // SpectrogramFromEnergy using loudness_coefficients, which must be
+  // loudness.Coefficients(cam_filterbank->thresholds_hz).
+  //
+  // Lets callers converting many small batches of time steps, like
+  // StreamingAnalyzer, keep the loudness coefficients without going through
+  // loudness_coefficients_cache.
+  void SpectrogramFromEnergy(
+      hwy::AlignedNDArray<float, 2>& energy_channels_db,
+      hwy::AlignedNDArray<float, 2>& partial_energy_channels_db,
+      hwy::AlignedNDArray<float, 2>& spectrogram,
+      const LoudnessCoefficients& loudness_coefficients) const;
+
+  // Returns loudness.Coefficients(cam_filterbank->thresholds_hz), computed
+  // once and kept in loudness_coefficients_cache until loudness or
+  // cam_filterbank change.
+  std::shared_ptr<const LoudnessCoefficients> CachedLoudnessCoefficients()
+      const;
+
   // Returns the perceptual distance between the two spectrograms.
   //
   // spectrogram_a and spectrogram_b are (num_samples, num_channels)-shaped
@@ -240,18 +368,50 @@ struct Zimtohrli {
       bool verbose, const hwy::AlignedNDArray<float, 2>& spectrogram_a,
       const hwy::AlignedNDArray<float, 2>& spectrogram_b) const;
 
+  // Returns the perceptual distance between the two spectrograms, comparing
+  // the time steps in time_pairs instead of running the dynamic time warp.
+  //
+  // time_pairs is typically the output of TimePairs for the same spectrograms,
+  // or one of the fields of a Comparison::dtw.
+  struct Distance Distance(
+      bool verbose, const hwy::AlignedNDArray<float, 2>& spectrogram_a,
+      const hwy::AlignedNDArray<float, 2>& spectrogram_b,
+      const std::vector<std::pair<size_t, size_t>>& time_pairs) const;
+
+  // Returns the time steps of spectrogram_a and spectrogram_b that Distance
+  // compares, i.e. the dynamic time warp between them, or the identity if
+  // unwarp_window_seconds is zero.
+  std::vector<std::pair<size_t, size_t>> TimePairs(
+      const hwy::AlignedNDArray<float, 2>& spectrogram_a,
+      const hwy::AlignedNDArray<float, 2>& spectrogram_b) const;
+
+  // Returns the ChainDTW window size and warp radius in time steps that
+  // TimePairs uses when unwarp_window_seconds is nonzero, both converted with
+  // the audio sample rate.
+  std::pair<size_t, size_t> DTWWindowAndRadius() const;
+
+  // Returns the CoarseToFineChainDTW corridor radius in time steps that the
+  // dynamic time warps use, or zero if unwarp_corridor_seconds is zero and
+  // they use ChainDTW.
+  size_t DTWCorridorRadius() const;
+
   // Convenience method to analyze a signal.
   //
   // Allocates an Analysis instance, and executes Spectrogram on it along with
   // the provided channels working memory array.
   //
-  // signal is a span of audio samples between -1 and 1.
+  // signal is a span of audio samples between -1 and 1. It doesn't have to be
+  // aligned or padded, so it can view memory owned by the caller, e.g. a Go
+  // slice or a Python buffer.
   //
   // state is the state of the internal filterbank. Reusing the state between
   // calls allows processing of audio in chunks.
   //
   // channels is a (num_samples, num_channels)-shaped array that will be
   // populated with the audio samples in the individual channels.
+  //
+  // Filters with the full rate filterbank of cam_filterbank, so this instance
+  // must not have a decimated_filterbank.
   Analysis Analyze(hwy::Span<const float> signal, FilterbankState& state,
                    hwy::AlignedNDArray<float, 2>& channels) const;
 
@@ -259,6 +419,121 @@ struct Zimtohrli {
   Analysis Analyze(hwy::Span<const float> signal,
                    hwy::AlignedNDArray<float, 2>& channels) const;
 
+  // Analyze without populating a channels array, which avoids allocating
+  // and writing num_samples x num_channels floats.
+  //
+  // Like the overloads taking a channels array, this instance must not have a
+  // decimated_filterbank.
+  Analysis Analyze(hwy::Span<const float> signal,
+                   FilterbankState& state) const;
+
+  // Analyze without chunk processing or populating a channels array.
+  Analysis Analyze(hwy::Span<const float> signal) const;
+
+  // Returns the Analysis of each audio channel of a multichannel sound.
+  //
+  // frames is a (num_audio_channels, num_samples)-shaped array of samples
+  // between -1 and 1.
+  //
+  // Result element i is identical to Analyze(frames[{i}]), computed with
+  // AnalyzeBatch.
+  std::vector<Analysis> AnalyzeAudioChannels(
+      const hwy::AlignedNDArray<float, 2>& frames) const;
+
+  // Returns the Analysis of each of a batch of signals of the same length,
+  // e.g. clips scored together.
+  //
+  // Result element i is identical to Analyze(signals[i]), but all signals are
+  // stepped through the filterbank in one pass with
+  // Filterbank::FilterEnergyBatch, and the loudness coefficients are computed
+  // once for all of them. For the Cam filterbanks the batched pass keeps the
+  // state of groups of signals in registers, so it's faster than analyzing
+  // the signals one by one, see BM_AnalyzeBatch and BM_AnalyzeEach.
+  //
+  // With a decimated_filterbank the signals go through it one at a time, and
+  // only the loudness coefficients are shared.
+  std::vector<Analysis> AnalyzeBatch(
+      absl::Span<const hwy::Span<const float>> signals) const;
+
+  // Returns the linear energy of the channels of signal, i.e. the output of
+  // the filterbank stage of Analyze, as a (num_downscaled_samples,
+  // num_channels)-shaped array.
+  //
+  // The energy only depends on cam_filterbank and perceptual_sample_rate, so
+  // callers evaluating many values of the other parameters, e.g. when
+  // optimizing masking, loudness, or NSIM parameters, can compute it once per
+  // signal and only run AnalyzeEnergy for each evaluation.
+  hwy::AlignedNDArray<float, 2> Energy(hwy::Span<const float> signal) const;
+
+  // Returns the Analysis of a signal given its Energy, running only the stages
+  // after the filterbank: dB conversion, masking, and loudness.
+  //
+  // energy_channels must have been computed by a Zimtohrli instance with the
+  // same cam_filterbank and perceptual_sample_rate to get the same result as
+  // Analyze.
+  Analysis AnalyzeEnergy(
+      const hwy::AlignedNDArray<float, 2>& energy_channels) const;
+
+  // Analyze into analysis, using the filterbank state in workspace.
+  //
+  // The arrays of analysis are only allocated if it's empty or doesn't already
+  // have the shape required by the signal.
+  void Analyze(hwy::Span<const float> signal, ZimtohrliWorkspace& workspace,
+               std::optional<Analysis>& analysis) const;
+
+  // Distance using the dynamic time warp and NSIM working memory in
+  // workspace.
+  struct Distance Distance(bool verbose,
+                           const hwy::AlignedNDArray<float, 2>& spectrogram_a,
+                           const hwy::AlignedNDArray<float, 2>& spectrogram_b,
+                           ZimtohrliWorkspace& workspace) const;
+
+  // Returns whether Distance(false, spectrogram_a, spectrogram_b).value is
+  // below threshold, without computing more of the distance than needed to
+  // know.
+  //
+  // Interleaves the dynamic time warp, one window at a time, with the NSIM of
+  // the time steps it has matched so far. Since the NSIM of each channel of
+  // each step is between -1 and 1, the steps compared so far bound the final
+  // distance, and the comparison stops once the bound is on one side of
+  // threshold. Pairs much more different than threshold stop early, while
+  // the bound of pairs closer than threshold only tightens towards the end.
+  //
+  // Comparing which of two candidates B and C is closer to A is
+  // DistanceBelow(A, C, Distance(false, A, B).value).
+  bool DistanceBelow(const hwy::AlignedNDArray<float, 2>& spectrogram_a,
+                     const hwy::AlignedNDArray<float, 2>& spectrogram_b,
+                     float threshold) const;
+
+  // DistanceBelow using the dynamic time warp and NSIM working memory in
+  // workspace.
+  bool DistanceBelow(const hwy::AlignedNDArray<float, 2>& spectrogram_a,
+                     const hwy::AlignedNDArray<float, 2>& spectrogram_b,
+                     float threshold, ZimtohrliWorkspace& workspace) const;
+
+  // Returns the distance between two signals, analyzing them into workspace
+  // and using it for all intermediate storage.
+  float Distance(hwy::Span<const float> signal_a,
+                 hwy::Span<const float> signal_b,
+                 ZimtohrliWorkspace& workspace) const;
+
+  // Returns a (num_spectrograms, num_spectrograms)-shaped array where element
+  // [i][j] is the distance between spectrograms[i] and spectrograms[j].
+  //
+  // Distances are symmetric up to tie breaking in the dynamic time warp, so
+  // only the num_spectrograms x (num_spectrograms - 1) / 2 pairs above the
+  // diagonal are computed, on the threads of pool with one ZimtohrliWorkspace
+  // per thread, and mirrored below it. The diagonal is zero.
+  //
+  // spectrograms must not be empty.
+  hwy::AlignedNDArray<float, 2> DistanceMatrix(
+      absl::Span<const hwy::AlignedNDArray<float, 2>* const> spectrograms,
+      ThreadPool& pool) const;
+
+  // DistanceMatrix of the spectrograms of analyses.
+  hwy::AlignedNDArray<float, 2> DistanceMatrix(
+      absl::Span<const Analysis* const> analyses, ThreadPool& pool) const;
+
   // Convenience method to compare multi channel audios.
   //
   // Allocates a Comparison instance and populates it with analyses of the
@@ -281,6 +556,58 @@ struct Zimtohrli {
                      absl::Span<const hwy::AlignedNDArray<float, 2>* const>
                          frames_b_span) const;
 
+  // Compare with precomputed analyses of sound A.
+  //
+  // Useful when comparing the same sound A to sounds B in multiple calls, since
+  // sound A only has to be analyzed once.
+  //
+  // analysis_a[channel_index] must be the output of calling Analyze on channel
+  // 'channel_index' of frames_a with this instance.
+  //
+  // The analyses are copied into the analysis_a field of the result, so the
+  // caller keeps them for the next call.
+  Comparison Compare(absl::Span<const Analysis> analysis_a,
+                     const hwy::AlignedNDArray<float, 2>& frames_a,
+                     absl::Span<const hwy::AlignedNDArray<float, 2>* const>
+                         frames_b_span) const;
+
+  // Compare using the threads of pool.
+  //
+  // The audio channels of sound A, and each pair of audio channel and sound B,
+  // are analyzed and compared in parallel. The result is identical to that of
+  // the single threaded Compare.
+  Comparison Compare(const hwy::AlignedNDArray<float, 2>& frames_a,
+                     absl::Span<const hwy::AlignedNDArray<float, 2>* const>
+                         frames_b_span,
+                     ThreadPool& pool) const;
+
+  // Compare with precomputed analyses of sound A, using the threads of pool.
+  Comparison Compare(absl::Span<const Analysis> analysis_a,
+                     const hwy::AlignedNDArray<float, 2>& frames_a,
+                     absl::Span<const hwy::AlignedNDArray<float, 2>* const>
+                         frames_b_span,
+                     ThreadPool& pool) const;
+
+  // Populates the analysis_absolute_delta, analysis_relative_delta, and
+  // frames_delta of a comparison returned by Compare for the same frames_a and
+  // frames_b_span.
+  //
+  // Compare leaves the deltas empty, since they take as much memory as the
+  // analyses of the sounds B twice over, and most callers only need the
+  // analyses and the dynamic time warps.
+  void ComputeDeltas(const hwy::AlignedNDArray<float, 2>& frames_a,
+                     absl::Span<const hwy::AlignedNDArray<float, 2>* const>
+                         frames_b_span,
+                     Comparison& comparison) const;
+
+  // ComputeDeltas using the threads of pool, with one task per pair of audio
+  // channel and sound B. The result is identical to that of the single
+  // threaded ComputeDeltas.
+  void ComputeDeltas(const hwy::AlignedNDArray<float, 2>& frames_a,
+                     absl::Span<const hwy::AlignedNDArray<float, 2>* const>
+                         frames_b_span,
+                     Comparison& comparison, ThreadPool& pool) const;
+
   // Sample rate corresponding to the human hearing sensitivity to timing
   // differences.
   float perceptual_sample_rate = 100.0;
@@ -296,9 +623,37 @@ struct Zimtohrli {
 
   // The window of the dynamic time warp that matches audio signals.
   //
+  // The window is unwarp_window_seconds * cam_filterbank->sample_rate time
+  // steps of the spectrograms, i.e. it is converted with the audio sample rate
+  // and not perceptual_sample_rate. At the defaults that is 96000 time steps,
+  // so the dynamic time warp covers any practical clip in one window. The MOS
+  // mapping is calibrated with this window, so the conversion is kept.
+  //
   // If zero no dynamic time warp will be performed.
   float unwarp_window_seconds = 2;
 
+  // The maximum warp considered by the dynamic time warp.
+  //
+  // Converted to time steps like unwarp_window_seconds, i.e. the radius is
+  // unwarp_radius_seconds * cam_filterbank->sample_rate time steps.
+  //
+  // If zero the warp is only limited by unwarp_window_seconds.
+  float unwarp_radius_seconds = 0;
+
+  // If nonzero, the dynamic time warp is first computed on time decimated
+  // spectrograms, and then only refined within unwarp_corridor_seconds of the
+  // path found on them, which makes large unwarp windows affordable.
+  //
+  // Converted to time steps like unwarp_window_seconds.
+  //
+  // See CoarseToFineChainDTW for details.
+  float unwarp_corridor_seconds = 0;
+
+  // Whether Compare computes the dynamic time warp once, on the spectrograms,
+  // and uses it for all fields of each AnalysisDTW, instead of computing it
+  // separately for each field.
+  bool share_dtw = true;
+
   // The reference dB SPL of a sine signal of amplitude 1.
   float full_scale_sine_db = 78.3;
 
@@ -317,6 +672,42 @@ struct Zimtohrli {
 
   // Whether the loudness model is applied when creating spectrograms.
   bool apply_loudness = true;
+
+  // Whether dB conversions (in ToDb, the deltas of Compare, and the verbose
+  // fields of Distance) use polynomial approximations of log10 and exp
+  // instead of full precision ones.
+  //
+  // The approximations are off by less than 0.001 dB, which changes distances
+  // by a negligible amount compared to the differences between sounds, so it's
+  // useful for large sweeps where only the ranking matters.
+  bool fast_math = false;
+
+  // If set, the counters the stages of Spectrogram, Distance, and Compare add
+  // their wall time and work to.
+  //
+  // Copies of this instance, e.g. the per sample rate instances of
+  // MultiRateZimtohrli, share the same counters.
+  std::shared_ptr<ZimtohrliStats> stats;
+
+  // If set, computes the energy of whole signals instead of the filterbank of
+  // cam_filterbank, i.e. in the Analyze overloads that don't take a
+  // FilterbankState or channels array, Energy, and Distance of signals.
+  //
+  // Processing in chunks needs the state of the full rate filterbank, so the
+  // Analyze overloads taking a FilterbankState or channels array,
+  // StreamingAnalyzer and IncrementalDistance refuse instances where it is
+  // set.
+  //
+  // Must have been created from cam_filterbank. Trades some precision for
+  // speed, see DecimatedFilterbank.
+  std::shared_ptr<const DecimatedFilterbank> decimated_filterbank;
+
+  // The loudness coefficients the spectrograms use, see
+  // CachedLoudnessCoefficients.
+  //
+  // Not copied by WithFilterbank, since copies have other filterbanks.
+  std::shared_ptr<LoudnessCoefficientsCache> loudness_coefficients_cache =
+      std::make_shared<LoudnessCoefficientsCache>();
 };
 
 }  // namespace zimtohrli
@@ -18,6 +18,7 @@
 #include <cmath>
 #include <cstddef>
 #include <cstdlib>
+#include <memory>
 #include <optional>
 #include <utility>
 #include <vector>
@@ -27,8 +28,11 @@
 #include "hwy/aligned_allocator.h"
 #include "hwy/base.h"
 #include "zimt/cam.h"
+#include "zimt/decimated_filterbank.h"
 #include "zimt/filterbank.h"
 #include "zimt/loudness.h"
+#include "zimt/stats.h"
+#include "zimt/thread_pool.h"
 
 namespace zimtohrli {
 
@@ -129,6 +133,17 @@ TEST(Zimtohrli, DTWDistanceTest) {
               0.0080544948577880859f, 1e-2f);
 }
 
+TEST(Zimtohrli, DTWWindowAndRadiusTest) {
+  // The window is converted with the audio sample rate, which the MOS mapping
+  // is calibrated for, so the default window covers 96000 time steps.
+  Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(48000)};
+  EXPECT_EQ(z.DTWWindowAndRadius().first, size_t{96000});
+  EXPECT_EQ(z.DTWWindowAndRadius().second, size_t{96000});
+  // The radius is converted the same way.
+  z.unwarp_radius_seconds = 0.5;
+  EXPECT_EQ(z.DTWWindowAndRadius().second, size_t{24000});
+}
+
 TEST(Zimtohrli, DistanceTest) {
   hwy::AlignedNDArray<float, 2> spectrogram_a({2, 2});
   hwy::AlignedNDArray<float, 2> spectrogram_b({2, 2});
@@ -341,6 +356,10 @@ TEST(Zimtohrli, ComparisonTest) {
   Analysis analysis_b = z.Analyze(audio_b[0][{0}], channels);
 
   Comparison comparison = z.Compare(audio_a, audio_b_pointers);
+  EXPECT_TRUE(comparison.analysis_absolute_delta.empty());
+  EXPECT_TRUE(comparison.analysis_relative_delta.empty());
+  EXPECT_TRUE(comparison.frames_delta.empty());
+  z.ComputeDeltas(audio_a, audio_b_pointers, comparison);
 
   CheckNear(analysis_a.energy_channels_db,
             comparison.analysis_a[0].energy_channels_db);
@@ -376,6 +395,539 @@ TEST(Zimtohrli, ComparisonTest) {
                  comparison.analysis_relative_delta[0][0].spectrogram);
 }
 
+void CheckEqual(const hwy::AlignedNDArray<float, 2>& array_a,
+                const hwy::AlignedNDArray<float, 2>& array_b) {
+  ASSERT_EQ(array_a.shape(), array_b.shape());
+  for (size_t step_index = 0; step_index < array_a.shape()[0]; ++step_index) {
+    for (size_t channel_index = 0; channel_index < array_a.shape()[1];
+         ++channel_index) {
+      ASSERT_EQ(array_a[{step_index}][channel_index],
+                array_b[{step_index}][channel_index]);
+    }
+  }
+}
+
+void CheckEqual(const Analysis& analysis_a, const Analysis& analysis_b) {
+  CheckEqual(analysis_a.energy_channels_db, analysis_b.energy_channels_db);
+  CheckEqual(analysis_a.partial_energy_channels_db,
+             analysis_b.partial_energy_channels_db);
+  CheckEqual(analysis_a.spectrogram, analysis_b.spectrogram);
+}
+
+TEST(Zimtohrli, ParallelComparisonTest) {
+  const float sample_rate = 48000;
+  const size_t num_samples = static_cast<size_t>(sample_rate / 2);
+  Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+
+  hwy::AlignedNDArray<float, 2> audio_a({2, num_samples});
+  CreateAudio(sample_rate, {{{1000, 0.5}}, {{2000, 0.5}}}, audio_a);
+  std::vector<hwy::AlignedNDArray<float, 2>> audio_b;
+  for (const float frequency : {1100, 2100, 3100}) {
+    hwy::AlignedNDArray<float, 2> frames({2, num_samples});
+    CreateAudio(sample_rate, {{{frequency, 0.5}}, {{frequency * 2, 0.5}}},
+                frames);
+    audio_b.push_back(std::move(frames));
+  }
+  std::vector<const hwy::AlignedNDArray<float, 2>*> audio_b_pointers;
+  for (const hwy::AlignedNDArray<float, 2>& frames : audio_b) {
+    audio_b_pointers.push_back(&frames);
+  }
+
+  Comparison serial = z.Compare(audio_a, audio_b_pointers);
+  z.ComputeDeltas(audio_a, audio_b_pointers, serial);
+  ThreadPool pool(4);
+  Comparison parallel = z.Compare(audio_a, audio_b_pointers, pool);
+  z.ComputeDeltas(audio_a, audio_b_pointers, parallel, pool);
+
+  ASSERT_EQ(parallel.analysis_a.size(), 2);
+  for (size_t channel_index = 0; channel_index < 2; ++channel_index) {
+    CheckEqual(serial.analysis_a[channel_index],
+               parallel.analysis_a[channel_index]);
+  }
+  ASSERT_EQ(parallel.analysis_b.size(), audio_b.size());
+  for (size_t b_index = 0; b_index < audio_b.size(); ++b_index) {
+    ASSERT_EQ(parallel.analysis_b[b_index].size(), 2);
+    for (size_t channel_index = 0; channel_index < 2; ++channel_index) {
+      CheckEqual(serial.analysis_b[b_index][channel_index],
+                 parallel.analysis_b[b_index][channel_index]);
+      CheckEqual(serial.analysis_absolute_delta[b_index][channel_index],
+                 parallel.analysis_absolute_delta[b_index][channel_index]);
+      CheckEqual(serial.analysis_relative_delta[b_index][channel_index],
+                 parallel.analysis_relative_delta[b_index][channel_index]);
+      EXPECT_EQ(serial.dtw[b_index][channel_index].spectrogram,
+                parallel.dtw[b_index][channel_index].spectrogram);
+    }
+    CheckEqual(serial.frames_delta[b_index], parallel.frames_delta[b_index]);
+  }
+}
+
+TEST(Zimtohrli, PrecomputedAnalysisComparisonTest) {
+  const float sample_rate = 48000;
+  const size_t num_samples = static_cast<size_t>(sample_rate / 2);
+  Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+
+  hwy::AlignedNDArray<float, 2> audio_a({2, num_samples});
+  CreateAudio(sample_rate, {{{1000, 0.5}}, {{2000, 0.5}}}, audio_a);
+  hwy::AlignedNDArray<float, 2> audio_b({2, num_samples});
+  CreateAudio(sample_rate, {{{1100, 0.5}}, {{2100, 0.5}}}, audio_b);
+  const std::vector<const hwy::AlignedNDArray<float, 2>*> audio_b_pointers = {
+      &audio_b};
+
+  const Comparison want = z.Compare(audio_a, audio_b_pointers);
+  const std::vector<Analysis> analysis_a = z.AnalyzeAudioChannels(audio_a);
+  // Comparing twice with the same analyses checks that they are left intact.
+  for (int round = 0; round < 2; ++round) {
+    const Comparison got = z.Compare(analysis_a, audio_a, audio_b_pointers);
+    ASSERT_EQ(got.analysis_a.size(), 2);
+    ASSERT_EQ(got.analysis_b.size(), 1);
+    ASSERT_EQ(got.analysis_b[0].size(), 2);
+    for (size_t channel_index = 0; channel_index < 2; ++channel_index) {
+      CheckEqual(want.analysis_a[channel_index], got.analysis_a[channel_index]);
+      CheckEqual(want.analysis_b[0][channel_index],
+                 got.analysis_b[0][channel_index]);
+      EXPECT_EQ(want.dtw[0][channel_index].spectrogram,
+                got.dtw[0][channel_index].spectrogram);
+    }
+  }
+}
+
+TEST(Zimtohrli, SharedDTWTest) {
+  const float sample_rate = 48000;
+  const size_t num_samples = static_cast<size_t>(sample_rate / 2);
+  Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+  ASSERT_TRUE(z.share_dtw);
+
+  hwy::AlignedNDArray<float, 2> audio_a({1, num_samples});
+  CreateAudio(sample_rate, {{{1000, 0.5}, {2000, 0.5}}}, audio_a);
+  hwy::AlignedNDArray<float, 2> audio_b({1, num_samples});
+  CreateAudio(sample_rate, {{{1000, 0.5}, {2100, 0.5}}}, audio_b);
+  const std::vector<const hwy::AlignedNDArray<float, 2>*> audio_b_pointers = {
+      &audio_b};
+
+  const Comparison comparison = z.Compare(audio_a, audio_b_pointers);
+  const Analysis& analysis_a = comparison.analysis_a[0];
+  const Analysis& analysis_b = comparison.analysis_b[0][0];
+  const AnalysisDTW& dtw = comparison.dtw[0][0];
+  const std::vector<std::pair<size_t, size_t>> time_pairs =
+      z.TimePairs(analysis_a.spectrogram, analysis_b.spectrogram);
+  EXPECT_EQ(dtw.energy_channels_db, time_pairs);
+  EXPECT_EQ(dtw.partial_energy_channels_db, time_pairs);
+  EXPECT_EQ(dtw.spectrogram, time_pairs);
+  EXPECT_EQ(
+      z.Distance(false, analysis_a.spectrogram, analysis_b.spectrogram).value,
+      z.Distance(false, analysis_a.spectrogram, analysis_b.spectrogram,
+                 dtw.spectrogram)
+          .value);
+}
+
+TEST(Zimtohrli, WorkspaceTest) {
+  const float sample_rate = 48000;
+  const size_t num_samples = static_cast<size_t>(sample_rate / 2);
+  Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+
+  hwy::AlignedNDArray<float, 2> audio_a({1, num_samples});
+  CreateAudio(sample_rate, {{{1000, 0.5}, {2000, 0.5}}}, audio_a);
+  hwy::AlignedNDArray<float, 2> audio_b({1, num_samples});
+  CreateAudio(sample_rate, {{{1000, 0.5}, {2100, 0.5}}}, audio_b);
+
+  const Analysis analysis_a = z.Analyze(audio_a[{0}]);
+  const Analysis analysis_b = z.Analyze(audio_b[{0}]);
+  const float want_distance =
+      z.Distance(false, analysis_a.spectrogram, analysis_b.spectrogram).value;
+
+  ZimtohrliWorkspace workspace;
+  EXPECT_EQ(z.Distance(audio_a[{0}], audio_b[{0}], workspace), want_distance);
+  ASSERT_TRUE(workspace.analysis_a.has_value());
+  ASSERT_TRUE(workspace.analysis_b.has_value());
+  const float* spectrogram_a_data = workspace.analysis_a->spectrogram.data();
+  const float* spectrogram_b_data = workspace.analysis_b->spectrogram.data();
+
+  // A second call with equally long signals reuses the buffers.
+  EXPECT_EQ(z.Distance(audio_a[{0}], audio_b[{0}], workspace), want_distance);
+  EXPECT_EQ(workspace.analysis_a->spectrogram.data(), spectrogram_a_data);
+  EXPECT_EQ(workspace.analysis_b->spectrogram.data(), spectrogram_b_data);
+  for (size_t step_index = 0; step_index < analysis_a.spectrogram.shape()[0];
+       ++step_index) {
+    for (size_t channel_index = 0;
+         channel_index < analysis_a.spectrogram.shape()[1]; ++channel_index) {
+      EXPECT_EQ(workspace.analysis_a->spectrogram[{step_index}][channel_index],
+                analysis_a.spectrogram[{step_index}][channel_index]);
+    }
+  }
+
+  // Shorter signals get differently shaped analyses.
+  const size_t short_num_samples = num_samples / 2;
+  const hwy::Span<const float> short_a(audio_a[{0}].data(), short_num_samples);
+  const hwy::Span<const float> short_b(audio_b[{0}].data(), short_num_samples);
+  const Analysis short_analysis_a = z.Analyze(short_a);
+  const Analysis short_analysis_b = z.Analyze(short_b);
+  EXPECT_EQ(z.Distance(short_a, short_b, workspace),
+            z.Distance(false, short_analysis_a.spectrogram,
+                       short_analysis_b.spectrogram)
+                .value);
+  EXPECT_EQ(workspace.analysis_a->spectrogram.shape(),
+            short_analysis_a.spectrogram.shape());
+}
+
+void ExpectSameArrays(const hwy::AlignedNDArray<float, 2>& array_a,
+                      const hwy::AlignedNDArray<float, 2>& array_b) {
+  ASSERT_EQ(array_a.shape(), array_b.shape());
+  for (size_t step_index = 0; step_index < array_a.shape()[0]; ++step_index) {
+    for (size_t channel_index = 0; channel_index < array_a.shape()[1];
+         ++channel_index) {
+      EXPECT_EQ(array_a[{step_index}][channel_index],
+                array_b[{step_index}][channel_index]);
+    }
+  }
+}
+
+TEST(Zimtohrli, AnalyzeEnergyTest) {
+  const float sample_rate = 48000;
+  const size_t num_samples = static_cast<size_t>(sample_rate / 2);
+  const Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+
+  hwy::AlignedNDArray<float, 2> audio({1, num_samples});
+  CreateAudio(sample_rate, {{{1000, 0.5}, {2000, 0.5}}}, audio);
+  const hwy::AlignedNDArray<float, 2> energy_channels = z.Energy(audio[{0}]);
+
+  const Analysis want = z.Analyze(audio[{0}]);
+  const Analysis got = z.AnalyzeEnergy(energy_channels);
+  ExpectSameArrays(got.energy_channels_db, want.energy_channels_db);
+  ExpectSameArrays(got.partial_energy_channels_db,
+                   want.partial_energy_channels_db);
+  ExpectSameArrays(got.spectrogram, want.spectrogram);
+
+  // The energy can be reused by instances with different downstream
+  // parameters.
+  Zimtohrli downstream =
+      z.WithFilterbank(Cam{}.CreateFilterbank(sample_rate));
+  downstream.masking.max_mask = 10;
+  downstream.full_scale_sine_db = 70;
+  downstream.nsim_step_window = 4;
+  const Analysis want_downstream = downstream.Analyze(audio[{0}]);
+  const Analysis got_downstream = downstream.AnalyzeEnergy(energy_channels);
+  ExpectSameArrays(got_downstream.spectrogram, want_downstream.spectrogram);
+  float max_change = 0;
+  for (size_t step_index = 0; step_index < want.spectrogram.shape()[0];
+       ++step_index) {
+    for (size_t channel_index = 0;
+         channel_index < want.spectrogram.shape()[1]; ++channel_index) {
+      max_change = std::max(
+          max_change,
+          std::abs(want_downstream.spectrogram[{step_index}][channel_index] -
+                   want.spectrogram[{step_index}][channel_index]));
+    }
+  }
+  EXPECT_GT(max_change, 1);
+}
+
+TEST(Zimtohrli, LoudnessCoefficientsCacheTest) {
+  const float sample_rate = 48000;
+  const size_t num_samples = static_cast<size_t>(sample_rate / 2);
+  Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+
+  hwy::AlignedNDArray<float, 2> audio({1, num_samples});
+  CreateAudio(sample_rate, {{{1000, 0.5}, {2000, 0.5}}}, audio);
+  const Analysis before = z.Analyze(audio[{0}]);
+  EXPECT_EQ(z.CachedLoudnessCoefficients(), z.CachedLoudnessCoefficients());
+
+  // Changing the loudness parameters after the first analysis recomputes the
+  // cached coefficients.
+  z.loudness.a_f_params[0] *= 1.5;
+  const Analysis got = z.Analyze(audio[{0}]);
+  Zimtohrli fresh = z.WithFilterbank(Cam{}.CreateFilterbank(sample_rate));
+  const Analysis want = fresh.Analyze(audio[{0}]);
+  ExpectSameArrays(got.spectrogram, want.spectrogram);
+  float max_change = 0;
+  for (size_t step_index = 0; step_index < want.spectrogram.shape()[0];
+       ++step_index) {
+    for (size_t channel_index = 0;
+         channel_index < want.spectrogram.shape()[1]; ++channel_index) {
+      max_change =
+          std::max(max_change,
+                   std::abs(want.spectrogram[{step_index}][channel_index] -
+                            before.spectrogram[{step_index}][channel_index]));
+    }
+  }
+  EXPECT_GT(max_change, 1);
+}
+
+TEST(Zimtohrli, AnalyzeAudioChannelsTest) {
+  const float sample_rate = 48000;
+  const size_t num_samples = static_cast<size_t>(sample_rate / 2);
+  const Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+
+  // An odd number of audio channels, to verify the odd channel out of the
+  // pairs the filterbank processes together.
+  hwy::AlignedNDArray<float, 2> audio({3, num_samples});
+  CreateAudio(sample_rate,
+              {{{1000, 0.5}}, {{2000, 0.5}, {500, 0.1}}, {{4000, 0.2}}},
+              audio);
+  const std::vector<Analysis> got = z.AnalyzeAudioChannels(audio);
+  ASSERT_EQ(got.size(), size_t{3});
+  for (size_t audio_channel_index = 0; audio_channel_index < got.size();
+       ++audio_channel_index) {
+    const Analysis want = z.Analyze(audio[{audio_channel_index}]);
+    ExpectSameArrays(got[audio_channel_index].energy_channels_db,
+                     want.energy_channels_db);
+    ExpectSameArrays(got[audio_channel_index].partial_energy_channels_db,
+                     want.partial_energy_channels_db);
+    ExpectSameArrays(got[audio_channel_index].spectrogram, want.spectrogram);
+  }
+}
+
+TEST(Zimtohrli, AnalyzeBatchTest) {
+  const float sample_rate = 48000;
+  const size_t num_samples = static_cast<size_t>(sample_rate / 4);
+  const Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+  Zimtohrli decimated_z = z.WithFilterbank(Cam{}.CreateFilterbank(sample_rate));
+  decimated_z.decimated_filterbank =
+      std::make_shared<const DecimatedFilterbank>(*z.cam_filterbank, 16);
+
+  std::vector<std::vector<float>> clips;
+  std::vector<hwy::Span<const float>> signals;
+  for (const float hz : {300.0f, 1000.0f, 2500.0f, 7000.0f}) {
+    std::vector<float>& clip = clips.emplace_back(num_samples);
+    for (size_t sample_index = 0; sample_index < num_samples; ++sample_index) {
+      clip[sample_index] = 0.3 * std::sin(2 * M_PI * hz * sample_index /
+                                          sample_rate);
+    }
+  }
+  for (const std::vector<float>& clip : clips) {
+    signals.emplace_back(clip.data(), clip.size());
+  }
+  for (const Zimtohrli* instance : {&z, &decimated_z}) {
+    const std::vector<Analysis> got = instance->AnalyzeBatch(signals);
+    ASSERT_EQ(got.size(), signals.size());
+    for (size_t signal_index = 0; signal_index < signals.size();
+         ++signal_index) {
+      const Analysis want = instance->Analyze(signals[signal_index]);
+      ExpectSameArrays(got[signal_index].energy_channels_db,
+                       want.energy_channels_db);
+      ExpectSameArrays(got[signal_index].spectrogram, want.spectrogram);
+    }
+  }
+  EXPECT_TRUE(z.AnalyzeBatch({}).empty());
+}
+
+TEST(Zimtohrli, StatsTest) {
+  const float sample_rate = 48000;
+  const size_t num_samples = static_cast<size_t>(sample_rate);
+  Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+  hwy::AlignedNDArray<float, 2> audio_a({1, num_samples});
+  CreateAudio(sample_rate, {{{1000, 0.5}}}, audio_a);
+  hwy::AlignedNDArray<float, 2> audio_b({1, num_samples});
+  CreateAudio(sample_rate, {{{1100, 0.5}}}, audio_b);
+  const float want_distance =
+      z.Distance(false, z.Analyze(audio_a[{0}]).spectrogram,
+                 z.Analyze(audio_b[{0}]).spectrogram)
+          .value;
+
+  z.stats = std::make_shared<ZimtohrliStats>();
+  const Analysis analysis_a = z.Analyze(audio_a[{0}]);
+  const Analysis analysis_b = z.Analyze(audio_b[{0}]);
+  // Recording stats doesn't change the results.
+  EXPECT_EQ(
+      z.Distance(false, analysis_a.spectrogram, analysis_b.spectrogram).value,
+      want_distance);
+
+#ifdef ZIMTOHRLI_STATS
+  const size_t num_steps = analysis_a.spectrogram.shape()[0];
+  EXPECT_EQ(z.stats->filterbank.calls.load(), size_t{2});
+  EXPECT_EQ(z.stats->filterbank.samples.load(), 2 * num_samples);
+  EXPECT_EQ(z.stats->filterbank.bytes_allocated.load(),
+            2 * 3 * num_steps * z.NumChannels() * sizeof(float));
+  EXPECT_EQ(z.stats->masking.calls.load(), size_t{2});
+  EXPECT_EQ(z.stats->masking.samples.load(), 2 * num_steps);
+  EXPECT_EQ(z.stats->loudness.calls.load(), size_t{2});
+  EXPECT_EQ(z.stats->dtw.calls.load(), size_t{1});
+  EXPECT_EQ(z.stats->dtw.samples.load(), num_steps);
+  EXPECT_GT(z.stats->dtw_cells.load(), num_steps);
+  EXPECT_EQ(z.stats->nsim.calls.load(), size_t{1});
+  EXPECT_GE(z.stats->nsim.samples.load(), num_steps);
+  EXPECT_GT(z.stats->nsim.nanoseconds.load(), size_t{0});
+
+  z.stats->Reset();
+  EXPECT_EQ(z.stats->filterbank.calls.load(), size_t{0});
+  EXPECT_EQ(z.stats->dtw_cells.load(), size_t{0});
+#else
+  EXPECT_EQ(z.stats->filterbank.calls.load(), size_t{0});
+#endif
+}
+
+TEST(Zimtohrli, DistanceMatrixTest) {
+  const float sample_rate = 48000;
+  const size_t num_samples = static_cast<size_t>(sample_rate / 4);
+  const Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+  std::vector<Analysis> analyses;
+  for (const float frequency : {1000, 1100, 2000, 4000, 8000}) {
+    hwy::AlignedNDArray<float, 2> audio({1, num_samples});
+    CreateAudio(sample_rate, {{{frequency, 0.5}}}, audio);
+    analyses.push_back(z.Analyze(audio[{0}]));
+  }
+  std::vector<const Analysis*> analysis_pointers;
+  for (const Analysis& analysis : analyses) {
+    analysis_pointers.push_back(&analysis);
+  }
+
+  ThreadPool pool(3);
+  const hwy::AlignedNDArray<float, 2> matrix =
+      z.DistanceMatrix(analysis_pointers, pool);
+  ASSERT_EQ(matrix.shape()[0], analyses.size());
+  ASSERT_EQ(matrix.shape()[1], analyses.size());
+  for (size_t row = 0; row < analyses.size(); ++row) {
+    EXPECT_EQ(matrix[{row}][row], 0);
+    for (size_t column = row + 1; column < analyses.size(); ++column) {
+      EXPECT_EQ(matrix[{row}][column],
+                z.Distance(false, analyses[row].spectrogram,
+                           analyses[column].spectrogram)
+                    .value);
+      EXPECT_EQ(matrix[{column}][row], matrix[{row}][column]);
+    }
+  }
+}
+
+TEST(Zimtohrli, DistanceBelowTest) {
+  const float sample_rate = 48000;
+  const size_t num_samples = static_cast<size_t>(sample_rate / 2);
+  hwy::AlignedNDArray<float, 2> audio_a({1, num_samples});
+  CreateAudio(sample_rate, {{{1000, 0.5}}}, audio_a);
+  // 0 disables the dynamic time warp, 0.0005 seconds makes it run in windows
+  // of 24 steps, and 2 seconds covers the entire spectrograms.
+  for (const float unwarp_window_seconds : {0.0f, 0.0005f, 2.0f}) {
+    const Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate),
+                         .unwarp_window_seconds = unwarp_window_seconds};
+    const Analysis analysis_a = z.Analyze(audio_a[{0}]);
+    ZimtohrliWorkspace workspace;
+    for (const float frequency_b : {1000, 1100, 4000}) {
+      hwy::AlignedNDArray<float, 2> audio_b({1, num_samples});
+      CreateAudio(sample_rate, {{{frequency_b, 0.5}}}, audio_b);
+      const Analysis analysis_b = z.Analyze(audio_b[{0}]);
+      const float distance =
+          z.Distance(false, analysis_a.spectrogram, analysis_b.spectrogram)
+              .value;
+      for (const float threshold :
+           {0.0f, distance * 0.5f, distance, distance * 1.5f + 1e-3f, 1.0f}) {
+        EXPECT_EQ(z.DistanceBelow(analysis_a.spectrogram,
+                                  analysis_b.spectrogram, threshold),
+                  distance < threshold)
+            << "unwarp_window_seconds=" << unwarp_window_seconds
+            << ", frequency_b=" << frequency_b << ", threshold=" << threshold;
+        EXPECT_EQ(z.DistanceBelow(analysis_a.spectrogram,
+                                  analysis_b.spectrogram, threshold,
+                                  workspace),
+                  distance < threshold);
+      }
+    }
+  }
+}
+
+TEST(Zimtohrli, CoarseToFineDTWTest) {
+  const float sample_rate = 48000;
+  const size_t num_samples = static_cast<size_t>(sample_rate);
+  hwy::AlignedNDArray<float, 2> audio_a({1, num_samples});
+  CreateAudio(sample_rate, {{{1000, 0.5}, {3000, 0.1}}}, audio_a);
+  hwy::AlignedNDArray<float, 2> audio_b({1, num_samples});
+  CreateAudio(sample_rate, {{{1100, 0.5}, {3000, 0.1}}}, audio_b);
+  const Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+  const Zimtohrli coarse_to_fine_z = {
+      .cam_filterbank = Cam{}.CreateFilterbank(sample_rate),
+      .unwarp_corridor_seconds = 4 / sample_rate};
+  const Analysis analysis_a = z.Analyze(audio_a[{0}]);
+  const Analysis analysis_b = z.Analyze(audio_b[{0}]);
+  EXPECT_EQ(coarse_to_fine_z.TimePairs(analysis_a.spectrogram,
+                                       analysis_b.spectrogram),
+            z.TimePairs(analysis_a.spectrogram, analysis_b.spectrogram));
+  const float distance =
+      coarse_to_fine_z
+          .Distance(false, analysis_a.spectrogram, analysis_b.spectrogram)
+          .value;
+  for (const float threshold : {distance * 0.5f, distance * 1.5f + 1e-3f}) {
+    EXPECT_EQ(coarse_to_fine_z.DistanceBelow(
+                  analysis_a.spectrogram, analysis_b.spectrogram, threshold),
+              distance < threshold);
+  }
+  // Compare without share_dtw warps each field of the analyses separately.
+  const auto [window_size, warp_radius] = z.DTWWindowAndRadius();
+  const AnalysisDTW dtw(analysis_a, analysis_b, window_size, warp_radius);
+  const AnalysisDTW coarse_to_fine_dtw(analysis_a, analysis_b, window_size,
+                                       warp_radius,
+                                       coarse_to_fine_z.DTWCorridorRadius());
+  EXPECT_EQ(coarse_to_fine_dtw.energy_channels_db, dtw.energy_channels_db);
+  EXPECT_EQ(coarse_to_fine_dtw.partial_energy_channels_db,
+            dtw.partial_energy_channels_db);
+  EXPECT_EQ(coarse_to_fine_dtw.spectrogram, dtw.spectrogram);
+}
+
+TEST(Zimtohrli, FastMathTest) {
+  const float sample_rate = 48000;
+  const size_t num_samples = static_cast<size_t>(sample_rate);
+  const Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+  Zimtohrli fast_z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+  fast_z.fast_math = true;
+
+  // Pairs of (frequency, amplitude) of sound A and sound B.
+  const std::vector<std::vector<std::pair<float, float>>> corpus = {
+      {{1000, 0.5}, {1000, 0.25}}, {{100, 0.1}, {110, 0.1}},
+      {{5000, 1.0}, {5500, 0.01}}, {{440, 0.01}, {440, 0.011}},
+      {{10000, 0.5}, {2000, 0.5}}};
+  for (const std::vector<std::pair<float, float>>& pair : corpus) {
+    hwy::AlignedNDArray<float, 2> audio_a({1, num_samples});
+    CreateAudio(sample_rate, {{pair[0]}}, audio_a);
+    hwy::AlignedNDArray<float, 2> audio_b({1, num_samples});
+    CreateAudio(sample_rate, {{pair[1]}}, audio_b);
+
+    const Analysis analysis_a = z.Analyze(audio_a[{0}]);
+    const Analysis analysis_b = z.Analyze(audio_b[{0}]);
+    const Distance distance =
+        z.Distance(true, analysis_a.spectrogram, analysis_b.spectrogram);
+    const Analysis fast_analysis_a = fast_z.Analyze(audio_a[{0}]);
+    const Analysis fast_analysis_b = fast_z.Analyze(audio_b[{0}]);
+    const Distance fast_distance = fast_z.Distance(
+        true, fast_analysis_a.spectrogram, fast_analysis_b.spectrogram);
+
+    EXPECT_NEAR(fast_distance.value, distance.value, 1e-4);
+    EXPECT_NEAR(fast_distance.max_absolute_delta.value,
+                distance.max_absolute_delta.value, 1e-2);
+    EXPECT_NEAR(fast_distance.max_relative_delta.value,
+                distance.max_relative_delta.value, 1e-2);
+  }
+}
+
+TEST(Zimtohrli, CompactAnalysisTest) {
+  const float sample_rate = 48000;
+  const size_t num_samples = static_cast<size_t>(sample_rate / 2);
+  const Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+
+  hwy::AlignedNDArray<float, 2> audio_a({1, num_samples});
+  CreateAudio(sample_rate, {{{1000, 0.5}, {2000, 0.5}}}, audio_a);
+  hwy::AlignedNDArray<float, 2> audio_b({1, num_samples});
+  CreateAudio(sample_rate, {{{1000, 0.5}, {3000, 0.5}}}, audio_b);
+
+  const Analysis analysis_a = z.Analyze(audio_a[{0}]);
+  const Analysis analysis_b = z.Analyze(audio_b[{0}]);
+  const CompactAnalysis compact_a = Compact(analysis_a);
+  EXPECT_EQ(compact_a.spectrogram.shape(), analysis_a.spectrogram.shape());
+  const hwy::AlignedNDArray<float, 2> widened_a = WidenSpectrogram(compact_a);
+  const hwy::AlignedNDArray<float, 2> widened_b =
+      WidenSpectrogram(Compact(analysis_b));
+  ASSERT_EQ(widened_a.shape(), analysis_a.spectrogram.shape());
+  for (size_t step_index = 0; step_index < widened_a.shape()[0];
+       ++step_index) {
+    for (size_t channel_index = 0; channel_index < widened_a.shape()[1];
+         ++channel_index) {
+      const float want = analysis_a.spectrogram[{step_index}][channel_index];
+      EXPECT_NEAR(widened_a[{step_index}][channel_index], want,
+                  std::abs(want) / 2048);
+    }
+  }
+
+  EXPECT_NEAR(
+      z.Distance(false, widened_a, widened_b).value,
+      z.Distance(false, analysis_a.spectrogram, analysis_b.spectrogram).value,
+      1e-2);
+}
+
 TEST(Zimtohrli, NormalizeAmplitudeTest) {
   hwy::AlignedNDArray<float, 1> reference({8});
   reference[{}] = {0.5, 0.5, 0.5, 0.5, 0.5, 0.5, 0.5, 0.5};
@@ -396,6 +948,49 @@ TEST(Zimtohrli, NormalizeAmplitudeTest) {
   EXPECT_EQ(signal_measurements.max_abs_amplitude, 0.5);
 }
 
+TEST(Zimtohrli, UnalignedSignalTest) {
+  const size_t num_samples = 1037;
+  hwy::AlignedNDArray<float, 1> buffer({num_samples + 1});
+  for (size_t index = 0; index < buffer.shape()[0]; ++index) {
+    buffer[{}][index] = 0.5 * std::sin(0.1 * index) * (index % 3 ? 1 : -0.5);
+  }
+  // Starts one float into the buffer, and isn't a multiple of any lane count.
+  const hwy::Span<float> signal(buffer.data() + 1, num_samples);
+  double want_energy = 0;
+  float want_max = 0;
+  for (size_t index = 0; index < num_samples; ++index) {
+    want_energy += signal[index] * signal[index];
+    want_max = std::max(want_max, std::abs(signal[index]));
+  }
+  const EnergyAndMaxAbsAmplitude measurements = Measure(signal);
+  EXPECT_NEAR(measurements.energy_db_fs,
+              20 * std::log10(want_energy / num_samples), 1e-4);
+  EXPECT_EQ(measurements.max_abs_amplitude, want_max);
+
+  const float sample_rate = 48000;
+  const Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+  hwy::AlignedNDArray<float, 1> aligned_signal({num_samples});
+  hwy::CopyBytes(signal.data(), aligned_signal.data(),
+                 num_samples * sizeof(float));
+  const Analysis analysis = z.Analyze(signal);
+  const Analysis aligned_analysis = z.Analyze(aligned_signal[{}]);
+  CheckEqual(analysis, aligned_analysis);
+
+  const float first_sample = buffer[{}][0];
+  const std::vector<float> original(signal.data(),
+                                    signal.data() + num_samples);
+  const EnergyAndMaxAbsAmplitude normalized =
+      NormalizeAmplitude(2 * want_max, signal);
+  EXPECT_EQ(normalized.max_abs_amplitude, 2 * want_max);
+  EXPECT_NEAR(normalized.energy_db_fs,
+              20 * std::log10(4 * want_energy / num_samples), 1e-4);
+  for (size_t index = 0; index < num_samples; ++index) {
+    EXPECT_NEAR(signal[index], 2 * original[index], 1e-6);
+  }
+  // The sample before the span is untouched.
+  EXPECT_EQ(buffer[{}][0], first_sample);
+}
+
 TEST(Zimtohrli, SpectrogramTest) {
   const float full_scale_sine_db = 80;
   const float sample_rate = 48000;
@@ -527,6 +1122,72 @@ void BM_SpectrogramDistanceVsResolution(benchmark::State& state) {
 }
 BENCHMARK_RANGE(BM_SpectrogramDistanceVsResolution, 1, 64);
 
+void BM_VerboseDistance(benchmark::State& state) {
+  const Cam cam;
+  const Zimtohrli z = {.cam_filterbank = cam.CreateFilterbank(48000),
+                       .unwarp_window_seconds = 0};
+  const size_t num_steps = 100 * state.range(0);
+  hwy::AlignedNDArray<float, 2> spectrogram_a({num_steps, z.NumChannels()});
+  hwy::AlignedNDArray<float, 2> spectrogram_b({num_steps, z.NumChannels()});
+  for (size_t step_index = 0; step_index < num_steps; ++step_index) {
+    for (size_t channel_index = 0; channel_index < z.NumChannels();
+         ++channel_index) {
+      spectrogram_a[{step_index}][channel_index] =
+          40 + 20 * sin(static_cast<float>(step_index * channel_index));
+      spectrogram_b[{step_index}][channel_index] =
+          40 + 20 * cos(static_cast<float>(step_index + channel_index));
+    }
+  }
+  for (auto s : state) {
+    z.Distance(/* verbose */ true, spectrogram_a, spectrogram_b);
+  }
+  state.SetItemsProcessed(num_steps * z.NumChannels() * state.iterations());
+}
+BENCHMARK_RANGE(BM_VerboseDistance, 1, 64);
+
+// Returns num_clips one second clips at sample_rate, for the batch analysis
+// benchmarks.
+hwy::AlignedNDArray<float, 2> CreateClips(size_t sample_rate,
+                                          size_t num_clips) {
+  hwy::AlignedNDArray<float, 2> clips({num_clips, sample_rate});
+  CreateAudio(sample_rate,
+              std::vector<std::vector<std::pair<float, float>>>(
+                  num_clips, {{1000, 0.5}, {2000, 0.5}}),
+              clips);
+  return clips;
+}
+
+void BM_AnalyzeEach(benchmark::State& state) {
+  const size_t sample_rate = 48000;
+  const Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+  const hwy::AlignedNDArray<float, 2> clips =
+      CreateClips(sample_rate, state.range(0));
+  for (auto s : state) {
+    for (size_t clip_index = 0; clip_index < clips.shape()[0];
+         ++clip_index) {
+      z.Analyze(clips[{clip_index}]);
+    }
+  }
+  state.SetItemsProcessed(clips.size() * state.iterations());
+}
+BENCHMARK_RANGE(BM_AnalyzeEach, 1, 8);
+
+void BM_AnalyzeBatch(benchmark::State& state) {
+  const size_t sample_rate = 48000;
+  const Zimtohrli z = {.cam_filterbank = Cam{}.CreateFilterbank(sample_rate)};
+  const hwy::AlignedNDArray<float, 2> clips =
+      CreateClips(sample_rate, state.range(0));
+  std::vector<hwy::Span<const float>> signals;
+  for (size_t clip_index = 0; clip_index < clips.shape()[0]; ++clip_index) {
+    signals.push_back(clips[{clip_index}]);
+  }
+  for (auto s : state) {
+    z.AnalyzeBatch(signals);
+  }
+  state.SetItemsProcessed(clips.size() * state.iterations());
+}
+BENCHMARK_RANGE(BM_AnalyzeBatch, 1, 8);
+
 TEST(Zimtohrli, FindMaxDistortionTest) {
   // Reference sound pressure of a sine signal with amplitude 1.
   const float full_scale_sine_db = 80;
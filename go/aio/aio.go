@@ -25,6 +25,7 @@ import (
 	"strings"
 
 	"github.com/google/zimtohrli/go/audio"
+	"github.com/google/zimtohrli/go/goohrli"
 )
 
 // Fetch calls Recode if path ends with .wav, otherwise Copy.
@@ -41,7 +42,20 @@ func Load(path string) (*audio.Audio, error) {
 }
 
 // LoadAtRate loads audio from an ffmpeg-decodable file from a path (which may be a URL) and returns it at the given sample rate.
+//
+// Local files that libsndfile can decode, and that already have the given sample rate, are decoded in process by
+// goohrli.LoadAudioAtRate. Other files are decoded and resampled by an ffmpeg subprocess.
 func LoadAtRate(path string, rate int) (*audio.Audio, error) {
+	if !strings.Contains(path, "://") {
+		if result, err := goohrli.LoadAudioAtRate(path, float64(rate)); err == nil {
+			return result, nil
+		}
+	}
+	return loadWithFFmpeg(path, rate)
+}
+
+// loadWithFFmpeg decodes the file at path to 16-bit WAV at the given sample rate using ffmpeg.
+func loadWithFFmpeg(path string, rate int) (*audio.Audio, error) {
 	cmd := exec.Command("ffmpeg", "-i", path, "-vn", "-acodec", "pcm_s16le", "-f", "wav", "-ar", fmt.Sprint(rate), "-")
 	stdout, stderr := &bytes.Buffer{}, &bytes.Buffer{}
 	cmd.Stdout, cmd.Stderr = stdout, stderr
@@ -24,7 +24,10 @@ import (
 	"reflect"
 	"runtime"
 	"sort"
+	"strconv"
+	"strings"
 
+	"github.com/google/zimtohrli/go/audio"
 	"github.com/google/zimtohrli/go/data"
 	"github.com/google/zimtohrli/go/goohrli"
 	"github.com/google/zimtohrli/go/pipe"
@@ -40,8 +43,13 @@ func main() {
 	details := flag.String("details", "", "Glob to directories with databases to show the details of.")
 	calculate := flag.String("calculate", "", "Glob to directories with databases to calculate metrics for.")
 	force := flag.Bool("force", false, "Whether to recalculate scores that already exist.")
+	shard := flag.String("shard", "", "Shard 'i/N' of the references to calculate metrics for, with i in [0, N), to split a calculation between N machines. Requires -shard_dir when N > 1.")
+	shardDir := flag.String("shard_dir", "", "Directory to checkpoint the scores of the shard to instead of the calculated databases, in a database directory per calculated one, named by its base name and a hash of its absolute path. Combine the shards afterwards with -merge.")
+	merge := flag.String("merge", "", "Glob to directories with shard databases, written by -shard_dir, to merge into the database in -merge_into, e.g. 'shards/*/STUDY-*' for the shards of STUDY copied from each machine to a directory in shards.")
+	mergeInto := flag.String("merge_into", "", "Directory with the database to merge the shard databases in -merge into.")
 	calculateZimtohrli := flag.Bool("calculate_zimtohrli", false, "Whether to calculate Zimtohrli scores.")
 	zimtohrliScoreType := flag.String("zimtohrli_score_type", string(data.Zimtohrli), "Score type name to use when storing Zimtohrli scores in a dataset.")
+	analysisDir := flag.String("analysis_dir", "", "Directory to persist reference analyses in, so that repeated Zimtohrli calculations with the same parameters skip analyzing the references.")
 	calculateViSQOL := flag.Bool("calculate_visqol", false, "Whether to calculate ViSQOL scores.")
 	calculatePipeMetric := flag.String("calculate_pipe", "", "Path to a binary that serves metrics via stdin/stdout pipe. Install some of the via 'install_python_metrics.py'.")
 	zimtohrliParameters := goohrli.DefaultParameters(48000)
@@ -58,11 +66,12 @@ func main() {
 	optimizeLogfile := flag.String("optimize_logfile", "", "File to write optimization events to.")
 	optimizeStartStep := flag.Float64("optimize_start_step", 1, "Start step for the simulated annealing.")
 	optimizeNumSteps := flag.Float64("optimize_num_steps", 1000, "Number of steps for the simulated annealing.")
+	optimizeFilterbankMutationRate := flag.Float64("optimize_filterbank_mutation_rate", 1, "Fraction of the simulated annealing steps that mutate the filterbank parameters. The other steps only mutate the NSIM windows and reuse cached channel energies. 1 mutates all parameters every step.")
 	workers := flag.Int("workers", runtime.NumCPU(), "Number of concurrent workers for tasks.")
 	failFast := flag.Bool("fail_fast", false, "Whether to panic immediately on any error.")
 	flag.Parse()
 
-	if *details == "" && *calculate == "" && *correlate == "" && *accuracy == "" && *leaderboard == "" && *report == "" && *optimize == "" {
+	if *details == "" && *calculate == "" && *merge == "" && *correlate == "" && *accuracy == "" && *leaderboard == "" && *report == "" && *optimize == "" {
 		flag.Usage()
 		os.Exit(1)
 	}
@@ -88,12 +97,34 @@ func main() {
 				f.Sync()
 			}
 		}
-		err = bundles.Optimize(*optimizeStartStep, *optimizeNumSteps, optimizeLog)
+		err = bundles.Optimize(*optimizeStartStep, *optimizeNumSteps, *optimizeFilterbankMutationRate, optimizeLog)
 		if err != nil {
 			log.Fatal(err)
 		}
 	}
 
+	shardIndex, shardCount := 0, 1
+	if *shard != "" {
+		index, count, found := strings.Cut(*shard, "/")
+		if !found {
+			log.Fatalf("-shard %q is not 'i/N'", *shard)
+		}
+		if shardIndex, err = strconv.Atoi(index); err != nil {
+			log.Fatalf("-shard %q is not 'i/N': %v", *shard, err)
+		}
+		if shardCount, err = strconv.Atoi(count); err != nil {
+			log.Fatalf("-shard %q is not 'i/N': %v", *shard, err)
+		}
+		if shardIndex < 0 || shardIndex >= shardCount {
+			log.Fatalf("-shard %q doesn't have 0 <= i < N", *shard)
+		}
+		// The write-ahead log of the databases doesn't work over network file systems, so the shards on different
+		// machines can't checkpoint to a shared database.
+		if shardCount > 1 && *shardDir == "" {
+			log.Fatalf("-shard %q requires -shard_dir, since the machines can't share a database", *shard)
+		}
+	}
+
 	if *calculate != "" {
 		studies, err := data.OpenStudies(*calculate)
 		if err != nil {
@@ -108,7 +139,16 @@ func main() {
 				}
 				zimtohrliParameters.SampleRate = sampleRate
 				z := goohrli.New(zimtohrliParameters)
-				measurements[data.ScoreType(*zimtohrliScoreType)] = z.NormalizedAudioDistance
+				cache := goohrli.NewAnalysisCache(runtime.NumCPU())
+				if *analysisDir != "" {
+					if err := os.MkdirAll(*analysisDir, 0755); err != nil {
+						log.Fatal(err)
+					}
+					cache = goohrli.NewPersistentAnalysisCache(runtime.NumCPU(), *analysisDir)
+				}
+				measurements[data.ScoreType(*zimtohrliScoreType)] = func(ref, dist *audio.Audio) (float64, error) {
+					return z.CachedNormalizedAudioDistance(cache, ref, dist)
+				}
 			}
 			if *calculateViSQOL {
 				v := goohrli.NewViSQOL()
@@ -135,6 +175,41 @@ func main() {
 			if err != nil {
 				log.Fatal(err)
 			}
+			if bundle, err = bundle.Shard(shardIndex, shardCount); err != nil {
+				log.Fatal(err)
+			}
+			if len(bundle.References) == 0 {
+				log.Printf("*** No references in shard %v/%v of %v", shardIndex, shardCount, bundle.Dir)
+				continue
+			}
+			output := study
+			if *shardDir != "" {
+				shardPath, err := data.ShardStudyDir(*shardDir, study.Dir())
+				if err != nil {
+					log.Fatal(err)
+				}
+				if output, err = data.OpenStudy(shardPath); err != nil {
+					log.Fatal(err)
+				}
+				// Adds the references of the shard to the shard database, which keeps the scores checkpointed by
+				// earlier runs, and resumes from those scores.
+				if err := output.MergeReferences(bundle.References); err != nil {
+					log.Fatal(err)
+				}
+				numRefs := len(bundle.References)
+				if bundle, err = output.ToBundle(); err != nil {
+					log.Fatal(err)
+				}
+				if len(bundle.References) != numRefs {
+					log.Fatalf("%v has other references than shard %v/%v of %v", shardPath, shardIndex, shardCount, study.Dir())
+				}
+				// The paths of the references are relative to the calculated database.
+				bundle.Dir = study.Dir()
+			}
+			scoreTypes := []data.ScoreType{}
+			for scoreType := range measurements {
+				scoreTypes = append(scoreTypes, scoreType)
+			}
 			log.Printf("*** Calculating %+v (force=%v) for %v", sortedTypes, *force, bundle.Dir)
 			bar := progress.New("Calculating")
 			pool := &worker.Pool[any]{
@@ -142,14 +217,40 @@ func main() {
 				OnChange: bar.Update,
 				FailFast: *failFast,
 			}
-			if err := bundle.Calculate(measurements, pool, *force); err != nil {
+			checkpoint := func(ref *data.Reference, dist *data.Distortion) error {
+				return output.PutScores([]*data.Reference{{Name: ref.Name, Distortions: []*data.Distortion{dist}}}, scoreTypes)
+			}
+			if err := bundle.CalculateWithCheckpoint(measurements, pool, *force, checkpoint); err != nil {
 				log.Printf("%#v", err)
 				log.Fatal(err)
 			}
-			if err := study.Put(bundle.References); err != nil {
+			bar.Finish()
+			if output != study {
+				if err := output.Close(); err != nil {
+					log.Fatal(err)
+				}
+			}
+		}
+	}
+
+	if *merge != "" {
+		if *mergeInto == "" {
+			log.Fatal("-merge requires -merge_into")
+		}
+		shards, err := data.OpenStudies(*merge)
+		if err != nil {
+			log.Fatal(err)
+		}
+		defer shards.Close()
+		study, err := data.OpenStudy(*mergeInto)
+		if err != nil {
+			log.Fatal(err)
+		}
+		defer study.Close()
+		for _, shardStudy := range shards {
+			if err := study.Merge(shardStudy); err != nil {
 				log.Fatal(err)
 			}
-			bar.Finish()
 		}
 	}
 
@@ -20,6 +20,7 @@ import (
 	"database/sql"
 	"encoding/json"
 	"fmt"
+	"hash/fnv"
 	"io"
 	"log"
 	"math"
@@ -30,6 +31,7 @@ import (
 	"runtime"
 	"sort"
 	"strings"
+	"sync"
 	"time"
 
 	"github.com/dgryski/go-onlinestats"
@@ -91,6 +93,8 @@ func (s ScoreTypes) Swap(i, j int) {
 type Study struct {
 	dir string
 	db  *sql.DB
+	// mutex serializes the write transactions, which sqlite doesn't run concurrently.
+	mutex sync.Mutex
 }
 
 // ReferenceBundle is a plain data type containing a bunch of references, typicall the content of a study.
@@ -129,6 +133,42 @@ func (r *ReferenceBundle) Add(ref *Reference) {
 	r.References = append(r.References, ref)
 }
 
+// Shard returns a bundle with the references of shard index of count shards of this bundle.
+//
+// References are assigned to shards by a hash of their names, so the shards are disjoint, cover the bundle, and
+// don't depend on the order of the references or on which machine computes them.
+func (r *ReferenceBundle) Shard(index, count int) (*ReferenceBundle, error) {
+	if count < 1 || index < 0 || index >= count {
+		return nil, fmt.Errorf("shard %v/%v is not a shard index in [0, %v)", index, count, count)
+	}
+	result := &ReferenceBundle{
+		Dir:        r.Dir,
+		ScoreTypes: map[ScoreType]int{},
+	}
+	for _, ref := range r.References {
+		hash := fnv.New64a()
+		hash.Write([]byte(ref.Name))
+		if hash.Sum64()%uint64(count) == uint64(index) {
+			result.Add(ref)
+		}
+	}
+	return result, nil
+}
+
+// ShardStudyDir returns the directory in shardDir to checkpoint the scores of shards of the study in studyDir to.
+//
+// The directory is named by the base name of studyDir followed by a hash of its absolute path, so that studies with
+// the same base name in different directories get different shard databases.
+func ShardStudyDir(shardDir, studyDir string) (string, error) {
+	absDir, err := filepath.Abs(studyDir)
+	if err != nil {
+		return "", err
+	}
+	hash := fnv.New64a()
+	hash.Write([]byte(absDir))
+	return filepath.Join(shardDir, fmt.Sprintf("%s-%016x", filepath.Base(absDir), hash.Sum64())), nil
+}
+
 // ToBundle returns a reference bundle for this study.
 func (s *Study) ToBundle() (*ReferenceBundle, error) {
 	result := &ReferenceBundle{
@@ -403,6 +443,37 @@ func (s Studies) ToBundles() (ReferenceBundles, error) {
 // in the bundles. For JDN bundles this means 1 - accuracy, for the MOS bundles it means
 // 1 - Spearman correlation.
 func (r ReferenceBundles) CalculateZimtohrliMSE(z *goohrli.Goohrli) (float64, error) {
+	return r.calculateZimtohrliMSE(func() Measurement {
+		cache := goohrli.NewAnalysisCache(runtime.NumCPU())
+		return func(ref, dist *audio.Audio) (float64, error) {
+			return z.CachedNormalizedAudioDistance(cache, ref, dist)
+		}
+	})
+}
+
+// CalculateStagedZimtohrliMSE is like CalculateZimtohrliMSE, but gets the channel energies of all references and
+// distortions from the cache, so that evaluating parameters that only differ from previously evaluated ones
+// downstream of the filterbank skips the filterbank entirely.
+func (r ReferenceBundles) CalculateStagedZimtohrliMSE(z *goohrli.Goohrli, cache *goohrli.EnergyCache) (float64, error) {
+	return r.calculateZimtohrliMSE(func() Measurement {
+		return func(ref, dist *audio.Audio) (float64, error) {
+			return z.StagedNormalizedAudioDistance(cache, ref, dist)
+		}
+	})
+}
+
+// Signals returns the number of references and distortions in all the bundles.
+func (r ReferenceBundles) Signals() int {
+	res := 0
+	for _, bundle := range r {
+		for _, ref := range bundle.References {
+			res += 1 + len(ref.Distortions)
+		}
+	}
+	return res
+}
+
+func (r ReferenceBundles) calculateZimtohrliMSE(newMeasurement func() Measurement) (float64, error) {
 	sumOfSquares := 0.0
 	for _, bundle := range r {
 		bar := progress.New(fmt.Sprintf("Calculating for %v", filepath.Base(bundle.Dir)))
@@ -410,7 +481,8 @@ func (r ReferenceBundles) CalculateZimtohrliMSE(z *goohrli.Goohrli) (float64, er
 			Workers:  runtime.NumCPU(),
 			OnChange: bar.Update,
 		}
-		if err := bundle.Calculate(map[ScoreType]Measurement{Zimtohrli: z.NormalizedAudioDistance}, pool, true); err != nil {
+		measurement := newMeasurement()
+		if err := bundle.Calculate(map[ScoreType]Measurement{Zimtohrli: measurement}, pool, true); err != nil {
 			return 0, err
 		}
 		if bundle.IsJND() {
@@ -468,12 +540,25 @@ func mutateInt(i, min, max int, rng *rand.Rand, temp float64) int {
 
 const sampleRate = 48000
 
-func mutate(z *goohrli.Goohrli, rng *rand.Rand, temp float64) *goohrli.Goohrli {
+// mutate returns a mutation of z.
+//
+// With a filterbankMutationRate of 1 or more every step mutates all parameters. Otherwise only that fraction of
+// the steps mutate the parameters of the filterbank stage, and the other steps only mutate parameters downstream of
+// it, so they can reuse cached channel energies.
+func mutate(z *goohrli.Goohrli, rng *rand.Rand, temp, filterbankMutationRate float64) *goohrli.Goohrli {
 	params := z.Parameters()
-	params.PerceptualSampleRate = mutateFloat(params.PerceptualSampleRate, 50, 150, rng, temp)
-	params.FrequencyResolution = mutateFloat(params.FrequencyResolution, 1, 15, rng, temp)
-	params.NSIMChannelWindow = mutateInt(params.NSIMChannelWindow, 3, 64, rng, temp)
-	params.NSIMStepWindow = mutateInt(params.NSIMStepWindow, 3, 64, rng, temp)
+	if filterbankMutationRate >= 1 {
+		params.PerceptualSampleRate = mutateFloat(params.PerceptualSampleRate, 50, 150, rng, temp)
+		params.FrequencyResolution = mutateFloat(params.FrequencyResolution, 1, 15, rng, temp)
+		params.NSIMChannelWindow = mutateInt(params.NSIMChannelWindow, 3, 64, rng, temp)
+		params.NSIMStepWindow = mutateInt(params.NSIMStepWindow, 3, 64, rng, temp)
+	} else if rng.Float64() < filterbankMutationRate {
+		params.PerceptualSampleRate = mutateFloat(params.PerceptualSampleRate, 50, 150, rng, temp)
+		params.FrequencyResolution = mutateFloat(params.FrequencyResolution, 1, 15, rng, temp)
+	} else {
+		params.NSIMChannelWindow = mutateInt(params.NSIMChannelWindow, 3, 64, rng, temp)
+		params.NSIMStepWindow = mutateInt(params.NSIMStepWindow, 3, 64, rng, temp)
+	}
 	result := goohrli.New(params)
 	return result
 }
@@ -526,9 +611,16 @@ type OptimizationEvent struct {
 
 // Optimize will use simulated annealing to optimize a Zimtohrli metric for predicting
 // these bundles.
-func (r ReferenceBundles) Optimize(startStep, numSteps float64, logger func(OptimizationEvent)) error {
+//
+// filterbankMutationRate is the fraction of the steps that mutate the parameters of the filterbank, see mutate. 1
+// mutates all parameters every step.
+//
+// Keeps the channel energies of the signals for the two most recent sets of filterbank parameters, so steps that
+// only mutate parameters downstream of the filterbank don't recompute it.
+func (r ReferenceBundles) Optimize(startStep, numSteps, filterbankMutationRate float64, logger func(OptimizationEvent)) error {
+	cache := goohrli.NewEnergyCache(2 * r.Signals())
 	z := goohrli.New(goohrli.DefaultParameters(sampleRate))
-	loss, err := r.CalculateZimtohrliMSE(z)
+	loss, err := r.CalculateStagedZimtohrliMSE(z, cache)
 	if err != nil {
 		return err
 	}
@@ -537,9 +629,9 @@ func (r ReferenceBundles) Optimize(startStep, numSteps float64, logger func(Opti
 	for step := startStep; step < numSteps; step++ {
 		rng := rand.New(rand.NewSource(int64(step)))
 		temp := 1.0 - (step+1)/numSteps
-		newZ := mutate(z, rng, temp)
+		newZ := mutate(z, rng, temp, filterbankMutationRate)
 		log.Printf("Created new solution %+v", newZ)
-		newLoss, err := r.CalculateZimtohrliMSE(newZ)
+		newLoss, err := r.CalculateStagedZimtohrliMSE(newZ, cache)
 		if err != nil {
 			return err
 		}
@@ -801,13 +893,77 @@ func OpenStudy(dir string) (*Study, error) {
 	if err != nil {
 		return nil, fmt.Errorf("trying to open %q: %v", dbPath, err)
 	}
-	if _, err := db.Exec("CREATE TABLE IF NOT EXISTS OBJ (ID BLOB PRIMARY KEY, DATA BLOB)"); err != nil {
-		return nil, fmt.Errorf("trying to ensure object table: %v", err)
+	if _, err := db.Exec("PRAGMA journal_mode = WAL"); err != nil {
+		return nil, fmt.Errorf("trying to enable write-ahead logging: %v", err)
+	}
+	if _, err := db.Exec(studySchema); err != nil {
+		return nil, fmt.Errorf("trying to ensure study tables: %v", err)
 	}
-	return &Study{
+	result := &Study{
 		dir: dir,
 		db:  db,
-	}, nil
+	}
+	if err := result.migrateObjects(); err != nil {
+		return nil, fmt.Errorf("trying to migrate objects in %q: %v", dbPath, err)
+	}
+	return result, nil
+}
+
+// studySchema stores references, distortions, and scores in separate tables, so that updating or reading scores
+// doesn't have to rewrite or decode whole references.
+//
+// Distortions are keyed by reference and name, and IDX keeps their order within the reference. Scores are keyed by
+// reference, distortion, and score type.
+const studySchema = `
+CREATE TABLE IF NOT EXISTS REF (NAME TEXT PRIMARY KEY, PATH TEXT) WITHOUT ROWID;
+CREATE TABLE IF NOT EXISTS DIST (REF TEXT, NAME TEXT, IDX INTEGER, PATH TEXT, PRIMARY KEY (REF, NAME)) WITHOUT ROWID;
+CREATE INDEX IF NOT EXISTS DIST_ORDER ON DIST (REF, IDX);
+CREATE TABLE IF NOT EXISTS SCORE (REF TEXT, DIST TEXT, TYPE TEXT, VALUE REAL, PRIMARY KEY (REF, DIST, TYPE)) WITHOUT ROWID;
+`
+
+// migrateObjects moves the references of studies created before studySchema, stored as JSON in an OBJ table, into
+// the tables of studySchema, and drops the OBJ table.
+func (s *Study) migrateObjects() error {
+	tables := 0
+	if err := s.db.QueryRow("SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'OBJ'").Scan(&tables); err != nil {
+		return err
+	}
+	if tables == 0 {
+		return nil
+	}
+	return s.update(func(tx *sql.Tx) error {
+		rows, err := tx.Query("SELECT DATA FROM OBJ")
+		if err != nil {
+			return err
+		}
+		refs := []*Reference{}
+		for rows.Next() {
+			var value []byte
+			if err := rows.Scan(&value); err != nil {
+				rows.Close()
+				return err
+			}
+			ref := &Reference{}
+			if err := json.Unmarshal(value, ref); err != nil {
+				rows.Close()
+				return err
+			}
+			refs = append(refs, ref)
+		}
+		if err := rows.Close(); err != nil {
+			return err
+		}
+		if err := putReferences(tx, refs); err != nil {
+			return err
+		}
+		_, err = tx.Exec("DROP TABLE OBJ")
+		return err
+	})
+}
+
+// Dir returns the directory of the study.
+func (s *Study) Dir() string {
+	return s.dir
 }
 
 // Close closes the study.
@@ -818,8 +974,20 @@ func (s *Study) Close() error {
 // Measurement returns distance between sounds.
 type Measurement func(reference, distortion *audio.Audio) (float64, error)
 
+// Checkpoint persists the scores of a distortion of a reference.
+type Checkpoint func(ref *Reference, dist *Distortion) error
+
 // Calculate computes measurements and populates the scores of the distortions.
 func (r *ReferenceBundle) Calculate(measurements map[ScoreType]Measurement, pool *worker.Pool[any], force bool) error {
+	return r.CalculateWithCheckpoint(measurements, pool, force, nil)
+}
+
+// CalculateWithCheckpoint computes measurements, populates the scores of the distortions, and calls checkpoint, if
+// not nil, for each distortion once all its scores are computed.
+//
+// Checkpointing the scores to the study lets an interrupted calculation resume where it left off, since scores that
+// already exist are only recomputed if force is true.
+func (r *ReferenceBundle) CalculateWithCheckpoint(measurements map[ScoreType]Measurement, pool *worker.Pool[any], force bool, checkpoint Checkpoint) error {
 	for _, loopRef := range r.References {
 		refNeededMeasurements := map[ScoreType]Measurement{}
 		for _, dist := range loopRef.Distortions {
@@ -854,6 +1022,9 @@ func (r *ReferenceBundle) Calculate(measurements map[ScoreType]Measurement, pool
 					if err != nil {
 						return err
 					}
+					// mutex guards the scores of dist, and remainingMeasurements counts the scores left to compute.
+					var mutex sync.Mutex
+					remainingMeasurements := len(distNeededMeasurements)
 					for loopScoreType := range distNeededMeasurements {
 						scoreType := loopScoreType
 						pool.Submit(func(func(any)) error {
@@ -864,7 +1035,13 @@ func (r *ReferenceBundle) Calculate(measurements map[ScoreType]Measurement, pool
 							if math.IsNaN(score) {
 								return fmt.Errorf("NaN scores not allowed")
 							}
+							mutex.Lock()
+							defer mutex.Unlock()
 							dist.Scores[scoreType] = score
+							remainingMeasurements--
+							if remainingMeasurements == 0 && checkpoint != nil {
+								return checkpoint(ref, dist)
+							}
 							return nil
 						})
 					}
@@ -878,59 +1055,256 @@ func (r *ReferenceBundle) Calculate(measurements map[ScoreType]Measurement, pool
 }
 
 // ViewEachReference returns each reference in the study.
+//
+// Streams the references, distortions, and scores from a single query ordered by reference, so only one reference
+// is in memory at a time. The distortion name breaks ties between equal indices, so the scores of each distortion
+// are always adjacent.
 func (s *Study) ViewEachReference(f func(*Reference) error) error {
 	tx, err := s.db.Begin()
 	if err != nil {
 		return err
 	}
 	defer tx.Rollback()
-	rows, err := tx.Query("SELECT DATA FROM OBJ")
+	rows, err := tx.Query(`SELECT REF.NAME, REF.PATH, DIST.NAME, DIST.PATH, SCORE.TYPE, SCORE.VALUE FROM REF
+		LEFT JOIN DIST ON DIST.REF = REF.NAME
+		LEFT JOIN SCORE ON SCORE.REF = DIST.REF AND SCORE.DIST = DIST.NAME
+		ORDER BY REF.NAME, DIST.IDX, DIST.NAME`)
 	if err != nil {
 		return err
 	}
 	defer rows.Close()
+	var ref *Reference
+	var dist *Distortion
 	for rows.Next() {
-		var value []byte
-		if err := rows.Scan(&value); err != nil {
+		var refName, refPath string
+		var distName, distPath, scoreType sql.NullString
+		var score sql.NullFloat64
+		if err := rows.Scan(&refName, &refPath, &distName, &distPath, &scoreType, &score); err != nil {
 			return err
 		}
-		ref := &Reference{}
-		if err := json.Unmarshal(value, ref); err != nil {
-			return err
+		if ref == nil || ref.Name != refName {
+			if ref != nil {
+				if err := f(ref); err == io.EOF {
+					return nil
+				} else if err != nil {
+					return err
+				}
+			}
+			ref = &Reference{Name: refName, Path: refPath}
+			dist = nil
 		}
-		if err := f(ref); err == io.EOF {
-			break
-		} else if err != nil {
+		if !distName.Valid {
+			continue
+		}
+		if dist == nil || dist.Name != distName.String {
+			dist = &Distortion{Name: distName.String, Path: distPath.String, Scores: map[ScoreType]float64{}}
+			ref.Distortions = append(ref.Distortions, dist)
+		}
+		if scoreType.Valid {
+			dist.Scores[ScoreType(scoreType.String)] = score.Float64
+		}
+	}
+	if err := rows.Err(); err != nil {
+		return err
+	}
+	if ref != nil {
+		if err := f(ref); err != nil && err != io.EOF {
 			return err
 		}
 	}
 	return nil
 }
 
-// Put inserts some references into a study.
-func (s *Study) Put(refs []*Reference) error {
+// update runs f in a transaction, and commits it if f succeeds.
+func (s *Study) update(f func(tx *sql.Tx) error) error {
+	s.mutex.Lock()
+	defer s.mutex.Unlock()
 	tx, err := s.db.Begin()
 	if err != nil {
 		return err
 	}
-	if err := func() error {
+	if err := f(tx); err != nil {
+		if rerr := tx.Rollback(); rerr != nil {
+			return rerr
+		}
+		return err
+	}
+	return tx.Commit()
+}
+
+// Put inserts some references into a study, replacing any references with the same names along with all their
+// distortions and scores.
+func (s *Study) Put(refs []*Reference) error {
+	return s.update(func(tx *sql.Tx) error {
+		return putReferences(tx, refs)
+	})
+}
+
+// PutScores updates the scores of the provided types of some references already in a study, without rewriting the
+// rest of the references.
+func (s *Study) PutScores(refs []*Reference, scoreTypes []ScoreType) error {
+	return s.update(func(tx *sql.Tx) error {
+		insertScore, err := tx.Prepare(insertScoreQuery)
+		if err != nil {
+			return err
+		}
+		defer insertScore.Close()
 		for _, ref := range refs {
-			b, err := json.Marshal(ref)
-			if err != nil {
-				return err
+			for _, dist := range ref.Distortions {
+				for _, scoreType := range scoreTypes {
+					if score, found := dist.Scores[scoreType]; found {
+						if _, err := insertScore.Exec(ref.Name, dist.Name, string(scoreType), score); err != nil {
+							return err
+						}
+					}
+				}
 			}
-			if _, err = tx.Exec("INSERT INTO OBJ (ID, DATA) VALUES (?, ?) ON CONFLICT (ID) DO UPDATE SET DATA = ?", []byte(ref.Name), b, b); err != nil {
+		}
+		return nil
+	})
+}
+
+// Merge adds the references, distortions, and scores of other to s.
+//
+// Scores in other replace scores of the same types in s, while references and distortions already in s are kept
+// as they are. Used to combine the studies the shards of a calculation checkpointed their scores to.
+func (s *Study) Merge(other *Study) error {
+	return s.update(func(tx *sql.Tx) error {
+		merge, err := prepareMerge(tx)
+		if err != nil {
+			return err
+		}
+		defer merge.close()
+		return other.ViewEachReference(merge.add)
+	})
+}
+
+// MergeReferences adds some references, their distortions, and their scores to a study, like Merge.
+func (s *Study) MergeReferences(refs []*Reference) error {
+	return s.update(func(tx *sql.Tx) error {
+		merge, err := prepareMerge(tx)
+		if err != nil {
+			return err
+		}
+		defer merge.close()
+		for _, ref := range refs {
+			if err := merge.add(ref); err != nil {
 				return err
 			}
 		}
 		return nil
-	}(); err != nil {
-		if rerr := tx.Rollback(); rerr != nil {
-			return rerr
+	})
+}
+
+// merger contains the statements merging references into a transaction.
+type merger struct {
+	insertRef   *sql.Stmt
+	insertDist  *sql.Stmt
+	insertScore *sql.Stmt
+}
+
+func prepareMerge(tx *sql.Tx) (*merger, error) {
+	result := &merger{}
+	var err error
+	if result.insertRef, err = tx.Prepare("INSERT INTO REF (NAME, PATH) VALUES (?, ?) ON CONFLICT (NAME) DO NOTHING"); err != nil {
+		result.close()
+		return nil, err
+	}
+	if result.insertDist, err = tx.Prepare("INSERT INTO DIST (REF, NAME, IDX, PATH) VALUES (?, ?, ?, ?) ON CONFLICT (REF, NAME) DO NOTHING"); err != nil {
+		result.close()
+		return nil, err
+	}
+	if result.insertScore, err = tx.Prepare(insertScoreQuery); err != nil {
+		result.close()
+		return nil, err
+	}
+	return result, nil
+}
+
+func (m *merger) close() {
+	for _, statement := range []*sql.Stmt{m.insertRef, m.insertDist, m.insertScore} {
+		if statement != nil {
+			statement.Close()
+		}
+	}
+}
+
+func (m *merger) add(ref *Reference) error {
+	if _, err := m.insertRef.Exec(ref.Name, ref.Path); err != nil {
+		return err
+	}
+	for index, dist := range ref.Distortions {
+		if _, err := m.insertDist.Exec(ref.Name, dist.Name, index, dist.Path); err != nil {
+			return err
+		}
+		for scoreType, score := range dist.Scores {
+			if _, err := m.insertScore.Exec(ref.Name, dist.Name, string(scoreType), score); err != nil {
+				return err
+			}
+		}
+	}
+	return nil
+}
+
+const insertScoreQuery = "INSERT INTO SCORE (REF, DIST, TYPE, VALUE) VALUES (?, ?, ?, ?) ON CONFLICT (REF, DIST, TYPE) DO UPDATE SET VALUE = excluded.VALUE"
+
+// putReferences inserts refs in tx, replacing any references with the same names.
+func putReferences(tx *sql.Tx, refs []*Reference) error {
+	statements := []*sql.Stmt{}
+	defer func() {
+		for _, statement := range statements {
+			statement.Close()
 		}
+	}()
+	prepare := func(query string) (*sql.Stmt, error) {
+		statement, err := tx.Prepare(query)
+		if err == nil {
+			statements = append(statements, statement)
+		}
+		return statement, err
+	}
+	deleteScores, err := prepare("DELETE FROM SCORE WHERE REF = ?")
+	if err != nil {
 		return err
 	}
-	return tx.Commit()
+	deleteDists, err := prepare("DELETE FROM DIST WHERE REF = ?")
+	if err != nil {
+		return err
+	}
+	insertRef, err := prepare("INSERT INTO REF (NAME, PATH) VALUES (?, ?) ON CONFLICT (NAME) DO UPDATE SET PATH = excluded.PATH")
+	if err != nil {
+		return err
+	}
+	insertDist, err := prepare("INSERT INTO DIST (REF, NAME, IDX, PATH) VALUES (?, ?, ?, ?)")
+	if err != nil {
+		return err
+	}
+	insertScore, err := prepare(insertScoreQuery)
+	if err != nil {
+		return err
+	}
+	for _, ref := range refs {
+		if _, err := deleteScores.Exec(ref.Name); err != nil {
+			return err
+		}
+		if _, err := deleteDists.Exec(ref.Name); err != nil {
+			return err
+		}
+		if _, err := insertRef.Exec(ref.Name, ref.Path); err != nil {
+			return err
+		}
+		for index, dist := range ref.Distortions {
+			if _, err := insertDist.Exec(ref.Name, dist.Name, index, dist.Path); err != nil {
+				return err
+			}
+			for scoreType, score := range dist.Scores {
+				if _, err := insertScore.Exec(ref.Name, dist.Name, string(scoreType), score); err != nil {
+					return err
+				}
+			}
+		}
+	}
+	return nil
 }
 
 // Distortion contains data for a distortion of a reference.
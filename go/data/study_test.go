@@ -0,0 +1,276 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package data
+
+import (
+	"bytes"
+	"encoding/binary"
+	"fmt"
+	"os"
+	"path/filepath"
+	"reflect"
+	"sync/atomic"
+	"testing"
+
+	"github.com/google/zimtohrli/go/audio"
+	"github.com/google/zimtohrli/go/worker"
+)
+
+func writeWAV(t *testing.T, path string, numSamples int) {
+	t.Helper()
+	buf := &bytes.Buffer{}
+	for index := 0; index < numSamples; index++ {
+		binary.Write(buf, binary.LittleEndian, int16(index%100*100))
+	}
+	wav := &bytes.Buffer{}
+	for _, chunk := range []any{
+		audio.RIFFHeader{ChunkID: audio.FixString{'R', 'I', 'F', 'F'}, ChunkSize: int32(36 + buf.Len()), Format: audio.FixString{'W', 'A', 'V', 'E'}},
+		audio.ChunkHeader{SubChunkID: audio.FixString{'f', 'm', 't', ' '}, SubChunkSize: 16},
+		audio.FormatChunk{AudioFormat: 1, NumChannels: 1, SampleRate: sampleRate, ByteRate: 2 * sampleRate, BlockAlign: 2, BitsPerSample: 16},
+		audio.ChunkHeader{SubChunkID: audio.FixString{'d', 'a', 't', 'a'}, SubChunkSize: int32(buf.Len())},
+	} {
+		if err := binary.Write(wav, binary.LittleEndian, chunk); err != nil {
+			t.Fatal(err)
+		}
+	}
+	wav.Write(buf.Bytes())
+	if err := os.WriteFile(path, wav.Bytes(), 0644); err != nil {
+		t.Fatal(err)
+	}
+}
+
+func openTestStudy(t *testing.T, dir string) *Study {
+	t.Helper()
+	study, err := OpenStudy(dir)
+	if err != nil {
+		t.Fatal(err)
+	}
+	t.Cleanup(func() { study.Close() })
+	return study
+}
+
+func readReferences(t *testing.T, study *Study) map[string]*Reference {
+	t.Helper()
+	result := map[string]*Reference{}
+	if err := study.ViewEachReference(func(ref *Reference) error {
+		result[ref.Name] = ref
+		return nil
+	}); err != nil {
+		t.Fatal(err)
+	}
+	return result
+}
+
+func TestShard(t *testing.T) {
+	bundle := &ReferenceBundle{ScoreTypes: map[ScoreType]int{}}
+	for index := 0; index < 100; index++ {
+		bundle.Add(&Reference{
+			Name:        fmt.Sprintf("ref%v", index),
+			Distortions: []*Distortion{{Name: "dist", Scores: map[ScoreType]float64{MOS: 1}}},
+		})
+	}
+	const count = 3
+	seen := map[string]int{}
+	for index := 0; index < count; index++ {
+		shard, err := bundle.Shard(index, count)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(shard.References) == 0 {
+			t.Errorf("shard %v/%v is empty", index, count)
+		}
+		if shard.ScoreTypes[MOS] != len(shard.References) {
+			t.Errorf("shard %v/%v has %v MOS scores, want %v", index, count, shard.ScoreTypes[MOS], len(shard.References))
+		}
+		for _, ref := range shard.References {
+			seen[ref.Name]++
+		}
+		again, err := bundle.Shard(index, count)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if !reflect.DeepEqual(again, shard) {
+			t.Errorf("shard %v/%v isn't deterministic", index, count)
+		}
+	}
+	if len(seen) != len(bundle.References) {
+		t.Errorf("shards cover %v references, want %v", len(seen), len(bundle.References))
+	}
+	for name, times := range seen {
+		if times != 1 {
+			t.Errorf("%q is in %v shards, want 1", name, times)
+		}
+	}
+	for _, tc := range [][2]int{{-1, 3}, {3, 3}, {0, 0}} {
+		if _, err := bundle.Shard(tc[0], tc[1]); err == nil {
+			t.Errorf("Shard(%v, %v) succeeded, want error", tc[0], tc[1])
+		}
+	}
+}
+
+func TestShardStudyDir(t *testing.T) {
+	tmpDir := t.TempDir()
+	first, err := ShardStudyDir("shards", filepath.Join(tmpDir, "a", "study"))
+	if err != nil {
+		t.Fatal(err)
+	}
+	second, err := ShardStudyDir("shards", filepath.Join(tmpDir, "b", "study"))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if first == second {
+		t.Errorf("studies with the same base name got the same shard directory %q", first)
+	}
+	if filepath.Dir(first) != "shards" {
+		t.Errorf("shard directory %q isn't in the shard directory", first)
+	}
+	wd, err := os.Getwd()
+	if err != nil {
+		t.Fatal(err)
+	}
+	relative, err := filepath.Rel(wd, filepath.Join(tmpDir, "a", "study"))
+	if err != nil {
+		t.Fatal(err)
+	}
+	again, err := ShardStudyDir("shards", relative)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if again != first {
+		t.Errorf("relative study directory got shard directory %q, want %q", again, first)
+	}
+}
+
+func TestMerge(t *testing.T) {
+	tmpDir := t.TempDir()
+	study := openTestStudy(t, filepath.Join(tmpDir, "study"))
+	if err := study.Put([]*Reference{
+		{Name: "ref0", Path: "ref0.wav", Distortions: []*Distortion{
+			{Name: "dist0", Path: "dist0.wav", Scores: map[ScoreType]float64{MOS: 4, Zimtohrli: 1}},
+		}},
+	}); err != nil {
+		t.Fatal(err)
+	}
+	shard := openTestStudy(t, filepath.Join(tmpDir, "shard"))
+	if err := shard.Put([]*Reference{
+		{Name: "ref0", Path: "other.wav", Distortions: []*Distortion{
+			{Name: "dist0", Path: "other.wav", Scores: map[ScoreType]float64{Zimtohrli: 2}},
+			{Name: "dist1", Path: "dist1.wav", Scores: map[ScoreType]float64{Zimtohrli: 3}},
+		}},
+		{Name: "ref1", Path: "ref1.wav", Distortions: []*Distortion{
+			{Name: "dist2", Path: "dist2.wav", Scores: map[ScoreType]float64{Zimtohrli: 4}},
+		}},
+	}); err != nil {
+		t.Fatal(err)
+	}
+	if err := study.Merge(shard); err != nil {
+		t.Fatal(err)
+	}
+	want := map[string]*Reference{
+		"ref0": {Name: "ref0", Path: "ref0.wav", Distortions: []*Distortion{
+			{Name: "dist0", Path: "dist0.wav", Scores: map[ScoreType]float64{MOS: 4, Zimtohrli: 2}},
+			{Name: "dist1", Path: "dist1.wav", Scores: map[ScoreType]float64{Zimtohrli: 3}},
+		}},
+		"ref1": {Name: "ref1", Path: "ref1.wav", Distortions: []*Distortion{
+			{Name: "dist2", Path: "dist2.wav", Scores: map[ScoreType]float64{Zimtohrli: 4}},
+		}},
+	}
+	if got := readReferences(t, study); !reflect.DeepEqual(got, want) {
+		t.Errorf("merged study has %+v, want %+v", got, want)
+	}
+}
+
+func TestCalculateWithCheckpointResumes(t *testing.T) {
+	tmpDir := t.TempDir()
+	study := openTestStudy(t, tmpDir)
+	refs := []*Reference{}
+	// Each distortion has its own length, which the measurement returns as score.
+	wantScores := map[string]float64{}
+	numSamples := 1000
+	for refIndex := 0; refIndex < 3; refIndex++ {
+		ref := &Reference{Name: fmt.Sprintf("ref%v", refIndex), Path: fmt.Sprintf("ref%v.wav", refIndex)}
+		writeWAV(t, filepath.Join(tmpDir, ref.Path), 1000)
+		for distIndex := 0; distIndex < 4; distIndex++ {
+			dist := &Distortion{
+				Name:   fmt.Sprintf("dist%v", distIndex),
+				Path:   fmt.Sprintf("ref%v_dist%v.wav", refIndex, distIndex),
+				Scores: map[ScoreType]float64{MOS: 3},
+			}
+			numSamples++
+			writeWAV(t, filepath.Join(tmpDir, dist.Path), numSamples)
+			wantScores[dist.Path] = float64(numSamples)
+			ref.Distortions = append(ref.Distortions, dist)
+		}
+		refs = append(refs, ref)
+	}
+	if err := study.Put(refs); err != nil {
+		t.Fatal(err)
+	}
+	checkpoint := func(ref *Reference, dist *Distortion) error {
+		return study.PutScores([]*Reference{{Name: ref.Name, Distortions: []*Distortion{dist}}}, []ScoreType{Zimtohrli})
+	}
+	calculate := func(failingSamples int) (int32, error) {
+		bundle, err := study.ToBundle()
+		if err != nil {
+			t.Fatal(err)
+		}
+		calls := int32(0)
+		measurement := func(ref, dist *audio.Audio) (float64, error) {
+			atomic.AddInt32(&calls, 1)
+			if len(dist.Samples[0]) == failingSamples {
+				return 0, fmt.Errorf("failing on purpose")
+			}
+			return float64(len(dist.Samples[0])), nil
+		}
+		err = bundle.CalculateWithCheckpoint(map[ScoreType]Measurement{Zimtohrli: measurement}, &worker.Pool[any]{Workers: 2}, false, checkpoint)
+		return calls, err
+	}
+
+	// The first calculation is interrupted by a failing distortion, but checkpoints the others.
+	const failingPath = "ref1_dist1.wav"
+	calls, err := calculate(int(wantScores[failingPath]))
+	if err == nil {
+		t.Fatal("calculation with a failing measurement succeeded")
+	}
+	if calls != 12 {
+		t.Errorf("first calculation measured %v distortions, want 12", calls)
+	}
+	for _, ref := range readReferences(t, study) {
+		for _, dist := range ref.Distortions {
+			score, found := dist.Scores[Zimtohrli]
+			switch {
+			case dist.Path == failingPath && found:
+				t.Errorf("%v/%v has score %v after failing", ref.Name, dist.Name, score)
+			case dist.Path != failingPath && !found:
+				t.Errorf("%v/%v has no checkpointed score", ref.Name, dist.Name)
+			}
+		}
+	}
+
+	// The resumed calculation only measures the distortion without a checkpointed score.
+	if calls, err = calculate(-1); err != nil {
+		t.Fatal(err)
+	}
+	if calls != 1 {
+		t.Errorf("resumed calculation measured %v distortions, want 1", calls)
+	}
+	for _, ref := range readReferences(t, study) {
+		for _, dist := range ref.Distortions {
+			if got := dist.Scores[Zimtohrli]; got != wantScores[dist.Path] {
+				t.Errorf("%v/%v has score %v, want %v", ref.Name, dist.Name, got, wantScores[dist.Path])
+			}
+		}
+	}
+}
@@ -0,0 +1,186 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package goohrli
+
+/*
+#include <stdlib.h>
+#include "goohrli.h"
+*/
+import "C"
+import (
+	"bytes"
+	"encoding/binary"
+	"fmt"
+	"math"
+	"os"
+	"runtime"
+	"syscall"
+	"unsafe"
+)
+
+const (
+	analysisFileMagic      = "ZIMTSPEC"
+	analysisFileVersion    = 1
+	analysisFileHeaderSize = 64
+	analysisFileAlignment  = 64
+	bytesPerFloat          = 4
+)
+
+// AnalysisFileHeader is the header of an analysis file, as described in zimt/analysis_file.h.
+//
+// The header is followed by NumSteps rows of RowStride little-endian floats, of which the first NumChannels
+// are spectrogram values.
+type AnalysisFileHeader struct {
+	Magic                [8]byte
+	Version              uint32
+	HeaderSize           uint32
+	Fingerprint          uint64
+	NumSteps             uint64
+	NumChannels          uint64
+	RowStride            uint64
+	PerceptualSampleRate float32
+	Reserved             [12]byte
+}
+
+// MappedAnalysisFile is a read-only memory mapping of an analysis file.
+type MappedAnalysisFile struct {
+	Header AnalysisFileHeader
+
+	data []byte
+	rows []float32
+}
+
+// isRowsSize returns whether numSteps rows of rowStride floats take exactly rowsSize bytes, without overflowing for
+// corrupt headers.
+func isRowsSize(rowsSize, numSteps, rowStride uint64) bool {
+	if rowsSize%bytesPerFloat != 0 {
+		return false
+	}
+	numFloats := rowsSize / bytesPerFloat
+	if numSteps == 0 || rowStride == 0 {
+		return numFloats == 0
+	}
+	return numFloats%rowStride == 0 && numFloats/rowStride == numSteps
+}
+
+// OpenAnalysisFile maps the analysis file at path and validates its header.
+func OpenAnalysisFile(path string) (*MappedAnalysisFile, error) {
+	f, err := os.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+	info, err := f.Stat()
+	if err != nil {
+		return nil, err
+	}
+	if info.Size() < analysisFileHeaderSize {
+		return nil, fmt.Errorf("%q is too small to be an analysis file", path)
+	}
+	data, err := syscall.Mmap(int(f.Fd()), 0, int(info.Size()), syscall.PROT_READ, syscall.MAP_SHARED)
+	if err != nil {
+		return nil, fmt.Errorf("unable to map %q: %v", path, err)
+	}
+	result := &MappedAnalysisFile{data: data}
+	runtime.SetFinalizer(result, func(m *MappedAnalysisFile) {
+		m.Close()
+	})
+	if err := binary.Read(bytes.NewReader(data[:analysisFileHeaderSize]), binary.LittleEndian, &result.Header); err != nil {
+		result.Close()
+		return nil, err
+	}
+	header := &result.Header
+	if string(header.Magic[:]) != analysisFileMagic {
+		result.Close()
+		return nil, fmt.Errorf("%q is not an analysis file", path)
+	}
+	if header.Version != analysisFileVersion {
+		result.Close()
+		return nil, fmt.Errorf("%q has version %v, want %v", path, header.Version, analysisFileVersion)
+	}
+	if header.HeaderSize != analysisFileHeaderSize ||
+		header.RowStride < header.NumChannels ||
+		header.RowStride%(analysisFileAlignment/bytesPerFloat) != 0 ||
+		!isRowsSize(uint64(len(data))-analysisFileHeaderSize, header.NumSteps, header.RowStride) {
+		result.Close()
+		return nil, fmt.Errorf("%q has an inconsistent header", path)
+	}
+	if header.NumSteps > 0 {
+		result.rows = unsafe.Slice((*float32)(unsafe.Pointer(&data[header.HeaderSize])), header.NumSteps*header.RowStride)
+	}
+	return result, nil
+}
+
+// Close unmaps the file. Rows returned by Row must not be used after Close.
+func (m *MappedAnalysisFile) Close() error {
+	if m.data == nil {
+		return nil
+	}
+	err := syscall.Munmap(m.data)
+	m.data = nil
+	m.rows = nil
+	return err
+}
+
+// Row returns a view, directly into the mapped file, of the NumChannels spectrogram values at stepIndex.
+func (m *MappedAnalysisFile) Row(stepIndex int) []float32 {
+	start := uint64(stepIndex) * m.Header.RowStride
+	end := start + m.Header.NumChannels
+	return m.rows[start:end:end]
+}
+
+// Fingerprint returns a hash of the parameters of g that affect its analyses, as stored in analysis files.
+func (g *Goohrli) Fingerprint() uint64 {
+	return uint64(C.AnalysisFingerprint(g.zimtohrli))
+}
+
+// SaveAnalysis writes the spectrogram of an analysis produced by g to path as an analysis file.
+func (g *Goohrli) SaveAnalysis(analysis *Analysis, path string) error {
+	cPath := C.CString(path)
+	defer C.free(unsafe.Pointer(cPath))
+	status := C.WriteAnalysis(g.zimtohrli, analysis.analysis, cPath)
+	runtime.KeepAlive(analysis)
+	if status != 0 {
+		return fmt.Errorf("writing an analysis to %q failed with status code %v", path, status)
+	}
+	return nil
+}
+
+// LoadAnalysis returns the analysis stored at path, which must have been saved by a Goohrli with the same
+// Fingerprint as g.
+func (g *Goohrli) LoadAnalysis(path string) (*Analysis, error) {
+	file, err := OpenAnalysisFile(path)
+	if err != nil {
+		return nil, err
+	}
+	defer file.Close()
+	if fingerprint := g.Fingerprint(); file.Header.Fingerprint != fingerprint {
+		return nil, fmt.Errorf("%q was produced with different parameters (fingerprint %v, want %v)", path, file.Header.Fingerprint, fingerprint)
+	}
+	if file.Header.NumSteps > math.MaxInt32 || file.Header.RowStride > math.MaxInt32 {
+		return nil, fmt.Errorf("%q has %v steps of %v floats, which is more than supported", path, file.Header.NumSteps, file.Header.RowStride)
+	}
+	var data *C.float
+	if len(file.rows) > 0 {
+		data = (*C.float)(unsafe.Pointer(&file.rows[0]))
+	}
+	result := &Analysis{
+		analysis: C.AnalysisFromSpectrogram(data, C.int(file.Header.NumSteps), C.int(file.Header.NumChannels), C.int(file.Header.RowStride)),
+	}
+	runtime.SetFinalizer(result, func(a *Analysis) {
+		C.FreeAnalysis(a.analysis)
+	})
+	return result, nil
+}
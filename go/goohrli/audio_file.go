@@ -0,0 +1,81 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package goohrli
+
+/*
+#include <stdlib.h>
+#include "goohrli.h"
+*/
+import "C"
+import (
+	"fmt"
+	"unsafe"
+
+	"github.com/google/zimtohrli/go/audio"
+)
+
+// LoadAudio decodes the audio file at path in process using libsndfile.
+//
+// The samples are decoded as floats directly into the returned audio, whose channels can be passed to Analyze
+// without copying. Only supports the formats and local paths libsndfile supports, see aio.LoadAtRate for a loader
+// that falls back to ffmpeg.
+func LoadAudio(path string) (*audio.Audio, error) {
+	return loadAudio(path, 0)
+}
+
+// LoadAudioAtRate is like LoadAudio, but returns an error before decoding anything if the sample rate of the file
+// isn't rate.
+func LoadAudioAtRate(path string, rate float64) (*audio.Audio, error) {
+	return loadAudio(path, rate)
+}
+
+// loadAudio decodes the audio file at path, and if rate isn't 0 checks that the file has that sample rate first.
+func loadAudio(path string, rate float64) (*audio.Audio, error) {
+	cPath := C.CString(path)
+	defer C.free(unsafe.Pointer(cPath))
+	var reader C.AudioReader
+	if status := C.OpenAudioReader(cPath, &reader); status != 0 {
+		return nil, fmt.Errorf("opening %q with libsndfile failed with status code %v", path, status)
+	}
+	defer C.FreeAudioReader(reader)
+	numChannels := int(C.AudioReaderNumChannels(reader))
+	numFrames := int(C.AudioReaderNumFrames(reader))
+	result := &audio.Audio{
+		Samples: make([][]float32, numChannels),
+		Rate:    float64(C.AudioReaderSampleRate(reader)),
+	}
+	if rate != 0 && result.Rate != rate {
+		return nil, fmt.Errorf("%q has sample rate %v, want %v", path, result.Rate, rate)
+	}
+	if numChannels == 0 || numFrames == 0 {
+		return nil, fmt.Errorf("%q doesn't contain any audio", path)
+	}
+	data := make([]float32, numChannels*numFrames)
+	var numRead C.int64_t
+	if status := C.ReadAudio(reader, (*C.float)(&data[0]), C.int64_t(numFrames), &numRead); status != 0 {
+		return nil, fmt.Errorf("decoding %q with libsndfile failed with status code %v", path, status)
+	}
+	if int(numRead) != numFrames {
+		return nil, fmt.Errorf("only decoded %v of %v frames from %q", numRead, numFrames, path)
+	}
+	for channelIndex := range result.Samples {
+		channel := data[channelIndex*numFrames : (channelIndex+1)*numFrames : (channelIndex+1)*numFrames]
+		result.Samples[channelIndex] = channel
+		if maxAbsAmplitude := Measure(channel).MaxAbsAmplitude; maxAbsAmplitude > result.MaxAbsAmplitude {
+			result.MaxAbsAmplitude = maxAbsAmplitude
+		}
+	}
+	return result, nil
+}
@@ -0,0 +1,139 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package goohrli
+
+import (
+	"crypto/sha256"
+	"fmt"
+	"log"
+	"path/filepath"
+	"sync"
+	"unsafe"
+)
+
+// analysisKey identifies an analysis by the content of the signal and the parameters used to produce it.
+type analysisKey struct {
+	signalHash [sha256.Size]byte
+	parameters string
+}
+
+type analysisEntry struct {
+	once     sync.Once
+	analysis *Analysis
+}
+
+// AnalysisCache keeps analyses of recently analyzed signals, keyed by the content of the signal and the
+// parameters of the Goohrli instance that analyzed it.
+//
+// Useful when the same reference is compared to many distorted signals. Safe for concurrent use.
+type AnalysisCache struct {
+	capacity int
+	compact  bool
+	dir      string
+
+	mutex   sync.Mutex
+	entries map[analysisKey]*analysisEntry
+	order   []analysisKey
+}
+
+// NewAnalysisCache returns a cache keeping at most capacity analyses, evicting the oldest first.
+func NewAnalysisCache(capacity int) *AnalysisCache {
+	return &AnalysisCache{
+		capacity: capacity,
+		entries:  map[analysisKey]*analysisEntry{},
+	}
+}
+
+// NewCompactAnalysisCache is like NewAnalysisCache, but keeps analyses from Goohrli.AnalyzeCompact, so that
+// many more of them fit in the same memory.
+func NewCompactAnalysisCache(capacity int) *AnalysisCache {
+	result := NewAnalysisCache(capacity)
+	result.compact = true
+	return result
+}
+
+// NewPersistentAnalysisCache is like NewAnalysisCache, but also saves analyses as analysis files in dir, and loads
+// them from there instead of analyzing signals it has seen before, even in previous processes.
+//
+// The files are named by the content of the signal and the Fingerprint of the analyzing Goohrli, so the same
+// directory can be shared between runs with different parameters.
+func NewPersistentAnalysisCache(capacity int, dir string) *AnalysisCache {
+	result := NewAnalysisCache(capacity)
+	result.dir = dir
+	return result
+}
+
+// signalHash returns the SHA-256 of the in-memory bytes of the samples of signal.
+//
+// Hashes a view of the samples instead of a copy, so that cache lookups don't allocate or make an extra pass over
+// the signal.
+func signalHash(signal []float32) [sha256.Size]byte {
+	if len(signal) == 0 {
+		return sha256.Sum256(nil)
+	}
+	return sha256.Sum256(unsafe.Slice((*byte)(unsafe.Pointer(&signal[0])), 4*len(signal)))
+}
+
+func newAnalysisKey(g *Goohrli, signal []float32) analysisKey {
+	return analysisKey{
+		signalHash: signalHash(signal),
+		parameters: fmt.Sprintf("%+v", g.Parameters()),
+	}
+}
+
+// Analyze returns the analysis of the signal by g, computing it only if it isn't already cached.
+func (c *AnalysisCache) Analyze(g *Goohrli, signal []float32) *Analysis {
+	key := newAnalysisKey(g, signal)
+	c.mutex.Lock()
+	entry, found := c.entries[key]
+	if !found {
+		entry = &analysisEntry{}
+		c.entries[key] = entry
+		c.order = append(c.order, key)
+		for len(c.order) > c.capacity {
+			delete(c.entries, c.order[0])
+			c.order = c.order[1:]
+		}
+	}
+	c.mutex.Unlock()
+	entry.once.Do(func() {
+		path := ""
+		if c.dir != "" {
+			path = filepath.Join(c.dir, fmt.Sprintf("%x-%016x.zspec", key.signalHash, g.Fingerprint()))
+			if analysis, err := g.LoadAnalysis(path); err == nil {
+				entry.analysis = analysis
+				return
+			}
+		}
+		if c.compact {
+			entry.analysis = g.AnalyzeCompact(signal)
+		} else {
+			entry.analysis = g.Analyze(signal)
+		}
+		if path != "" {
+			if err := g.SaveAnalysis(entry.analysis, path); err != nil {
+				log.Printf("Unable to persist analysis: %v", err)
+			}
+		}
+	})
+	return entry.analysis
+}
+
+// Len returns the number of cached analyses.
+func (c *AnalysisCache) Len() int {
+	c.mutex.Lock()
+	defer c.mutex.Unlock()
+	return len(c.entries)
+}
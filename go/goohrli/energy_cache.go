@@ -0,0 +1,115 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package goohrli
+
+import (
+	"container/list"
+	"crypto/sha256"
+	"sync"
+)
+
+// EnergyParameters are the parameters that the channel energy of a signal depends on.
+//
+// Instances with the same EnergyParameters can share the result of Goohrli.Energy, and only differ in the stages
+// after the filterbank.
+type EnergyParameters struct {
+	SampleRate           float64
+	FrequencyResolution  float64
+	PerceptualSampleRate float64
+	FilterOrder          int
+	FilterPassBandRipple float64
+	FilterStopBandRipple float64
+}
+
+// EnergyParameters returns the parameters that the Energy of g depends on.
+func (g *Goohrli) EnergyParameters() EnergyParameters {
+	params := g.Parameters()
+	return EnergyParameters{
+		SampleRate:           params.SampleRate,
+		FrequencyResolution:  params.FrequencyResolution,
+		PerceptualSampleRate: params.PerceptualSampleRate,
+		FilterOrder:          params.FilterOrder,
+		FilterPassBandRipple: params.FilterPassBandRipple,
+		FilterStopBandRipple: params.FilterStopBandRipple,
+	}
+}
+
+type energyKey struct {
+	signalHash [sha256.Size]byte
+	parameters EnergyParameters
+}
+
+type energyEntry struct {
+	key    energyKey
+	once   sync.Once
+	energy *Energy
+}
+
+// EnergyCache keeps the channel energies of recently seen signals, keyed by the content of the signal and the
+// EnergyParameters of the Goohrli instance that computed them.
+//
+// Meant for parameter optimization, where most evaluations only change parameters downstream of the filterbank.
+// Evicts the least recently used energy first, so that the energies of the current parameters survive evaluations
+// of rejected candidates with different EnergyParameters. Safe for concurrent use.
+type EnergyCache struct {
+	capacity int
+
+	mutex   sync.Mutex
+	entries map[energyKey]*list.Element
+	order   *list.List
+}
+
+// NewEnergyCache returns a cache keeping at most capacity energies.
+func NewEnergyCache(capacity int) *EnergyCache {
+	return &EnergyCache{
+		capacity: capacity,
+		entries:  map[energyKey]*list.Element{},
+		order:    list.New(),
+	}
+}
+
+// Energy returns the channel energy of the signal computed by g, computing it only if it isn't already cached.
+func (c *EnergyCache) Energy(g *Goohrli, signal []float32) *Energy {
+	key := energyKey{
+		signalHash: signalHash(signal),
+		parameters: g.EnergyParameters(),
+	}
+	c.mutex.Lock()
+	element, found := c.entries[key]
+	if found {
+		c.order.MoveToBack(element)
+	} else {
+		element = c.order.PushBack(&energyEntry{key: key})
+		c.entries[key] = element
+		for c.order.Len() > c.capacity {
+			oldest := c.order.Front()
+			delete(c.entries, oldest.Value.(*energyEntry).key)
+			c.order.Remove(oldest)
+		}
+	}
+	entry := element.Value.(*energyEntry)
+	c.mutex.Unlock()
+	entry.once.Do(func() {
+		entry.energy = g.Energy(signal)
+	})
+	return entry.energy
+}
+
+// Len returns the number of cached energies.
+func (c *EnergyCache) Len() int {
+	c.mutex.Lock()
+	defer c.mutex.Unlock()
+	return len(c.entries)
+}
@@ -0,0 +1,49 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package goohrli
+
+/*
+#include <stdlib.h>
+#include "goohrli.h"
+*/
+import "C"
+import (
+	"fmt"
+	"unsafe"
+)
+
+// SaveFilterbankCache writes the filterbank designs created so far in this process to path.
+//
+// Short-lived processes that create the same Goohrli instances every time they start can load the designs with
+// LoadFilterbankCache, which is much faster than designing the filters again.
+func SaveFilterbankCache(path string) error {
+	cPath := C.CString(path)
+	defer C.free(unsafe.Pointer(cPath))
+	if status := C.WriteFilterbankCache(cPath); status != 0 {
+		return fmt.Errorf("writing the filterbank cache to %q failed with status code %v", path, status)
+	}
+	return nil
+}
+
+// LoadFilterbankCache adds the filterbank designs saved by SaveFilterbankCache at path to the cache of this process,
+// so that New skips designing those filterbanks.
+func LoadFilterbankCache(path string) error {
+	cPath := C.CString(path)
+	defer C.free(unsafe.Pointer(cPath))
+	if status := C.ReadFilterbankCache(cPath); status != 0 {
+		return fmt.Errorf("reading the filterbank cache from %q failed with status code %v", path, status)
+	}
+	return nil
+}
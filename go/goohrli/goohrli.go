@@ -22,12 +22,14 @@ package goohrli
 */
 import "C"
 import (
+	"crypto/sha256"
 	"encoding/json"
 	"fmt"
 	"log"
 	"math"
 	"reflect"
 	"runtime"
+	"sync"
 	"time"
 
 	"github.com/google/zimtohrli/go/audio"
@@ -79,6 +81,11 @@ func New(params Parameters) *Goohrli {
 	return result
 }
 
+// NumChannels returns the number of frequency channels of this instance.
+func (g *Goohrli) NumChannels() int {
+	return int(C.NumChannels(g.zimtohrli))
+}
+
 // Duration wraps a time.Duration to provide specialized JSON marshal/unmarshal methods.
 type Duration struct {
 	time.Duration
@@ -118,6 +125,7 @@ type Parameters struct {
 	FullScaleSineDB      float64
 	ApplyLoudness        bool
 	UnwarpWindow         Duration
+	UnwarpCorridor       Duration
 	NSIMStepWindow       int
 	NSIMChannelWindow    int
 	MaskingLowerZeroAt20 float64
@@ -133,7 +141,7 @@ type Parameters struct {
 	LoudnessTFParams     [numLoudnessTFParams]float64
 }
 
-var durationType = reflect.TypeOf(time.Second)
+var durationType = reflect.TypeOf(Duration{})
 
 // Update assumes the argument is JSON and updates the parameters with the fields present in the provided JSON object.
 func (p *Parameters) Update(b []byte) error {
@@ -144,7 +152,7 @@ func (p *Parameters) Update(b []byte) error {
 	val := reflect.ValueOf(p).Elem()
 	for k, v := range updateMap {
 		fieldVal := val.FieldByName(k)
-		if fieldVal.IsZero() {
+		if !fieldVal.IsValid() {
 			return fmt.Errorf("provided unknown field %q", k)
 		}
 		switch fieldVal.Kind() {
@@ -170,7 +178,7 @@ func (p *Parameters) Update(b []byte) error {
 				if err != nil {
 					return fmt.Errorf("unable to parse duration field %q", v)
 				}
-				fieldVal.Set(reflect.ValueOf(d))
+				fieldVal.Set(reflect.ValueOf(Duration{d}))
 			}
 		}
 	}
@@ -194,6 +202,7 @@ func cFromGoParameters(params Parameters) C.ZimtohrliParameters {
 		cParams.ApplyLoudness = 0
 	}
 	cParams.UnwarpWindowSeconds = C.float(float64(params.UnwarpWindow.Duration) / float64(time.Second))
+	cParams.UnwarpCorridorSeconds = C.float(float64(params.UnwarpCorridor.Duration) / float64(time.Second))
 	cParams.NSIMStepWindow = C.int(params.NSIMStepWindow)
 	cParams.NSIMChannelWindow = C.int(params.NSIMChannelWindow)
 	cParams.MaskingLowerZeroAt20 = C.float(params.MaskingLowerZeroAt20)
@@ -234,6 +243,7 @@ func goFromCParameters(cParams C.ZimtohrliParameters) Parameters {
 		FullScaleSineDB:      float64(cParams.FullScaleSineDB),
 		ApplyLoudness:        cParams.ApplyLoudness != 0,
 		UnwarpWindow:         Duration{time.Duration(float64(time.Second) * float64(cParams.UnwarpWindowSeconds))},
+		UnwarpCorridor:       Duration{time.Duration(float64(time.Second) * float64(cParams.UnwarpCorridorSeconds))},
 		NSIMStepWindow:       int(cParams.NSIMStepWindow),
 		NSIMChannelWindow:    int(cParams.NSIMChannelWindow),
 		MaskingLowerZeroAt20: float64(cParams.MaskingLowerZeroAt20),
@@ -276,6 +286,64 @@ func (g *Goohrli) Parameters() Parameters {
 	return goFromCParameters(C.GetZimtohrliParameters(g.zimtohrli))
 }
 
+// StageStats contains the counters of the work done by one stage of the Zimtohrli pipeline.
+type StageStats struct {
+	// Duration is the wall time spent in the stage.
+	Duration time.Duration
+	// Calls is the number of times the stage ran.
+	Calls int64
+	// Samples is the number of samples processed, audio samples for the filterbank and time steps for the other stages.
+	Samples int64
+	// BytesAllocated is the number of bytes of the arrays allocated to hold the output of the stage.
+	BytesAllocated int64
+}
+
+// Stats contains the counters of the work done by the stages of the Zimtohrli pipeline.
+type Stats struct {
+	// Filterbank is the filterbank and energy computation.
+	Filterbank StageStats
+	// Masking is the dB conversion and masking.
+	Masking StageStats
+	// Loudness is the loudness model.
+	Loudness StageStats
+	// DTW is the dynamic time warp.
+	DTW StageStats
+	// NSIM is the NSIM.
+	NSIM StageStats
+	// DTWCells is the number of cost matrix cells evaluated by the dynamic time warp.
+	DTWCells int64
+}
+
+func goFromCStageStats(s C.StageStats) StageStats {
+	return StageStats{
+		Duration:       time.Duration(float64(s.Seconds) * float64(time.Second)),
+		Calls:          int64(s.Calls),
+		Samples:        int64(s.Samples),
+		BytesAllocated: int64(s.BytesAllocated),
+	}
+}
+
+// EnableStats makes g record Stats from now on, starting with all counters at zero.
+//
+// Must not be called concurrently with other methods of g.
+func (g *Goohrli) EnableStats() {
+	C.EnableZimtohrliStats(g.zimtohrli)
+}
+
+// Stats returns the counters recorded since EnableStats, or all zeros if it wasn't called or the library was built
+// without ZIMTOHRLI_STATS.
+func (g *Goohrli) Stats() Stats {
+	s := C.GetZimtohrliStats(g.zimtohrli)
+	return Stats{
+		Filterbank: goFromCStageStats(s.Filterbank),
+		Masking:    goFromCStageStats(s.Masking),
+		Loudness:   goFromCStageStats(s.Loudness),
+		DTW:        goFromCStageStats(s.DTW),
+		NSIM:       goFromCStageStats(s.NSIM),
+		DTWCells:   int64(s.DTWCells),
+	}
+}
+
 // Set updates the parameters controlling the behavior of this instance.
 //
 // SampleRate, FrequencyResolution, and Filter*-parameters can't be updated and will be ignored in this method.
@@ -289,6 +357,54 @@ func (g *Goohrli) String() string {
 
 // NormalizedAudioDistance returns the distance between the audio files after normalizing their amplitudes for the same max amplitude.
 func (g *Goohrli) NormalizedAudioDistance(audioA, audioB *audio.Audio) (float64, error) {
+	return g.CachedNormalizedAudioDistance(nil, audioA, audioB)
+}
+
+// CachedNormalizedAudioDistance is like NormalizedAudioDistance, but gets the analyses of audioA from the cache if it isn't nil.
+func (g *Goohrli) CachedNormalizedAudioDistance(cache *AnalysisCache, audioA, audioB *audio.Audio) (float64, error) {
+	if cache == nil {
+		return g.normalizedAudioDistance(audioA, audioB, func(signalsA, signalsB [][]float32) []float64 {
+			distances, err := g.Distances(signalsA, signalsB, 1)
+			if err != nil {
+				log.Panic(err)
+			}
+			result := make([]float64, len(distances))
+			for index, distance := range distances {
+				result[index] = float64(distance)
+			}
+			return result
+		})
+	}
+	return g.normalizedAudioDistance(audioA, audioB, eachChannel(func(signalA, signalB []float32) float64 {
+		return g.ReferenceDistance(cache.Analyze(g, signalA), signalB)
+	}))
+}
+
+// StagedNormalizedAudioDistance is like NormalizedAudioDistance, but gets the channel energies of both audioA and audioB
+// from the cache, and only runs the stages after the filterbank on them.
+//
+// Meant for evaluating many parameter sets that share the upstream parameters of EnergyParameters, e.g. when
+// optimizing the masking, loudness, or NSIM parameters.
+func (g *Goohrli) StagedNormalizedAudioDistance(cache *EnergyCache, audioA, audioB *audio.Audio) (float64, error) {
+	return g.normalizedAudioDistance(audioA, audioB, eachChannel(func(signalA, signalB []float32) float64 {
+		return float64(g.AnalysisDistance(g.AnalyzeEnergy(cache.Energy(g, signalA)), g.AnalyzeEnergy(cache.Energy(g, signalB))))
+	}))
+}
+
+// eachChannel returns a function computing distance for each pair of channels.
+func eachChannel(distance func(signalA, signalB []float32) float64) func(signalsA, signalsB [][]float32) []float64 {
+	return func(signalsA, signalsB [][]float32) []float64 {
+		result := make([]float64, len(signalsA))
+		for index := range signalsA {
+			result[index] = distance(signalsA[index], signalsB[index])
+		}
+		return result
+	}
+}
+
+// normalizedAudioDistance normalizes the channels of audioB to the amplitude of audioA, and returns the root mean
+// square of the distances between the channels computed by distances.
+func (g *Goohrli) normalizedAudioDistance(audioA, audioB *audio.Audio, distances func(signalsA, signalsB [][]float32) []float64) (float64, error) {
 	sumOfSquares := 0.0
 	params := g.Parameters()
 	if params.SampleRate != audioA.Rate || params.SampleRate != audioB.Rate {
@@ -303,7 +419,8 @@ func (g *Goohrli) NormalizedAudioDistance(audioA, audioB *audio.Audio) (float64,
 	for channelIndex := range audioA.Samples {
 		measurement := Measure(audioA.Samples[channelIndex])
 		NormalizeAmplitude(measurement.MaxAbsAmplitude, audioB.Samples[channelIndex])
-		dist := float64(g.Distance(audioA.Samples[channelIndex], audioB.Samples[channelIndex]))
+	}
+	for _, dist := range distances(audioA.Samples, audioB.Samples) {
 		if math.IsNaN(dist) {
 			return 0, fmt.Errorf("%v.Distance(...) returned %v", g, dist)
 		}
@@ -332,11 +449,91 @@ func (g *Goohrli) Analyze(signal []float32) *Analysis {
 	return result
 }
 
+// AnalyzeCompact returns an analysis of the signal that only keeps the spectrogram, as 16-bit floats.
+//
+// It uses a sixth of the memory of Analyze, and can be used anywhere an analysis from Analyze can.
+func (g *Goohrli) AnalyzeCompact(signal []float32) *Analysis {
+	result := &Analysis{
+		analysis: C.AnalyzeCompact(g.zimtohrli, (*C.float)(&signal[0]), C.int(len(signal))),
+	}
+	runtime.SetFinalizer(result, func(a *Analysis) {
+		C.FreeAnalysis(a.analysis)
+	})
+	return result
+}
+
+// Energy is a Go wrapper around the channel energy of a signal, the output of the filterbank stage of Analyze.
+type Energy struct {
+	energy C.Energy
+}
+
+// Energy returns the channel energy of the signal.
+//
+// The energy only depends on the EnergyParameters of g, so it can be reused by instances that only differ in
+// other parameters.
+func (g *Goohrli) Energy(signal []float32) *Energy {
+	result := &Energy{
+		energy: C.ChannelEnergy(g.zimtohrli, (*C.float)(&signal[0]), C.int(len(signal))),
+	}
+	runtime.SetFinalizer(result, func(e *Energy) {
+		C.FreeEnergy(e.energy)
+	})
+	return result
+}
+
+// AnalyzeEnergy returns an analysis of the signal with the provided channel energy, running only the masking and
+// loudness stages of Analyze.
+//
+// The energy must come from an instance with the same EnergyParameters as g.
+func (g *Goohrli) AnalyzeEnergy(energy *Energy) *Analysis {
+	result := &Analysis{
+		analysis: C.AnalyzeEnergy(g.zimtohrli, energy.energy),
+	}
+	runtime.KeepAlive(energy)
+	runtime.SetFinalizer(result, func(a *Analysis) {
+		C.FreeAnalysis(a.analysis)
+	})
+	return result
+}
+
 // AnalysisDistance returns the Zimtohrli distance between two analyses.
 func (g *Goohrli) AnalysisDistance(analysisA *Analysis, analysisB *Analysis) float32 {
 	return float32(C.AnalysisDistance(g.zimtohrli, analysisA.analysis, analysisB.analysis))
 }
 
+// AnalysisDistanceBelow returns whether the Zimtohrli distance between two analyses is below threshold.
+//
+// Only computes as much of the distance as needed to know, so analyses much closer or much further apart than
+// threshold are cheaper to decide than computing their AnalysisDistance.
+func (g *Goohrli) AnalysisDistanceBelow(analysisA *Analysis, analysisB *Analysis, threshold float32) bool {
+	result := C.AnalysisDistanceBelow(g.zimtohrli, analysisA.analysis, analysisB.analysis, C.float(threshold)) != 0
+	runtime.KeepAlive(analysisA)
+	runtime.KeepAlive(analysisB)
+	return result
+}
+
+// DistanceMatrix returns the distances between all pairs of analyses, where result[i][j] is the distance between
+// analyses[i] and analyses[j].
+//
+// Each pair is only computed once, since distances are symmetric, and the pairs are spread over numThreads threads.
+func (g *Goohrli) DistanceMatrix(analyses []*Analysis, numThreads int) [][]float32 {
+	if len(analyses) == 0 {
+		return nil
+	}
+	handles := make([]C.Analysis, len(analyses))
+	for index, analysis := range analyses {
+		handles[index] = analysis.analysis
+	}
+	distances := make([]float32, len(analyses)*len(analyses))
+	C.DistanceMatrix(g.zimtohrli, &handles[0], C.int(len(analyses)), C.int(numThreads), (*C.float)(&distances[0]))
+	runtime.KeepAlive(analyses)
+	result := make([][]float32, len(analyses))
+	for index := range result {
+		result[index] = distances[index*len(analyses) : (index+1)*len(analyses)]
+	}
+	return result
+}
+
 // Distance returns the Zimtohrli distance between two signals.
 func (g *Goohrli) Distance(signalA []float32, signalB []float32) float64 {
 	analysisA := C.Analyze(g.zimtohrli, (*C.float)(&signalA[0]), C.int(len(signalA)))
@@ -346,15 +543,104 @@ func (g *Goohrli) Distance(signalA []float32, signalB []float32) float64 {
 	return float64(C.AnalysisDistance(g.zimtohrli, analysisA, analysisB))
 }
 
+// ReferenceDistance returns the Zimtohrli distance between a precomputed reference analysis and a signal.
+func (g *Goohrli) ReferenceDistance(reference *Analysis, signal []float32) float64 {
+	result := float64(C.ReferenceDistance(g.zimtohrli, reference.analysis, (*C.float)(&signal[0]), C.int(len(signal))))
+	runtime.KeepAlive(reference)
+	return result
+}
+
+// ReferenceDistances returns the Zimtohrli distances between a precomputed reference analysis and each of the signals.
+//
+// Equivalent to calling ReferenceDistance for each signal, but makes a single cgo call, and spreads the signals over
+// numThreads threads.
+func (g *Goohrli) ReferenceDistances(reference *Analysis, signals [][]float32, numThreads int) []float32 {
+	if len(signals) == 0 {
+		return nil
+	}
+	var pinner runtime.Pinner
+	defer pinner.Unpin()
+	data, sizes := pinSignals(&pinner, signals)
+	distances := make([]float32, len(signals))
+	C.ReferenceDistances(g.zimtohrli, reference.analysis, &data[0], &sizes[0], C.int(len(signals)), C.int(numThreads), (*C.float)(&distances[0]))
+	runtime.KeepAlive(reference)
+	return distances
+}
+
+// Distances returns the Zimtohrli distances between signalsA[i] and signalsB[i] for each i.
+//
+// Equivalent to calling Distance for each pair, but makes a single cgo call, and spreads the pairs over numThreads
+// threads.
+func (g *Goohrli) Distances(signalsA, signalsB [][]float32, numThreads int) ([]float32, error) {
+	if len(signalsA) != len(signalsB) {
+		return nil, fmt.Errorf("the number of signals A and B differ: %v, %v", len(signalsA), len(signalsB))
+	}
+	if len(signalsA) == 0 {
+		return nil, nil
+	}
+	var pinner runtime.Pinner
+	defer pinner.Unpin()
+	dataA, sizesA := pinSignals(&pinner, signalsA)
+	dataB, sizesB := pinSignals(&pinner, signalsB)
+	distances := make([]float32, len(signalsA))
+	C.PairDistances(g.zimtohrli, &dataA[0], &sizesA[0], &dataB[0], &sizesB[0], C.int(len(signalsA)), C.int(numThreads), (*C.float)(&distances[0]))
+	return distances, nil
+}
+
+// pinSignals pins the signals, so that pointers to them can be passed to C inside a slice, and returns those pointers
+// along with the sizes of the signals.
+//
+// Empty signals have no memory to pin, and are passed as nil with size 0.
+func pinSignals(pinner *runtime.Pinner, signals [][]float32) ([]*C.float, []C.int) {
+	data := make([]*C.float, len(signals))
+	sizes := make([]C.int, len(signals))
+	for index, signal := range signals {
+		if len(signal) == 0 {
+			continue
+		}
+		pinner.Pin(&signal[0])
+		data[index] = (*C.float)(&signal[0])
+		sizes[index] = C.int(len(signal))
+	}
+	return data, sizes
+}
+
 // ViSQOL is a Go wrapper around zimtohrli::ViSQOL.
+//
+// Keeps the most recently used references prepared, so that AudioMOS resamples each reference once when it's
+// compared to many distorted signals.
 type ViSQOL struct {
 	visqol C.ViSQOL
+
+	mutex      sync.Mutex
+	references map[viSQOLReferenceKey]*viSQOLReferenceEntry
+	// The keys of references, from least to most recently used.
+	order []viSQOLReferenceKey
+}
+
+// viSQOLReferenceCacheSize is the number of prepared references kept by a ViSQOL.
+const viSQOLReferenceCacheSize = 16
+
+type viSQOLReferenceKey struct {
+	signalHash [sha256.Size]byte
+	sampleRate float64
+}
+
+type viSQOLReferenceEntry struct {
+	once      sync.Once
+	reference *ViSQOLReference
+}
+
+// ViSQOLReference is a Go wrapper around zimtohrli::ViSQOL::Reference.
+type ViSQOLReference struct {
+	reference C.ViSQOLReference
 }
 
 // NewViSQOL returns a new Gosqol.
 func NewViSQOL() *ViSQOL {
 	result := &ViSQOL{
-		visqol: C.CreateViSQOL(),
+		visqol:     C.CreateViSQOL(),
+		references: map[viSQOLReferenceKey]*viSQOLReferenceEntry{},
 	}
 	runtime.SetFinalizer(result, func(g *ViSQOL) {
 		C.FreeViSQOL(g.visqol)
@@ -371,7 +657,67 @@ func (v *ViSQOL) MOS(sampleRate float64, reference []float32, degraded []float32
 	return float64(result.MOS), nil
 }
 
+// Reference returns the reference samples prepared for ReferenceMOS.
+func (v *ViSQOL) Reference(sampleRate float64, reference []float32) *ViSQOLReference {
+	result := &ViSQOLReference{
+		reference: C.CreateViSQOLReference(v.visqol, C.float(sampleRate), (*C.float)(&reference[0]), C.int(len(reference))),
+	}
+	runtime.KeepAlive(v)
+	runtime.SetFinalizer(result, func(r *ViSQOLReference) {
+		C.FreeViSQOLReference(r.reference)
+	})
+	return result
+}
+
+// ReferenceMOS returns the ViSQOL mean opinion score of the degraded samples compared to the prepared reference.
+//
+// The degraded samples must have the sample rate the reference was prepared with.
+func (v *ViSQOL) ReferenceMOS(reference *ViSQOLReference, degraded []float32) (float64, error) {
+	result := C.ReferenceMOS(v.visqol, reference.reference, (*C.float)(&degraded[0]), C.int(len(degraded)))
+	runtime.KeepAlive(v)
+	runtime.KeepAlive(reference)
+	if result.Status != 0 {
+		return 0, fmt.Errorf("calling ViSQOL returned status %v", result.Status)
+	}
+	return float64(result.MOS), nil
+}
+
+// cachedReference returns the prepared reference, preparing it only if it isn't among the recently used ones.
+func (v *ViSQOL) cachedReference(sampleRate float64, reference []float32) *ViSQOLReference {
+	key := viSQOLReferenceKey{
+		signalHash: signalHash(reference),
+		sampleRate: sampleRate,
+	}
+	v.mutex.Lock()
+	entry, found := v.references[key]
+	if found {
+		// Move the key to the most recently used end of the order.
+		for index, usedKey := range v.order {
+			if usedKey == key {
+				v.order = append(v.order[:index], v.order[index+1:]...)
+				break
+			}
+		}
+	} else {
+		entry = &viSQOLReferenceEntry{}
+		v.references[key] = entry
+	}
+	v.order = append(v.order, key)
+	for len(v.order) > viSQOLReferenceCacheSize {
+		delete(v.references, v.order[0])
+		v.order = v.order[1:]
+	}
+	v.mutex.Unlock()
+	entry.once.Do(func() {
+		entry.reference = v.Reference(sampleRate, reference)
+	})
+	return entry.reference
+}
+
 // AudioMOS returns the ViSQOL mean opinion score of the degraded audio compared to the reference audio.
+//
+// The prepared reference channels are cached, so comparing many degraded audios to the same reference only
+// resamples the reference once.
 func (v *ViSQOL) AudioMOS(reference, degraded *audio.Audio) (float64, error) {
 	sumOfSquares := 0.0
 	if reference.Rate != degraded.Rate {
@@ -381,7 +727,7 @@ func (v *ViSQOL) AudioMOS(reference, degraded *audio.Audio) (float64, error) {
 		return 0, fmt.Errorf("the audio files don't have the same number of channels: %v, %v", len(reference.Samples), len(degraded.Samples))
 	}
 	for channelIndex := range reference.Samples {
-		mos, err := v.MOS(reference.Rate, reference.Samples[channelIndex], degraded.Samples[channelIndex])
+		mos, err := v.ReferenceMOS(v.cachedReference(reference.Rate, reference.Samples[channelIndex]), degraded.Samples[channelIndex])
 		if err != nil {
 			return 0, err
 		}
@@ -23,6 +23,8 @@
 #ifndef GO_LIB_GOOHRLI_H_
 #define GO_LIB_GOOHRLI_H_
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -49,6 +51,7 @@ typedef struct ZimtohrliParameters {
   float FullScaleSineDB;
   int ApplyLoudness;
   float UnwarpWindowSeconds;
+  float UnwarpCorridorSeconds;
   int NSIMStepWindow;
   int NSIMChannelWindow;
   float MaskingLowerZeroAt20;
@@ -76,13 +79,51 @@ Zimtohrli CreateZimtohrli(ZimtohrliParameters params);
 // Deletes a zimtohrli::Zimtohrli.
 void FreeZimtohrli(Zimtohrli z);
 
-// void* representation of zimtohrli::Analysis.
+// Returns the number of frequency channels of the zimtohrli::Zimtohrli.
+//
+// Analyses from instances with the same number of channels and the same
+// frequency resolution and filter parameters land on the same perceptual grid,
+// even if the instances were created for different sample rates.
+int NumChannels(Zimtohrli z);
+
+// void* representation of a zimtohrli::Analysis or a
+// zimtohrli::CompactAnalysis.
 typedef void* Analysis;
 
 // Returns a zimtohrli::Analysis produced by the provided zimtohrli::Zimtohrli
 // and using the provided perceptual_sample_rate and data.
+//
+// The data is read in place, and only has to stay valid during the call.
 Analysis Analyze(Zimtohrli zimtohrli, float* data, int size);
 
+// Like Analyze, but returns a zimtohrli::CompactAnalysis that only keeps the
+// spectrogram, as 16-bit floats, using a sixth of the memory.
+//
+// Compact and full analyses can be used interchangeably in AnalysisDistance,
+// ReferenceDistance, and FreeAnalysis.
+Analysis AnalyzeCompact(Zimtohrli zimtohrli, float* data, int size);
+
+// void* representation of the linear channel energy returned by
+// zimtohrli::Zimtohrli::Energy.
+typedef void* Energy;
+
+// Returns the channel energy of data computed by the filterbank of the
+// provided zimtohrli::Zimtohrli.
+//
+// The energy only depends on the sample rate, frequency resolution, filter,
+// and perceptual sample rate parameters, so it can be reused by instances that
+// only differ in other parameters.
+//
+// The data is read in place, and only has to stay valid during the call.
+Energy ChannelEnergy(Zimtohrli zimtohrli, float* data, int size);
+
+// Deletes an Energy.
+void FreeEnergy(Energy e);
+
+// Returns a zimtohrli::Analysis of the signal with the provided channel
+// energy, running only the masking and loudness stages of Analyze.
+Analysis AnalyzeEnergy(Zimtohrli zimtohrli, Energy energy);
+
 // Plain C version of zimtohrli::EnergyAndMaxAbsAmplitude.
 typedef struct {
   float EnergyDBFS;
@@ -95,6 +136,8 @@ EnergyAndMaxAbsAmplitude Measure(const float* signal, int size);
 // Normalizes the amplitudes of the signal so that it has the provided max
 // amplitude, and returns the new energ in dB FS, and the new maximum absolute
 // amplitude.
+//
+// The signal is normalized in place.
 EnergyAndMaxAbsAmplitude NormalizeAmplitude(float max_abs_amplitude,
                                             float* signal_data, int size);
 
@@ -113,6 +156,109 @@ void FreeAnalysis(Analysis a);
 // zimtohrli::Zimtohrli.
 float AnalysisDistance(Zimtohrli zimtohrli, Analysis a, Analysis b);
 
+// Returns 1 if the Zimtohrli distance between two analyses is below
+// threshold, and 0 otherwise, only computing as much of the distance as
+// needed to know, see zimtohrli::Zimtohrli::DistanceBelow.
+int AnalysisDistanceBelow(Zimtohrli zimtohrli, Analysis a, Analysis b,
+                          float threshold);
+
+// Returns the Zimtohrli distance between a precomputed reference analysis and
+// the analysis of the provided data, using the provided zimtohrli::Zimtohrli.
+//
+// Avoids re-analyzing the reference when comparing it to many signals.
+float ReferenceDistance(Zimtohrli zimtohrli, Analysis reference, float* data,
+                        int size);
+
+// Populates distances with the Zimtohrli distances between a precomputed
+// reference analysis and each of the num_signals signals, where signal i has
+// sizes[i] samples at data[i], computed on num_threads threads with one
+// zimtohrli::ZimtohrliWorkspace per thread.
+//
+// Equivalent to calling ReferenceDistance for each signal, but in a single
+// call. The data is read in place, and only has to stay valid during the
+// call.
+void ReferenceDistances(Zimtohrli zimtohrli, Analysis reference,
+                        const float* const* data, const int* sizes,
+                        int num_signals, int num_threads, float* distances);
+
+// Populates distances with the Zimtohrli distances between the num_pairs pairs
+// of signals, where pair i has sizes_a[i] samples at data_a[i] and sizes_b[i]
+// samples at data_b[i], computed on num_threads threads with one
+// zimtohrli::ZimtohrliWorkspace per thread.
+//
+// Equivalent to analyzing both signals of each pair and calling
+// AnalysisDistance, but in a single call. The data is read in place, and only
+// has to stay valid during the call.
+void PairDistances(Zimtohrli zimtohrli, const float* const* data_a,
+                   const int* sizes_a, const float* const* data_b,
+                   const int* sizes_b, int num_pairs, int num_threads,
+                   float* distances);
+
+// Populates distances with the row-major (num_analyses, num_analyses)-shaped
+// matrix of distances between all pairs of analyses, computed on num_threads
+// threads using zimtohrli::Zimtohrli::DistanceMatrix.
+void DistanceMatrix(Zimtohrli zimtohrli, const Analysis* analyses,
+                    int num_analyses, int num_threads, float* distances);
+
+// Returns the zimtohrli::AnalysisFingerprint of the zimtohrli::Zimtohrli.
+uint64_t AnalysisFingerprint(Zimtohrli zimtohrli);
+
+// Writes the spectrogram of the analysis to path as an analysis file (see
+// zimt/analysis_file.h), fingerprinted with the provided zimtohrli::Zimtohrli.
+//
+// Returns 0 on success, and an absl::StatusCode otherwise.
+int WriteAnalysis(Zimtohrli zimtohrli, Analysis analysis, const char* path);
+
+// Returns an Analysis containing the num_steps rows of num_channels
+// spectrogram values at data, with row_stride floats between the start of each
+// row, e.g. from a memory mapped analysis file.
+//
+// The data is copied, and doesn't have to outlive the returned Analysis.
+Analysis AnalysisFromSpectrogram(const float* data, int num_steps,
+                                 int num_channels, int row_stride);
+
+// Writes the filterbank designs cached in this process to path, see
+// zimtohrli::WriteFilterbankCache.
+//
+// Returns 0 on success, and an absl::StatusCode otherwise.
+int WriteFilterbankCache(const char* path);
+
+// Adds the filterbank designs in path to the cache of this process, so that
+// CreateZimtohrli skips designing those filterbanks, see
+// zimtohrli::ReadFilterbankCache.
+//
+// Returns 0 on success, and an absl::StatusCode otherwise.
+int ReadFilterbankCache(const char* path);
+
+// void* representation of a zimtohrli::AudioFileReader.
+typedef void* AudioReader;
+
+// Opens the audio file at path with libsndfile, and stores a
+// zimtohrli::AudioFileReader decoding it in reader.
+//
+// Returns 0 on success, and an absl::StatusCode otherwise.
+int OpenAudioReader(const char* path, AudioReader* reader);
+
+// Deletes an AudioReader, closing the file.
+void FreeAudioReader(AudioReader reader);
+
+// Returns the number of channels in the file of the reader.
+int AudioReaderNumChannels(AudioReader reader);
+
+// Returns the number of frames in the file of the reader.
+int64_t AudioReaderNumFrames(AudioReader reader);
+
+// Returns the sample rate of the file of the reader.
+float AudioReaderSampleRate(AudioReader reader);
+
+// Decodes the next frames of the file of the reader as planar floats into
+// data, with the max_frames samples of each channel after each other, and
+// stores the number of frames decoded in num_read.
+//
+// Returns 0 on success, and an absl::StatusCode otherwise.
+int ReadAudio(AudioReader reader, float* data, int64_t max_frames,
+              int64_t* num_read);
+
 // Sets the parameters.
 //
 // Sample rate, frequency resolution, and filter parameters can only be set when
@@ -123,6 +269,35 @@ void SetZimtohrliParameters(Zimtohrli zimtohrli,
 // Returns the parameters.
 ZimtohrliParameters GetZimtohrliParameters(Zimtohrli zimtohrli);
 
+// Counters of the work done by one stage, see zimtohrli::StageStats.
+typedef struct {
+  double Seconds;
+  int64_t Calls;
+  int64_t Samples;
+  int64_t BytesAllocated;
+} StageStats;
+
+// Counters of the work done by a zimtohrli::Zimtohrli, see
+// zimtohrli::ZimtohrliStats.
+typedef struct {
+  StageStats Filterbank;
+  StageStats Masking;
+  StageStats Loudness;
+  StageStats DTW;
+  StageStats NSIM;
+  int64_t DTWCells;
+} ZimtohrliStats;
+
+// Makes zimtohrli record stats from now on, starting with all counters at
+// zero.
+//
+// Must not be called concurrently with other calls using zimtohrli.
+void EnableZimtohrliStats(Zimtohrli zimtohrli);
+
+// Returns the stats recorded since EnableZimtohrliStats, or all zeros if it
+// wasn't called.
+ZimtohrliStats GetZimtohrliStats(Zimtohrli zimtohrli);
+
 // void* representation of zimtohrli::ViSQOL.
 typedef void* ViSQOL;
 
@@ -142,6 +317,22 @@ typedef struct {
 MOSResult MOS(ViSQOL v, float sample_rate, const float* reference,
               int reference_size, const float* distorted, int distorted_size);
 
+// void* representation of zimtohrli::ViSQOL::Reference.
+typedef void* ViSQOLReference;
+
+// Returns a zimtohrli::ViSQOL::Reference of reference.
+ViSQOLReference CreateViSQOLReference(ViSQOL v, float sample_rate,
+                                      const float* reference,
+                                      int reference_size);
+
+// Deletes a zimtohrli::ViSQOL::Reference.
+void FreeViSQOLReference(ViSQOLReference r);
+
+// ReferenceMOS returns a ViSQOL MOS between the prepared reference and
+// distorted.
+MOSResult ReferenceMOS(ViSQOL v, ViSQOLReference r, const float* distorted,
+                       int distorted_size);
+
 #ifdef __cplusplus
 }
 #endif
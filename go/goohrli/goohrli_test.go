@@ -18,9 +18,12 @@ import (
 	"encoding/json"
 	"log"
 	"math"
+	"path/filepath"
 	"reflect"
 	"testing"
 	"time"
+
+	"github.com/google/zimtohrli/go/audio"
 )
 
 func TestMeasureAndNormalize(t *testing.T) {
@@ -85,6 +88,7 @@ func TestParams(t *testing.T) {
 	params.PerceptualSampleRate *= 0.5
 	params.SampleRate *= 0.5
 	params.UnwarpWindow.Duration *= 2
+	params.UnwarpCorridor.Duration = 125 * time.Millisecond
 
 	g.Set(params)
 	newParams := g.Parameters()
@@ -138,6 +142,377 @@ func TestGoohrli(t *testing.T) {
 		if d := rdiff(distance, tc.distance); d > 0.1 {
 			t.Errorf("Distance = %v, want %v", distance, tc.distance)
 		}
+		referenceDistance := g.ReferenceDistance(analysisA, soundB)
+		if d := rdiff(referenceDistance, tc.distance); d > 0.1 {
+			t.Errorf("ReferenceDistance = %v, want %v", referenceDistance, tc.distance)
+		}
+	}
+}
+
+func TestAnalysisDistanceBelow(t *testing.T) {
+	params := DefaultParameters(48000)
+	g := New(params)
+	analyses := []*Analysis{}
+	for _, freq := range []float64{1000, 1100, 4000} {
+		sound := make([]float32, int(params.SampleRate)/4)
+		for index := range sound {
+			sound[index] = float32(math.Sin(2 * math.Pi * freq * float64(index) / params.SampleRate))
+		}
+		analyses = append(analyses, g.Analyze(sound))
+	}
+	for _, other := range analyses[1:] {
+		distance := g.AnalysisDistance(analyses[0], other)
+		for _, threshold := range []float32{0, distance / 2, distance, distance*2 + 1e-3, 1} {
+			if got, want := g.AnalysisDistanceBelow(analyses[0], other, threshold), distance < threshold; got != want {
+				t.Errorf("AnalysisDistanceBelow(..., %v) = %v, want %v", threshold, got, want)
+			}
+		}
+	}
+}
+
+func TestBatchDistances(t *testing.T) {
+	params := DefaultParameters(48000)
+	g := New(params)
+	sounds := [][]float32{}
+	for _, freq := range []float64{1000, 2000, 4000} {
+		sound := make([]float32, int(params.SampleRate)/4)
+		for index := range sound {
+			sound[index] = float32(math.Sin(2 * math.Pi * freq * float64(index) / params.SampleRate))
+		}
+		sounds = append(sounds, sound)
+	}
+	reference := g.Analyze(sounds[0])
+	referenceDistances := g.ReferenceDistances(reference, sounds, 2)
+	references := [][]float32{sounds[0], sounds[0], sounds[0]}
+	distances, err := g.Distances(references, sounds, 2)
+	if err != nil {
+		t.Fatal(err)
+	}
+	for index, sound := range sounds {
+		if want := float32(g.ReferenceDistance(reference, sound)); referenceDistances[index] != want {
+			t.Errorf("ReferenceDistances(...)[%v] = %v, want %v", index, referenceDistances[index], want)
+		}
+		if want := float32(g.Distance(sounds[0], sound)); distances[index] != want {
+			t.Errorf("Distances(...)[%v] = %v, want %v", index, distances[index], want)
+		}
+	}
+	if _, err := g.Distances(references, sounds[1:], 2); err == nil {
+		t.Errorf("Distances(...) with different numbers of signals succeeded")
+	}
+}
+
+func TestDistanceMatrix(t *testing.T) {
+	params := DefaultParameters(48000)
+	g := New(params)
+	analyses := []*Analysis{}
+	for _, freq := range []float64{1000, 2000, 4000} {
+		sound := make([]float32, int(params.SampleRate)/4)
+		for index := range sound {
+			sound[index] = float32(math.Sin(2 * math.Pi * freq * float64(index) / params.SampleRate))
+		}
+		analyses = append(analyses, g.Analyze(sound))
+	}
+	matrix := g.DistanceMatrix(analyses, 2)
+	if len(matrix) != len(analyses) {
+		t.Fatalf("len(DistanceMatrix(...)) = %v, want %v", len(matrix), len(analyses))
+	}
+	for row := range analyses {
+		if matrix[row][row] != 0 {
+			t.Errorf("DistanceMatrix(...)[%v][%v] = %v, want 0", row, row, matrix[row][row])
+		}
+		for column := row + 1; column < len(analyses); column++ {
+			if want := g.AnalysisDistance(analyses[row], analyses[column]); matrix[row][column] != want {
+				t.Errorf("DistanceMatrix(...)[%v][%v] = %v, want %v", row, column, matrix[row][column], want)
+			}
+			if matrix[column][row] != matrix[row][column] {
+				t.Errorf("DistanceMatrix(...)[%v][%v] = %v, want %v", column, row, matrix[column][row], matrix[row][column])
+			}
+		}
+	}
+}
+
+func TestMultiRate(t *testing.T) {
+	m := NewMultiRate(DefaultParameters(48000))
+	if m.ForRate(48000) != m.ForRate(48000) {
+		t.Errorf("ForRate(48000) returned different instances")
+	}
+	tone := func(rate, freq float64) *audio.Audio {
+		samples := make([]float32, int(rate)/2)
+		for index := range samples {
+			samples[index] = float32(0.5 * math.Sin(2*math.Pi*freq*float64(index)/rate))
+		}
+		return &audio.Audio{Samples: [][]float32{samples}, Rate: rate}
+	}
+	otherTone, err := m.NormalizedAudioDistance(tone(48000, 1000), tone(48000, 1100))
+	if err != nil {
+		t.Fatal(err)
+	}
+	for _, rate := range []float64{44100, 96000} {
+		crossRate, err := m.NormalizedAudioDistance(tone(48000, 1000), tone(rate, 1000))
+		if err != nil {
+			t.Fatal(err)
+		}
+		if crossRate*10 > otherTone {
+			t.Errorf("distance between the same tone at 48000 and %v is %v, want much less than %v", rate, crossRate, otherTone)
+		}
+	}
+	if _, err := m.NormalizedAudioDistance(tone(48000, 1000), tone(16000, 1000)); err == nil {
+		t.Errorf("NormalizedAudioDistance of audio at 48000 and 16000 returned no error")
+	}
+}
+
+func TestAnalysisCache(t *testing.T) {
+	params := DefaultParameters(48000)
+	g := New(params)
+	cache := NewAnalysisCache(2)
+	sounds := make([][]float32, 3)
+	for soundIndex := range sounds {
+		sounds[soundIndex] = make([]float32, int(params.SampleRate)/10)
+		for index := range sounds[soundIndex] {
+			sounds[soundIndex][index] = float32(math.Sin(2 * math.Pi * float64(1000*(soundIndex+1)) * float64(index) / params.SampleRate))
+		}
+	}
+	analysis := cache.Analyze(g, sounds[0])
+	if cached := cache.Analyze(g, sounds[0]); cached != analysis {
+		t.Errorf("Analyze of the same sound returned %v, want cached %v", cached, analysis)
+	}
+	params.FullScaleSineDB += 10
+	otherG := New(params)
+	if other := cache.Analyze(otherG, sounds[0]); other == analysis {
+		t.Errorf("Analyze with different parameters returned the cached analysis")
+	}
+	cache.Analyze(g, sounds[1])
+	cache.Analyze(g, sounds[2])
+	if l := cache.Len(); l != 2 {
+		t.Errorf("Len() = %v, want 2", l)
+	}
+}
+
+func TestEnergyCache(t *testing.T) {
+	params := DefaultParameters(48000)
+	g := New(params)
+	cache := NewEnergyCache(2)
+	tone := func(freq float64) *audio.Audio {
+		samples := make([]float32, int(params.SampleRate)/4)
+		for index := range samples {
+			samples[index] = float32(0.5 * math.Sin(2*math.Pi*freq*float64(index)/params.SampleRate))
+		}
+		return &audio.Audio{Samples: [][]float32{samples}, Rate: params.SampleRate}
+	}
+	reference := tone(1000)
+	energy := cache.Energy(g, reference.Samples[0])
+	if cached := cache.Energy(g, reference.Samples[0]); cached != energy {
+		t.Errorf("Energy of the same sound returned %v, want cached %v", cached, energy)
+	}
+
+	downstreamParams := params
+	downstreamParams.MaskingMaxMask += 5
+	downstreamParams.NSIMStepWindow += 4
+	downstreamG := New(downstreamParams)
+	if shared := cache.Energy(downstreamG, reference.Samples[0]); shared != energy {
+		t.Errorf("Energy with different downstream parameters returned %v, want cached %v", shared, energy)
+	}
+	for _, z := range []*Goohrli{g, downstreamG} {
+		want, err := z.NormalizedAudioDistance(reference, tone(1100))
+		if err != nil {
+			t.Fatal(err)
+		}
+		got, err := z.StagedNormalizedAudioDistance(cache, reference, tone(1100))
+		if err != nil {
+			t.Fatal(err)
+		}
+		if got != want {
+			t.Errorf("StagedNormalizedAudioDistance(...) = %v, want %v", got, want)
+		}
+	}
+
+	upstreamParams := params
+	upstreamParams.PerceptualSampleRate += 10
+	if other := cache.Energy(New(upstreamParams), reference.Samples[0]); other == energy {
+		t.Errorf("Energy with different upstream parameters returned the cached energy")
+	}
+	if l := cache.Len(); l != 2 {
+		t.Errorf("Len() = %v, want 2", l)
+	}
+}
+
+func TestLoadAudio(t *testing.T) {
+	loaded, err := LoadAudio(filepath.Join("..", "..", "cpp", "zimt", "test.wav"))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(loaded.Samples) != 2 {
+		t.Fatalf("got %v channels, want 2", len(loaded.Samples))
+	}
+	for channelIndex, amplitude := range []float32{0.5, 0.25} {
+		if len(loaded.Samples[channelIndex]) != 10 {
+			t.Fatalf("got %v frames in channel %v, want 10", len(loaded.Samples[channelIndex]), channelIndex)
+		}
+		for frameIndex, sample := range loaded.Samples[channelIndex] {
+			want := amplitude
+			if frameIndex%2 == 1 {
+				want = -amplitude
+			}
+			if sample != want {
+				t.Errorf("sample %v of channel %v is %v, want %v", frameIndex, channelIndex, sample, want)
+			}
+		}
+	}
+	if loaded.MaxAbsAmplitude != 0.5 {
+		t.Errorf("MaxAbsAmplitude is %v, want 0.5", loaded.MaxAbsAmplitude)
+	}
+	if _, err := LoadAudio(filepath.Join(t.TempDir(), "missing.wav")); err == nil {
+		t.Errorf("LoadAudio of a missing file returned no error")
+	}
+}
+
+func TestAnalyzeCompact(t *testing.T) {
+	params := DefaultParameters(48000)
+	g := New(params)
+	soundA := make([]float32, int(params.SampleRate))
+	soundB := make([]float32, int(params.SampleRate))
+	for index := range soundA {
+		soundA[index] = float32(math.Sin(2 * math.Pi * 5000 * float64(index) / params.SampleRate))
+		soundB[index] = float32(math.Sin(2 * math.Pi * 10000 * float64(index) / params.SampleRate))
+	}
+	want := float64(g.AnalysisDistance(g.Analyze(soundA), g.Analyze(soundB)))
+	compactA := g.AnalyzeCompact(soundA)
+	compactB := g.AnalyzeCompact(soundB)
+	if got := float64(g.AnalysisDistance(compactA, compactB)); rdiff(got, want) > 0.01 {
+		t.Errorf("AnalysisDistance of compact analyses = %v, want %v", got, want)
+	}
+	if got := float64(g.AnalysisDistance(compactA, g.Analyze(soundB))); rdiff(got, want) > 0.01 {
+		t.Errorf("AnalysisDistance of compact and full analysis = %v, want %v", got, want)
+	}
+	if got := g.ReferenceDistance(compactA, soundB); rdiff(got, want) > 0.01 {
+		t.Errorf("ReferenceDistance of compact analysis = %v, want %v", got, want)
+	}
+}
+
+func TestAnalysisFile(t *testing.T) {
+	params := DefaultParameters(48000)
+	g := New(params)
+	soundA := make([]float32, int(params.SampleRate)/4)
+	soundB := make([]float32, int(params.SampleRate)/4)
+	for index := range soundA {
+		soundA[index] = float32(math.Sin(2 * math.Pi * 1000 * float64(index) / params.SampleRate))
+		soundB[index] = float32(math.Sin(2 * math.Pi * 2000 * float64(index) / params.SampleRate))
+	}
+	analysisA := g.Analyze(soundA)
+	path := filepath.Join(t.TempDir(), "a.zspec")
+	if err := g.SaveAnalysis(analysisA, path); err != nil {
+		t.Fatal(err)
+	}
+
+	file, err := OpenAnalysisFile(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if file.Header.Fingerprint != g.Fingerprint() {
+		t.Errorf("Fingerprint = %v, want %v", file.Header.Fingerprint, g.Fingerprint())
+	}
+	if file.Header.NumSteps == 0 || file.Header.NumChannels == 0 {
+		t.Errorf("Header = %+v, want non empty spectrogram", file.Header)
+	}
+	if l := len(file.Row(0)); uint64(l) != file.Header.NumChannels {
+		t.Errorf("len(Row(0)) = %v, want %v", l, file.Header.NumChannels)
+	}
+	if err := file.Close(); err != nil {
+		t.Error(err)
+	}
+
+	loadedA, err := g.LoadAnalysis(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	analysisB := g.Analyze(soundB)
+	if got, want := g.AnalysisDistance(loadedA, analysisB), g.AnalysisDistance(analysisA, analysisB); got != want {
+		t.Errorf("AnalysisDistance with loaded analysis = %v, want %v", got, want)
+	}
+
+	params.FullScaleSineDB += 10
+	if _, err := New(params).LoadAnalysis(path); err == nil {
+		t.Errorf("LoadAnalysis with different parameters succeeded")
+	}
+}
+
+func TestFilterbankCache(t *testing.T) {
+	params := DefaultParameters(48000)
+	params.FrequencyResolution = 7
+	g := New(params)
+	path := filepath.Join(t.TempDir(), "filterbanks")
+	if err := SaveFilterbankCache(path); err != nil {
+		t.Fatal(err)
+	}
+	if err := LoadFilterbankCache(path); err != nil {
+		t.Fatal(err)
+	}
+	if got, want := New(params).NumChannels(), g.NumChannels(); got != want {
+		t.Errorf("NumChannels() after LoadFilterbankCache = %v, want %v", got, want)
+	}
+	if err := LoadFilterbankCache(filepath.Join(t.TempDir(), "missing")); err == nil {
+		t.Errorf("LoadFilterbankCache of a missing file succeeded")
+	}
+}
+
+func TestPersistentAnalysisCache(t *testing.T) {
+	params := DefaultParameters(48000)
+	g := New(params)
+	sound := make([]float32, int(params.SampleRate)/10)
+	for index := range sound {
+		sound[index] = float32(math.Sin(2 * math.Pi * 1000 * float64(index) / params.SampleRate))
+	}
+	dir := t.TempDir()
+	analysis := NewPersistentAnalysisCache(1, dir).Analyze(g, sound)
+	files, err := filepath.Glob(filepath.Join(dir, "*.zspec"))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(files) != 1 {
+		t.Fatalf("%v contains %v, want 1 analysis file", dir, files)
+	}
+	loaded := NewPersistentAnalysisCache(1, dir).Analyze(g, sound)
+	if got, want := g.AnalysisDistance(analysis, loaded), g.AnalysisDistance(analysis, analysis); got != want {
+		t.Errorf("AnalysisDistance between computed and loaded analysis = %v, want %v", got, want)
+	}
+}
+
+func TestStats(t *testing.T) {
+	sampleRate := 48000.0
+	g := New(DefaultParameters(sampleRate))
+	if got := g.Stats(); got != (Stats{}) {
+		t.Errorf("Stats before EnableStats = %+v, want zeros", got)
+	}
+	g.EnableStats()
+	signalA := make([]float32, int(sampleRate))
+	signalB := make([]float32, int(sampleRate))
+	for index := range signalA {
+		signalA[index] = float32(math.Sin(2 * math.Pi * 1000 * float64(index) / sampleRate))
+		signalB[index] = float32(math.Sin(2 * math.Pi * 1100 * float64(index) / sampleRate))
+	}
+	g.AnalysisDistance(g.Analyze(signalA), g.Analyze(signalB))
+	stats := g.Stats()
+	if stats == (Stats{}) {
+		t.Skip("built without ZIMTOHRLI_STATS")
+	}
+	if stats.Filterbank.Calls != 2 || stats.Filterbank.Samples != int64(2*len(signalA)) {
+		t.Errorf("got filterbank stats %+v, want 2 calls of %v samples", stats.Filterbank, len(signalA))
+	}
+	if stats.Filterbank.BytesAllocated == 0 {
+		t.Errorf("got no bytes allocated by the filterbank")
+	}
+	for name, stage := range map[string]StageStats{
+		"Masking":  stats.Masking,
+		"Loudness": stats.Loudness,
+		"DTW":      stats.DTW,
+		"NSIM":     stats.NSIM,
+	} {
+		if stage.Calls == 0 || stage.Samples == 0 {
+			t.Errorf("got %v stats %+v, want calls and samples", name, stage)
+		}
+	}
+	if stats.DTWCells == 0 {
+		t.Errorf("got no evaluated DTW cells")
 	}
 }
 
@@ -178,6 +553,45 @@ func TestViSQOL(t *testing.T) {
 	}
 }
 
+func TestViSQOLReference(t *testing.T) {
+	sampleRate := 48000.0
+	v := NewViSQOL()
+	reference := make([]float32, int(sampleRate))
+	degraded := make([]float32, int(sampleRate))
+	for index := range reference {
+		reference[index] = float32(math.Sin(2 * math.Pi * 5000 * float64(index) / sampleRate))
+		degraded[index] = float32(math.Sin(2 * math.Pi * 6000 * float64(index) / sampleRate))
+	}
+	wantMOS, err := v.MOS(sampleRate, reference, degraded)
+	if err != nil {
+		t.Fatal(err)
+	}
+	prepared := v.Reference(sampleRate, reference)
+	for i := 0; i < 2; i++ {
+		mos, err := v.ReferenceMOS(prepared, degraded)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if mos != wantMOS {
+			t.Errorf("ReferenceMOS = %v, want %v", mos, wantMOS)
+		}
+	}
+	referenceAudio := &audio.Audio{Samples: [][]float32{reference}, Rate: sampleRate}
+	degradedAudio := &audio.Audio{Samples: [][]float32{degraded}, Rate: sampleRate}
+	for i := 0; i < 2; i++ {
+		mos, err := v.AudioMOS(referenceAudio, degradedAudio)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if mos != wantMOS {
+			t.Errorf("AudioMOS = %v, want %v", mos, wantMOS)
+		}
+	}
+	if got := len(v.references); got != 1 {
+		t.Errorf("got %v cached references, want 1", got)
+	}
+}
+
 var goohrliDurationType = reflect.TypeOf(Duration{})
 
 func populate(s any) {
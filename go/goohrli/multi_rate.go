@@ -0,0 +1,89 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package goohrli
+
+import (
+	"fmt"
+	"math"
+	"sync"
+
+	"github.com/google/zimtohrli/go/audio"
+)
+
+// MultiRate keeps Goohrli instances sharing the same parameters, but with filterbanks designed for different sample
+// rates.
+//
+// Audio at e.g. 44.1, 48, and 96 kHz gets the same frequency channels and perceptual time steps, so it can be
+// compared directly instead of being resampled to a common rate first. Safe for concurrent use.
+type MultiRate struct {
+	params Parameters
+
+	mutex  sync.Mutex
+	byRate map[float64]*Goohrli
+}
+
+// NewMultiRate returns a MultiRate creating instances with params, with SampleRate replaced by the rate of the audio.
+func NewMultiRate(params Parameters) *MultiRate {
+	return &MultiRate{
+		params: params,
+		byRate: map[float64]*Goohrli{},
+	}
+}
+
+// ForRate returns the instance for audio at the given sample rate, creating it the first time it's needed.
+func (m *MultiRate) ForRate(rate float64) *Goohrli {
+	m.mutex.Lock()
+	defer m.mutex.Unlock()
+	g, found := m.byRate[rate]
+	if !found {
+		params := m.params
+		params.SampleRate = rate
+		g = New(params)
+		m.byRate[rate] = g
+	}
+	return g
+}
+
+// NormalizedAudioDistance is like Goohrli.NormalizedAudioDistance, but analyzes each audio at its own sample rate.
+//
+// Returns an error if the sample rates don't get the same frequency channels, e.g. if one of them has a Nyquist
+// frequency below the highest channel of the other.
+func (m *MultiRate) NormalizedAudioDistance(audioA, audioB *audio.Audio) (float64, error) {
+	gA, gB := m.ForRate(audioA.Rate), m.ForRate(audioB.Rate)
+	if gA.NumChannels() != gB.NumChannels() {
+		return 0, fmt.Errorf("sample rates %v and %v produce different frequency channels: %v, %v", audioA.Rate, audioB.Rate, gA.NumChannels(), gB.NumChannels())
+	}
+	if len(audioA.Samples) != len(audioB.Samples) {
+		return 0, fmt.Errorf("the audio files don't have the same number of channels: %v, %v", len(audioA.Samples), len(audioB.Samples))
+	}
+	if len(audioA.Samples) == 0 {
+		return 0, fmt.Errorf("the audio files don't have any channels")
+	}
+	sumOfSquares := 0.0
+	for channelIndex := range audioA.Samples {
+		measurement := Measure(audioA.Samples[channelIndex])
+		NormalizeAmplitude(measurement.MaxAbsAmplitude, audioB.Samples[channelIndex])
+		dist := float64(gA.AnalysisDistance(gA.Analyze(audioA.Samples[channelIndex]), gB.Analyze(audioB.Samples[channelIndex])))
+		if math.IsNaN(dist) {
+			return 0, fmt.Errorf("%v.AnalysisDistance(...) returned %v", gA, dist)
+		}
+		sumOfSquares += dist * dist
+	}
+	result := math.Sqrt(sumOfSquares / float64(len(audioA.Samples)))
+	if math.IsNaN(result) {
+		return 0, fmt.Errorf("math.Sqrt(%v / %v) is %v", sumOfSquares, len(audioA.Samples), result)
+	}
+	return result, nil
+}
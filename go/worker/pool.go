@@ -30,20 +30,34 @@ type ChangeHandler func(submitted, completed, errors int)
 type ErrorHandler func(error) error
 
 // Pool is a pool of workers.
+//
+// Runs the jobs on a fixed number of goroutines, picking the most recently submitted job first. Jobs submitted by
+// other jobs therefore run before the remaining jobs at the outer levels, so a job that loads some data and submits
+// jobs using it gets its data processed and released before the next outer job loads more.
+//
+// The number of queued jobs is bounded by QueueSize. When the queue is full, Submit runs the job itself instead of
+// queueing it, which slows down submitters that are faster than the workers, and can't deadlock even when all
+// workers are submitting jobs.
 type Pool[T any] struct {
 	Workers  int
 	OnChange ChangeHandler
 	OnError  ErrorHandler
 	FailFast bool
+	// QueueSize is the maximum number of queued jobs, defaulting to 4 * Workers.
+	QueueSize int
 
 	startOnce sync.Once
 
-	jobs             chan func(func(T)) error
+	mutex sync.Mutex
+	// cond is signaled when a job is queued, and broadcast when the pool is closed.
+	cond    *sync.Cond
+	queue   []func(func(T)) error
+	closed  bool
+	results []T
+	errors  []error
+
 	jobsWaitGroup    sync.WaitGroup
-	results          chan T
-	resultsWaitGroup sync.WaitGroup
-	errors           chan error
-	errorsWaitGroup  sync.WaitGroup
+	workersWaitGroup sync.WaitGroup
 
 	submittedJobs uint32
 	completedJobs uint32
@@ -52,41 +66,60 @@ type Pool[T any] struct {
 
 func (p *Pool[T]) init() {
 	p.startOnce.Do(func() {
-		p.jobs = make(chan func(func(T)) error)
-		p.results = make(chan T)
-		p.errors = make(chan error)
+		p.cond = sync.NewCond(&p.mutex)
+		if p.QueueSize == 0 {
+			p.QueueSize = 4 * p.Workers
+		}
+		p.workersWaitGroup.Add(p.Workers)
 		for i := 0; i < p.Workers; i++ {
 			go func() {
-				for job := range p.jobs {
-					if err := job(func(t T) {
-						p.resultsWaitGroup.Add(1)
-						go func() {
-							p.results <- t
-							p.resultsWaitGroup.Done()
-						}()
-					}); err != nil {
-						if err = p.err(err); err != nil {
-							if p.FailFast {
-								log.Fatal(err)
-							}
-							p.errorsWaitGroup.Add(1)
-							go func() {
-								p.errors <- err
-								p.errorsWaitGroup.Done()
-							}()
-							atomic.AddUint32(&p.errorJobs, 1)
-							p.change()
-						}
-					}
-					p.jobsWaitGroup.Done()
-					atomic.AddUint32(&p.completedJobs, 1)
-					p.change()
+				defer p.workersWaitGroup.Done()
+				for job := p.next(); job != nil; job = p.next() {
+					p.run(job)
 				}
 			}()
 		}
 	})
 }
 
+// next returns the most recently queued job, waiting for one if the queue is empty, or nil when the pool is closed.
+func (p *Pool[T]) next() func(func(T)) error {
+	p.mutex.Lock()
+	defer p.mutex.Unlock()
+	for len(p.queue) == 0 && !p.closed {
+		p.cond.Wait()
+	}
+	if len(p.queue) == 0 {
+		return nil
+	}
+	job := p.queue[len(p.queue)-1]
+	p.queue[len(p.queue)-1] = nil
+	p.queue = p.queue[:len(p.queue)-1]
+	return job
+}
+
+func (p *Pool[T]) run(job func(func(T)) error) {
+	if err := job(func(t T) {
+		p.mutex.Lock()
+		p.results = append(p.results, t)
+		p.mutex.Unlock()
+	}); err != nil {
+		if err = p.err(err); err != nil {
+			if p.FailFast {
+				log.Fatal(err)
+			}
+			p.mutex.Lock()
+			p.errors = append(p.errors, err)
+			p.mutex.Unlock()
+			atomic.AddUint32(&p.errorJobs, 1)
+			p.change()
+		}
+	}
+	atomic.AddUint32(&p.completedJobs, 1)
+	p.change()
+	p.jobsWaitGroup.Done()
+}
+
 func (p *Pool[T]) err(err error) error {
 	if p.OnError != nil {
 		return p.OnError(err)
@@ -101,6 +134,8 @@ func (p *Pool[T]) change() {
 }
 
 // Submit submits a job to the pool.
+//
+// If the queue is full, the job is run before Submit returns.
 func (p *Pool[T]) Submit(job func(func(T)) error) error {
 	p.init()
 
@@ -108,9 +143,15 @@ func (p *Pool[T]) Submit(job func(func(T)) error) error {
 	atomic.AddUint32(&p.submittedJobs, 1)
 	p.change()
 
-	go func() {
-		p.jobs <- job
-	}()
+	p.mutex.Lock()
+	if len(p.queue) < p.QueueSize {
+		p.queue = append(p.queue, job)
+		p.mutex.Unlock()
+		p.cond.Signal()
+		return nil
+	}
+	p.mutex.Unlock()
+	p.run(job)
 	return nil
 }
 
@@ -125,7 +166,7 @@ func (e Errors) Error() string {
 	return buf.String()
 }
 
-// Error waits for all submitted jobs to finish, closes the submission channel, and returns whether
+// Error waits for all submitted jobs to finish, stops the workers, and returns whether
 // any of the jobs produced an error.
 //
 // Must be called after all jobs are added.
@@ -133,17 +174,13 @@ func (p *Pool[T]) Error() error {
 	p.init()
 
 	p.jobsWaitGroup.Wait()
-	close(p.jobs)
-	go func() {
-		p.errorsWaitGroup.Wait()
-		close(p.errors)
-	}()
-	result := Errors{}
-	for err := range p.errors {
-		result = append(result, err)
-	}
-	if len(result) > 0 {
-		return result
+	p.mutex.Lock()
+	p.closed = true
+	p.mutex.Unlock()
+	p.cond.Broadcast()
+	p.workersWaitGroup.Wait()
+	if len(p.errors) > 0 {
+		return Errors(p.errors)
 	}
 	return nil
 }
@@ -154,9 +191,11 @@ func (p *Pool[T]) Error() error {
 //
 // Error() must be called before Results().
 func (p *Pool[T]) Results() <-chan T {
-	go func() {
-		p.resultsWaitGroup.Wait()
-		close(p.results)
-	}()
-	return p.results
+	result := make(chan T, len(p.results))
+	for _, t := range p.results {
+		result <- t
+	}
+	close(result)
+	p.results = nil
+	return result
 }
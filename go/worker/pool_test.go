@@ -0,0 +1,75 @@
+// Copyright 2024 The Zimtohrli Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package worker
+
+import (
+	"fmt"
+	"sort"
+	"testing"
+)
+
+func TestPoolNestedJobs(t *testing.T) {
+	pool := &Pool[int]{
+		Workers:   3,
+		QueueSize: 2,
+	}
+	for outer := 0; outer < 20; outer++ {
+		outerIndex := outer
+		pool.Submit(func(func(int)) error {
+			for inner := 0; inner < 5; inner++ {
+				innerIndex := inner
+				pool.Submit(func(f func(int)) error {
+					if innerIndex == 4 && outerIndex%10 == 0 {
+						return fmt.Errorf("job %v failed", outerIndex)
+					}
+					f(outerIndex*5 + innerIndex)
+					return nil
+				})
+			}
+			return nil
+		})
+	}
+	err := pool.Error()
+	if errs, ok := err.(Errors); !ok || len(errs) != 2 {
+		t.Errorf("Error() = %v, want 2 errors", err)
+	}
+	results := []int{}
+	for result := range pool.Results() {
+		results = append(results, result)
+	}
+	if len(results) != 98 {
+		t.Fatalf("got %v results, want 98", len(results))
+	}
+	sort.Ints(results)
+	for index := 1; index < len(results); index++ {
+		if results[index] == results[index-1] {
+			t.Errorf("result %v produced twice", results[index])
+		}
+	}
+}
+
+func TestPoolWithoutWorkers(t *testing.T) {
+	pool := &Pool[int]{}
+	pool.Submit(func(f func(int)) error {
+		f(1)
+		return nil
+	})
+	if err := pool.Error(); err != nil {
+		t.Fatal(err)
+	}
+	if got := len(pool.Results()); got != 1 {
+		t.Errorf("got %v results, want 1", got)
+	}
+}